@@ -0,0 +1,169 @@
+/**
+ * libcap_utils - DPMI capture utilities
+ * Copyright (C) 2003-2013 (see AUTHORS)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/**
+ * Benchmark of column files: scanning the timestamp columns compared to
+ * reading the whole trace.
+ *
+ * Usage: bench/column [-n ITERATIONS] [-u] FILENAME..
+ *   -u  store columns uncompressed.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "bench/common.h"
+#include "caputils/caputils.h"
+#include "caputils/column.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static int scan_trace(char* const* filename, int num, uint64_t* checksum){
+	for ( int i = 0; i < num; i++ ){
+		stream_addr_t addr = STREAM_ADDR_INITIALIZER;
+		stream_t st;
+		int ret;
+
+		stream_addr_str(&addr, filename[i], 0);
+		if ( (ret=stream_open(&st, &addr, NULL, 0)) != 0 ){
+			fprintf(stderr, "%s: %s\n", filename[i], caputils_error_string(ret));
+			return ret;
+		}
+
+		cap_head* cp;
+		while ( stream_read(st, &cp, NULL, NULL) == 0 ){
+			*checksum += cp->ts.tv_sec + cp->ts.tv_psec;
+		}
+		stream_close(st);
+	}
+	return 0;
+}
+
+static int scan_columns(const char* filename, uint64_t* checksum){
+	column_reader_t reader;
+	int ret;
+	if ( (ret=column_reader_open(&reader, filename)) != 0 ){
+		fprintf(stderr, "%s: %s\n", filename, caputils_error_string(ret));
+		return ret;
+	}
+
+	uint32_t* sec = malloc(COLUMN_DEFAULT_ROWS * sizeof(uint32_t));
+	uint64_t* psec = malloc(COLUMN_DEFAULT_ROWS * sizeof(uint64_t));
+	for ( size_t chunk = 0; chunk < column_reader_chunks(reader); chunk++ ){
+		const size_t rows = column_reader_chunk_rows(reader, chunk);
+		if ( (ret=column_reader_read(reader, chunk, COLUMN_TS_SEC, sec)) != 0 ||
+		     (ret=column_reader_read(reader, chunk, COLUMN_TS_PSEC, psec)) != 0 ){
+			break;
+		}
+		for ( size_t i = 0; i < rows; i++ ){
+			*checksum += sec[i] + psec[i];
+		}
+	}
+
+	free(sec);
+	free(psec);
+	column_reader_close(reader);
+	return ret;
+}
+
+int main(int argc, char* argv[]){
+	unsigned int iterations = 10;
+	int flags = COLUMN_COMPRESS;
+	int op;
+
+	while ( (op=getopt(argc, argv, "n:u")) != -1 ){
+		switch ( op ){
+		case 'n':
+			iterations = atoi(optarg);
+			break;
+		case 'u':
+			flags = 0;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n ITERATIONS] [-u] FILENAME..\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if ( optind == argc ){
+		fprintf(stderr, "usage: %s [-n ITERATIONS] [-u] FILENAME..\n", argv[0]);
+		return 1;
+	}
+
+	char filename[] = "/tmp/bench-column-XXXXXX";
+	const int fd = mkstemp(filename);
+	if ( fd == -1 ){
+		perror("mkstemp");
+		return 1;
+	}
+	close(fd);
+
+	/* export all traces to a single file */
+	column_writer_t writer;
+	column_writer_open(&writer, filename, 0, flags);
+	double begin = now();
+	for ( int i = optind; i < argc; i++ ){
+		stream_addr_t addr = STREAM_ADDR_INITIALIZER;
+		stream_t st;
+		stream_addr_str(&addr, argv[i], 0);
+		if ( stream_open(&st, &addr, NULL, 0) != 0 ){
+			fprintf(stderr, "%s: failed to open\n", argv[i]);
+			column_writer_close(writer);
+			unlink(filename);
+			return 1;
+		}
+		cap_head* cp;
+		while ( stream_read(st, &cp, NULL, NULL) == 0 ){
+			column_writer_add(writer, cp);
+		}
+		stream_close(st);
+	}
+	const uint64_t rows = column_writer_rows(writer);
+	column_writer_close(writer);
+	const double export_time = now() - begin;
+
+	/* the checksums ensures the reads is not optimized away (and must match) */
+	uint64_t trace_checksum = 0;
+	begin = now();
+	for ( unsigned int n = 0; n < iterations; n++ ){
+		scan_trace(&argv[optind], argc - optind, &trace_checksum);
+	}
+	const double trace_time = now() - begin;
+
+	uint64_t column_checksum = 0;
+	begin = now();
+	for ( unsigned int n = 0; n < iterations; n++ ){
+		scan_columns(filename, &column_checksum);
+	}
+	const double column_time = now() - begin;
+
+	unlink(filename);
+
+	const double total = (double)rows * iterations;
+	printf("column: %"PRIu64" packets x %u iterations (checksum %s)\n", rows, iterations, trace_checksum == column_checksum ? "ok" : "MISMATCH");
+	printf("column: export %.1f ns/packet\n", export_time * 1e9 / rows);
+	printf("column: trace scan %.1f ns/packet, timestamp columns %.1f ns/packet (%.1fx)\n",
+	       trace_time * 1e9 / total, column_time * 1e9 / total, trace_time / column_time);
+
+	return trace_checksum != column_checksum;
+}
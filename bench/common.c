@@ -0,0 +1,70 @@
+/**
+ * libcap_utils - DPMI capture utilities
+ * Copyright (C) 2003-2013 (see AUTHORS)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "bench/common.h"
+#include "caputils/caputils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+int packets_load(struct packets* packets, const char* filename){
+	stream_addr_t addr = STREAM_ADDR_INITIALIZER;
+	stream_t st;
+	int ret;
+
+	stream_addr_str(&addr, filename, 0);
+	if ( (ret=stream_open(&st, &addr, NULL, 0)) != 0 ){
+		fprintf(stderr, "%s: %s\n", filename, caputils_error_string(ret));
+		return ret;
+	}
+
+	cap_head* cp;
+	while ( stream_read(st, &cp, NULL, NULL) == 0 ){
+		if ( packets->num == packets->capacity ){
+			packets->capacity = packets->capacity > 0 ? packets->capacity * 2 : 1024;
+			packets->pkt = realloc(packets->pkt, sizeof(char*) * packets->capacity);
+		}
+
+		const size_t size = sizeof(struct cap_header) + cp->caplen;
+		char* copy = malloc(size);
+		memcpy(copy, cp, size);
+		packets->pkt[packets->num++] = copy;
+	}
+
+	stream_close(st);
+	return 0;
+}
+
+void packets_free(struct packets* packets){
+	for ( size_t i = 0; i < packets->num; i++ ){
+		free(packets->pkt[i]);
+	}
+	free(packets->pkt);
+}
+
+double now(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,38 @@
+/**
+ * libcap_utils - DPMI capture utilities
+ * Copyright (C) 2003-2013 (see AUTHORS)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef BENCH_COMMON_H
+#define BENCH_COMMON_H
+
+#include <stddef.h>
+
+/* all packets is loaded into memory first so only the processing is measured */
+struct packets {
+	char** pkt;
+	size_t num;
+	size_t capacity;
+};
+
+int packets_load(struct packets* packets, const char* filename);
+void packets_free(struct packets* packets);
+
+/* monotonic time in seconds */
+double now(void);
+
+#endif /* BENCH_COMMON_H */
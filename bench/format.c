@@ -0,0 +1,111 @@
+/**
+ * libcap_utils - DPMI capture utilities
+ * Copyright (C) 2003-2013 (see AUTHORS)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/**
+ * Benchmark of format_pkg (capshow output).
+ *
+ * Usage: bench/format [-n ITERATIONS] [-d] [-x] [-o OUTPUT] FILENAME..
+ *   -d  format timestamps as dates (capshow --date).
+ *   -x  include hexdump (capshow --hexdump).
+ *   -o  write output to file instead of /dev/null.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "bench/common.h"
+#include "caputils/caputils.h"
+#include "caputils/log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+int main(int argc, char* argv[]){
+	unsigned int iterations = 20;
+	unsigned int flags = FORMAT_REL_TIMESTAMP;
+	const char* output = "/dev/null";
+	int op;
+
+	while ( (op=getopt(argc, argv, "n:dxo:")) != -1 ){
+		switch ( op ){
+		case 'n':
+			iterations = atoi(optarg);
+			break;
+		case 'd':
+			flags = (flags & ~FORMAT_REL_TIMESTAMP) | FORMAT_DATE_STR;
+			break;
+		case 'x':
+			flags |= FORMAT_HEXDUMP;
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n ITERATIONS] [-d] [-x] [-o OUTPUT] FILENAME..\n", argv[0]);
+			return 1;
+		}
+	}
+
+	struct packets packets = {NULL, 0, 0};
+	for ( int i = optind; i < argc; i++ ){
+		if ( packets_load(&packets, argv[i]) != 0 ){
+			return 1;
+		}
+	}
+
+	if ( packets.num == 0 ){
+		fprintf(stderr, "%s: no packets loaded\n", argv[0]);
+		return 1;
+	}
+
+	FILE* fp = fopen(output, "w");
+	if ( !fp ){
+		perror(output);
+		return 1;
+	}
+
+	/* same buffering as capshow */
+	static char output_buffer[1024*1024];
+	setvbuf(fp, output_buffer, _IOFBF, sizeof(output_buffer));
+
+	const double begin = now();
+	for ( unsigned int n = 0; n < iterations; n++ ){
+		struct format format;
+		format_setup(&format, flags);
+		for ( size_t i = 0; i < packets.num; i++ ){
+			format_pkg(fp, &format, (const struct cap_header*)packets.pkt[i]);
+		}
+	}
+	fflush(fp);
+	const long bytes = ftell(fp);
+	const double elapsed = now() - begin;
+	fclose(fp);
+
+	const double total = (double)packets.num * iterations;
+	printf("format: %zd packets x %u iterations\n", packets.num, iterations);
+	printf("format: %.3f s, %.1f ns/packet, %.0f pkt/s", elapsed, elapsed * 1e9 / total, total / elapsed);
+	if ( bytes > 0 ){
+		printf(", %.1f MB/s", bytes / elapsed / 1e6);
+	}
+	putchar('\n');
+
+	packets_free(&packets);
+	return 0;
+}
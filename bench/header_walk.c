@@ -0,0 +1,98 @@
+/**
+ * libcap_utils - DPMI capture utilities
+ * Copyright (C) 2003-2013 (see AUTHORS)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/**
+ * Benchmark of header_walk.
+ *
+ * Usage: bench/header_walk [-n ITERATIONS] [-a] FILENAME..
+ *   -a  also format network addresses (as when printing).
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "bench/common.h"
+#include "caputils/caputils.h"
+#include "caputils/packet.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+int main(int argc, char* argv[]){
+	unsigned int iterations = 100;
+	int format_addresses = 0;
+	int op;
+
+	while ( (op=getopt(argc, argv, "n:a")) != -1 ){
+		switch ( op ){
+		case 'n':
+			iterations = atoi(optarg);
+			break;
+		case 'a':
+			format_addresses = 1;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n ITERATIONS] [-a] FILENAME..\n", argv[0]);
+			return 1;
+		}
+	}
+
+	struct packets packets = {NULL, 0, 0};
+	for ( int i = optind; i < argc; i++ ){
+		if ( packets_load(&packets, argv[i]) != 0 ){
+			return 1;
+		}
+	}
+
+	if ( packets.num == 0 ){
+		fprintf(stderr, "%s: no packets loaded\n", argv[0]);
+		return 1;
+	}
+
+	/* the checksum ensures the walk is not optimized away */
+	unsigned long headers = 0;
+	unsigned long checksum = 0;
+	const double begin = now();
+	for ( unsigned int n = 0; n < iterations; n++ ){
+		for ( size_t i = 0; i < packets.num; i++ ){
+			struct header_chunk header;
+			header_init(&header, (const struct cap_header*)packets.pkt[i], 0);
+			while ( header_walk(&header) ){
+				headers++;
+				checksum += header.protocol->type;
+			}
+
+			if ( format_addresses ){
+				checksum += strlen(network_src_str(&header.last_net));
+				checksum += strlen(network_dst_str(&header.last_net));
+			}
+		}
+	}
+	const double elapsed = now() - begin;
+
+	const double total = (double)packets.num * iterations;
+	printf("header_walk: %zd packets x %u iterations, %lu headers (checksum %lu)\n", packets.num, iterations, headers, checksum);
+	printf("header_walk: %.3f s, %.1f ns/packet, %.2f Mpkt/s\n", elapsed, elapsed * 1e9 / total, total / elapsed / 1e6);
+
+	packets_free(&packets);
+
+	return 0;
+}
@@ -0,0 +1,189 @@
+/**
+ * libcap_utils - DPMI capture utilities
+ * Copyright (C) 2003-2013 (see AUTHORS)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/**
+ * Benchmark of timepico arithmetic, compared with the previous (floating-point
+ * and branching) implementation.
+ *
+ * Usage: bench/timepico [-n ITERATIONS] [-s SIZE]
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "bench/common.h"
+#include "caputils/picotime.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* implementation prior to 0.7.18 */
+static int legacy_timecmp(const timepico *ts1, const timepico *ts2){
+	if (ts1->tv_sec < ts2->tv_sec) return -1;
+	if (ts1->tv_sec > ts2->tv_sec) return 1;
+	if (ts1->tv_psec < ts2->tv_psec) return -1;
+	if (ts1->tv_psec > ts2->tv_psec) return 1;
+	return 0;
+}
+
+static timepico legacy_sub(timepico x, timepico y){
+	timepico result;
+	if (x.tv_psec < y.tv_psec) {
+		int psec = (y.tv_psec - x.tv_psec) / PICODIVIDER + 1;
+		y.tv_psec -= PICODIVIDER * psec;
+		y.tv_sec += psec;
+	}
+	if (x.tv_psec - y.tv_psec > PICODIVIDER) {
+		int psec = (x.tv_psec - y.tv_psec) / PICODIVIDER;
+		y.tv_psec += PICODIVIDER * psec;
+		y.tv_sec -= psec;
+	}
+	result.tv_sec = x.tv_sec - y.tv_sec;
+	result.tv_psec = x.tv_psec - y.tv_psec;
+	return result;
+}
+
+static timepico legacy_add(timepico a, timepico b){
+	timepico tmp = { a.tv_sec + b.tv_sec, a.tv_psec + b.tv_psec };
+	while ( tmp.tv_psec > PICODIVIDER ){
+		tmp.tv_sec++;
+		tmp.tv_psec -= PICODIVIDER;
+	}
+	return tmp;
+}
+
+static uint64_t xorshift(uint64_t* state){
+	uint64_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	return *state = x;
+}
+
+static void report(const char* name, double elapsed, double ops, uint64_t checksum){
+	printf("timepico: %-16s %8.3f s, %6.2f ns/op (checksum %"PRIu64")\n", name, elapsed, elapsed * 1e9 / ops, checksum);
+}
+
+int main(int argc, char* argv[]){
+	unsigned int iterations = 200;
+	size_t size = 65536;
+	int op;
+
+	while ( (op=getopt(argc, argv, "n:s:")) != -1 ){
+		switch ( op ){
+		case 'n':
+			iterations = atoi(optarg);
+			break;
+		case 's':
+			size = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n ITERATIONS] [-s SIZE]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if ( size < 2 ){
+		fprintf(stderr, "%s: size must be at least 2\n", argv[0]);
+		return 1;
+	}
+
+	/* mostly increasing timestamps with random interarrival times (up to ~2ms)
+	 * and occasional reordering, similar to merged traces */
+	timepico* ts = malloc(size * sizeof(timepico));
+	int64_t* dt = malloc(size * sizeof(int64_t));
+	uint64_t state = 0x2545f4914f6cdd1d;
+	timepico cur = {1341272547, 0};
+	for ( size_t i = 0; i < size; i++ ){
+		const uint64_t r = xorshift(&state);
+		const timepico step = {0, r % 2000000000};
+		cur = timepico_add(cur, step);
+		ts[i] = cur;
+		if ( (r >> 40) % 16 == 0 && i > 0 ){
+			ts[i] = ts[i-1];
+			ts[i-1] = cur;
+		}
+	}
+
+	const double ops = (double)iterations * (size - 1);
+	uint64_t checksum;
+	double begin;
+
+#define BENCH(name, expr) \
+	checksum = 0; \
+	begin = now(); \
+	for ( unsigned int n = 0; n < iterations; n++ ){ \
+		for ( size_t i = 0; i < size - 1; i++ ){ \
+			expr; \
+		} \
+	} \
+	report(name, now() - begin, ops, checksum)
+
+	BENCH("timecmp (legacy)", checksum += legacy_timecmp(&ts[i], &ts[i+1]) + 1);
+	BENCH("timecmp",          checksum += timecmp(&ts[i], &ts[i+1]) + 1);
+	BENCH("sub (legacy)",     checksum += legacy_sub(ts[i+1], ts[i]).tv_psec);
+	BENCH("sub",              checksum += timepico_sub(ts[i+1], ts[i]).tv_psec);
+	BENCH("add (legacy)",     checksum += legacy_add(ts[i+1], ts[i]).tv_psec);
+	BENCH("add",              checksum += timepico_add(ts[i+1], ts[i]).tv_psec);
+
+	/* batch helpers, compared with the equivalent loop over timecmp/sub */
+	checksum = 0;
+	begin = now();
+	for ( unsigned int n = 0; n < iterations; n++ ){
+		size_t min = 0;
+		for ( size_t i = 1; i < size; i++ ){
+			if ( legacy_timecmp(&ts[i], &ts[min]) < 0 ) min = i;
+		}
+		checksum += min;
+	}
+	report("min (loop)", now() - begin, ops, checksum);
+
+	checksum = 0;
+	begin = now();
+	for ( unsigned int n = 0; n < iterations; n++ ){
+		checksum += timepico_min(ts, size);
+	}
+	report("min", now() - begin, ops, checksum);
+
+	checksum = 0;
+	begin = now();
+	for ( unsigned int n = 0; n < iterations; n++ ){
+		for ( size_t i = 0; i < size - 1; i++ ){
+			const timepico d = legacy_sub(ts[i+1], ts[i]);
+			dt[i] = (int32_t)d.tv_sec * (int64_t)PICOSECONDS_PER_SECOND + d.tv_psec;
+		}
+		checksum += dt[n % (size - 1)];
+	}
+	report("deltas (loop)", now() - begin, ops, checksum);
+
+	checksum = 0;
+	begin = now();
+	for ( unsigned int n = 0; n < iterations; n++ ){
+		timepico_deltas(ts, size, dt);
+		checksum += dt[n % (size - 1)];
+	}
+	report("deltas", now() - begin, ops, checksum);
+
+	free(ts);
+	free(dt);
+
+	return 0;
+}
@@ -0,0 +1,150 @@
+/**
+ * libcap_utils - DPMI capture utilities
+ * Copyright (C) 2003-2013 (see AUTHORS)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+/**
+ * Benchmark of udp measurement streams over loopback, with and without
+ * segmentation offloading (UDP GSO on the sender, GRO on the receiver).
+ *
+ * Usage: bench/udp [-n PACKETS] [-s SIZE] [-f FRAME_SIZE]
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "bench/common.h"
+#include "caputils/caputils.h"
+#include "caputils/sender.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+static unsigned int num_packets = 1000000;
+static size_t packet_size = 100;
+static size_t frame_size = 1472; /* same as a regular 1500 byte ethernet MTU */
+
+static int run_sender(const stream_addr_t* addr, const char* name){
+	stream_t st;
+	sender_t sender;
+	int ret;
+
+	if ( (ret=stream_create(&st, addr, NULL, "bench", "udp")) != 0 ||
+	     (ret=sender_open(&sender, st, frame_size, NULL)) != 0 ){
+		fprintf(stderr, "udp: %s\n", caputils_error_string(ret));
+		return 1;
+	}
+
+	char buf[sizeof(struct cap_header) + packet_size];
+	struct cap_header* cp = (struct cap_header*)buf;
+	memset(buf, 0, sizeof(buf));
+	cp->caplen = packet_size;
+	cp->len = packet_size;
+
+	const double begin = now();
+	for ( unsigned int i = 0; i < num_packets; i++ ){
+		cp->ts.tv_sec = i;
+		if ( (ret=sender_write(sender, cp)) != 0 ){
+			fprintf(stderr, "udp: %s\n", caputils_error_string(ret));
+			break;
+		}
+	}
+	sender_flush(sender);
+	const double elapsed = now() - begin;
+	const struct sender_stat stat = *sender_get_stat(sender);
+	sender_close(sender);
+
+	printf("udp: %-12s send %8.3f s, %6.2f Mpkt/s, %7.2f Mbit/s (%"PRIu64" frames in %"PRIu64" batches)\n",
+	       name, elapsed, num_packets / elapsed / 1e6, stat.bytes * 8 / elapsed / 1e6, stat.frames, stat.batches);
+
+	stream_close(st);
+	return 0;
+}
+
+static void run(const char* address, int flags, const char* name){
+	stream_addr_t addr = STREAM_ADDR_INITIALIZER;
+	stream_t st;
+	int ret;
+
+	stream_addr_aton(&addr, address, STREAM_ADDR_GUESS, flags);
+	if ( (ret=stream_open(&st, &addr, NULL, 0)) != 0 ){
+		fprintf(stderr, "udp: %s\n", caputils_error_string(ret));
+		exit(1);
+	}
+
+	fflush(stdout);
+	const pid_t pid = fork();
+	if ( pid == 0 ){
+		exit(run_sender(&addr, name));
+	}
+
+	/* packets is lost if the receiver is too slow, stop when the sender has
+	 * terminated or nothing has arrived for a second */
+	struct timeval timeout = {1, 0};
+	unsigned int received = 0;
+	double begin = 0.0;
+	double end = 0.0;
+	cap_head* cp;
+	while ( stream_read(st, &cp, NULL, &timeout) == 0 ){
+		if ( received++ == 0 ){
+			begin = now();
+		}
+		end = now();
+	}
+
+	waitpid(pid, NULL, 0);
+	const double elapsed = end - begin;
+	printf("udp: %-12s recv %8.3f s, %6.2f Mpkt/s (%u of %u packets, %.1f%%)\n",
+	       name, elapsed, elapsed > 0 ? received / elapsed / 1e6 : 0.0, received, num_packets, 100.0 * received / num_packets);
+
+	stream_close(st);
+}
+
+int main(int argc, char* argv[]){
+	int op;
+
+	while ( (op=getopt(argc, argv, "n:s:f:")) != -1 ){
+		switch ( op ){
+		case 'n':
+			num_packets = atoi(optarg);
+			break;
+		case 's':
+			packet_size = atoi(optarg);
+			break;
+		case 'f':
+			frame_size = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n PACKETS] [-s SIZE] [-f FRAME_SIZE]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	char address[64];
+	const int port = 30000 + getpid() % 20000;
+	sprintf(address, "udp://127.0.0.1:%d", port);
+	run(address, STREAM_ADDR_NO_OFFLOAD, "no offload");
+	sprintf(address, "udp://127.0.0.1:%d", port + 1);
+	run(address, 0, "offload");
+
+	return 0;
+}
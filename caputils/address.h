@@ -104,6 +104,8 @@ enum AddressType {
 	 * guess. Essentially it works like following:
 	 *  - If it is parsable as an ethernet address, STREAM_ADDR_ETHERNET is used.
 	 *  - If is begins with tcp:// or udp://, STREAM_ADD_{TCP,UDP} is used.
+	 *  - If is begins with shm://, STREAM_ADDR_SHM is used.
+	 *  - If is begins with iface://, STREAM_ADDR_IFACE is used.
 	 *  - Otwerwise STREAM_ADDR_CAPFILE with STREAM_ADDR_LOCAL flag is used.
 	 *
 	 * However, if the user have a file which is named as an ethernet address
@@ -118,6 +120,8 @@ enum AddressType {
 	STREAM_ADDR_TCP,
 	STREAM_ADDR_FP,
 	STREAM_ADDR_FIFO,
+	STREAM_ADDR_SHM,
+	STREAM_ADDR_IFACE,
 };
 
 enum AddressFlags {
@@ -144,6 +148,10 @@ enum AddressFlags {
 
 	/* The local filename is duplicated and automatically freed. */
 	STREAM_ADDR_DUPLICATE = (1<<4),
+
+	/* Disable segmentation offloading (UDP GSO/GRO) even if the kernel supports
+	 * it. Mostly useful for benchmarking and troubleshooting. */
+	STREAM_ADDR_NO_OFFLOAD = (1<<5),
 };
 
 /**
@@ -168,8 +176,8 @@ int stream_addr_str(stream_addr_t* dst, const char* src, int flags);
 int stream_addr_fp(stream_addr_t* dst, FILE* fp, int flags);
 
 /**
- * Convert destination to string. The string is returned in a statically
- * allocated buffer, which subsequent calls will overwrite.
+ * Convert destination to string. The string is returned in a thread-local
+ * buffer, which subsequent calls from the same thread will overwrite.
  */
 const char* stream_addr_ntoa(const stream_addr_t* src);
 
@@ -0,0 +1,215 @@
+/**
+ * libcap_utils - DPMI capture utilities
+ * Copyright (C) 2003-2013 (see AUTHORS)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#ifndef CAPUTILS_COLUMN_H
+#define CAPUTILS_COLUMN_H
+
+#include <caputils/capture.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+#ifdef CAPUTILS_EXPORT
+#pragma GCC visibility push(default)
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Columnar packet summaries.
+ *
+ * A fixed set of fields is extracted from each packet and stored column by
+ * column in chunks of rows. Each column in a chunk is stored separately
+ * (optionally compressed) together with the minimum and maximum value so a
+ * single column can be read without touching the others and chunks can be
+ * skipped using only the statistics.
+ *
+ * Values is stored in host byte order (as capfiles) with a fixed width per
+ * column: integers is zero-extended to the column width, strings is NUL-padded
+ * and addresses is IPv6 (IPv4 is stored as IPv4-mapped, ::ffff:a.b.c.d).
+ */
+struct column_writer;
+typedef struct column_writer* column_writer_t;
+
+struct column_reader;
+typedef struct column_reader* column_reader_t;
+
+enum column_id {
+	COLUMN_TS_SEC = 0,                           /* uint32 timestamp seconds */
+	COLUMN_TS_PSEC,                              /* uint64 timestamp picoseconds */
+	COLUMN_LEN,                                  /* uint32 frame length */
+	COLUMN_CAPLEN,                               /* uint32 captured length */
+	COLUMN_MAMPID,                               /* char[8] measurement point */
+	COLUMN_NIC,                                  /* char[8] capture interface (CI) */
+	COLUMN_IP_SRC,                               /* in6_addr source address (zero if not IP) */
+	COLUMN_IP_DST,                               /* in6_addr destination address */
+	COLUMN_IP_PROTO,                             /* uint8 transport protocol */
+	COLUMN_SPORT,                                /* uint16 TCP/UDP source port */
+	COLUMN_DPORT,                                /* uint16 TCP/UDP destination port */
+	COLUMN_TCP_FLAGS,                            /* uint8 TCP flags */
+	COLUMN_VLAN,                                 /* uint16 outermost VLAN id or COLUMN_NO_VLAN */
+
+	COLUMN_MAX
+};
+
+enum column_type {
+	COLUMN_TYPE_UINT,
+	COLUMN_TYPE_STRING,
+	COLUMN_TYPE_ADDRESS,
+};
+
+enum column_codec {
+	COLUMN_CODEC_RAW = 0,                        /* fixed width values */
+	COLUMN_CODEC_DELTA,                          /* zigzag varint of the difference to the previous value */
+	COLUMN_CODEC_RLE,                            /* varint run length followed by the value */
+};
+
+enum column_flags {
+	COLUMN_COMPRESS = (1<<0),                    /* store each column using the smallest codec */
+};
+
+#define COLUMN_NO_VLAN 0xffff
+#define COLUMN_DEFAULT_ROWS 65536
+
+/**
+ * Summary of a single packet, one field per column.
+ */
+struct column_row {
+	timepico ts;
+	uint32_t len;
+	uint32_t caplen;
+	char mampid[8];
+	char nic[CAPHEAD_NICLEN];
+	struct in6_addr src;
+	struct in6_addr dst;
+	uint8_t proto;
+	uint8_t tcp_flags;
+	uint16_t sport;
+	uint16_t dport;
+	uint16_t vlan;
+};
+
+/**
+ * Statistics of a column in a chunk. min and max holds column_width bytes
+ * (strings and addresses is compared bytewise).
+ */
+struct column_stats {
+	uint8_t min[16];
+	uint8_t max[16];
+	enum column_codec codec;
+	size_t stored_size;                          /* bytes in the file */
+	size_t raw_size;                             /* bytes after decoding */
+};
+
+const char* column_name(enum column_id column);
+size_t column_width(enum column_id column);
+enum column_type column_type(enum column_id column);
+
+/**
+ * Find a column by name.
+ * @return Column or -1 if there is no such column.
+ */
+int column_from_name(const char* name);
+
+/**
+ * Read an integer column value (at ptr) regardless of width.
+ */
+uint64_t column_uint(enum column_id column, const void* ptr);
+
+/**
+ * Extract the summary of a packet. Addresses, ports and protocol is taken from
+ * the outermost IP header and the transport header following it.
+ */
+void column_row_from_packet(struct column_row* row, const struct cap_header* cp);
+
+/**
+ * Create a column file.
+ * @param rows Rows per chunk, 0 for default (COLUMN_DEFAULT_ROWS).
+ * @param flags Bitmask of enum column_flags.
+ * @return 0 if successful or error code on errors.
+ */
+int column_writer_open(column_writer_t* writer, const char* filename, size_t rows, int flags);
+
+/**
+ * Summarize and append a packet.
+ */
+int column_writer_add(column_writer_t writer, const struct cap_header* cp);
+
+/**
+ * Append a row, a chunk is written when full. If writing the chunk fails the
+ * error is returned by all later calls (including column_writer_close).
+ */
+int column_writer_add_row(column_writer_t writer, const struct column_row* row);
+
+/**
+ * Write remaining rows and close the file.
+ */
+int column_writer_close(column_writer_t writer);
+
+/**
+ * Number of rows added.
+ */
+uint64_t column_writer_rows(const column_writer_t writer);
+
+/**
+ * Open a column file, only the file header and the chunk headers is read.
+ * A reader must not be used by several threads at once.
+ * @return 0 if successful or error code on errors.
+ */
+int column_reader_open(column_reader_t* reader, const char* filename);
+
+void column_reader_close(column_reader_t reader);
+
+size_t column_reader_chunks(const column_reader_t reader);
+
+/**
+ * Total number of rows in all chunks.
+ */
+uint64_t column_reader_rows(const column_reader_t reader);
+
+/**
+ * Number of rows in a chunk.
+ */
+size_t column_reader_chunk_rows(const column_reader_t reader, size_t chunk);
+
+/**
+ * Get statistics for a column in a chunk.
+ * @return 0 if successful or EINVAL if chunk or column is out of range.
+ */
+int column_reader_stats(const column_reader_t reader, size_t chunk, enum column_id column, struct column_stats* stats);
+
+/**
+ * Read and decode a single column of a chunk.
+ * @param dst Must hold column_reader_chunk_rows * column_width bytes.
+ * @return 0 if successful or error code on errors.
+ */
+int column_reader_read(column_reader_t reader, size_t chunk, enum column_id column, void* dst);
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifdef CAPUTILS_EXPORT
+#pragma GCC visibility pop
+#endif
+
+#endif /* CAPUTILS_COLUMN_H */
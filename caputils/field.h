@@ -0,0 +1,146 @@
+/**
+ * libcap_utils - DPMI capture utilities
+ * Copyright (C) 2003-2013 (see AUTHORS)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef CAPUTILS_FIELD_H
+#define CAPUTILS_FIELD_H
+
+#include <caputils/capture.h>
+#include <caputils/packet.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+#ifdef CAPUTILS_EXPORT
+#pragma GCC visibility push(default)
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Field paths.
+ *
+ * A path such as "ip.src", "tcp.flags" or "dns.qname" is compiled once into a
+ * plan (protocol and location of the field within the header) and then
+ * evaluated for each packet using the layer table from packet_dissect.
+ *
+ * struct field_plan* plan;
+ * field_compile(&plan, "tcp.dport");
+ * struct field_value value;
+ * if ( field_extract(plan, cp, &value) ){
+ *   printf("%"PRIu64"\n", value.u);
+ * }
+ * field_free(plan);
+ */
+
+enum caputils_field_type {
+	FIELD_UINT,                                  /* unsigned integer (host byte order) in u */
+	FIELD_IPV4,                                  /* address in v4 */
+	FIELD_IPV6,                                  /* address in v6 */
+	FIELD_MAC,                                   /* address in mac */
+	FIELD_DNSNAME,                               /* domain name (wire format) at ptr, len bytes */
+};
+
+struct field_value {
+	enum caputils_field_type type;
+	size_t len;                                  /* size of the field in bytes */
+	union {
+		uint64_t u;
+		struct in_addr v4;
+		struct in6_addr v6;
+		uint8_t mac[6];
+		const char* ptr;                           /* points into the packet */
+	};
+};
+
+/**
+ * Custom extraction for variable-length fields.
+ * @param ptr Start of the protocol header.
+ * @param size Number of captured bytes from ptr.
+ * @return Non-zero if the field is present.
+ */
+typedef int (*field_extract_callback)(const char* ptr, size_t size, struct field_value* value);
+
+/**
+ * Field descriptor, each protocol lists its fields in a table terminated by an
+ * entry without name.
+ * Fixed-size fields is read as a big-endian integer of width bytes at offset,
+ * then shifted and masked (if mask is non-zero).
+ */
+struct caputils_field {
+	const char* name;
+	enum caputils_field_type type;
+	uint16_t offset;
+	uint8_t width;
+	uint8_t shift;
+	uint64_t mask;
+	field_extract_callback extract;              /* if set it has precedence over offset/width */
+};
+
+struct field_plan;
+
+/**
+ * Compile a field path.
+ * @return Zero if successful, EINVAL if the path is malformed or ENOENT if the protocol or field is unknown.
+ */
+int field_compile(struct field_plan** plan, const char* path);
+
+void field_free(struct field_plan* plan);
+
+/**
+ * Get the type of the values yielded by a plan.
+ */
+enum caputils_field_type field_type(const struct field_plan* plan);
+
+/**
+ * Extract a field from a dissected packet. Use this when extracting multiple
+ * fields from the same packet so it is only dissected once.
+ * @return Non-zero if the field is present.
+ */
+int field_get(const struct field_plan* plan, const struct layer_table* table, struct field_value* value);
+
+/**
+ * Extract a field from a packet.
+ * @return Non-zero if the field is present.
+ */
+int field_extract(const struct field_plan* plan, const struct cap_header* cp, struct field_value* value);
+
+/**
+ * Extract a column of values from n packets.
+ * @param present Optional, set to non-zero for packets where the field is present.
+ * @return Number of packets where the field was present.
+ */
+size_t field_extract_batch(const struct field_plan* plan, const struct cap_header* const* cp, size_t n, struct field_value* values, uint8_t* present);
+
+/**
+ * Write a human-readable representation of a value.
+ * @return dst
+ */
+const char* field_format(const struct field_value* value, char* dst, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifdef CAPUTILS_EXPORT
+#pragma GCC visibility pop
+#endif
+
+#endif /* CAPUTILS_FIELD_H */
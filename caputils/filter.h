@@ -69,6 +69,13 @@ enum FilterOffset {
 	/* Local filters (these is not used by MArCd, can be reordered) */
 	OFFSET_FRAME_MAX_DT,
 	OFFSET_FRAME_NUM,
+	OFFSET_IP_SRC_SET,
+	OFFSET_IP_DST_SET,
+	OFFSET_IP_PROTO_SET,
+	OFFSET_PORT_SET,
+	OFFSET_SAMPLE,
+	OFFSET_SAMPLE_RANDOM,
+	OFFSET_SAMPLE_FLOW,
 };
 
 enum FilterBitmask {
@@ -94,6 +101,13 @@ enum FilterBitmask {
 	/* local filters */
 	FILTER_FRAME_MAX_DT = (1<<OFFSET_FRAME_MAX_DT),
 	FILTER_FRAME_NUM = (1<<OFFSET_FRAME_NUM),
+	FILTER_IP_SRC_SET = (1<<OFFSET_IP_SRC_SET),
+	FILTER_IP_DST_SET = (1<<OFFSET_IP_DST_SET),
+	FILTER_IP_PROTO_SET = (1<<OFFSET_IP_PROTO_SET),
+	FILTER_PORT_SET = (1<<OFFSET_PORT_SET),   /* either src or dst port */
+	FILTER_SAMPLE = (1<<OFFSET_SAMPLE),       /* systematic 1-in-N */
+	FILTER_SAMPLE_RANDOM = (1<<OFFSET_SAMPLE_RANDOM), /* random 1-in-N */
+	FILTER_SAMPLE_FLOW = (1<<OFFSET_SAMPLE_FLOW),     /* 1-in-N flows */
 };
 
 enum FilterMode {
@@ -102,6 +116,9 @@ enum FilterMode {
 	FILTER_OR,
 };
 
+/* IPv4 and IPv6 prefix set (opaque, loaded from file) */
+struct ipset;
+
 struct frame_num_node {
 	struct frame_num_node* next;
 	signed int lower;
@@ -150,15 +167,29 @@ struct filter {
 	/* local filters */
 	timepico frame_max_dt;             /* reject all packets after a interarrival-time is higher than specified, no more packets will be matched */
 	struct frame_num_node* frame_num;  /* reject packets based on frame number (useful to manually select packets to keep or discard) */
+	struct ipset* ip_src_set;          /* IP source is in any of the prefixes */
+	struct ipset* ip_dst_set;          /* IP destination is in any of the prefixes */
+	uint64_t* ip_proto_set;            /* 256-bit bitmap of IP protocols */
+	uint64_t* port_set;                /* 65536-bit bitmap of src or dst ports */
+	uint32_t sample;                   /* keep every Nth packet */
+	uint32_t sample_random;            /* keep each packet with probability 1/N */
+	uint32_t sample_flow;              /* keep 1/N of the flows (5-tuple hash) */
+	uint64_t sample_random_seed;
+	uint64_t sample_flow_seed;
 
 	/* BFP filter (if supported) */
 	struct bpf_insn* bpf_insn;
 	char* bpf_expr;
 
+	/* filter expression (see filter_expr_set) */
+	struct filter_expr* expr_dag;
+	char* expr;
+
 	/* state */
 	int first;                         /* 1 if this is the first packet */
 	int frame_counter;                 /* Incrementing number for each frame */
 	timepico frame_last_ts;            /* timestamp of the previous packet */
+	uint64_t sample_counter;           /* packets subjected to sampling */
 
 	/* destination */
 	uint32_t consumer;                 /* Destination Consumer */
@@ -239,6 +270,34 @@ void filter_endtime_set(struct filter* filter, const timepico t);
 void filter_frame_dt_set(struct filter* filter, const timepico t);
 void filter_frame_num_set(struct filter* filter, const char* str);
 
+/**
+ * Enable sampling of the packets matching the rest of the filter.
+ * @param mode FILTER_SAMPLE (every Nth packet), FILTER_SAMPLE_RANDOM (each
+ *             packet with probability 1/N) or FILTER_SAMPLE_FLOW (all packets
+ *             of 1/N of the flows, both directions of a 5-tuple is kept or
+ *             dropped together).
+ * @param seed Seed for random and flow sampling, the same seed and input
+ *             always selects the same packets.
+ * @return Zero if successful or EINVAL.
+ */
+int filter_sample_set(struct filter* filter, enum FilterBitmask mode, uint32_t rate, uint64_t seed);
+
+/**
+ * Get the combined sampling rate, i.e. on average one in N of the packets
+ * matching the rest of the filter is kept.
+ * @return N or 1 if the filter does not sample.
+ */
+uint64_t filter_sample_rate(const struct filter* filter);
+
+/**
+ * Set a filter expression, e.g. "(tcp.port 80 or udp.port 53) and not ip.src 10/8".
+ * Predicates use the same fields as the options (see capfilter(1)) and are
+ * joined with and, or, not and parentheses. If an expression is already set
+ * the new one is joined with and.
+ * @return Zero if successful or EINVAL if the expression is malformed.
+ */
+int filter_expr_set(struct filter* filter, const char* expr);
+
 /**
  * Display a representation of the filter.
  */
@@ -246,6 +305,11 @@ void filter_print(const struct filter* filter, FILE* fp, int verbose);
 
 /**
  * Try to match a packet against the filter.
+ *
+ * The filter holds matching state (e.g. frame counters) so a filter must only
+ * be used by one thread at a time, use one filter per thread when matching in
+ * parallel. filter_from_argv uses getopt and is not thread-safe.
+ *
  * @param pkt Pointer to beginning of packet.
  * @param head Capture header.
  * @return Return non-zero if packet matches.
@@ -22,6 +22,7 @@
 
 #include "caputils/capture.h"
 #include "caputils/stream.h"
+#include "caputils/packet.h"
 
 #ifdef CAPUTILS_EXPORT
 #pragma GCC visibility push(default)
@@ -90,6 +91,13 @@ void format_setup(struct format* state, unsigned int flags);
  */
 void format_pkg(FILE* fp, struct format* state, const struct cap_header* cp);
 
+/**
+ * Like format_pkg but using a connection id determined by the caller. Connection
+ * ids must be assigned in packet order so when formatting packets in parallel
+ * the ids is determined (using connection_id) before handing the packets over.
+ */
+void format_pkg_id(FILE* fp, struct format* state, const struct cap_header* cp, connection_id_t id);
+
 /**
  * When writing stateful descriptions it is sometimes useful to ignore a packet
  * but increment the packet counter and time reference.
@@ -52,8 +52,8 @@ typedef char mampid_t[16];
 void mampid_set(mampid_t dst, const char* src);
 
 /**
- * Get pointer to char-buffer suitable for printing. Returns pointer to static
- * memory.
+ * Get pointer to char-buffer suitable for printing. Returns pointer to
+ * thread-local memory.
  */
 const char* mampid_get(const mampid_t src);
 
@@ -346,6 +346,10 @@ int marc_filter_request(marc_context_t ctx, const char* MAMPid, uint32_t filter_
 typedef int (*marc_output_handler_t)(FILE*, const char*, ...);
 typedef int (*marc_output_handlerv_t)(FILE*, const char*, va_list);
 
+/**
+ * Set process-wide output handlers. Not thread-safe, call before any other
+ * thread uses marc.
+ */
 int marc_set_output_handler(marc_output_handler_t, marc_output_handlerv_t, FILE* errors, FILE* verbose);
 
 #ifdef __cplusplus
@@ -33,6 +33,7 @@ extern "C" {
 
 #include <stdint.h>
 #include <stddef.h>
+#include <netinet/in.h>
 
 enum Level {
 	LEVEL_INVALID = 0,
@@ -69,12 +70,29 @@ const struct tcphdr* find_tcp_header(const void* pkt, const struct ethhdr* ether
 const struct udphdr* find_udp_header(const void* pkt, const struct ethhdr* ether, const struct ip* ip, uint16_t* src, uint16_t* dest);
 
 struct network {
-	char net_src[120];   /* human-readable representation of src address */
-	char net_dst[120];   /* human-readable representation of dst address */
+	int family;          /* AF_INET, AF_INET6 or zero if no network header has been found */
+	union {
+		struct in_addr v4;
+		struct in6_addr v6;
+	} src, dst;          /* raw addresses (network byte order) */
 	size_t plen;         /* payload size (not including network headers) */
+
+	/* cached human-readable representation, use network_src_str/network_dst_str */
+	int formatted;
+	char src_str[INET6_ADDRSTRLEN];
+	char dst_str[INET6_ADDRSTRLEN];
 };
 typedef const struct network* net_t;
 
+/**
+ * Get human-readable representation of the source/destination address. The
+ * address is formatted on first use and cached in the network struct, so
+ * walking headers without printing them never formats addresses.
+ * @return Pointer to string owned by net, or an empty string if no network header is set.
+ */
+const char* network_src_str(net_t net);
+const char* network_dst_str(net_t net);
+
 /**
  * Header walk. An API for traversing each (known) header in a packet.
  *
@@ -108,6 +126,10 @@ struct header_chunk {
 /**
  * Initialize header walker.
  *
+ * The protocol decoders (header_walk, header_dump and header_format) only keep
+ * state in the header_chunk and may be used concurrently from multiple threads
+ * as long as each thread uses its own header_chunk.
+ *
  * @param header context to initialize.
  * @param cp captured packet.
  * @param layer unused for now.
@@ -118,6 +140,64 @@ void header_dump(FILE* fp, const struct header_chunk* header, const char* prefix
 void header_format(FILE* fp, const struct header_chunk* header, int flags);
 size_t header_size(const struct header_chunk* header);
 
+/**
+ * Flat layer table. An alternative to header_walk when the headers only is
+ * located, not printed: all layers is found in one pass without any I/O.
+ *
+ * struct layer_table table;
+ * packet_dissect(cp, &table);
+ * const struct layer* tcp = layer_find(&table, PROTOCOL_TCP);
+ * if ( tcp ){
+ *   const struct tcphdr* th = (const struct tcphdr*)(cp->payload + tcp->offset);
+ * }
+ */
+
+enum {
+	LAYER_MAX = 16,                              /* max number of layers stored in a layer table */
+};
+
+enum layer_flags {
+	LAYER_TRUNCATED = (1<<0),                    /* captured data ends before the end of the header */
+};
+
+enum layer_table_flags {
+	LAYER_TABLE_TRUNCATED = (1<<0),              /* packet truncated, at least one layer is missing or incomplete */
+	LAYER_TABLE_OVERFLOW  = (1<<1),              /* packet has more than LAYER_MAX layers */
+	LAYER_TABLE_CORRUPT   = (1<<2),              /* a header points outside the packet */
+};
+
+struct layer {
+	uint16_t protocol;                           /* enum caputils_protocol_type */
+	uint16_t flags;                              /* enum layer_flags */
+	uint32_t offset;                             /* offset from cp->payload */
+	uint32_t length;                             /* bytes until next layer (rest of the captured data for the last layer) */
+};
+
+struct layer_table {
+	const struct cap_header* cp;
+	unsigned int num_layers;
+	unsigned int flags;                          /* enum layer_table_flags */
+	struct network net;                          /* last network layer (same as header_chunk.last_net) */
+	struct layer layer[LAYER_MAX];
+};
+
+/**
+ * Locate all layers in a packet. Same layers as visited by header_walk.
+ * Common stacks (Ethernet, VLAN, MPLS, IPv4, IPv6, TCP and UDP) is decoded
+ * directly and other protocols using the protocol registry. TCP and UDP
+ * carrying payload is passed to the registry to detect the application
+ * protocol. Nothing is printed and malformed headers only sets flags.
+ *
+ * @return Number of layers found.
+ */
+unsigned int packet_dissect(const struct cap_header* cp, struct layer_table* table);
+
+/**
+ * Find the first layer of a given protocol.
+ * @return Layer or NULL if the protocol is not present.
+ */
+const struct layer* layer_find(const struct layer_table* table, enum caputils_protocol_type protocol);
+
 typedef unsigned int connection_id_t;
 
 /**
@@ -135,9 +215,26 @@ typedef unsigned int connection_id_t;
  * id (out-of-order within a CI, packets being out-of-order due to
  * arriving at different times to multiple CI is fine but reading
  * randomized packets from trace will not work.)
+ *
+ * Each thread uses its own table, i.e. ids is only unique within the calling
+ * thread. Use connection_id_r to control the table explicitly.
  */
 connection_id_t connection_id(const struct cap_header* cp);
 
+/**
+ * Connection states used by connection_id_r. A table may only be used by one
+ * thread at a time.
+ */
+struct connection_table;
+
+struct connection_table* connection_table_alloc(void);
+void connection_table_free(struct connection_table* table);
+
+/**
+ * Like connection_id but using the given table.
+ */
+connection_id_t connection_id_r(struct connection_table* table, const struct cap_header* cp);
+
 /**
  * No connection id could be generated.
  */
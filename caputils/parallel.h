@@ -0,0 +1,117 @@
+/**
+ * libcap_utils - DPMI capture utilities
+ * Copyright (C) 2003-2013 (see AUTHORS)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef CAPUTILS_PARALLEL_H
+#define CAPUTILS_PARALLEL_H
+
+#include <caputils/capture.h>
+#include <caputils/filter.h>
+#include <stddef.h>
+
+#ifdef CAPUTILS_EXPORT
+#pragma GCC visibility push(default)
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Initialize a task state (the memory is zeroed before the call).
+ */
+typedef void (*parallel_init_callback_t)(void* state, void* user);
+
+/**
+ * Called for each packet in the task, from a worker thread.
+ * @param match Non-zero if the packet matched the filter (always set if no filter is used).
+ * @return Zero to continue or an error code to abort the entire job.
+ */
+typedef int (*parallel_map_callback_t)(void* state, const struct cap_header* cp, int match, void* user);
+
+/**
+ * Merge a task state into the result. Called from the calling thread, in
+ * input order (by path and then by position in the file).
+ * @param index Index of the path the task belongs to.
+ */
+typedef void (*parallel_reduce_callback_t)(void* state, size_t index, void* user);
+
+/**
+ * Release resources held by a task state (optional).
+ */
+typedef void (*parallel_cleanup_callback_t)(void* state, void* user);
+
+struct caputils_parallel {
+	size_t state_size;                       /* size of the per-task state in bytes */
+	parallel_init_callback_t init;           /* optional */
+	parallel_map_callback_t map;
+	parallel_reduce_callback_t reduce;
+	parallel_cleanup_callback_t cleanup;     /* optional */
+	void* user;                              /* passed to all callbacks */
+
+	/* Filter to match packets with (optional). Each thread uses a private copy.
+	 * Filters depending on the packet sequence (frame numbers and max
+	 * interarrival-time) cannot be used. */
+	const struct filter* filter;
+
+	/* Size of the chunks capfiles are split into, zero for default. */
+	size_t chunk_size;
+};
+
+/**
+ * Process a set of capture files using a pool of worker threads.
+ *
+ * The work is split into tasks: each file is split into chunks aligned to
+ * packet boundaries (non-regular files and legacy versions is a single
+ * task). Idle threads take the next unprocessed task, each task gets a new
+ * state which is passed to map for every packet and finally merged with
+ * reduce, in order.
+ *
+ * A file which cannot be opened or read (e.g. it is truncated) does not stop
+ * the other files: the packets read from it so far is still reduced and the
+ * error is returned once all files has been processed. An error from map
+ * aborts the entire job.
+ *
+ * Only paths is accepted: an already opened stream has consumed its header and
+ * buffered data so it cannot be split into chunks, use stream_read instead.
+ *
+ * @param paths Files to process.
+ * @param num_paths Number of files.
+ * @param threads Number of worker threads, zero to use one per CPU.
+ * @return 0 if successful, first error from map, first error reading a file
+ *         or error code on errors.
+ */
+int caputils_parallel_foreach(const char* const* paths, size_t num_paths, unsigned int threads, const struct caputils_parallel* job);
+
+/**
+ * Tell if a filter can be used by caputils_parallel_foreach, i.e. it does not
+ * depend on the packet sequence (frame numbers, max interarrival-time,
+ * systematic or random sampling).
+ * @return non-zero if supported.
+ */
+int caputils_parallel_filter_supported(const struct filter* filter);
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifdef CAPUTILS_EXPORT
+#pragma GCC visibility pop
+#endif
+
+#endif /* CAPUTILS_PARALLEL_H */
@@ -0,0 +1,117 @@
+/**
+ * libcap_utils - DPMI capture utilities
+ * Copyright (C) 2003-2013 (see AUTHORS)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#ifndef CAPUTILS_PCAP_WRITER_H
+#define CAPUTILS_PCAP_WRITER_H
+
+#include <caputils/capture.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef CAPUTILS_EXPORT
+#pragma GCC visibility push(default)
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * pcap and pcapng writer.
+ *
+ * Converts capture packets to pcap records in a large userspace buffer which
+ * is written with a single system call when full. With pcapng each unique
+ * nic and mampid pair gets an interface description block (if_name is the nic
+ * and if_description the mampid, which is also how pcapng files is read by
+ * stream_open).
+ */
+struct pcap_writer;
+typedef struct pcap_writer* pcap_writer_t;
+
+/**
+ * Packets encoded in memory (without writing), used to convert packets in
+ * parallel. Encoding only reads the writer so several batches can be filled
+ * concurrently but they must be written from a single thread.
+ */
+struct pcap_batch;
+typedef struct pcap_batch* pcap_batch_t;
+
+enum pcap_format {
+	PCAP_FORMAT_USEC = 0,     /* pcap with microsecond timestamps */
+	PCAP_FORMAT_NSEC,         /* pcap with nanosecond timestamps */
+	PCAP_FORMAT_PCAPNG,       /* pcapng with nanosecond timestamps (if_tsresol) */
+};
+
+/**
+ * Create a pcap file.
+ * @param linktype Link type of all packets (see pcap-linktype(7)), usually 1 (ethernet).
+ * @param snaplen Packets is truncated to snaplen bytes, 0 for default (65535).
+ * @return 0 if successful or error code on errors (EINVAL if format or snaplen
+ *         is invalid).
+ */
+int pcap_writer_open(pcap_writer_t* writer, const char* filename, enum pcap_format format, int linktype, size_t snaplen);
+
+/**
+ * Write a packet.
+ */
+int pcap_writer_write(pcap_writer_t writer, const struct cap_header* cp);
+
+/**
+ * Write buffered packets to the file.
+ */
+int pcap_writer_flush(pcap_writer_t writer);
+
+/**
+ * Flush and close the file.
+ */
+int pcap_writer_close(pcap_writer_t writer);
+
+/**
+ * Number of packets written.
+ */
+uint64_t pcap_writer_packets(const pcap_writer_t writer);
+
+/**
+ * Create an empty batch for the writer.
+ * @return NULL if out of memory.
+ */
+pcap_batch_t pcap_batch_new(const pcap_writer_t writer);
+
+/**
+ * Encode a packet into the batch.
+ */
+int pcap_batch_add(pcap_batch_t batch, const struct cap_header* cp);
+
+/**
+ * Write all packets in the batch (in order) and empty it so it can be reused.
+ */
+int pcap_writer_write_batch(pcap_writer_t writer, pcap_batch_t batch);
+
+void pcap_batch_free(pcap_batch_t batch);
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifdef CAPUTILS_EXPORT
+#pragma GCC visibility pop
+#endif
+
+#endif /* CAPUTILS_PCAP_WRITER_H */
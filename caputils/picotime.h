@@ -24,7 +24,14 @@
 #include <stdlib.h>
 #include <sys/time.h>
 
-#define PICODIVIDER 1e12
+#define PICODIVIDER 1e12                                  /* deprecated, floating-point (use PICOSECONDS_PER_SECOND) */
+#define PICOSECONDS_PER_SECOND UINT64_C(1000000000000)
+
+/* The arithmetic functions is defined inline in this header, the library also
+ * exports them for calls which is not inlined. */
+#ifndef CAPUTILS_PICOTIME_INLINE
+#define CAPUTILS_PICOTIME_INLINE extern inline __attribute__((gnu_inline))
+#endif
 
 #ifdef CAPUTILS_EXPORT
 #pragma GCC visibility push(default)
@@ -73,28 +80,101 @@ int timepico_from_string(timepico* dst, const char* str);
 const char* timepico_to_string_r(const timepico* src, char* dst, size_t bytes, const char* fmt) __attribute__((format(strftime,4,0)));
 
 /**
- * Like timepico_to_string but using static memory.
+ * Like timepico_to_string_r but using thread-local memory, which subsequent
+ * calls from the same thread will overwrite.
  */
 const char* timepico_to_string(const timepico* src, const char* fmt) __attribute__((format(strftime,2,0)));
 
 /**
  * Convert to a double.
+ * The precision is limited to about 0.2 microseconds for current dates, use
+ * timepico_diff_ps for exact differences.
  * Added in v0.7.14.
  */
 double timepico_to_double(timepico tp);
 
-//compares two struct timepico (ts1<ts2=-1, ts1>ts2=1, ts1==ts2=0)
-int timecmp(const timepico *ts1, const timepico *ts2);
+/**
+ * Normalize so tv_psec is less than one second (with the excess added to
+ * tv_sec). All arithmetic functions return normalized timestamps.
+ */
+CAPUTILS_PICOTIME_INLINE timepico timepico_normalize(timepico t){
+	t.tv_sec += t.tv_psec / PICOSECONDS_PER_SECOND;
+	t.tv_psec %= PICOSECONDS_PER_SECOND;
+	return t;
+}
+
+/**
+ * Compares two timestamps.
+ * @return -1 if ts1 < ts2, 1 if ts1 > ts2 and 0 if equal.
+ */
+CAPUTILS_PICOTIME_INLINE int timecmp(const timepico *ts1, const timepico *ts2){
+	const int sec  = (ts1->tv_sec  > ts2->tv_sec)  - (ts1->tv_sec  < ts2->tv_sec);
+	const int psec = (ts1->tv_psec > ts2->tv_psec) - (ts1->tv_psec < ts2->tv_psec);
+	const int order = 2 * sec + psec;      /* seconds takes precedence */
+	return (order > 0) - (order < 0);
+}
 
 /**
  * Calculate a - b.
+ * If b is greater than a the seconds wraps around (modulo 2^32).
  */
-timepico timepico_sub(timepico a, timepico b);
+CAPUTILS_PICOTIME_INLINE timepico timepico_sub(timepico a, timepico b){
+	if ( __builtin_expect(a.tv_psec >= PICOSECONDS_PER_SECOND || b.tv_psec >= PICOSECONDS_PER_SECOND, 0) ){
+		a = timepico_normalize(a);
+		b = timepico_normalize(b);
+	}
+
+	const uint64_t borrow = a.tv_psec < b.tv_psec;
+	timepico result;
+	result.tv_sec  = a.tv_sec - b.tv_sec - (uint32_t)borrow;
+	result.tv_psec = a.tv_psec - b.tv_psec + (PICOSECONDS_PER_SECOND & -borrow);
+	return result;
+}
 
 /**
  * Calculate a + b.
  */
-timepico timepico_add(timepico a, timepico b);
+CAPUTILS_PICOTIME_INLINE timepico timepico_add(timepico a, timepico b){
+	if ( __builtin_expect(a.tv_psec >= PICOSECONDS_PER_SECOND || b.tv_psec >= PICOSECONDS_PER_SECOND, 0) ){
+		a = timepico_normalize(a);
+		b = timepico_normalize(b);
+	}
+
+	timepico result;
+	result.tv_psec = a.tv_psec + b.tv_psec;
+	const uint64_t carry = result.tv_psec >= PICOSECONDS_PER_SECOND;
+	result.tv_sec  = a.tv_sec + b.tv_sec + (uint32_t)carry;
+	result.tv_psec -= PICOSECONDS_PER_SECOND & -carry;
+	return result;
+}
+
+/**
+ * Calculate a - b in picoseconds. The difference must be within about
+ * +-106 days (63 bits of picoseconds) and the timestamps normalized.
+ */
+CAPUTILS_PICOTIME_INLINE int64_t timepico_diff_ps(timepico a, timepico b){
+	const uint64_t sec = (uint64_t)((int64_t)a.tv_sec - (int64_t)b.tv_sec);
+	return (int64_t)(sec * PICOSECONDS_PER_SECOND + (a.tv_psec - b.tv_psec));
+}
+
+/**
+ * Find the oldest timestamp among n timestamps.
+ * @return Index of the oldest timestamp (the first if several is equal) or 0 if n is 0.
+ */
+size_t timepico_min(const timepico* ts, size_t n);
+
+/**
+ * Calculate the difference (in picoseconds) between consecutive timestamps,
+ * i.e. dt[i] = ts[i+1] - ts[i] for n - 1 values. Same limitations as
+ * timepico_diff_ps.
+ */
+void timepico_deltas(const timepico* ts, size_t n, int64_t* dt);
+
+/**
+ * Calculate the difference (in picoseconds) between n timestamps and a reference,
+ * i.e. dt[i] = ts[i] - ref. Same limitations as timepico_diff_ps.
+ */
+void timepico_diff_batch(const timepico* ts, size_t n, timepico ref, int64_t* dt);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,108 @@
+/**
+ * libcap_utils - DPMI capture utilities
+ * Copyright (C) 2003-2013 (see AUTHORS)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef CAPUTILS_SENDER_H
+#define CAPUTILS_SENDER_H
+
+#include <caputils/capture.h>
+#include <caputils/stream.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+#ifdef CAPUTILS_EXPORT
+#pragma GCC visibility push(default)
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Measurement frame sender.
+ *
+ * Packs individual packets into measurement frames (sendhead followed by
+ * packets) for ethernet and udp streams. Sequence numbers, packet count and
+ * SENDER_FLUSH is managed by the sender. A frame is completed when the next
+ * packet doesn't fit or when the oldest packet in it is older than the
+ * latency. Completed frames is queued and transmitted in batches.
+ */
+struct sender;
+typedef struct sender* sender_t;
+
+struct sender_stat {
+	uint64_t packets;  /* number of packets written */
+	uint64_t frames;   /* number of frames transmitted */
+	uint64_t batches;  /* number of batches (system calls) used to transmit frames */
+	uint64_t bytes;    /* number of bytes transmitted (including link headers) */
+};
+
+/**
+ * Create a sender for a stream created with stream_create. The stream is not
+ * owned by the sender and must be closed after sender_close.
+ *
+ * @param frame_size Size of measurement frames in bytes (excluding link
+ *                   headers), use 0 for the largest size the stream allows
+ *                   (derived from the interface MTU, jumbo frames are used
+ *                   if the interface is configured for it).
+ * @param latency Maximum time a packet may wait for its frame to be sent, use
+ *                NULL to only send full frames.
+ * @return 0 if successful, ERROR_NOT_IMPLEMENTED if the stream doesn't
+ *         support measurement frames or EINVAL if frame_size is too large or
+ *         too small.
+ */
+int sender_open(sender_t* sender, stream_t st, size_t frame_size, const struct timeval* latency);
+
+/**
+ * Add a packet to the current frame.
+ * @return 0 if successful or error code on errors. EMSGSIZE if the packet
+ *         cannot fit in a frame.
+ */
+int sender_write(sender_t sender, const struct cap_header* cp);
+
+/**
+ * Send the current frame if the latency has expired. Should be called
+ * periodically when packets arrives slowly, sender_write does this already.
+ */
+int sender_poll(sender_t sender);
+
+/**
+ * Send all queued frames, including the current partial frame.
+ */
+int sender_flush(sender_t sender);
+
+/**
+ * Send all pending packets, mark the last frame with SENDER_FLUSH and release
+ * the sender.
+ */
+int sender_close(sender_t sender);
+
+/**
+ * Get sender statistics.
+ */
+const struct sender_stat* sender_get_stat(const sender_t sender);
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifdef CAPUTILS_EXPORT
+#pragma GCC visibility pop
+#endif
+
+#endif /* CAPUTILS_SENDER_H */
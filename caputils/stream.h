@@ -34,6 +34,12 @@
 extern "C" {
 #endif
 
+/**
+ * Thread-safety: a stream_t is not internally synchronized and must only be
+ * used by one thread at a time (packets returned by stream_read is only valid
+ * until the next call on the same stream). Different streams may be used
+ * concurrently from different threads.
+ */
 struct stream;
 typedef struct stream* stream_t;
 
@@ -44,6 +50,9 @@ struct stream_stat {
 
 	uint64_t buffer_size;  /* size of buffer in bytes */
 	uint64_t buffer_usage; /* number of bytes used */
+
+	uint64_t late;         /* number of packets arriving later than the reorder window allowed (reorder streams only) */
+	uint64_t dropped;      /* number of packets dropped because a reader was too slow (shared memory, fan-out and interface streams only) */
 };
 typedef struct stream_stat stream_stat_t;
 
@@ -112,6 +121,13 @@ void stream_get_version(const stream_t st, struct file_version* dst);
  */
 const char* stream_get_comment(const stream_t st);
 
+/**
+ * Get the sampling rate recorded in the comment as "sample-rate=N" (e.g. by
+ * capfilter --sample), i.e. each packet in the stream represents N packets.
+ * @return N or 1 if the stream is not sampled.
+ */
+uint64_t stream_get_sample_rate(const stream_t st);
+
 /**
  * Get MAMPid of stream or NULL if unknown.
  * @return Internal reference to MAMPid.
@@ -189,6 +205,108 @@ int stream_read_cb(stream_t st, stream_read_callback_t callback, struct filter*
  */
 int stream_peek(stream_t st, cap_head** header, struct filter* filter);
 
+/**
+ * Keep a packet returned by stream_read valid after the next read, without
+ * copying it. The buffer chunk holding the packet is set aside and the stream
+ * continues in a new chunk (reusing released chunks when possible). Each
+ * stream_retain must be paired with a stream_release on the same stream and
+ * retained packets is invalid after stream_close.
+ *
+ * Supported by file, tcp, ethernet, udp and fan-out streams.
+ * @return 0 if successful, ERROR_NOT_IMPLEMENTED if the stream doesn't support
+ *         retaining packets or EINVAL if the packet doesn't belong to the stream.
+ */
+int stream_retain(stream_t st, const cap_head* cp);
+
+/**
+ * Release a packet previously retained with stream_retain.
+ */
+int stream_release(stream_t st, const cap_head* cp);
+
+/**
+ * Get a descriptor which becomes readable when data arrives to the stream,
+ * suitable for poll or epoll based event loops. Packets may already be
+ * buffered by the stream so it must be drained using stream_try_read (until
+ * EAGAIN) before waiting on the descriptor again.
+ * @return File descriptor or -1 if the stream has no pollable descriptor.
+ */
+int stream_get_fd(const stream_t st);
+
+/**
+ * Non-blocking version of stream_read. Pipes and FIFOs (including stdin) is
+ * polled as well, only regular files is read without checking.
+ * @return same as stream_read. EAGAIN if no packet is available right now.
+ */
+int stream_try_read(stream_t st, cap_head** header, struct filter* filter);
+
+enum StreamReorderFlags {
+	/* Discard packets arriving after newer packets has already been released
+	 * instead of passing them through out-of-order. */
+	STREAM_REORDER_DROP_LATE = (1<<0),
+};
+
+/**
+ * Open a stream which reorders the packets of another stream by timestamp.
+ *
+ * Packets are held until the difference between the oldest held packet and the
+ * newest seen packet is larger than window, or when more than max_packets is
+ * held. When the inner stream is idle (i.e. the read times out) the oldest
+ * packet is released immediately. Packets arriving later than the window
+ * allows are counted in stream_stat.late.
+ *
+ * Works with any stream type, including live ethernet and udp streams. The
+ * inner stream is owned by the reorder stream and is closed by stream_close.
+ *
+ * @param stptr Pointer to a stream handle.
+ * @param inner Stream to read packets from.
+ * @param window Max timestamp difference, use zero to only limit by packet count.
+ * @param max_packets Max number of held packets, use zero to only limit by window.
+ * @param flags Bitmask of StreamReorderFlags.
+ * @return 0 if successful or error code on errors.
+ */
+int stream_reorder_open(stream_t* stptr, stream_t inner, const timepico window, size_t max_packets, int flags);
+
+/**
+ * Open a stream which merges several streams into a single time-ordered stream.
+ *
+ * Each input is assumed to be ordered by timestamp. An input's watermark is
+ * the timestamp of the last packet read from it and a packet is only released
+ * when all other inputs has passed it, has reached EOF or, if idle is set, has
+ * not delivered any packets within the idle timeout. Works with live streams
+ * (ethernet, udp, pfring) as well as files. An input failing with an error is
+ * dropped with a warning and the merge continues with the remaining inputs.
+ * The inputs are owned by the merge stream and is closed by stream_close.
+ *
+ * @param stptr Pointer to a stream handle.
+ * @param inputs Array of streams to merge.
+ * @param num_inputs Number of streams in inputs.
+ * @param idle Idle timeout, NULL to always wait for all inputs.
+ * @return 0 if successful or error code on errors.
+ */
+int stream_merge_open(stream_t* stptr, stream_t* inputs, size_t num_inputs, const struct timeval* idle);
+
+/**
+ * Open several streams which each receives all packets from the source stream.
+ *
+ * Packets is shared by all children without copying (the source must support
+ * stream_retain, otherwise each packet is copied once) and each child has its
+ * own read position. A packet is released when the slowest child has read past
+ * it. If the buffer grows beyond buffer_size bytes the oldest
+ * packets is dropped for the children lagging behind (counted in
+ * stream_stat.dropped for each child). stream_stat.buffer_usage is the number
+ * of bytes the child is lagging behind.
+ *
+ * The children share state and must be used from the same thread. The source
+ * is owned by the children and is closed when all children are closed.
+ *
+ * @param children Array of num_children stream handles to initialize.
+ * @param src Stream to read packets from.
+ * @param num_children Number of children to create.
+ * @param buffer_size Max number of bytes to buffer, use 0 for default (16 MiB).
+ * @return 0 if successful or error code on errors.
+ */
+int stream_fanout_open(stream_t* children, stream_t src, size_t num_children, size_t buffer_size);
+
 /**
  * Force flushing of output stream. Most usable with capfiles.
  */
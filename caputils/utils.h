@@ -47,7 +47,8 @@ const char* caputils_error_string(int code);
 const char* hexdump_address_r(const struct ether_addr* address, char buf[IFHWADDRLEN*3]);
 
 /**
- * Like ether_ntoa but does not omit leading zeros. Returns a string to static memory.
+ * Like ether_ntoa but does not omit leading zeros. Returns a string to
+ * thread-local memory.
  */
 const char* hexdump_address(const struct ether_addr* addr);
 
@@ -31,8 +31,8 @@ static void handle_tcp(const cap_head* cp, const struct header_chunk* header, co
 	const size_t header_size = 4*tcp->doff;
 	const size_t payload_size = header->last_net.plen - header_size;
 	fprintf(stdout, "Got a TCP packet from %s:%d to %s:%d with a %zd byte payload\n",
-	        header->last_net.net_src, ntohs(tcp->source),
-	        header->last_net.net_dst, ntohs(tcp->dest),
+	        network_src_str(&header->last_net), ntohs(tcp->source),
+	        network_dst_str(&header->last_net), ntohs(tcp->dest),
 	        payload_size);
 }
 
@@ -32,11 +32,9 @@
 /**
  * like strtok but works with sequential delimiters
  */
-static char* strtok2(char* str, char* delim){
-	static char* next = NULL;
-
+static char* strtok2(char* str, char* delim, char** next){
 	if ( !str ){
-		str = next;
+		str = *next;
 	}
 
 	if ( !str ){
@@ -45,12 +43,12 @@ static char* strtok2(char* str, char* delim){
 
 	char* tmp = strpbrk(str, delim);
 	if ( !tmp ){
-		next = NULL;
+		*next = NULL;
 		return str;
 	}
 
 	*tmp = 0;
-	next = tmp+1;
+	*next = tmp+1;
 
 	return str;
 }
@@ -65,9 +63,10 @@ static void homogenize_eth_addr(char* buf){
 
 	char tmp[17] = {0,};
 	char* cur = tmp;
-	char* pair = strtok2(buf, ":");
+	char* saveptr = NULL;
+	char* pair = strtok2(buf, ":", &saveptr);
 	while ( pair ){
-		char* next = strtok2(NULL, ":");
+		char* next = strtok2(NULL, ":", &saveptr);
 
 		switch ( strlen(pair) ){
 		case 12: /* no delimiter */
@@ -140,10 +139,7 @@ static void homogenize_eth_addr(char* buf){
 
 int stream_addr_aton(stream_addr_t* dst, const char* src, enum AddressType type, int flags){
 	char buf[48] = {0,};   /* larger than max, just in case user provides large */
-//	strncpy(buf, src, 48); /* input, will bail out later on bad data. */
-
-	memset(buf, 0, sizeof buf);
-	memcpy(buf, src, 48);
+	strncpy(buf, src, sizeof(buf) - 1); /* input, will bail out later on bad data. */
 
 	stream_addr_reset(dst);
 	dst->_type = htons(type);
@@ -170,6 +166,10 @@ int stream_addr_aton(stream_addr_t* dst, const char* src, enum AddressType type,
 					return stream_addr_aton(dst, src+7, STREAM_ADDR_CAPFILE, flags | STREAM_ADDR_LOCAL);
 				} else if ( strcasecmp("fifo", prefix) == 0 ){
 					return stream_addr_aton(dst, src+7, STREAM_ADDR_FIFO, flags | STREAM_ADDR_LOCAL | STREAM_ADDR_UNLINK);
+				} else if ( strcasecmp("shm", prefix) == 0 ){
+					return stream_addr_aton(dst, src+6, STREAM_ADDR_SHM, flags | STREAM_ADDR_LOCAL);
+				} else if ( strcasecmp("iface", prefix) == 0 ){
+					return stream_addr_aton(dst, src+8, STREAM_ADDR_IFACE, flags | STREAM_ADDR_LOCAL);
 				}
 
 				return EINVAL;
@@ -189,11 +189,8 @@ int stream_addr_aton(stream_addr_t* dst, const char* src, enum AddressType type,
 		// DESTADDR is ipaddress:port
 		{
 			char* ip = buf;
-//			strncpy(buf, src, 48);
-
 			memset(buf, 0, sizeof buf);
-			memcpy(buf, src, 48);
-
+			strncpy(buf, src, sizeof(buf) - 1);
 
 			dst->ipv4.sin_family = AF_INET;
 			dst->ipv4.sin_port = htons(0x0810); /* default port */
@@ -222,6 +219,8 @@ int stream_addr_aton(stream_addr_t* dst, const char* src, enum AddressType type,
 
 	case STREAM_ADDR_CAPFILE: // File
 	case STREAM_ADDR_FIFO:
+	case STREAM_ADDR_SHM:
+	case STREAM_ADDR_IFACE:
 		if ( flags & STREAM_ADDR_LOCAL ){
 			dst->local_filename = src;
 			if ( flags &  STREAM_ADDR_DUPLICATE ){
@@ -262,7 +261,7 @@ int stream_addr_fp(stream_addr_t* dst, FILE* fp, int flags){
 }
 
 const char* stream_addr_ntoa(const stream_addr_t* src){
-	static char buf[1024];
+	static __thread char buf[1024];
 	return stream_addr_ntoa_r(src, buf, 1024);
 }
 
@@ -283,6 +282,12 @@ const char* stream_addr_ntoa_r(const stream_addr_t* src, char* buf, size_t bytes
 	case STREAM_ADDR_FIFO:
 		written = snprintf(buf, bytes, "fifo://%s", src->local_filename);
 		break;
+	case STREAM_ADDR_SHM:
+		written = snprintf(buf, bytes, "shm://%s", stream_addr_have_flag(src, STREAM_ADDR_LOCAL) ? src->local_filename : src->filename);
+		break;
+	case STREAM_ADDR_IFACE:
+		written = snprintf(buf, bytes, "iface://%s", stream_addr_have_flag(src, STREAM_ADDR_LOCAL) ? src->local_filename : src->filename);
+		break;
 
 	case STREAM_ADDR_CAPFILE:
 		if ( stream_addr_have_flag(src, STREAM_ADDR_LOCAL) ){
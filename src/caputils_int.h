@@ -59,7 +59,24 @@ enum {
 
 	ERROR_NOT_IMPLEMENTED, /* should not normally be used but during the transition period it is useful */
 
+	/* errors related to pcap files (appended to keep existing codes) */
+	ERROR_PCAP_LINKTYPE,
+
 	ERROR_LAST
 };
 
+/**
+ * Wait until fd becomes readable, using poll so descriptors above FD_SETSIZE
+ * works. Like select on Linux the timeout is updated to reflect the time left.
+ * @param timeout Max time to wait, NULL to block indefinitely.
+ * @return 1 if readable, 0 on timeout and -1 on errors (errno is set).
+ */
+int poll_readable(int fd, struct timeval* timeout);
+
+/**
+ * Write all of data, retrying on short writes and EINTR.
+ * @return 0 if successful or errno value on errors.
+ */
+int write_all(int fd, const char* data, size_t size);
+
 #endif /* CAPUTILS_INT_H */
@@ -0,0 +1,802 @@
+/**
+ * libcap_utils - DPMI capture utilities
+ * Copyright (C) 2003-2013 (see AUTHORS)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include "caputils/caputils.h"
+#include "caputils/column.h"
+#include "caputils/packet.h"
+#include "caputils_int.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/**
+ * File layout:
+ *
+ *   file header, one descriptor per column
+ *   chunk: chunk header, one entry per column, column data..
+ *   chunk: ..
+ *
+ * Each chunk is self-contained and the chunk headers is linked by their size
+ * so the reader can locate all chunks by reading only the headers.
+ */
+
+#define COLUMN_FILE_MAGIC  0x6c6f6370   /* "pcol" */
+#define COLUMN_CHUNK_MAGIC 0x6b6e6863   /* "chnk" */
+#define COLUMN_VERSION 1
+#define COLUMN_MAX_ROWS (16*1024*1024)
+#define VARINT_MAX 10                   /* bytes needed for a 64 bit varint */
+
+struct column_file_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t num_columns;
+	uint32_t chunk_rows;                  /* maximum rows in a chunk */
+};
+
+struct column_desc {
+	char name[16];
+	uint32_t width;
+	uint32_t type;
+};
+
+struct column_chunk_header {
+	uint32_t magic;
+	uint32_t rows;
+	uint64_t size;                        /* total size of the chunk including headers */
+};
+
+struct column_entry {
+	uint64_t offset;                      /* from the beginning of the chunk */
+	uint32_t size;                        /* stored bytes */
+	uint32_t codec;
+	uint8_t min[16];
+	uint8_t max[16];
+};
+
+struct column_info {
+	const char* name;
+	size_t width;
+	enum column_type type;
+};
+
+static const struct column_info column_info[COLUMN_MAX] = {
+	{"ts_sec",    4,  COLUMN_TYPE_UINT},
+	{"ts_psec",   8,  COLUMN_TYPE_UINT},
+	{"len",       4,  COLUMN_TYPE_UINT},
+	{"caplen",    4,  COLUMN_TYPE_UINT},
+	{"mampid",    8,  COLUMN_TYPE_STRING},
+	{"nic",       CAPHEAD_NICLEN, COLUMN_TYPE_STRING},
+	{"src",       16, COLUMN_TYPE_ADDRESS},
+	{"dst",       16, COLUMN_TYPE_ADDRESS},
+	{"proto",     1,  COLUMN_TYPE_UINT},
+	{"sport",     2,  COLUMN_TYPE_UINT},
+	{"dport",     2,  COLUMN_TYPE_UINT},
+	{"tcp_flags", 1,  COLUMN_TYPE_UINT},
+	{"vlan",      2,  COLUMN_TYPE_UINT},
+};
+
+struct column_writer {
+	int fd;
+	int flags;
+	size_t chunk_rows;
+	size_t rows;                          /* rows in the current chunk */
+	uint64_t total;
+	int error;                            /* sticky error from writing a chunk */
+
+	char* data[COLUMN_MAX];               /* raw values of the current chunk */
+	char* encoded[COLUMN_MAX];            /* encoded values (same size as raw) */
+	char* scratch;                        /* room for the widest column */
+};
+
+struct column_chunk {
+	size_t rows;
+	off_t offset;                         /* of the chunk header */
+	struct column_entry entry[COLUMN_MAX];
+};
+
+struct column_reader {
+	int fd;
+	struct column_chunk* chunk;
+	size_t num_chunks;
+	uint64_t rows;
+
+	char* buffer;                         /* encoded column data */
+	size_t buffer_size;
+};
+
+const char* column_name(enum column_id column){
+	return (unsigned int)column < COLUMN_MAX ? column_info[column].name : NULL;
+}
+
+size_t column_width(enum column_id column){
+	return (unsigned int)column < COLUMN_MAX ? column_info[column].width : 0;
+}
+
+enum column_type column_type(enum column_id column){
+	return (unsigned int)column < COLUMN_MAX ? column_info[column].type : COLUMN_TYPE_UINT;
+}
+
+int column_from_name(const char* name){
+	for ( unsigned int i = 0; i < COLUMN_MAX; i++ ){
+		if ( strcmp(name, column_info[i].name) == 0 ){
+			return i;
+		}
+	}
+	return -1;
+}
+
+/* the codecs is called with a constant width so each loop is specialized when
+ * these is inlined */
+#define ALWAYS_INLINE static inline __attribute__((always_inline))
+
+/* call fn with a constant width (1, 2, 4, 8 or 16) */
+#define WIDTH_DISPATCH(width, fn, ...)              \
+	switch ( width ){                                 \
+	case 1: return fn(1, __VA_ARGS__);                \
+	case 2: return fn(2, __VA_ARGS__);                \
+	case 4: return fn(4, __VA_ARGS__);                \
+	case 8: return fn(8, __VA_ARGS__);                \
+	default: return fn(16, __VA_ARGS__);              \
+	}
+
+ALWAYS_INLINE uint64_t get_uint(const void* ptr, size_t width){
+	switch ( width ){
+	case 1: { uint8_t  v; memcpy(&v, ptr, 1); return v; }
+	case 2: { uint16_t v; memcpy(&v, ptr, 2); return v; }
+	case 4: { uint32_t v; memcpy(&v, ptr, 4); return v; }
+	case 8: { uint64_t v; memcpy(&v, ptr, 8); return v; }
+	}
+	return 0;
+}
+
+ALWAYS_INLINE void put_uint(void* ptr, size_t width, uint64_t value){
+	switch ( width ){
+	case 1: { uint8_t  v = value; memcpy(ptr, &v, 1); break; }
+	case 2: { uint16_t v = value; memcpy(ptr, &v, 2); break; }
+	case 4: { uint32_t v = value; memcpy(ptr, &v, 4); break; }
+	case 8: memcpy(ptr, &value, 8); break;
+	}
+}
+
+uint64_t column_uint(enum column_id column, const void* ptr){
+	return get_uint(ptr, column_width(column));
+}
+
+static void set_v4mapped(struct in6_addr* dst, const char* src){
+	memset(dst, 0, sizeof(struct in6_addr));
+	dst->s6_addr[10] = 0xff;
+	dst->s6_addr[11] = 0xff;
+	memcpy(&dst->s6_addr[12], src, 4);
+}
+
+static uint16_t get_be16(const char* ptr){
+	uint16_t value;
+	memcpy(&value, ptr, sizeof(uint16_t));
+	return ntohs(value);
+}
+
+void column_row_from_packet(struct column_row* row, const struct cap_header* cp){
+	memset(row, 0, sizeof(struct column_row));
+	row->ts = cp->ts;
+	row->len = cp->len;
+	row->caplen = cp->caplen;
+	memcpy(row->mampid, cp->mampid, sizeof(row->mampid));
+	memcpy(row->nic, cp->nic, sizeof(row->nic));
+	row->vlan = COLUMN_NO_VLAN;
+
+	struct layer_table table;
+	packet_dissect(cp, &table);
+
+	int have_ip = 0;
+	for ( unsigned int i = 0; i < table.num_layers; i++ ){
+		const struct layer* layer = &table.layer[i];
+		const char* hdr = cp->payload + layer->offset;
+
+		switch ( layer->protocol ){
+		case PROTOCOL_VLAN:
+			if ( !have_ip && row->vlan == COLUMN_NO_VLAN && layer->length >= 2 ){
+				row->vlan = get_be16(hdr) & 0xfff;
+			}
+			break;
+
+		case PROTOCOL_IPV4:
+			if ( !have_ip && layer->length >= 20 ){
+				set_v4mapped(&row->src, hdr + 12);
+				set_v4mapped(&row->dst, hdr + 16);
+				row->proto = (uint8_t)hdr[9];
+				have_ip = 1;
+			}
+			break;
+
+		case PROTOCOL_IPV6:
+			if ( !have_ip && layer->length >= 40 ){
+				memcpy(&row->src, hdr + 8, sizeof(struct in6_addr));
+				memcpy(&row->dst, hdr + 24, sizeof(struct in6_addr));
+				row->proto = (uint8_t)hdr[6];
+				have_ip = 1;
+			}
+			break;
+
+		case PROTOCOL_TCP:
+		case PROTOCOL_UDP:
+			if ( !have_ip ) break;
+			row->proto = layer->protocol == PROTOCOL_TCP ? IPPROTO_TCP : IPPROTO_UDP;
+			if ( layer->length >= 4 ){
+				row->sport = get_be16(hdr);
+				row->dport = get_be16(hdr + 2);
+			}
+			if ( layer->protocol == PROTOCOL_TCP && layer->length >= 14 ){
+				row->tcp_flags = (uint8_t)hdr[13];
+			}
+			return; /* only the outermost transport */
+		}
+	}
+}
+
+/**
+ * Codecs. Encoders returns the encoded size or 0 if it doesn't fit in limit
+ * bytes, decoders returns non-zero if the data is invalid.
+ */
+
+ALWAYS_INLINE char* put_varint(char* dst, uint64_t value){
+	while ( value >= 0x80 ){
+		*dst++ = (char)(value | 0x80);
+		value >>= 7;
+	}
+	*dst++ = (char)value;
+	return dst;
+}
+
+ALWAYS_INLINE const char* get_varint(const char* src, const char* end, uint64_t* value){
+	/* most values is a single byte */
+	if ( src < end && !(*src & 0x80) ){
+		*value = (uint8_t)*src;
+		return src + 1;
+	}
+
+	uint64_t result = 0;
+	for ( unsigned int shift = 0; src < end && shift < 64; shift += 7 ){
+		const uint8_t byte = (uint8_t)*src++;
+		result |= (uint64_t)(byte & 0x7f) << shift;
+		if ( !(byte & 0x80) ){
+			*value = result;
+			return src;
+		}
+	}
+	return NULL;
+}
+
+ALWAYS_INLINE size_t encode_delta_n(size_t width, char* dst, size_t limit, const char* src, size_t rows){
+	char* ptr = dst;
+	uint64_t prev = 0;
+	for ( size_t i = 0; i < rows; i++ ){
+		if ( (size_t)(ptr - dst) + VARINT_MAX > limit ) return 0;
+		const uint64_t value = get_uint(src + i * width, width);
+		const int64_t delta = (int64_t)(value - prev);
+		ptr = put_varint(ptr, ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63));
+		prev = value;
+	}
+	return ptr - dst;
+}
+
+ALWAYS_INLINE int decode_delta_n(size_t width, char* dst, size_t rows, const char* src, size_t size){
+	const char* end = src + size;
+	uint64_t prev = 0;
+	for ( size_t i = 0; i < rows; i++ ){
+		uint64_t zigzag;
+		if ( !(src=get_varint(src, end, &zigzag)) ) return 1;
+		prev += (zigzag >> 1) ^ -(zigzag & 1);
+		put_uint(dst + i * width, width, prev);
+	}
+	return src != end;
+}
+
+ALWAYS_INLINE size_t encode_rle_n(size_t width, char* dst, size_t limit, const char* src, size_t rows){
+	char* ptr = dst;
+	for ( size_t i = 0; i < rows; ){
+		size_t run = 1;
+		while ( i + run < rows && memcmp(src + i * width, src + (i + run) * width, width) == 0 ){
+			run++;
+		}
+		if ( (size_t)(ptr - dst) + VARINT_MAX + width > limit ) return 0;
+		ptr = put_varint(ptr, run);
+		memcpy(ptr, src + i * width, width);
+		ptr += width;
+		i += run;
+	}
+	return ptr - dst;
+}
+
+ALWAYS_INLINE int decode_rle_n(size_t width, char* dst, size_t rows, const char* src, size_t size){
+	const char* end = src + size;
+	size_t row = 0;
+	while ( src < end ){
+		uint64_t run;
+		if ( !(src=get_varint(src, end, &run)) ) return 1;
+		if ( run == 0 || run > rows - row || (size_t)(end - src) < width ) return 1;
+		for ( uint64_t i = 0; i < run; i++ ){
+			memcpy(dst + row++ * width, src, width);
+		}
+		src += width;
+	}
+	return row != rows;
+}
+
+static size_t encode_delta(char* dst, size_t limit, const char* src, size_t rows, size_t width){
+	WIDTH_DISPATCH(width, encode_delta_n, dst, limit, src, rows);
+}
+
+static int decode_delta(char* dst, size_t rows, size_t width, const char* src, size_t size){
+	WIDTH_DISPATCH(width, decode_delta_n, dst, rows, src, size);
+}
+
+static size_t encode_rle(char* dst, size_t limit, const char* src, size_t rows, size_t width){
+	WIDTH_DISPATCH(width, encode_rle_n, dst, limit, src, rows);
+}
+
+static int decode_rle(char* dst, size_t rows, size_t width, const char* src, size_t size){
+	WIDTH_DISPATCH(width, decode_rle_n, dst, rows, src, size);
+}
+
+static int pread_all(int fd, void* dst, size_t size, off_t offset){
+	char* ptr = (char*)dst;
+	while ( size > 0 ){
+		const ssize_t bytes = pread(fd, ptr, size, offset);
+		if ( bytes < 0 ){
+			if ( errno == EINTR ) continue;
+			return errno;
+		} else if ( bytes == 0 ){
+			return ERROR_CAPFILE_TRUNCATED;
+		}
+		ptr += bytes;
+		size -= bytes;
+		offset += bytes;
+	}
+	return 0;
+}
+
+ALWAYS_INLINE int minmax_n(size_t width, enum column_id column, const char* data, size_t rows, struct column_entry* entry){
+	const char* min = data;
+	const char* max = data;
+
+	if ( column_info[column].type == COLUMN_TYPE_UINT ){
+		uint64_t lo = get_uint(data, width);
+		uint64_t hi = lo;
+		for ( size_t i = 1; i < rows; i++ ){
+			const uint64_t value = get_uint(data + i * width, width);
+			if ( value < lo ){ lo = value; min = data + i * width; }
+			if ( value > hi ){ hi = value; max = data + i * width; }
+		}
+	} else {
+		/* strings and addresses is compared bytewise */
+		for ( size_t i = 1; i < rows; i++ ){
+			const char* value = data + i * width;
+			if ( memcmp(value, min, width) < 0 ) min = value;
+			if ( memcmp(value, max, width) > 0 ) max = value;
+		}
+	}
+
+	memcpy(entry->min, min, width);
+	memcpy(entry->max, max, width);
+	return 0;
+}
+
+static int column_minmax(enum column_id column, const char* data, size_t rows, struct column_entry* entry){
+	WIDTH_DISPATCH(column_info[column].width, minmax_n, column, data, rows, entry);
+}
+
+/**
+ * Select the smallest encoding of a column.
+ * @return Pointer to the data to store.
+ */
+static const char* column_encode(struct column_writer* writer, enum column_id column, struct column_entry* entry){
+	const size_t width = column_info[column].width;
+	const size_t raw = writer->rows * width;
+	const char* best = writer->data[column];
+	size_t size;
+
+	entry->codec = COLUMN_CODEC_RAW;
+	entry->size = raw;
+	if ( !(writer->flags & COLUMN_COMPRESS) ){
+		return best;
+	}
+
+	if ( column_info[column].type == COLUMN_TYPE_UINT &&
+	     (size=encode_delta(writer->encoded[column], entry->size, writer->data[column], writer->rows, width)) > 0 ){
+		entry->codec = COLUMN_CODEC_DELTA;
+		entry->size = size;
+		best = writer->encoded[column];
+	}
+
+	/* rle is encoded to scratch (delta might be smaller) */
+	if ( (size=encode_rle(writer->scratch, entry->size, writer->data[column], writer->rows, width)) > 0 ){
+		memcpy(writer->encoded[column], writer->scratch, size);
+		entry->codec = COLUMN_CODEC_RLE;
+		entry->size = size;
+		best = writer->encoded[column];
+	}
+
+	return best;
+}
+
+static int write_chunk(struct column_writer* writer){
+	if ( writer->rows == 0 ){
+		return 0;
+	}
+
+	struct {
+		struct column_chunk_header header;
+		struct column_entry entry[COLUMN_MAX];
+	} chunk;
+	const char* data[COLUMN_MAX];
+
+	memset(&chunk, 0, sizeof(chunk));
+	uint64_t offset = sizeof(chunk);
+	for ( unsigned int i = 0; i < COLUMN_MAX; i++ ){
+		struct column_entry* entry = &chunk.entry[i];
+		column_minmax(i, writer->data[i], writer->rows, entry);
+		data[i] = column_encode(writer, i, entry);
+		entry->offset = offset;
+		offset += entry->size;
+	}
+
+	chunk.header.magic = COLUMN_CHUNK_MAGIC;
+	chunk.header.rows = writer->rows;
+	chunk.header.size = offset;
+
+	int ret;
+	if ( (ret=write_all(writer->fd, (const char*)&chunk, sizeof(chunk))) != 0 ){
+		return ret;
+	}
+	for ( unsigned int i = 0; i < COLUMN_MAX; i++ ){
+		if ( (ret=write_all(writer->fd, data[i], chunk.entry[i].size)) != 0 ){
+			return ret;
+		}
+	}
+
+	writer->rows = 0;
+	return 0;
+}
+
+static void writer_free(struct column_writer* writer){
+	for ( unsigned int i = 0; i < COLUMN_MAX; i++ ){
+		free(writer->data[i]);
+		free(writer->encoded[i]);
+	}
+	free(writer->scratch);
+	free(writer);
+}
+
+int column_writer_open(column_writer_t* writerptr, const char* filename, size_t rows, int flags){
+	if ( !writerptr || !filename || rows > COLUMN_MAX_ROWS ){
+		return EINVAL;
+	}
+
+	struct column_writer* writer = calloc(1, sizeof(struct column_writer));
+	if ( !writer ){
+		return ENOMEM;
+	}
+
+	writer->flags = flags;
+	writer->chunk_rows = rows > 0 ? rows : COLUMN_DEFAULT_ROWS;
+	writer->fd = -1;
+
+	size_t widest = 0;
+	for ( unsigned int i = 0; i < COLUMN_MAX; i++ ){
+		const size_t size = writer->chunk_rows * column_info[i].width;
+		if ( !(writer->data[i]=malloc(size)) || !(writer->encoded[i]=malloc(size)) ){
+			writer_free(writer);
+			return ENOMEM;
+		}
+		if ( size > widest ) widest = size;
+	}
+	if ( !(writer->scratch=malloc(widest)) ){
+		writer_free(writer);
+		return ENOMEM;
+	}
+
+	if ( (writer->fd=open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666)) == -1 ){
+		const int ret = errno;
+		writer_free(writer);
+		return ret;
+	}
+
+	struct {
+		struct column_file_header header;
+		struct column_desc desc[COLUMN_MAX];
+	} fh;
+	memset(&fh, 0, sizeof(fh));
+	fh.header.magic = COLUMN_FILE_MAGIC;
+	fh.header.version = COLUMN_VERSION;
+	fh.header.num_columns = COLUMN_MAX;
+	fh.header.chunk_rows = writer->chunk_rows;
+	for ( unsigned int i = 0; i < COLUMN_MAX; i++ ){
+		strncpy(fh.desc[i].name, column_info[i].name, sizeof(fh.desc[i].name) - 1);
+		fh.desc[i].width = column_info[i].width;
+		fh.desc[i].type = column_info[i].type;
+	}
+
+	int ret;
+	if ( (ret=write_all(writer->fd, (const char*)&fh, sizeof(fh))) != 0 ){
+		close(writer->fd);
+		writer_free(writer);
+		return ret;
+	}
+
+	*writerptr = writer;
+	return 0;
+}
+
+static void store(struct column_writer* writer, enum column_id column, const void* value){
+	const size_t width = column_info[column].width;
+	memcpy(writer->data[column] + writer->rows * width, value, width);
+}
+
+int column_writer_add_row(column_writer_t writer, const struct column_row* row){
+	/* the chunk is still full after a failed write */
+	if ( writer->error ){
+		return writer->error;
+	}
+
+	store(writer, COLUMN_TS_SEC, &row->ts.tv_sec);
+	store(writer, COLUMN_TS_PSEC, &row->ts.tv_psec);
+	store(writer, COLUMN_LEN, &row->len);
+	store(writer, COLUMN_CAPLEN, &row->caplen);
+	store(writer, COLUMN_MAMPID, row->mampid);
+	store(writer, COLUMN_NIC, row->nic);
+	store(writer, COLUMN_IP_SRC, &row->src);
+	store(writer, COLUMN_IP_DST, &row->dst);
+	store(writer, COLUMN_IP_PROTO, &row->proto);
+	store(writer, COLUMN_SPORT, &row->sport);
+	store(writer, COLUMN_DPORT, &row->dport);
+	store(writer, COLUMN_TCP_FLAGS, &row->tcp_flags);
+	store(writer, COLUMN_VLAN, &row->vlan);
+	writer->total++;
+
+	if ( ++writer->rows == writer->chunk_rows ){
+		return writer->error = write_chunk(writer);
+	}
+	return 0;
+}
+
+int column_writer_add(column_writer_t writer, const struct cap_header* cp){
+	struct column_row row;
+	column_row_from_packet(&row, cp);
+	return column_writer_add_row(writer, &row);
+}
+
+int column_writer_close(column_writer_t writer){
+	int ret = writer->error ? writer->error : write_chunk(writer);
+	if ( close(writer->fd) == -1 && ret == 0 ){
+		ret = errno;
+	}
+	writer_free(writer);
+	return ret;
+}
+
+uint64_t column_writer_rows(const column_writer_t writer){
+	return writer->total;
+}
+
+static int read_header(struct column_reader* reader, size_t* num_columns, off_t* offset){
+	struct column_file_header header;
+	int ret;
+
+	if ( (ret=pread_all(reader->fd, &header, sizeof(header), 0)) != 0 ){
+		return ret == ERROR_CAPFILE_TRUNCATED ? ERROR_CAPFILE_INVALID : ret;
+	}
+	if ( header.magic != COLUMN_FILE_MAGIC || header.num_columns < COLUMN_MAX || header.num_columns > 256 ){
+		return ERROR_CAPFILE_INVALID;
+	}
+	if ( header.version != COLUMN_VERSION ){
+		return EINVAL;
+	}
+
+	/* columns added in later versions is appended, only the known is checked */
+	struct column_desc desc[COLUMN_MAX];
+	if ( (ret=pread_all(reader->fd, desc, sizeof(desc), sizeof(header))) != 0 ){
+		return ret;
+	}
+	for ( unsigned int i = 0; i < COLUMN_MAX; i++ ){
+		if ( desc[i].width != column_info[i].width || strncmp(desc[i].name, column_info[i].name, sizeof(desc[i].name)) != 0 ){
+			return ERROR_CAPFILE_INVALID;
+		}
+	}
+
+	*num_columns = header.num_columns;
+	*offset = sizeof(header) + header.num_columns * sizeof(struct column_desc);
+	return 0;
+}
+
+static int read_chunk(struct column_reader* reader, struct column_chunk* chunk, size_t num_columns, off_t offset, off_t file_size, uint64_t* size){
+	const size_t header_size = sizeof(struct column_chunk_header) + num_columns * sizeof(struct column_entry);
+	char* buffer = malloc(header_size);
+	if ( !buffer ){
+		return ENOMEM;
+	}
+
+	int ret;
+	if ( (ret=pread_all(reader->fd, buffer, header_size, offset)) != 0 ){
+		free(buffer);
+		return ret;
+	}
+
+	struct column_chunk_header header;
+	memcpy(&header, buffer, sizeof(header));
+	memcpy(chunk->entry, buffer + sizeof(header), sizeof(chunk->entry));
+	free(buffer);
+
+	if ( header.magic != COLUMN_CHUNK_MAGIC || header.size < header_size || header.rows > COLUMN_MAX_ROWS ){
+		return ERROR_CAPFILE_INVALID;
+	}
+	if ( header.size > (uint64_t)(file_size - offset) ){
+		return ERROR_CAPFILE_TRUNCATED;
+	}
+	for ( unsigned int i = 0; i < COLUMN_MAX; i++ ){
+		const struct column_entry* entry = &chunk->entry[i];
+		if ( entry->offset < header_size || entry->offset + entry->size > header.size || entry->codec > COLUMN_CODEC_RLE ||
+		     (entry->codec == COLUMN_CODEC_DELTA && column_info[i].type != COLUMN_TYPE_UINT) ){
+			return ERROR_CAPFILE_INVALID;
+		}
+	}
+
+	chunk->rows = header.rows;
+	chunk->offset = offset;
+	reader->rows += header.rows;
+	*size = header.size;
+	return 0;
+}
+
+int column_reader_open(column_reader_t* readerptr, const char* filename){
+	if ( !readerptr || !filename ){
+		return EINVAL;
+	}
+
+	struct column_reader* reader = calloc(1, sizeof(struct column_reader));
+	if ( !reader ){
+		return ENOMEM;
+	}
+
+	if ( (reader->fd=open(filename, O_RDONLY)) == -1 ){
+		const int ret = errno;
+		free(reader);
+		return ret;
+	}
+
+	struct stat st;
+	size_t num_columns;
+	off_t offset;
+	int ret;
+	if ( fstat(reader->fd, &st) == -1 ){
+		ret = errno;
+		column_reader_close(reader);
+		return ret;
+	}
+	if ( (ret=read_header(reader, &num_columns, &offset)) != 0 ){
+		column_reader_close(reader);
+		return ret;
+	}
+
+	size_t capacity = 0;
+	while ( offset < st.st_size ){
+		if ( reader->num_chunks == capacity ){
+			capacity = capacity > 0 ? capacity * 2 : 64;
+			struct column_chunk* tmp = realloc(reader->chunk, capacity * sizeof(struct column_chunk));
+			if ( !tmp ){
+				column_reader_close(reader);
+				return ENOMEM;
+			}
+			reader->chunk = tmp;
+		}
+
+		struct column_chunk* chunk = &reader->chunk[reader->num_chunks];
+		uint64_t size;
+		if ( (ret=read_chunk(reader, chunk, num_columns, offset, st.st_size, &size)) != 0 ){
+			column_reader_close(reader);
+			return ret;
+		}
+		offset += size;
+		reader->num_chunks++;
+	}
+
+	*readerptr = reader;
+	return 0;
+}
+
+void column_reader_close(column_reader_t reader){
+	if ( !reader ) return;
+	if ( reader->fd != -1 ){
+		close(reader->fd);
+	}
+	free(reader->chunk);
+	free(reader->buffer);
+	free(reader);
+}
+
+size_t column_reader_chunks(const column_reader_t reader){
+	return reader->num_chunks;
+}
+
+uint64_t column_reader_rows(const column_reader_t reader){
+	return reader->rows;
+}
+
+size_t column_reader_chunk_rows(const column_reader_t reader, size_t chunk){
+	return chunk < reader->num_chunks ? reader->chunk[chunk].rows : 0;
+}
+
+int column_reader_stats(const column_reader_t reader, size_t chunk, enum column_id column, struct column_stats* stats){
+	if ( chunk >= reader->num_chunks || (unsigned int)column >= COLUMN_MAX ){
+		return EINVAL;
+	}
+
+	const struct column_entry* entry = &reader->chunk[chunk].entry[column];
+	memset(stats, 0, sizeof(struct column_stats));
+	memcpy(stats->min, entry->min, column_info[column].width);
+	memcpy(stats->max, entry->max, column_info[column].width);
+	stats->codec = entry->codec;
+	stats->stored_size = entry->size;
+	stats->raw_size = reader->chunk[chunk].rows * column_info[column].width;
+	return 0;
+}
+
+int column_reader_read(column_reader_t reader, size_t index, enum column_id column, void* dst){
+	if ( index >= reader->num_chunks || (unsigned int)column >= COLUMN_MAX ){
+		return EINVAL;
+	}
+
+	const struct column_chunk* chunk = &reader->chunk[index];
+	const struct column_entry* entry = &chunk->entry[column];
+	const size_t width = column_info[column].width;
+	const off_t offset = chunk->offset + entry->offset;
+
+	if ( entry->codec == COLUMN_CODEC_RAW ){
+		if ( entry->size != chunk->rows * width ){
+			return ERROR_CAPFILE_INVALID;
+		}
+		return pread_all(reader->fd, dst, entry->size, offset);
+	}
+
+	if ( entry->size > reader->buffer_size ){
+		char* tmp = realloc(reader->buffer, entry->size);
+		if ( !tmp ){
+			return ENOMEM;
+		}
+		reader->buffer = tmp;
+		reader->buffer_size = entry->size;
+	}
+
+	int ret;
+	if ( (ret=pread_all(reader->fd, reader->buffer, entry->size, offset)) != 0 ){
+		return ret;
+	}
+
+	const int invalid = entry->codec == COLUMN_CODEC_DELTA
+		? decode_delta(dst, chunk->rows, width, reader->buffer, entry->size)
+		: decode_rle(dst, chunk->rows, width, reader->buffer, entry->size);
+	return invalid ? ERROR_CAPFILE_INVALID : 0;
+}
@@ -24,6 +24,8 @@
 #include "caputils/caputils.h"
 #include "caputils/picotime.h"
 #include "caputils_int.h"
+#include "filter_int.h"
+#include "ipset.h"
 
 #include <unistd.h>
 #include <ctype.h>
@@ -50,6 +52,7 @@ enum Parameters {
 	PARAM_CAPLEN = 1,
 	PARAM_MODE,
 	PARAM_BPF,
+	PARAM_EXPR,
 };
 
 static struct option options[]= {
@@ -77,8 +80,16 @@ static struct option options[]= {
 	/* local-only filters */
 	{"frame-max-dt", required_argument, 0, FILTER_FRAME_MAX_DT},
 	{"frame-num",    required_argument, 0, FILTER_FRAME_NUM},
+	{"ip.src-set",   required_argument, 0, FILTER_IP_SRC_SET},
+	{"ip.dst-set",   required_argument, 0, FILTER_IP_DST_SET},
+	{"ip.proto-set", required_argument, 0, FILTER_IP_PROTO_SET},
+	{"tp.port-set",  required_argument, 0, FILTER_PORT_SET},
+	{"sample",       required_argument, 0, FILTER_SAMPLE},
+	{"sample-random",required_argument, 0, FILTER_SAMPLE_RANDOM},
+	{"sample-flow",  required_argument, 0, FILTER_SAMPLE_FLOW},
 
 	{"bpf",       required_argument, 0, PARAM_BPF | PARAM_BIT},
+	{"expr",      required_argument, 0, PARAM_EXPR | PARAM_BIT},
 	{0, 0, 0, 0}
 };
 
@@ -168,6 +179,19 @@ static int parse_inet_addr(const char* str, struct in_addr* addr, struct in_addr
 		buf_mask = separator+1;
 	}
 
+	/* with a prefix length a partial address is the network, e.g. 10/8 is
+	 * 10.0.0.0/8 (inet_aton would read "10" as 0.0.0.10) */
+	char prefix[INET_ADDRSTRLEN];
+	if ( separator && strchr(buf_mask, '.') == NULL ){
+		int parts = 1;
+		for ( const char* c = buf_addr; *c; c++ ) parts += *c == '.';
+		if ( parts < 4 && strlen(buf_addr) + 2*(4-parts) < sizeof(prefix) ){
+			strcpy(prefix, buf_addr);
+			while ( parts++ < 4 ) strcat(prefix, ".0");
+			buf_addr = prefix;
+		}
+	}
+
 	if ( inet_aton(buf_addr, addr) == 0 ){
 		fprintf(stderr, "Invalid IP address passed to --%s: %s. Ignoring\n", flag, buf_addr);
 		free(src);
@@ -197,7 +221,7 @@ static int parse_inet_addr(const char* str, struct in_addr* addr, struct in_addr
 	return 1;
 }
 
-static int parse_port(const char* src, uint16_t* port, uint16_t* mask, const char* flag){
+static int parse_port(char* src, uint16_t* port, uint16_t* mask, const char* flag){
 	*mask = 0xFFFF;
 
 	/* test if mask was passed */
@@ -216,8 +240,8 @@ static int parse_port(const char* src, uint16_t* port, uint16_t* mask, const cha
 	struct servent* service = getservbyname(src, NULL);
 	if ( service ){
 		*port = ntohs(service->s_port);
-	} else if ( isdigit(optarg[0]) ) {
-		*port = atoi(optarg);
+	} else if ( isdigit((unsigned char)src[0]) ) {
+		*port = atoi(src);
 	} else {
 		fprintf(stderr, "Invalid port number passed to %s: %s. Ignoring\n", flag, src);
 		return 0;
@@ -320,6 +344,145 @@ static int parse_ip_proto(const char* src, uint8_t* ip_proto, const char* flag){
 	return 1;
 }
 
+/**
+ * Add prefixes from file to set, the set is created if needed.
+ */
+static int parse_ipset(const char* filename, struct ipset** set, const char* flag){
+	struct ipset* tmp = *set ? *set : ipset_new();
+	if ( !tmp ){
+		return 0;
+	}
+
+	if ( ipset_load(tmp, filename, flag) != 0 ){
+		if ( !*set ) ipset_free(tmp);
+		return 0;
+	}
+
+	*set = tmp;
+	return 1;
+}
+
+static int port_by_name(const char* name, unsigned int* value){
+	struct servent* service = getservbyname(name, NULL);
+	if ( !service ) return 0;
+	*value = ntohs(service->s_port);
+	return 1;
+}
+
+static int proto_by_name(const char* name, unsigned int* value){
+	struct protoent* proto = getprotobyname(name);
+	if ( !proto ) return 0;
+	*value = proto->p_proto;
+	return 1;
+}
+
+static int parse_bitmap_value(const char* str, unsigned int* value, unsigned int bits, int (*by_name)(const char*, unsigned int*)){
+	char* end;
+	if ( isdigit((unsigned char)str[0]) ){
+		const unsigned long tmp = strtoul(str, &end, 10);
+		*value = tmp;
+		return *end == 0 && tmp < bits;
+	}
+	return by_name(str, value);
+}
+
+/**
+ * Add values from file to bitmap, the bitmap is allocated if needed. Values is
+ * separated by whitespace, commas or newlines and can be given as numbers, names
+ * or ranges (LOWER-UPPER). # starts a comment.
+ *
+ * @param bits Size of bitmap.
+ * @param by_name Lookup of names, e.g. getservbyname.
+ */
+static int parse_bitmap(const char* filename, uint64_t** bitmap, unsigned int bits, int (*by_name)(const char*, unsigned int*), const char* flag){
+	FILE* fp = fopen(filename, "r");
+	if ( !fp ){
+		fprintf(stderr, "Failed to open set passed to --%s: %s: %s\n", flag, filename, strerror(errno));
+		return 0;
+	}
+
+	uint64_t* tmp = *bitmap ? *bitmap : calloc(bits / 64, sizeof(uint64_t));
+	char* line = NULL;
+	size_t size = 0;
+	int lineno = 0;
+	int valid = tmp != NULL;
+	while ( valid && getline(&line, &size, fp) != -1 ){
+		lineno++;
+
+		char* comment = strchr(line, '#');
+		if ( comment ) *comment = 0;
+
+		char* ptr = NULL;
+		for ( char* token = strtok_r(line, ", \t\r\n", &ptr); token; token = strtok_r(NULL, ", \t\r\n", &ptr) ){
+			/* names may contain dashes (e.g. ftp-data) so try the full token first */
+			unsigned int lower, upper;
+			char* separator;
+			if ( parse_bitmap_value(token, &lower, bits, by_name) ){
+				upper = lower;
+			} else if ( (separator=strchr(token+1, '-')) ){
+				*separator = 0;
+				valid = parse_bitmap_value(token, &lower, bits, by_name) && parse_bitmap_value(separator+1, &upper, bits, by_name) && lower <= upper;
+				*separator = '-';
+			} else {
+				valid = 0;
+			}
+
+			if ( !valid ){
+				fprintf(stderr, "Invalid value in %s:%d passed to --%s: %s\n", filename, lineno, flag, token);
+				break;
+			}
+
+			for ( unsigned int i = lower; i <= upper; i++ ){
+				tmp[i >> 6] |= UINT64_C(1) << (i & 63);
+			}
+		}
+	}
+
+	free(line);
+	fclose(fp);
+
+	if ( !valid ){
+		if ( !*bitmap ) free(tmp);
+		return 0;
+	}
+
+	*bitmap = tmp;
+	return 1;
+}
+
+/**
+ * Parse sampling rate as N[:SEED].
+ */
+static int parse_sample(const char* src, uint32_t* rate, uint64_t* seed, const char* flag){
+	char* end;
+	errno = 0;
+	const unsigned long n = strtoul(src, &end, 10);
+	if ( errno != 0 || end == src || n == 0 || n > UINT32_MAX || !isdigit((unsigned char)src[0]) ){
+		fprintf(stderr, "Invalid rate passed to --%s: %s\n", flag, src);
+		return 0;
+	}
+
+	uint64_t tmp = 0;
+	if ( *end == ':' ){
+		const char* str = end + 1;
+		errno = 0;
+		tmp = strtoull(str, &end, 0);
+		if ( errno != 0 || end == str || !isdigit((unsigned char)str[0]) ){
+			fprintf(stderr, "Invalid seed passed to --%s: %s\n", flag, str);
+			return 0;
+		}
+	}
+
+	if ( *end != 0 ){
+		fprintf(stderr, "Invalid rate passed to --%s: %s\n", flag, src);
+		return 0;
+	}
+
+	*rate = (uint32_t)n;
+	if ( seed ) *seed = tmp;
+	return 1;
+}
+
 /**
  * Parse frame range.
  *
@@ -410,6 +573,33 @@ static int bpf_set(struct filter* filter, const char* expr, const char* program_
 	return 0;
 }
 
+static int expr_set(struct filter* filter, const char* expr, const char* program_name){
+	/* multiple expressions is joined with and */
+	char* joined;
+	if ( filter->expr ){
+		if ( asprintf(&joined, "(%s) and (%s)", filter->expr, expr) == -1 ){
+			return ENOMEM;
+		}
+	} else {
+		joined = strdup(expr);
+	}
+
+	struct filter_expr* dag;
+	int ret;
+	if ( (ret=filter_expr_compile(&dag, joined, program_name)) != 0 ){
+		free(joined);
+		return ret;
+	}
+
+	/* release previous expression */
+	filter_expr_free(filter->expr_dag);
+	free(filter->expr);
+
+	filter->expr_dag = dag;
+	filter->expr = joined;
+	return 0;
+}
+
 void filter_from_argv_usage(){
 	printf("libcap_filter-" VERSION " options\n"
 	       "      --starttime=DATETIME      Discard all packages before starttime described by\n"
@@ -433,12 +623,25 @@ void filter_from_argv_usage(){
 	       "      --tp.dport=PORT[/MASK]    Filter on destination portnumber.\n"
 	       "      --tp.port=PORT[/MASK]     Filter or source or destination portnumber (if\n"
 	       "                                either is a match the packet matches).\n"
+	       "      --ip.src-set=FILE         Filter on source ip address in any of the IPv4\n"
+	       "                                or IPv6 prefixes (ADDR[/LEN]) listed in FILE.\n"
+	       "      --ip.dst-set=FILE         Filter on destination ip address in FILE.\n"
+	       "      --ip.proto-set=FILE       Filter on ip protocols listed in FILE.\n"
+	       "      --tp.port-set=FILE        Filter on source or destination portnumber in\n"
+	       "                                any of the ports or ranges listed in FILE.\n"
 	       "      --frame-max-dt=TIME       Starts to reject packets after the interarrival-\n"
 	       "                                time is greater than TIME (WRT matched packets).\n"
 	       "      --frame-num=RANGE[,..]    Reject all packets not in specified range (see\n"
 	       "                                capfilter(1) for further description of syntax).\n"
+	       "      --sample=N                Keep every Nth packet matching the filter.\n"
+	       "      --sample-random=N[:SEED]  Keep each matching packet with probability 1/N.\n"
+	       "      --sample-flow=N[:SEED]    Keep all packets of 1/N of the flows (hash of the\n"
+	       "                                5-tuple, both directions is kept).\n"
 	       "      --caplen=BYTES            Store BYTES of the captured packet. [default=ALL]\n"
 	       "      --filter-mode=MODE        Set filter mode to AND or OR. [default=AND]\n"
+	       "      --expr=EXPRESSION         Match using an expression joining the fields\n"
+	       "                                above with and, or, not and parentheses, e.g.\n"
+	       "                                \"tcp.port 80 or (udp and not ip.src 10/8)\".\n"
 #ifdef HAVE_PCAP
 	       "      --bpf=FILTER              In addition to regular DPMI filter also use the\n"
 	       "                                supplied BPF. Matching takes place after DPMI\n"
@@ -456,6 +659,164 @@ void filter_init(struct filter* filter){
 	filter->frame_counter = 1;
 }
 
+enum FilterBitmask filter_field_by_name(const char* name){
+	for ( const struct option* cur = options; cur->name; cur++ ){
+		if ( !(cur->val & PARAM_BIT) && strcmp(cur->name, name) == 0 ){
+			return (enum FilterBitmask)cur->val;
+		}
+	}
+	return (enum FilterBitmask)0;
+}
+
+int filter_field_set(struct filter* filter, enum FilterBitmask field, char* value, const char* name){
+	switch (field){
+	case FILTER_PORT:
+		if ( !parse_port(value, &filter->port, &filter->port_mask, name) ){
+			return 0;
+		}
+		break;
+
+	case FILTER_START_TIME:
+		if ( timepico_from_string(&filter->starttime, value) != 0 ){
+			fprintf(stderr, "Invalid dated passed to --%s: %s. Ignoring.", name, value);
+			return 0;
+		}
+		break;
+
+	case FILTER_END_TIME:
+		if ( timepico_from_string(&filter->endtime, value) != 0 ){
+			fprintf(stderr, "Invalid dated passed to --%s: %s. Ignoring.", name, value);
+			return 0;
+		}
+		break;
+
+	case FILTER_MAMPID:
+		memset(filter->mampid, 0, sizeof filter->mampid);
+		memcpy(filter->mampid, value, strnlen(value, sizeof filter->mampid));
+		break;
+
+	case FILTER_IFACE:
+		memset(filter->iface, 0, sizeof filter->iface);
+		memcpy(filter->iface, value, strnlen(value, sizeof filter->iface));
+		break;
+
+	case FILTER_VLAN:
+		if ( !parse_vlan(value, &filter->vlan_tci, &filter->vlan_tci_mask, name) ){
+			return 0;
+		}
+		break;
+
+	case FILTER_ETH_TYPE:
+		if ( !parse_eth_type(value, &filter->eth_type, &filter->eth_type_mask, name) ){
+			return 0;
+		}
+		break;
+
+	case FILTER_ETH_SRC:
+		if ( !parse_eth_addr(value, &filter->eth_src, &filter->eth_src_mask, name) ){
+			return 0;
+		}
+		break;
+
+	case FILTER_ETH_DST:
+		if ( !parse_eth_addr(value, &filter->eth_dst, &filter->eth_dst_mask, name) ){
+			return 0;
+		}
+		break;
+
+	case FILTER_IP_PROTO:
+		if ( !parse_ip_proto(value, &filter->ip_proto, name) ){
+			return 0;
+		}
+		break;
+
+	case FILTER_IP_SRC:
+		if ( !parse_inet_addr(value, &filter->ip_src, &filter->ip_src_mask, name) ){
+			return 0;
+		}
+		break;
+
+	case FILTER_IP_DST:
+		if ( !parse_inet_addr(value, &filter->ip_dst, &filter->ip_dst_mask, name) ){
+			return 0;
+		}
+		break;
+
+	case FILTER_SRC_PORT:
+		if ( !parse_port(value, &filter->src_port, &filter->src_port_mask, name) ){
+			return 0;
+		}
+		break;
+
+	case FILTER_DST_PORT:
+		if ( !parse_port(value, &filter->dst_port, &filter->dst_port_mask, name) ){
+			return 0;
+		}
+		break;
+
+	case FILTER_FRAME_MAX_DT:
+		if ( timepico_from_string(&filter->frame_max_dt, value) != 0 ){
+			fprintf(stderr, "Invalid time passed to --%s: %s. Ignoring.", name, value);
+			return 0;
+		}
+		break;
+
+	case FILTER_FRAME_NUM:
+		parse_frame_range(value, filter);
+		break;
+
+	case FILTER_IP_SRC_SET:
+		if ( !parse_ipset(value, &filter->ip_src_set, name) ){
+			return 0;
+		}
+		break;
+
+	case FILTER_IP_DST_SET:
+		if ( !parse_ipset(value, &filter->ip_dst_set, name) ){
+			return 0;
+		}
+		break;
+
+	case FILTER_IP_PROTO_SET:
+		if ( !parse_bitmap(value, &filter->ip_proto_set, 256, proto_by_name, name) ){
+			return 0;
+		}
+		break;
+
+	case FILTER_PORT_SET:
+		if ( !parse_bitmap(value, &filter->port_set, 65536, port_by_name, name) ){
+			return 0;
+		}
+		break;
+
+	case FILTER_SAMPLE:
+		if ( !parse_sample(value, &filter->sample, NULL, name) ){
+			return 0;
+		}
+		break;
+
+	case FILTER_SAMPLE_RANDOM:
+		if ( !parse_sample(value, &filter->sample_random, &filter->sample_random_seed, name) ){
+			return 0;
+		}
+		break;
+
+	case FILTER_SAMPLE_FLOW:
+		if ( !parse_sample(value, &filter->sample_flow, &filter->sample_flow_seed, name) ){
+			return 0;
+		}
+		break;
+
+	default:
+		fprintf(stderr, "op: %d\n", field);
+		return 0;
+	}
+
+	/* update index bitmask */
+	filter->index |= field;
+	return 1;
+}
+
 int filter_from_argv_opterr = 1;
 
 int filter_from_argv(int* argcptr, char** argv, struct filter* filter){
@@ -515,117 +876,20 @@ int filter_from_argv(int* argcptr, char** argv, struct filter* filter){
 				ret = bpf_set(filter, optarg, argv[0]);
 				break;
 
+			case PARAM_EXPR:
+				ret = expr_set(filter, optarg, argv[0]);
+				break;
 			}
 			continue;
 		}
 
-		const enum FilterBitmask bitmask = (enum FilterBitmask)op;
-
-		switch (bitmask){
-		case FILTER_PORT:
-			if ( !parse_port(optarg, &filter->port, &filter->port_mask, "tp.port") ){
-				continue;
-			}
-			break;
-
-		case FILTER_START_TIME:
-			if ( timepico_from_string(&filter->starttime, optarg) != 0 ){
-				fprintf(stderr, "Invalid dated passed to --%s: %s. Ignoring.", options[index].name, optarg);
-				continue;
-			}
-			break;
-
-		case FILTER_END_TIME:
-			if ( timepico_from_string(&filter->endtime, optarg) != 0 ){
-				fprintf(stderr, "Invalid dated passed to --%s: %s. Ignoring.", options[index].name, optarg);
-				continue;
-			}
-			break;
-
-		case FILTER_MAMPID:
-//			strncpy(filter->mampid, optarg, 8);
-			memset(filter->mampid, 0, sizeof filter->mampid);
-			memcpy(filter->mampid, optarg, sizeof filter->mampid);
-			break;
-
-		case FILTER_IFACE:
-//			strncpy(filter->iface, optarg, 8);
-			memset(filter->iface, 0, sizeof filter->iface);
-			memcpy(filter->iface, optarg, sizeof filter->iface);
-
-			break;
-
-		case FILTER_VLAN:
-			if ( !parse_vlan(optarg, &filter->vlan_tci, &filter->vlan_tci_mask, "eth.vlan") ){
-				continue;
-			}
-			break;
-
-		case FILTER_ETH_TYPE:
-			if ( !parse_eth_type(optarg, &filter->eth_type, &filter->eth_type_mask, "eth.type") ){
-				continue;
-			}
-			break;
-
-		case FILTER_ETH_SRC:
-			if ( !parse_eth_addr(optarg, &filter->eth_src, &filter->eth_src_mask, "eth.src") ){
-				continue;
-			}
-			break;
-
-		case FILTER_ETH_DST:
-			if ( !parse_eth_addr(optarg, &filter->eth_dst, &filter->eth_dst_mask, "eth.dst") ){
-				continue;
-			}
-			break;
-
-		case FILTER_IP_PROTO:
-			if ( !parse_ip_proto(optarg, &filter->ip_proto, "ip.proto") ){
-				continue;
-			}
-			break;
-
-		case FILTER_IP_SRC:
-			if ( !parse_inet_addr(optarg, &filter->ip_src, &filter->ip_src_mask, "ip.src") ){
-				continue;
-			}
-			break;
-
-		case FILTER_IP_DST:
-			if ( !parse_inet_addr(optarg, &filter->ip_dst, &filter->ip_dst_mask, "ip.dst") ){
-				continue;
-			}
-			break;
-
-		case FILTER_SRC_PORT:
-			if ( !parse_port(optarg, &filter->src_port, &filter->src_port_mask, "tp.sport") ){
-				continue;
-			}
-			break;
-
-		case FILTER_DST_PORT:
-			if ( !parse_port(optarg, &filter->dst_port, &filter->dst_port_mask, "tp.dport") ){
-				continue;
-			}
-			break;
-
-		case FILTER_FRAME_MAX_DT:
-			if ( timepico_from_string(&filter->frame_max_dt, optarg) != 0 ){
-				fprintf(stderr, "Invalid time passed to --%s: %s. Ignoring.", options[index].name, optarg);
-				continue;
-			}
-			break;
-
-		case FILTER_FRAME_NUM:
-			parse_frame_range(optarg, filter);
-			break;
-
-		default:
-			fprintf(stderr, "op: %d\n", op);
+		/* invalid values is ignored except for sampling rates as they change what
+		 * the output represents */
+		const enum FilterBitmask field = (enum FilterBitmask)op;
+		if ( !filter_field_set(filter, field, optarg, options[index].name) &&
+		     (field & (FILTER_SAMPLE | FILTER_SAMPLE_RANDOM | FILTER_SAMPLE_FLOW)) ){
+			ret = EINVAL;
 		}
-
-		/* update index bitmask */
-		filter->index |= bitmask;
 	}
 
 	/* restore getopt */
@@ -646,6 +910,20 @@ int filter_close(struct filter* filter){
 	filter->bpf_expr = NULL;
 #endif
 
+	filter_expr_free(filter->expr_dag);
+	free(filter->expr);
+	filter->expr_dag = NULL;
+	filter->expr = NULL;
+
+	ipset_free(filter->ip_src_set);
+	ipset_free(filter->ip_dst_set);
+	free(filter->ip_proto_set);
+	free(filter->port_set);
+	filter->ip_src_set = NULL;
+	filter->ip_dst_set = NULL;
+	filter->ip_proto_set = NULL;
+	filter->port_set = NULL;
+
 	/* release all frame num ranges */
 	struct frame_num_node* cur = filter->frame_num;
 	while ( cur ){
@@ -658,10 +936,9 @@ int filter_close(struct filter* filter){
 }
 
 void filter_ci_set(struct filter* filter, const char* str){
-//	strncpy(filter->iface, str, 8);
+	filter->index |= FILTER_IFACE;
 	memset(filter->iface, 0, sizeof filter->iface);
-	memcpy(filter->iface, optarg, sizeof filter->iface);
-
+	memcpy(filter->iface, str, strnlen(str, sizeof filter->iface));
 }
 
 void filter_vlan_set(struct filter* filter, const char* str){
@@ -736,10 +1013,8 @@ void filter_dst_ip_aton(struct filter* filter, const char* str){
 
 void filter_mampid_set(struct filter* filter, const char* mampid){
 	filter->index |= FILTER_MAMPID;
-//	strncpy(filter->mampid, mampid, 8);
 	memset(filter->mampid, 0, sizeof filter->mampid);
-	memcpy(filter->mampid, optarg, sizeof filter->mampid);
-
+	memcpy(filter->mampid, mampid, strnlen(mampid, sizeof filter->mampid));
 }
 
 void filter_starttime_set(struct filter* filter, const timepico t){
@@ -761,3 +1036,32 @@ void filter_frame_num_set(struct filter* filter, const char* str){
 	filter->index |= FILTER_FRAME_NUM;
 	parse_frame_range(str, filter);
 }
+
+int filter_sample_set(struct filter* filter, enum FilterBitmask mode, uint32_t rate, uint64_t seed){
+	if ( rate == 0 ){
+		return EINVAL;
+	}
+
+	switch ( mode ){
+	case FILTER_SAMPLE:
+		filter->sample = rate;
+		break;
+	case FILTER_SAMPLE_RANDOM:
+		filter->sample_random = rate;
+		filter->sample_random_seed = seed;
+		break;
+	case FILTER_SAMPLE_FLOW:
+		filter->sample_flow = rate;
+		filter->sample_flow_seed = seed;
+		break;
+	default:
+		return EINVAL;
+	}
+
+	filter->index |= mode;
+	return 0;
+}
+
+int filter_expr_set(struct filter* filter, const char* expr){
+	return expr_set(filter, expr, "libcap_filter");
+}
@@ -40,6 +40,8 @@ static const char* errstr[ERROR_LAST - ERROR_FIRST] = {
 	/* ERROR_BUFFER_MULTIPLE */   "buffer size must be a multiple of MTU",
 
 	/* ERROR_NOT_IMPLEMENTED */   "feature not implemented.",
+
+	/* ERROR_PCAP_LINKTYPE */     "unsupported pcap link type, only ethernet can be read.",
 };
 
 const char* caputils_error_string(int code){
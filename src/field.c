@@ -0,0 +1,265 @@
+/**
+ * libcap_utils - DPMI capture utilities
+ * Copyright (C) 2003-2013 (see AUTHORS)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "caputils/field.h"
+#include "caputils/protocol.h"
+#include "caputils/utils.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <arpa/inet.h>
+
+struct field_plan {
+	enum caputils_protocol_type protocol;
+	const struct caputils_field* field;
+};
+
+#define REGISTER_FIELDS(x,y) \
+	do { \
+		extern const struct caputils_field x[]; \
+		fields[y] = x; \
+	} while (0)
+
+/* field tables by protocol type (kept out of struct caputils_protocol so its
+ * layout is unchanged) */
+static const struct caputils_field* fields[PROTOCOL_NUM_AVAILABLE] = {0,};
+
+static void __attribute__((constructor)) field_init(void){
+	REGISTER_FIELDS(protocol_dns_fields, PROTOCOL_DNS);
+	REGISTER_FIELDS(protocol_ethernet_fields, PROTOCOL_ETHERNET);
+	REGISTER_FIELDS(protocol_ipv4_fields, PROTOCOL_IPV4);
+	REGISTER_FIELDS(protocol_ipv6_fields, PROTOCOL_IPV6);
+	REGISTER_FIELDS(protocol_mpls_fields, PROTOCOL_MPLS);
+	REGISTER_FIELDS(protocol_tcp_fields, PROTOCOL_TCP);
+	REGISTER_FIELDS(protocol_udp_fields, PROTOCOL_UDP);
+	REGISTER_FIELDS(protocol_vlan_fields, PROTOCOL_VLAN);
+}
+
+/* short names used in paths, anything else is matched against the protocol name */
+static const struct {
+	const char* alias;
+	enum caputils_protocol_type protocol;
+} aliases[] = {
+	{"eth",  PROTOCOL_ETHERNET},
+	{"ip",   PROTOCOL_IPV4},
+	{"ip6",  PROTOCOL_IPV6},
+	{NULL,   PROTOCOL_DONE}, /* sentinel */
+};
+
+static int find_protocol(const char* name, size_t len, enum caputils_protocol_type* type){
+	for ( unsigned int i = 0; aliases[i].alias; i++ ){
+		if ( strlen(aliases[i].alias) == len && strncasecmp(aliases[i].alias, name, len) == 0 ){
+			*type = aliases[i].protocol;
+			return 1;
+		}
+	}
+
+	for ( unsigned int i = 0; i < PROTOCOL_NUM_AVAILABLE; i++ ){
+		const struct caputils_protocol* protocol = protocol_get((enum caputils_protocol_type)i);
+		if ( !protocol || !protocol->name ) continue;
+		if ( strlen(protocol->name) == len && strncasecmp(protocol->name, name, len) == 0 ){
+			*type = (enum caputils_protocol_type)i;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+int field_compile(struct field_plan** plan, const char* path){
+	if ( !plan || !path ){
+		return EINVAL;
+	}
+
+	const char* dot = strchr(path, '.');
+	if ( !dot || dot == path || dot[1] == 0 || strchr(dot + 1, '.') ){
+		return EINVAL;
+	}
+
+	enum caputils_protocol_type type;
+	if ( !find_protocol(path, dot - path, &type) ){
+		return ENOENT;
+	}
+
+	/* the protocol might not be registered (or has no fields) */
+	const struct caputils_field* field = protocol_get(type) ? fields[type] : NULL;
+	while ( field && field->name ){
+		if ( strcasecmp(field->name, dot + 1) == 0 ){
+			break;
+		}
+		field++;
+	}
+	if ( !field || !field->name ){
+		return ENOENT;
+	}
+
+	*plan = malloc(sizeof(struct field_plan));
+	if ( !*plan ){
+		return ENOMEM;
+	}
+	(*plan)->protocol = type;
+	(*plan)->field = field;
+	return 0;
+}
+
+void field_free(struct field_plan* plan){
+	free(plan);
+}
+
+enum caputils_field_type field_type(const struct field_plan* plan){
+	return plan->field->type;
+}
+
+int field_get(const struct field_plan* plan, const struct layer_table* table, struct field_value* value){
+	const struct layer* layer = layer_find(table, plan->protocol);
+	if ( !layer ){
+		return 0;
+	}
+
+	const struct caputils_field* field = plan->field;
+	const char* ptr = table->cp->payload + layer->offset;
+	const size_t size = table->cp->caplen - layer->offset;
+	value->type = field->type;
+
+	if ( field->extract ){
+		return field->extract(ptr, size, value);
+	}
+
+	/* truncated layers still yields the fields which was captured */
+	if ( (size_t)field->offset + field->width > size ){
+		return 0;
+	}
+
+	const uint8_t* src = (const uint8_t*)ptr + field->offset;
+	value->len = field->width;
+
+	switch ( field->type ){
+	case FIELD_UINT:
+		{
+			uint64_t x = 0;
+			for ( unsigned int i = 0; i < field->width; i++ ){
+				x = (x << 8) | src[i];
+			}
+			x >>= field->shift;
+			if ( field->mask ){
+				x &= field->mask;
+			}
+			value->u = x;
+		}
+		break;
+
+	case FIELD_IPV4:
+		memcpy(&value->v4, src, sizeof(struct in_addr));
+		break;
+
+	case FIELD_IPV6:
+		memcpy(&value->v6, src, sizeof(struct in6_addr));
+		break;
+
+	case FIELD_MAC:
+		memcpy(value->mac, src, sizeof(value->mac));
+		break;
+
+	case FIELD_DNSNAME:
+		value->ptr = (const char*)src;
+		break;
+	}
+
+	return 1;
+}
+
+int field_extract(const struct field_plan* plan, const struct cap_header* cp, struct field_value* value){
+	struct layer_table table;
+	packet_dissect(cp, &table);
+	return field_get(plan, &table, value);
+}
+
+size_t field_extract_batch(const struct field_plan* plan, const struct cap_header* const* cp, size_t n, struct field_value* values, uint8_t* present){
+	struct layer_table table;
+	size_t matched = 0;
+
+	for ( size_t i = 0; i < n; i++ ){
+		packet_dissect(cp[i], &table);
+		const int found = field_get(plan, &table, &values[i]);
+		if ( present ){
+			present[i] = found;
+		}
+		matched += found ? 1 : 0;
+	}
+
+	return matched;
+}
+
+static void format_dnsname(const struct field_value* value, char* dst, size_t size){
+	const uint8_t* src = (const uint8_t*)value->ptr;
+	size_t offset = 0;
+	size_t written = 0;
+
+	dst[0] = 0;
+	while ( offset < value->len && written + 1 < size ){
+		const uint8_t len = src[offset++];
+		if ( written > 0 ){
+			dst[written++] = '.';
+		}
+		for ( unsigned int i = 0; i < len && offset < value->len && written + 1 < size; i++ ){
+			dst[written++] = src[offset++];
+		}
+	}
+	dst[written] = 0;
+}
+
+const char* field_format(const struct field_value* value, char* dst, size_t size){
+	char buf[IFHWADDRLEN*3];
+
+	if ( size == 0 ){
+		return dst;
+	}
+
+	switch ( value->type ){
+	case FIELD_UINT:
+		snprintf(dst, size, "%"PRIu64, value->u);
+		break;
+
+	case FIELD_IPV4:
+		if ( !inet_ntop(AF_INET, &value->v4, dst, size) ) dst[0] = 0;
+		break;
+
+	case FIELD_IPV6:
+		if ( !inet_ntop(AF_INET6, &value->v6, dst, size) ) dst[0] = 0;
+		break;
+
+	case FIELD_MAC:
+		snprintf(dst, size, "%s", hexdump_address_r((const struct ether_addr*)value->mac, buf));
+		break;
+
+	case FIELD_DNSNAME:
+		format_dnsname(value, dst, size);
+		break;
+	}
+
+	return dst;
+}
@@ -24,7 +24,10 @@
 #include "caputils/filter.h"
 #include "caputils/packet.h"
 #include "caputils_int.h"
+#include "filter_int.h"
+#include "ipset.h"
 #include <stdlib.h>
+#include <inttypes.h>
 #include <string.h>
 #include <errno.h>
 #include <assert.h>
@@ -32,6 +35,7 @@
 #include <net/if.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
+#include <netinet/ip6.h>
 #include <netinet/udp.h>
 #include <netinet/tcp.h>
 #include <netinet/ether.h>
@@ -75,6 +79,18 @@ static const void* find_ipproto_header(const void* pkt, const struct ethhdr* eth
 	return pkt + sizeof(struct ethhdr) + vlan_offset + 4*(ip->ip_hl);
 }
 
+static const struct ip6_hdr* find_ipv6_header(const struct ethhdr* ether, uint16_t h_proto){
+	if ( h_proto != ETHERTYPE_IPV6 ){
+		return NULL;
+	}
+	const size_t vlan_offset = ntohs(ether->h_proto) == 0x8100 ? 4 : 0; /* vlan tag is 4 octets */
+	return (const struct ip6_hdr*)((const char*)ether + sizeof(struct ethhdr) + vlan_offset);
+}
+
+static int bitmap_test(const uint64_t* bitmap, unsigned int bit){
+	return (bitmap[bit >> 6] >> (bit & 63)) & 1;
+}
+
 const struct tcphdr* find_tcp_header(const void* pkt, const struct ethhdr* ether, const struct ip* ip, uint16_t* src, uint16_t* dst){
 	if ( !( ip && ip->ip_p == IPPROTO_TCP) ){
 		return NULL;
@@ -144,6 +160,28 @@ int FILTER filter_port(const struct filter* filter, uint16_t src, uint16_t dst){
 	return (filter->index & FILTER_PORT) && (filter->port == (src & filter->port_mask) || filter->port == (dst & filter->port_mask));
 }
 
+int FILTER filter_ip_src_in_set(const struct filter* filter, const struct ip* ip, const struct ip6_hdr* ip6){
+	if ( !(filter->index & FILTER_IP_SRC_SET) ) return 0;
+	if ( ip ) return ipset_match_v4(filter->ip_src_set, ip->ip_src);
+	if ( ip6 ) return ipset_match_v6(filter->ip_src_set, &ip6->ip6_src);
+	return 0;
+}
+
+int FILTER filter_ip_dst_in_set(const struct filter* filter, const struct ip* ip, const struct ip6_hdr* ip6){
+	if ( !(filter->index & FILTER_IP_DST_SET) ) return 0;
+	if ( ip ) return ipset_match_v4(filter->ip_dst_set, ip->ip_dst);
+	if ( ip6 ) return ipset_match_v6(filter->ip_dst_set, &ip6->ip6_dst);
+	return 0;
+}
+
+int FILTER filter_ip_proto_in_set(const struct filter* filter, const struct ip* ip){
+	return (filter->index & FILTER_IP_PROTO_SET) && ip && bitmap_test(filter->ip_proto_set, ip->ip_p);
+}
+
+int FILTER filter_port_in_set(const struct filter* filter, uint16_t src, uint16_t dst){
+	return (filter->index & FILTER_PORT_SET) && (bitmap_test(filter->port_set, src) || bitmap_test(filter->port_set, dst));
+}
+
 int FILTER filter_mampid(const struct filter* filter, const char mampid[]){
 	return (filter->index & FILTER_MAMPID) && (strncmp(filter->mampid, mampid, 8) == 0);
 }
@@ -189,16 +227,112 @@ int filter_frame_num(const struct filter* filter){
 	return 1;
 }
 
-static int filter_core(const struct filter* filter, const void* pkt, struct cap_header* head){
+/* splitmix64 finalizer */
+static uint64_t mix64(uint64_t x){
+	x ^= x >> 30; x *= UINT64_C(0xbf58476d1ce4e5b9);
+	x ^= x >> 27; x *= UINT64_C(0x94d049bb133111eb);
+	x ^= x >> 31;
+	return x;
+}
+
+/* hash two endpoints in the same order regardless of direction */
+static uint64_t endpoint_hash(uint64_t h, const void* a, const void* b, size_t size, uint16_t pa, uint16_t pb){
+	int cmp = memcmp(a, b, size);
+	if ( cmp == 0 ) cmp = (int)pa - (int)pb;
+	if ( cmp > 0 ){
+		const void* tmp = a; a = b; b = tmp;
+		const uint16_t ptmp = pa; pa = pb; pb = ptmp;
+	}
+
+	uint64_t word;
+	for ( size_t i = 0; i < size; i += sizeof(uint32_t) ){
+		uint32_t x, y;
+		memcpy(&x, (const char*)a + i, sizeof(uint32_t));
+		memcpy(&y, (const char*)b + i, sizeof(uint32_t));
+		word = ((uint64_t)x << 32) | y;
+		h = mix64(h ^ word);
+	}
+	return mix64(h ^ (((uint64_t)pa << 16) | pb));
+}
+
+uint64_t filter_flow_hash(const struct filter_packet* packet, uint64_t seed){
+	const uint64_t h = mix64(seed + UINT64_C(0x9e3779b97f4a7c15));
+
+	if ( packet->ip ){
+		const struct ip* ip = packet->ip;
+		return endpoint_hash(h ^ ip->ip_p, &ip->ip_src, &ip->ip_dst, sizeof(struct in_addr), packet->src_port, packet->dst_port);
+	}
+
+	if ( packet->ip6 ){
+		const struct ip6_hdr* ip6 = packet->ip6;
+		const uint8_t proto = ip6->ip6_nxt;
+		const char* payload = (const char*)(ip6 + 1);
+		uint16_t src = 0;
+		uint16_t dst = 0;
+		if ( (proto == IPPROTO_TCP || proto == IPPROTO_UDP) && payload + 4 <= (const char*)packet->ether + packet->head->caplen ){
+			src = ntohs(*(const uint16_t*)payload);
+			dst = ntohs(*(const uint16_t*)(payload + 2));
+		}
+		return endpoint_hash(h ^ proto, &ip6->ip6_src, &ip6->ip6_dst, sizeof(struct in6_addr), src, dst);
+	}
+
+	/* non-IP: ethernet addresses (padded to a multiple of 4) and type */
+	uint8_t a[8] = {0,};
+	uint8_t b[8] = {0,};
+	memcpy(a, packet->ether->h_source, ETH_ALEN);
+	memcpy(b, packet->ether->h_dest, ETH_ALEN);
+	return endpoint_hash(h ^ packet->h_proto, a, b, sizeof(a), 0, 0);
+}
+
+int filter_sample(struct filter* filter, const struct filter_packet* packet){
+	const uint64_t n = filter->sample_counter++;
+	int keep = 1;
+
+	if ( filter->index & FILTER_SAMPLE ){
+		keep &= n % filter->sample == 0;
+	}
+
+	/* counter-based generator: same seed always selects the same packets */
+	if ( filter->index & FILTER_SAMPLE_RANDOM ){
+		keep &= mix64(filter->sample_random_seed + (n + 1) * UINT64_C(0x9e3779b97f4a7c15)) % filter->sample_random == 0;
+	}
+
+	if ( filter->index & FILTER_SAMPLE_FLOW ){
+		keep &= filter_flow_hash(packet, filter->sample_flow_seed) % filter->sample_flow == 0;
+	}
+
+	return keep;
+}
+
+uint64_t filter_sample_rate(const struct filter* filter){
+	uint64_t rate = 1;
+	if ( filter->index & FILTER_SAMPLE )        rate *= filter->sample;
+	if ( filter->index & FILTER_SAMPLE_RANDOM ) rate *= filter->sample_random;
+	if ( filter->index & FILTER_SAMPLE_FLOW )   rate *= filter->sample_flow;
+	return rate;
+}
+
+void filter_packet_init(struct filter_packet* packet, const void* pkt, const struct cap_header* head){
 	const struct ethhdr* ether = (const struct ethhdr*)pkt;
-	uint16_t h_proto = ntohs(ether->h_proto); /* may be overwritten by find_ether_vlan_header */
-	uint16_t src_port = 0; /* set by find_{tcp,udp}_header */
-	uint16_t dst_port = 0; /* set by find_{tcp,udp}_header */
+	packet->head = head;
+	packet->ether = ether;
+	packet->h_proto = ntohs(ether->h_proto); /* may be overwritten by find_ether_vlan_header */
+	packet->src_port = 0; /* set by find_{tcp,udp}_header */
+	packet->dst_port = 0; /* set by find_{tcp,udp}_header */
+
+	packet->vlan = find_ether_vlan_header(ether, &packet->h_proto);
+	packet->ip = find_ipv4_header(ether, NULL);
+	packet->ip6 = find_ipv6_header(ether, packet->h_proto);
+	find_tcp_header(pkt, ether, packet->ip, &packet->src_port, &packet->dst_port);
+	find_udp_header(pkt, ether, packet->ip, &packet->src_port, &packet->dst_port);
+}
 
-	const struct ether_vlan_header* vlan = find_ether_vlan_header(ether, &h_proto);
-	const struct ip* ip = find_ipv4_header(ether, NULL);
-	find_tcp_header(pkt, ether, ip, &src_port, &dst_port);
-	find_udp_header(pkt, ether, ip, &src_port, &dst_port);
+unsigned int filter_test(const struct filter* filter, const struct filter_packet* packet){
+	const struct ethhdr* ether = packet->ether;
+	const struct ip* ip = packet->ip;
+	const struct cap_header* head = packet->head;
+	const uint16_t src_port = packet->src_port;
+	const uint16_t dst_port = packet->dst_port;
 
 	unsigned int match = 0;
 
@@ -210,8 +344,8 @@ static int filter_core(const struct filter* filter, const void* pkt, struct cap_
 	match |= filter_ip_proto(filter, ip)             << OFFSET_IP_PROTO;    /* IP protocol */
 	match |= filter_eth_dst(filter, ether)           << OFFSET_ETH_DST;     /* Ethernet destination */
 	match |= filter_eth_src(filter, ether)           << OFFSET_ETH_SRC;     /* Ethernet source */
-	match |= filter_h_proto(filter, h_proto)         << OFFSET_ETH_TYPE;    /* Ethernet type */
-	match |= filter_vlan_tci(filter, vlan)           << OFFSET_VLAN;        /* VLAN TCI (Tag Control Information) */
+	match |= filter_h_proto(filter, packet->h_proto) << OFFSET_ETH_TYPE;    /* Ethernet type */
+	match |= filter_vlan_tci(filter, packet->vlan)   << OFFSET_VLAN;        /* VLAN TCI (Tag Control Information) */
 	match |= filter_iface(filter, head->nic)         << OFFSET_IFACE;       /* Capture Interface (iface) */
 
 	/* 0.7 extensions */
@@ -223,9 +357,19 @@ static int filter_core(const struct filter* filter, const void* pkt, struct cap_
 	/* local tests */
 	match |= filter_frame_dt(filter, head->ts)       << OFFSET_FRAME_MAX_DT;
 	match |= filter_frame_num(filter)                << OFFSET_FRAME_NUM;
+	match |= filter_ip_src_in_set(filter, ip, packet->ip6)   << OFFSET_IP_SRC_SET;
+	match |= filter_ip_dst_in_set(filter, ip, packet->ip6)   << OFFSET_IP_DST_SET;
+	match |= filter_ip_proto_in_set(filter, ip)              << OFFSET_IP_PROTO_SET;
+	match |= filter_port_in_set(filter, src_port, dst_port)  << OFFSET_PORT_SET;
+
+	return match;
+}
+
+static int filter_core(const struct filter* filter, const struct filter_packet* packet){
+	const unsigned int match = filter_test(filter, packet);
 
 	switch ( filter->mode ){
-	case FILTER_AND: return match == filter->index;
+	case FILTER_AND: return match == (filter->index & ~FILTER_SAMPLE_ANY);
 	case FILTER_OR:  return match > 0;
 	default: fprintf(stderr, "invalid filter mode\n"); abort();
 	}
@@ -242,9 +386,19 @@ int filter_match(struct filter* filter, const void* pkt, struct cap_header* head
 		filter->first = 0;
 	}
 
-	const int core_match = filter->index == 0 || filter_core(filter, pkt, head);
-	const int bpf_match = filter->bpf_insn == NULL || bpf_filter(filter->bpf_insn, pkt, head->len, head->caplen);
-	const int match = core_match && bpf_match;
+	/* headers is only located once even if both regular filter and expression is used */
+	struct filter_packet packet;
+	if ( filter->index || filter->expr_dag ){
+		filter_packet_init(&packet, pkt, head);
+	}
+
+	/* the expression is joined with AND, same as BPF */
+	int match = (filter->index & ~FILTER_SAMPLE_ANY) == 0 || filter_core(filter, &packet);
+	match = match && (filter->expr_dag == NULL || filter_expr_match(filter->expr_dag, &packet));
+	match = match && (filter->bpf_insn == NULL || bpf_filter(filter->bpf_insn, pkt, head->len, head->caplen));
+
+	/* sampling is applied last so only packets matching everything else is counted */
+	match = match && (!(filter->index & FILTER_SAMPLE_ANY) || filter_sample(filter, &packet));
 
 	/* prune old frame ranges */
 	if ( filter->frame_num && filter->frame_num->upper > 0 && filter->frame_counter > filter->frame_num->upper ){
@@ -263,13 +417,19 @@ int filter_match(struct filter* filter, const void* pkt, struct cap_header* head
 }
 
 static const char* inet_ntoa_r(const struct in_addr in, char* buf){
-	const char* tmp = inet_ntoa(in);
-	strcpy(buf, tmp);
-	return buf;
+	return inet_ntop(AF_INET, &in, buf, INET_ADDRSTRLEN);
+}
+
+static int bitmap_count(const uint64_t* bitmap, unsigned int bits){
+	int n = 0;
+	for ( unsigned int i = 0; i < bits / 64; i++ ){
+		n += __builtin_popcountll(bitmap[i]);
+	}
+	return n;
 }
 
 void filter_print(const struct filter* filter, FILE* fp, int verbose){
-	static char buf[100];
+	char buf[100];
 
 	fprintf(fp, "FILTER {%02d}\n", filter->filter_id);
 	fprintf(fp, "\t%-14s: %s\n", stream_addr_type(&filter->dest) == STREAM_ADDR_CAPFILE ? "DESTFILE" : "DESTADDRESS", stream_addr_ntoa(&filter->dest));
@@ -349,11 +509,59 @@ void filter_print(const struct filter* filter, FILE* fp, int verbose){
 		fprintf(fp, "\tPORT_DST      : NULL\n");
 	}
 
+	if ( filter->index & FILTER_IP_SRC_SET ){
+		fprintf(fp, "\tIP_SRC_SET    : %zd IPv4 and %zd IPv6 prefixes\n", ipset_size(filter->ip_src_set, AF_INET), ipset_size(filter->ip_src_set, AF_INET6));
+	} else if ( verbose ){
+		fprintf(fp, "\tIP_SRC_SET    : NULL\n");
+	}
+
+	if ( filter->index & FILTER_IP_DST_SET ){
+		fprintf(fp, "\tIP_DST_SET    : %zd IPv4 and %zd IPv6 prefixes\n", ipset_size(filter->ip_dst_set, AF_INET), ipset_size(filter->ip_dst_set, AF_INET6));
+	} else if ( verbose ){
+		fprintf(fp, "\tIP_DST_SET    : NULL\n");
+	}
+
+	if ( filter->index & FILTER_IP_PROTO_SET ){
+		fprintf(fp, "\tIP_PROTO_SET  : %d protocols\n", bitmap_count(filter->ip_proto_set, 256));
+	} else if ( verbose ){
+		fprintf(fp, "\tIP_PROTO_SET  : NULL\n");
+	}
+
+	if ( filter->index & FILTER_PORT_SET ){
+		fprintf(fp, "\tPORT_SET      : %d ports\n", bitmap_count(filter->port_set, 65536));
+	} else if ( verbose ){
+		fprintf(fp, "\tPORT_SET      : NULL\n");
+	}
+
+	if ( filter->index & FILTER_SAMPLE ){
+		fprintf(fp, "\tSAMPLE        : 1/%u\n", filter->sample);
+	} else if ( verbose ){
+		fprintf(fp, "\tSAMPLE        : NULL\n");
+	}
+
+	if ( filter->index & FILTER_SAMPLE_RANDOM ){
+		fprintf(fp, "\tSAMPLE_RANDOM : 1/%u (SEED: %"PRIu64")\n", filter->sample_random, filter->sample_random_seed);
+	} else if ( verbose ){
+		fprintf(fp, "\tSAMPLE_RANDOM : NULL\n");
+	}
+
+	if ( filter->index & FILTER_SAMPLE_FLOW ){
+		fprintf(fp, "\tSAMPLE_FLOW   : 1/%u (SEED: %"PRIu64")\n", filter->sample_flow, filter->sample_flow_seed);
+	} else if ( verbose ){
+		fprintf(fp, "\tSAMPLE_FLOW   : NULL\n");
+	}
+
 	if ( filter->bpf_expr ){
 		fprintf(fp, "\tBPF           : \"%s\"\n", filter->bpf_expr);
 	} else if ( verbose ){
 		fprintf(fp, "\tBPF           :\n");
 	}
+
+	if ( filter->expr ){
+		fprintf(fp, "\tEXPR          : \"%s\"\n", filter->expr);
+	} else if ( verbose ){
+		fprintf(fp, "\tEXPR          :\n");
+	}
 }
 
 void filter_pack(struct filter* src, struct filter_packed* dst){
@@ -446,6 +654,14 @@ void filter_unpack(struct filter_packed* src, struct filter* dst){
 	/* filter version */
 	dst->version = htonl(0x02);
 
-	/* fill defaults for local filters */
+	/* fill defaults for local filters (sets is never transmitted) */
+	dst->index &= ~(FILTER_IP_SRC_SET | FILTER_IP_DST_SET | FILTER_IP_PROTO_SET | FILTER_PORT_SET | FILTER_SAMPLE_ANY);
 	dst->frame_num = NULL;
+	dst->ip_src_set = NULL;
+	dst->ip_dst_set = NULL;
+	dst->ip_proto_set = NULL;
+	dst->port_set = NULL;
+	dst->sample_counter = 0;
+	dst->expr_dag = NULL;
+	dst->expr = NULL;
 }
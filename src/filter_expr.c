@@ -0,0 +1,487 @@
+/**
+ * libcap_utils - DPMI capture utilities
+ * Copyright (C) 2003-2013 (see AUTHORS)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/**
+ * Filter expressions.
+ *
+ * expr      := and ( ("or" | "||") and )*
+ * and       := unary ( ("and" | "&&") unary )*
+ * unary     := ("not" | "!") unary | "(" expr ")" | predicate
+ * predicate := FIELD VALUE | FIELD=VALUE | PROTOCOL
+ *
+ * FIELD is any of the filter options (e.g. ip.src) or tcp/udp.{port,sport,dport}
+ * which also tests the ip protocol. A bare PROTOCOL (e.g. "tcp") is short for
+ * ip.proto.
+ *
+ * The expression is compiled into a DAG where identical subexpressions is
+ * shared. Each predicate is a single-field filter evaluated by the same tests as
+ * the regular filter. Evaluation short-circuits and shared nodes is only
+ * evaluated once per packet.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "caputils/filter.h"
+#include "filter_int.h"
+#include <ctype.h>
+#include <errno.h>
+#include <netdb.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+/* evaluation keeps the state of each node on the stack */
+#define EXPR_MAX_NODES 256
+#define EXPR_MAX_DEPTH 64           /* nested parentheses and negations */
+
+enum expr_op {
+	EXPR_LEAF,
+	EXPR_NOT,
+	EXPR_AND,
+	EXPR_OR,
+};
+
+struct expr_node {
+	enum expr_op op;
+	int lhs;                           /* operands (index of node) */
+	int rhs;
+	struct filter leaf;                /* EXPR_LEAF: all fields in leaf.index must match */
+	char* key;                         /* EXPR_LEAF: field and value, to find identical predicates */
+};
+
+struct filter_expr {
+	struct expr_node* node;            /* operands always precede the node using them */
+	int num_nodes;
+	int capacity;
+	int root;
+};
+
+enum token_type {
+	TOKEN_END,
+	TOKEN_LPAREN,
+	TOKEN_RPAREN,
+	TOKEN_NOT,
+	TOKEN_AND,
+	TOKEN_OR,
+	TOKEN_WORD,
+	TOKEN_UNTERMINATED,                /* quoted value without closing quote */
+};
+
+struct parser {
+	const char* str;
+	const char* cur;                   /* position after current token */
+	const char* program_name;
+
+	/* current token */
+	enum token_type type;
+	const char* begin;
+	size_t len;
+
+	struct filter_expr* expr;
+	int depth;                         /* current nesting of unary operators */
+};
+
+static int word_is(const struct parser* p, const char* word){
+	return strlen(word) == p->len && strncasecmp(p->begin, word, p->len) == 0;
+}
+
+static void next_token(struct parser* p){
+	while ( isspace((unsigned char)*p->cur) ) p->cur++;
+
+	p->begin = p->cur;
+	p->len = 1;
+
+	switch ( *p->cur ){
+	case 0:
+		p->type = TOKEN_END;
+		p->len = 0;
+		return;
+
+	case '(':
+		p->type = TOKEN_LPAREN;
+		p->cur++;
+		return;
+
+	case ')':
+		p->type = TOKEN_RPAREN;
+		p->cur++;
+		return;
+
+	case '!':
+		p->type = TOKEN_NOT;
+		p->cur++;
+		return;
+
+	case '"':
+	case '\'':
+		{
+			/* quoted value (e.g. dates with spaces) */
+			const char* end = strchr(p->cur + 1, *p->cur);
+			if ( !end ){
+				p->type = TOKEN_UNTERMINATED;
+				p->len = strlen(p->cur);
+				p->cur += p->len;
+				return;
+			}
+			p->type = TOKEN_WORD;
+			p->begin = p->cur + 1;
+			p->len = end - p->begin;
+			p->cur = end + 1;
+		}
+		return;
+	}
+
+	while ( *p->cur && !isspace((unsigned char)*p->cur) && *p->cur != '(' && *p->cur != ')' ) p->cur++;
+	p->len = p->cur - p->begin;
+
+	if      ( word_is(p, "and") || word_is(p, "&&") ) p->type = TOKEN_AND;
+	else if ( word_is(p, "or")  || word_is(p, "||") ) p->type = TOKEN_OR;
+	else if ( word_is(p, "not") ) p->type = TOKEN_NOT;
+	else p->type = TOKEN_WORD;
+}
+
+static int error(struct parser* p, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+static int error(struct parser* p, const char* fmt, ...){
+	if ( filter_from_argv_opterr ){
+		va_list ap;
+		va_start(ap, fmt);
+		fprintf(stderr, "%s: invalid expression `%s' at position %d: ", p->program_name, p->str, (int)(p->begin - p->str) + 1);
+		vfprintf(stderr, fmt, ap);
+		fputc('\n', stderr);
+		va_end(ap);
+	}
+	return -1;
+}
+
+/**
+ * @param leaf Ownership is taken (e.g. loaded sets).
+ */
+static int add_node(struct parser* p, enum expr_op op, int lhs, int rhs, struct filter* leaf, char* key){
+	struct filter_expr* expr = p->expr;
+
+	/* identical subexpressions is shared */
+	for ( int i = 0; i < expr->num_nodes; i++ ){
+		const struct expr_node* node = &expr->node[i];
+		if ( node->op != op ) continue;
+		switch ( op ){
+		case EXPR_LEAF:
+			if ( strcmp(node->key, key) != 0 ) continue;
+			free(key);
+			filter_close(leaf);
+			return i;
+		case EXPR_NOT:
+			if ( node->lhs != lhs ) continue;
+			return i;
+		case EXPR_AND:
+		case EXPR_OR:
+			if ( !(node->lhs == lhs && node->rhs == rhs) && !(node->lhs == rhs && node->rhs == lhs) ) continue;
+			return i;
+		}
+	}
+
+	if ( op == EXPR_NOT && expr->node[lhs].op == EXPR_NOT ){
+		return expr->node[lhs].lhs;
+	}
+
+	if ( expr->num_nodes == EXPR_MAX_NODES ){
+		free(key);
+		if ( leaf ) filter_close(leaf);
+		return error(p, "too many predicates (max %d nodes)", EXPR_MAX_NODES);
+	}
+
+	if ( expr->num_nodes == expr->capacity ){
+		const int capacity = expr->capacity > 0 ? expr->capacity * 2 : 16;
+		struct expr_node* tmp = realloc(expr->node, capacity * sizeof(struct expr_node));
+		if ( !tmp ){
+			free(key);
+			if ( leaf ) filter_close(leaf);
+			return error(p, "%s", strerror(ENOMEM));
+		}
+		expr->node = tmp;
+		expr->capacity = capacity;
+	}
+
+	struct expr_node* node = &expr->node[expr->num_nodes];
+	node->op = op;
+	node->lhs = lhs;
+	node->rhs = rhs;
+	node->key = key;
+	if ( leaf ){
+		node->leaf = *leaf;
+	}
+
+	return expr->num_nodes++;
+}
+
+/**
+ * Split "tcp.port" into protocol and field.
+ */
+static enum FilterBitmask qualified_port(const char* name, uint8_t* ip_proto){
+	static const struct {
+		const char* prefix;
+		uint8_t ip_proto;
+	} protocols[] = {
+		{"tcp.", IPPROTO_TCP},
+		{"udp.", IPPROTO_UDP},
+		{NULL, 0},
+	};
+
+	for ( int i = 0; protocols[i].prefix; i++ ){
+		if ( strncasecmp(name, protocols[i].prefix, 4) != 0 ) continue;
+		*ip_proto = protocols[i].ip_proto;
+		if ( strcasecmp(name + 4, "port")  == 0 ) return FILTER_PORT;
+		if ( strcasecmp(name + 4, "sport") == 0 ) return FILTER_SRC_PORT;
+		if ( strcasecmp(name + 4, "dport") == 0 ) return FILTER_DST_PORT;
+	}
+
+	return (enum FilterBitmask)0;
+}
+
+static int parse_predicate(struct parser* p){
+	char name[32];
+	char* value = NULL;
+	uint8_t ip_proto = 0;
+	const char* begin = p->begin;
+
+	/* FIELD=VALUE */
+	const char* eq = memchr(p->begin, '=', p->len);
+	const size_t name_len = eq ? (size_t)(eq - p->begin) : p->len;
+	if ( name_len >= sizeof(name) ){
+		return error(p, "unknown field `%.*s'", (int)name_len, p->begin);
+	}
+	memcpy(name, p->begin, name_len);
+	name[name_len] = 0;
+	if ( eq ){
+		value = strndup(eq + 1, p->len - name_len - 1);
+	}
+
+	enum FilterBitmask field = filter_field_by_name(name);
+	if ( !field ){
+		field = qualified_port(name, &ip_proto);
+	}
+
+	/* bare protocol name */
+	if ( !field && !eq ){
+		const struct protoent* proto = getprotobyname(name);
+		if ( !proto ){
+			return error(p, "unknown field or protocol `%s'", name);
+		}
+		struct filter leaf;
+		filter_init(&leaf);
+		filter_ip_proto_set(&leaf, proto->p_proto);
+		char* key;
+		if ( asprintf(&key, "%d/%d:", FILTER_IP_PROTO, proto->p_proto) == -1 ){
+			return error(p, "%s", strerror(ENOMEM));
+		}
+		next_token(p);
+		return add_node(p, EXPR_LEAF, -1, -1, &leaf, key);
+	}
+
+	if ( !field ){
+		free(value);
+		return error(p, "unknown field `%s'", name);
+	}
+	if ( field & (FILTER_FRAME_MAX_DT | FILTER_FRAME_NUM) ){
+		free(value);
+		return error(p, "`%s' depends on the packet sequence and cannot be used in expressions", name);
+	}
+	if ( field & FILTER_SAMPLE_ANY ){
+		free(value);
+		return error(p, "`%s' samples the matching packets and cannot be used in expressions", name);
+	}
+
+	/* FIELD VALUE (optionally FIELD = VALUE) */
+	if ( !value ){
+		next_token(p);
+		if ( p->type == TOKEN_WORD && (word_is(p, "=") || word_is(p, "==")) ){
+			next_token(p);
+		}
+		if ( p->type == TOKEN_UNTERMINATED ){
+			return error(p, "unterminated quote");
+		}
+		if ( p->type != TOKEN_WORD ){
+			return error(p, "missing value for `%s'", name);
+		}
+		value = strndup(p->begin, p->len);
+	}
+
+	char* key;
+	if ( asprintf(&key, "%d/%d:%s", field, ip_proto, value) == -1 ){
+		free(value);
+		return error(p, "%s", strerror(ENOMEM));
+	}
+
+	struct filter leaf;
+	filter_init(&leaf);
+	if ( ip_proto ){
+		filter_ip_proto_set(&leaf, ip_proto);
+	}
+	const int valid = filter_field_set(&leaf, field, value, name);
+	free(value);
+	if ( !valid ){
+		free(key);
+		p->begin = begin;
+		return error(p, "invalid value for `%s'", name);
+	}
+
+	next_token(p);
+	return add_node(p, EXPR_LEAF, -1, -1, &leaf, key);
+}
+
+static int parse_or(struct parser* p);
+
+static int parse_unary(struct parser* p){
+	if ( (p->type == TOKEN_NOT || p->type == TOKEN_LPAREN) && p->depth == EXPR_MAX_DEPTH ){
+		return error(p, "expression nested too deeply (max %d levels)", EXPR_MAX_DEPTH);
+	}
+
+	switch ( p->type ){
+	case TOKEN_NOT:
+		{
+			next_token(p);
+			p->depth++;
+			const int operand = parse_unary(p);
+			p->depth--;
+			if ( operand < 0 ) return -1;
+			return add_node(p, EXPR_NOT, operand, -1, NULL, NULL);
+		}
+
+	case TOKEN_LPAREN:
+		{
+			next_token(p);
+			p->depth++;
+			const int operand = parse_or(p);
+			p->depth--;
+			if ( operand < 0 ) return -1;
+			if ( p->type != TOKEN_RPAREN ){
+				return error(p, "expected `)'");
+			}
+			next_token(p);
+			return operand;
+		}
+
+	case TOKEN_WORD:
+		return parse_predicate(p);
+
+	case TOKEN_UNTERMINATED:
+		return error(p, "unterminated quote");
+
+	default:
+		return error(p, "expected predicate");
+	}
+}
+
+static int parse_and(struct parser* p){
+	int lhs = parse_unary(p);
+	while ( lhs >= 0 && p->type == TOKEN_AND ){
+		next_token(p);
+		const int rhs = parse_unary(p);
+		if ( rhs < 0 ) return -1;
+		lhs = add_node(p, EXPR_AND, lhs, rhs, NULL, NULL);
+	}
+	return lhs;
+}
+
+static int parse_or(struct parser* p){
+	int lhs = parse_and(p);
+	while ( lhs >= 0 && p->type == TOKEN_OR ){
+		next_token(p);
+		const int rhs = parse_and(p);
+		if ( rhs < 0 ) return -1;
+		lhs = add_node(p, EXPR_OR, lhs, rhs, NULL, NULL);
+	}
+	return lhs;
+}
+
+int filter_expr_compile(struct filter_expr** expr, const char* str, const char* program_name){
+	struct filter_expr* dag = calloc(1, sizeof(struct filter_expr));
+	if ( !dag ){
+		return ENOMEM;
+	}
+
+	struct parser p = {
+		.str = str,
+		.cur = str,
+		.program_name = program_name,
+		.expr = dag,
+	};
+
+	next_token(&p);
+	dag->root = parse_or(&p);
+	if ( dag->root >= 0 && p.type == TOKEN_UNTERMINATED ){
+		dag->root = error(&p, "unterminated quote");
+	} else if ( dag->root >= 0 && p.type != TOKEN_END ){
+		dag->root = error(&p, "unexpected `%.*s'", (int)p.len, p.begin);
+	}
+
+	if ( dag->root < 0 ){
+		filter_expr_free(dag);
+		return EINVAL;
+	}
+
+	*expr = dag;
+	return 0;
+}
+
+static int eval(const struct filter_expr* expr, int index, const struct filter_packet* packet, signed char* state){
+	if ( state[index] >= 0 ){
+		return state[index];
+	}
+
+	const struct expr_node* node = &expr->node[index];
+	int match = 0;
+	switch ( node->op ){
+	case EXPR_LEAF:
+		match = filter_test(&node->leaf, packet) == node->leaf.index;
+		break;
+	case EXPR_NOT:
+		match = !eval(expr, node->lhs, packet, state);
+		break;
+	case EXPR_AND:
+		match = eval(expr, node->lhs, packet, state) && eval(expr, node->rhs, packet, state);
+		break;
+	case EXPR_OR:
+		match = eval(expr, node->lhs, packet, state) || eval(expr, node->rhs, packet, state);
+		break;
+	}
+
+	return state[index] = match;
+}
+
+int filter_expr_match(const struct filter_expr* expr, const struct filter_packet* packet){
+	signed char state[EXPR_MAX_NODES];
+	memset(state, -1, expr->num_nodes);
+	return eval(expr, expr->root, packet, state);
+}
+
+void filter_expr_free(struct filter_expr* expr){
+	if ( !expr ) return;
+	for ( int i = 0; i < expr->num_nodes; i++ ){
+		free(expr->node[i].key);
+		if ( expr->node[i].op == EXPR_LEAF ){
+			filter_close(&expr->node[i].leaf);
+		}
+	}
+	free(expr->node);
+	free(expr);
+}
@@ -0,0 +1,76 @@
+#ifndef CAPUTILS_FILTER_INT_H
+#define CAPUTILS_FILTER_INT_H
+
+#include "caputils/filter.h"
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+
+/**
+ * Headers of the packet being matched, located once and shared by all tests.
+ */
+struct filter_packet {
+	const struct cap_header* head;
+	const struct ethhdr* ether;
+	const struct ether_vlan_header* vlan;
+	const struct ip* ip;
+	const struct ip6_hdr* ip6;
+	uint16_t h_proto;
+	uint16_t src_port;
+	uint16_t dst_port;
+};
+
+void filter_packet_init(struct filter_packet* packet, const void* pkt, const struct cap_header* head);
+
+/**
+ * Run all tests enabled in filter->index.
+ * @return Bitmask of the tests which matched.
+ */
+unsigned int filter_test(const struct filter* filter, const struct filter_packet* packet);
+
+/**
+ * Sampling is applied to packets matching the rest of the filter so these bits
+ * is never set by filter_test.
+ */
+#define FILTER_SAMPLE_ANY (FILTER_SAMPLE | FILTER_SAMPLE_RANDOM | FILTER_SAMPLE_FLOW)
+
+/**
+ * Decide if a packet matching the rest of the filter is kept by sampling.
+ * Updates the sample counter.
+ */
+int filter_sample(struct filter* filter, const struct filter_packet* packet);
+
+/**
+ * Hash of the 5-tuple (or ethernet addresses for non-IP packets) which is
+ * the same for both directions of a flow.
+ */
+uint64_t filter_flow_hash(const struct filter_packet* packet, uint64_t seed);
+
+/**
+ * Find a filter field by its option name (e.g. "ip.src").
+ * @return Bitmask of the field or 0 if there is no such field.
+ */
+enum FilterBitmask filter_field_by_name(const char* name);
+
+/**
+ * Parse value and enable the field, same as passing --NAME=VALUE.
+ * @param value Is modified during parsing.
+ * @return Non-zero if successful.
+ */
+int filter_field_set(struct filter* filter, enum FilterBitmask field, char* value, const char* name);
+
+/**
+ * Compiled --expr expression. It is not modified when matching so it can be
+ * shared between copies of the filter.
+ */
+struct filter_expr;
+
+/**
+ * Compile an expression.
+ * @param program_name Used as prefix for error messages.
+ * @return Zero if successful or EINVAL if the expression is malformed.
+ */
+int filter_expr_compile(struct filter_expr** expr, const char* str, const char* program_name);
+int filter_expr_match(const struct filter_expr* expr, const struct filter_packet* packet);
+void filter_expr_free(struct filter_expr* expr);
+
+#endif /* CAPUTILS_FILTER_INT_H */
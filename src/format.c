@@ -41,64 +41,95 @@ void fputs_printable(const char* str, int max, FILE* fp){
 	}
 }
 
-static void print_timestamp(FILE* fp, struct format* state, const struct cap_header* cp){
+static char* print_timestamp(char* dst, struct format* state, const struct cap_header* cp){
 	const int format_date  = state->flags & FORMAT_DATE_BIT;
 	const int format_local = state->flags & FORMAT_LOCAL_BIT;
 	const int relative     = state->flags & FORMAT_REL_TIMESTAMP;
 
 	if( !format_date ) {
 		timepico t = cp->ts;
-		int sign = 0; /* quick-and-dirty solution */
 
 		if ( relative ){
 			/* need to test if timestamp is less than reference in case multiple
 			 * locations is present in trace in which case dt may be negative. */
 			if ( timecmp(&t, &state->ref) >= 0 ){
 				t = timepico_sub(t, state->ref);
-				sign = 0;
 			} else {
 				t = timepico_sub(state->ref, t);
-				sign = 1;
+				*dst++ = '-';
 			}
 		}
 
-		fprintf(fp, "%s%u.%012"PRIu64, sign ? "-" : "", t.tv_sec, t.tv_psec);
-		return;
+		dst = fmt_uint(dst, t.tv_sec, 0, ' ');
+		*dst++ = '.';
+		return fmt_uint(dst, t.tv_psec, 12, '0');
 	}
 
-	static char buffer[32];
-	time_t time = (time_t)cp->ts.tv_sec;
-	struct tm* tm = format_local ? localtime(&time) : gmtime(&time);
-	strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", tm);
-	fprintf(fp, "%s.%012"PRIu64, buffer, cp->ts.tv_psec);
-	strftime(buffer, sizeof(buffer), "%z", tm);
-	fprintf(fp, " %s", buffer);
+	/* converting to broken-down time is slow (especially localtime) so the
+	 * date is only formatted when the second changes. The cache is per thread
+	 * (not in struct format) so formatters can run in parallel. */
+	static __thread struct {
+		int valid;
+		int local;
+		uint32_t sec;
+		char date[32];
+		char zone[16];
+	} cache;
+	if ( !cache.valid || cache.sec != cp->ts.tv_sec || cache.local != format_local ){
+		time_t time = (time_t)cp->ts.tv_sec;
+		struct tm tm;
+		if ( format_local ){
+			localtime_r(&time, &tm);
+		} else {
+			gmtime_r(&time, &tm);
+		}
+		strftime(cache.date, sizeof(cache.date), "%Y-%m-%d %H:%M:%S", &tm);
+		strftime(cache.zone, sizeof(cache.zone), "%z", &tm);
+		cache.sec = cp->ts.tv_sec;
+		cache.local = format_local;
+		cache.valid = 1;
+	}
+
+	dst = fmt_str(dst, cache.date);
+	*dst++ = '.';
+	dst = fmt_uint(dst, cp->ts.tv_psec, 12, '0');
+	*dst++ = ' ';
+	return fmt_str(dst, cache.zone);
 }
 
-static void print_pkt(FILE* fp, struct format* state, const struct cap_header* cp){
-	print_timestamp(fp, state, cp);
-	fprintf(fp, ":LINK(%4d):CAPLEN(%4d)", cp->len, cp->caplen);
+static void print_pkt(FILE* fp, struct format* state, const struct cap_header* cp, connection_id_t id, char* line, char* dst){
+	dst = print_timestamp(dst, state, cp);
+	dst = fmt_str(dst, ":LINK(");
+	dst = fmt_int(dst, cp->len, 4);
+	dst = fmt_str(dst, "):CAPLEN(");
+	dst = fmt_int(dst, cp->caplen, 4);
+	*dst++ = ')';
 
-	const connection_id_t id = connection_id(cp);
 	if ( id > 0 ){
-		fprintf(fp, ":ID(%4d)", id);
+		dst = fmt_str(dst, ":ID(");
+		dst = fmt_int(dst, id, 4);
+		*dst++ = ')';
 	} else {
-		fprintf(fp, ":ID(   -)");
+		dst = fmt_str(dst, ":ID(   -)");
 	}
 
 	if ( cp->caplen > 0 && state->flags >= FORMAT_LAYER_LINK ){
+		fwrite(line, 1, dst - line, fp);
+		dst = line;
+
 		struct header_chunk header;
 		header_init(&header, cp, 0);
 		while ( header_walk(&header) ){
 			if ( !header.protocol ){
-				fprintf(fp, "Unknown protocol\n");
+				fputs("Unknown protocol\n", fp);
 				continue;
 			}
 
 			header_format(fp, &header, state->flags);
 		};
 	}
-	fputc('\n', fp);
+	*dst++ = '\n';
+	fwrite(line, 1, dst - line, fp);
 
 	if ( state->flags & FORMAT_HEXDUMP ){
 		hexdump(fp, cp->payload, min(cp->caplen, cp->len));
@@ -117,22 +148,33 @@ void format_setup(struct format* state, unsigned int flags){
 }
 
 void format_pkg(FILE* fp, struct format* state, const struct cap_header* cp){
-	fprintf(fp, "[%4"PRIu64"]:", ++state->pktcount);
-	fputs_printable(cp->nic, 8, fp);
-	fputc(':', fp);
+	format_pkg_id(fp, state, cp, connection_id(cp));
+}
+
+void format_pkg_id(FILE* fp, struct format* state, const struct cap_header* cp, connection_id_t id){
+	/* the DPMI part is formatted into a single line and written at once */
+	char line[256];
+	char* dst = line;
+
+	*dst++ = '[';
+	dst = fmt_uint(dst, ++state->pktcount, 4, ' ');
+	*dst++ = ']';
+	*dst++ = ':';
+	dst = fmt_printable(dst, cp->nic, 8);
+	*dst++ = ':';
 
 	/* Added to handle some output if no mampid is found */
-	if(strlen(cp->mampid)!=0){
-	  fputs_printable(cp->mampid, 8, fp);
+	if ( cp->mampid[0] != 0 ){
+		dst = fmt_printable(dst, cp->mampid, 8);
 	} else {
-	  fputs_printable("(unset)", 8, fp);
+		dst = fmt_printable(dst, "(unset)", 8);
 	}
-	fputc(':', fp);
+	*dst++ = ':';
 	if ( state->first ){
 		state->ref = cp->ts;
 		state->first = 0;
 	}
-	print_pkt(fp, state, cp);
+	print_pkt(fp, state, cp, id, line, dst);
 }
 
 void format_ignore(FILE* fp, struct format* state, const struct cap_header* cp){
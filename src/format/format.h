@@ -24,6 +24,7 @@
 #include <caputils/log.h>
 #include <caputils/send.h>
 #include <caputils/packet.h>
+#include <caputils/field.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <arpa/inet.h>
@@ -66,6 +67,18 @@ const char* name_lookup(const struct name_table* table, int value, const char* d
  */
 void fputs_printable(const char* str, int max, FILE* fp);
 
+/**
+ * Fast formatting used by the hot paths of format_pkg instead of fprintf. The
+ * output is written to dst (no null-terminator) and a pointer past the last
+ * written character is returned. The caller must ensure dst is large enough.
+ */
+char* fmt_str(char* dst, const char* str);
+char* fmt_uint(char* dst, uint64_t value, unsigned int width, char pad); /* like %*u (pad ' ') or %0*u (pad '0') */
+char* fmt_int(char* dst, int value, unsigned int width);                 /* like %*d */
+char* fmt_hex(char* dst, uint64_t value, unsigned int width);            /* like %0*X */
+char* fmt_ipv4(char* dst, struct in_addr addr);                          /* like inet_ntop */
+char* fmt_printable(char* dst, const char* str, size_t max);             /* like fputs_printable, writes at most 4*max */
+
 /**
  * Test if there is enough data left for parsing.
  * @param cp capture header
@@ -49,8 +49,9 @@ void print_http(FILE* fp, const struct cap_header* cp, const char* payload, size
 
 		/* copy memory so it can be tokenized and ensures a null-terminator is present */
 		char* buf = strndup(payload, size);
-		const char* line = strtok(buf, "\r\n");
-		const char* rest = strtok(NULL, "\r\n");
+		char* saveptr;
+		const char* line = strtok_r(buf, "\r\n", &saveptr);
+		const char* rest = strtok_r(NULL, "\r\n", &saveptr);
 
 		/* only print if the full request line is present (determined by looking if
 		 * the next line is readable at all, which would happen if the \r\n line
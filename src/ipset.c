@@ -0,0 +1,425 @@
+/**
+ * libcap_utils - DPMI capture utilities
+ * Copyright (C) 2003-2013 (see AUTHORS)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "ipset.h"
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+/* tbl24 entries: 0 is not a member, 1 is a member and anything else refers to a
+ * tbl8 group (256-bit bitmap of the last octet) */
+#define TBL24_SIZE (1<<24)
+#define TBL24_MEMBER 1
+#define TBL24_GROUP (UINT32_C(1)<<31)
+
+struct trie_node {
+	struct in6_addr prefix;            /* bits after len is always zero */
+	unsigned int len;
+	int member;
+	struct trie_node* child[2];
+};
+
+union prefix_addr {
+	struct in_addr v4;
+	struct in6_addr v6;
+};
+
+struct ipset {
+	/* IPv4 DIR-24-8 */
+	uint32_t* tbl24;                   /* allocated when the first IPv4 prefix is added */
+	uint64_t (*tbl8)[4];
+	size_t num_tbl8;
+	size_t tbl8_capacity;
+	size_t num_v4;
+
+	/* IPv6 trie */
+	struct trie_node* root;
+	size_t num_v6;
+};
+
+struct ipset* ipset_new(void){
+	return calloc(1, sizeof(struct ipset));
+}
+
+static void trie_free(struct trie_node* node){
+	if ( !node ) return;
+	trie_free(node->child[0]);
+	trie_free(node->child[1]);
+	free(node);
+}
+
+void ipset_free(struct ipset* set){
+	if ( !set ) return;
+	free(set->tbl24);
+	free(set->tbl8);
+	trie_free(set->root);
+	free(set);
+}
+
+/**
+ * Replace an empty tbl24 entry with a new empty tbl8 group.
+ */
+static int tbl8_alloc(struct ipset* set, uint32_t* entry){
+	if ( set->num_tbl8 == set->tbl8_capacity ){
+		const size_t capacity = set->tbl8_capacity > 0 ? set->tbl8_capacity * 2 : 64;
+		void* tmp = realloc(set->tbl8, capacity * sizeof(*set->tbl8));
+		if ( !tmp ){
+			return ENOMEM;
+		}
+		set->tbl8 = tmp;
+		set->tbl8_capacity = capacity;
+	}
+	memset(set->tbl8[set->num_tbl8], 0, sizeof(*set->tbl8));
+	*entry = TBL24_GROUP | set->num_tbl8++;
+	return 0;
+}
+
+static int add_v4(struct ipset* set, struct in_addr in, unsigned int len){
+	if ( len > 32 ){
+		return EINVAL;
+	}
+
+	/* calloc of this size is mmapped so only pages written to is used */
+	if ( !set->tbl24 && !(set->tbl24 = calloc(TBL24_SIZE, sizeof(uint32_t))) ){
+		return ENOMEM;
+	}
+
+	const uint32_t mask = len > 0 ? ~UINT32_C(0) << (32 - len) : 0;
+	const uint32_t addr = ntohl(in.s_addr) & mask;
+	set->num_v4++;
+
+	/* covers one or more whole /24, any tbl8 group is replaced */
+	if ( len <= 24 ){
+		const uint32_t first = addr >> 8;
+		const uint32_t last = first + (UINT32_C(1) << (24 - len));
+		for ( uint32_t i = first; i < last; i++ ){
+			set->tbl24[i] = TBL24_MEMBER;
+		}
+		return 0;
+	}
+
+	uint32_t* entry = &set->tbl24[addr >> 8];
+	if ( *entry == TBL24_MEMBER ){
+		return 0; /* already covered by a shorter prefix */
+	}
+
+	if ( *entry == 0 && tbl8_alloc(set, entry) != 0 ){
+		return ENOMEM;
+	}
+
+	uint64_t* group = set->tbl8[*entry & ~TBL24_GROUP];
+	const unsigned int first = addr & 0xff;
+	const unsigned int last = first + (1U << (32 - len));
+	for ( unsigned int i = first; i < last; i++ ){
+		group[i >> 6] |= UINT64_C(1) << (i & 63);
+	}
+
+	return 0;
+}
+
+int ipset_match_v4(const struct ipset* set, struct in_addr in){
+	if ( !set->tbl24 ){
+		return 0;
+	}
+
+	const uint32_t addr = ntohl(in.s_addr);
+	const uint32_t entry = set->tbl24[addr >> 8];
+	if ( entry & TBL24_GROUP ){
+		const uint64_t* group = set->tbl8[entry & ~TBL24_GROUP];
+		return (group[(addr & 0xff) >> 6] >> (addr & 63)) & 1;
+	}
+
+	return entry;
+}
+
+static unsigned int bit_at(const struct in6_addr* addr, unsigned int n){
+	return (addr->s6_addr[n >> 3] >> (7 - (n & 7))) & 1;
+}
+
+/**
+ * Number of leading bits in common, at most max.
+ */
+static unsigned int common_len(const struct in6_addr* a, const struct in6_addr* b, unsigned int max){
+	for ( unsigned int i = 0; i < 16 && i * 8 < max; i++ ){
+		const unsigned int x = a->s6_addr[i] ^ b->s6_addr[i];
+		if ( x ){
+			const unsigned int n = i * 8 + __builtin_clz(x) - 24;
+			return n < max ? n : max;
+		}
+	}
+	return max;
+}
+
+static struct trie_node* trie_node_new(const struct in6_addr* prefix, unsigned int len, int member){
+	struct trie_node* node = malloc(sizeof(struct trie_node));
+	if ( !node ) return NULL;
+	node->prefix = *prefix;
+	node->len = len;
+	node->member = member;
+	node->child[0] = NULL;
+	node->child[1] = NULL;
+
+	/* clear bits after len */
+	for ( unsigned int i = 0; i < 16; i++ ){
+		const int bits = (int)len - (int)i * 8;
+		if ( bits >= 8 ) continue;
+		node->prefix.s6_addr[i] &= bits > 0 ? (uint8_t)(0xff << (8 - bits)) : 0;
+	}
+
+	return node;
+}
+
+static int add_v6(struct ipset* set, const struct in6_addr* addr, unsigned int len){
+	if ( len > 128 ){
+		return EINVAL;
+	}
+
+	set->num_v6++;
+
+	struct trie_node** cur = &set->root;
+	while ( *cur ){
+		struct trie_node* node = *cur;
+		const unsigned int max = node->len < len ? node->len : len;
+		const unsigned int common = common_len(&node->prefix, addr, max);
+
+		/* diverges within node: split */
+		if ( common < node->len ){
+			struct trie_node* parent = trie_node_new(addr, common, common == len);
+			if ( !parent ) return ENOMEM;
+			parent->child[bit_at(&node->prefix, common)] = node;
+			if ( common < len ){
+				struct trie_node* leaf = trie_node_new(addr, len, 1);
+				if ( !leaf ){
+					free(parent);
+					return ENOMEM;
+				}
+				parent->child[bit_at(addr, common)] = leaf;
+			}
+			*cur = parent;
+			return 0;
+		}
+
+		if ( node->len == len ){
+			node->member = 1;
+			return 0;
+		}
+
+		if ( node->member ){
+			return 0; /* already covered by a shorter prefix */
+		}
+
+		cur = &node->child[bit_at(addr, node->len)];
+	}
+
+	return (*cur = trie_node_new(addr, len, 1)) ? 0 : ENOMEM;
+}
+
+int ipset_match_v6(const struct ipset* set, const struct in6_addr* addr){
+	const struct trie_node* node = set->root;
+	while ( node ){
+		if ( common_len(&node->prefix, addr, node->len) < node->len ){
+			return 0;
+		}
+		if ( node->member ){
+			return 1;
+		}
+		node = node->child[bit_at(addr, node->len)];
+	}
+	return 0;
+}
+
+static int merge_v4(struct ipset* dst, const struct ipset* src){
+	if ( !src->tbl24 ){
+		return 0;
+	}
+
+	if ( !dst->tbl24 && !(dst->tbl24 = calloc(TBL24_SIZE, sizeof(uint32_t))) ){
+		return ENOMEM;
+	}
+
+	for ( uint32_t i = 0; i < TBL24_SIZE; i++ ){
+		const uint32_t entry = src->tbl24[i];
+		uint32_t* cur = &dst->tbl24[i];
+		if ( entry == 0 || *cur == TBL24_MEMBER ) continue;
+		if ( entry == TBL24_MEMBER ){
+			*cur = TBL24_MEMBER;
+			continue;
+		}
+
+		if ( *cur == 0 && tbl8_alloc(dst, cur) != 0 ){
+			return ENOMEM;
+		}
+
+		const uint64_t* from = src->tbl8[entry & ~TBL24_GROUP];
+		uint64_t* group = dst->tbl8[*cur & ~TBL24_GROUP];
+		for ( unsigned int j = 0; j < 4; j++ ){
+			group[j] |= from[j];
+		}
+	}
+
+	return 0;
+}
+
+static int merge_v6(struct ipset* dst, const struct trie_node* node){
+	if ( !node ){
+		return 0;
+	}
+
+	/* anything below a member is already covered by it */
+	if ( node->member ){
+		return add_v6(dst, &node->prefix, node->len);
+	}
+
+	int ret;
+	if ( (ret=merge_v6(dst, node->child[0])) != 0 ) return ret;
+	return merge_v6(dst, node->child[1]);
+}
+
+/**
+ * Add all prefixes in src to dst. Prefix counts is summed as if each prefix in
+ * src was added to dst again.
+ */
+static int ipset_merge(struct ipset* dst, const struct ipset* src){
+	const size_t num_v4 = dst->num_v4 + src->num_v4;
+	const size_t num_v6 = dst->num_v6 + src->num_v6;
+	int ret;
+
+	if ( (ret=merge_v4(dst, src)) != 0 ) return ret;
+	if ( (ret=merge_v6(dst, src->root)) != 0 ) return ret;
+
+	dst->num_v4 = num_v4;
+	dst->num_v6 = num_v6;
+	return 0;
+}
+
+int ipset_add(struct ipset* set, int family, const void* addr, unsigned int prefixlen){
+	switch ( family ){
+	case AF_INET:  return add_v4(set, *(const struct in_addr*)addr, prefixlen);
+	case AF_INET6: return add_v6(set, (const struct in6_addr*)addr, prefixlen);
+	default: return EAFNOSUPPORT;
+	}
+}
+
+size_t ipset_size(const struct ipset* set, int family){
+	switch ( family ){
+	case AF_INET:  return set->num_v4;
+	case AF_INET6: return set->num_v6;
+	default: return 0;
+	}
+}
+
+/**
+ * Parse ADDRESS[/LEN]. An IPv4 network may be abbreviated when a length is
+ * given, e.g. 10/8.
+ */
+static int parse_prefix(char* str, int* family, union prefix_addr* addr, unsigned int* len){
+	char* separator = strchr(str, '/');
+	if ( separator ){
+		*separator = 0;
+		char* end;
+		const char* tmp = separator + 1;
+		if ( !isdigit((unsigned char)*tmp) ) return 0;
+		*len = strtoul(tmp, &end, 10);
+		if ( *end ) return 0;
+	}
+
+	if ( strchr(str, ':') ){
+		*family = AF_INET6;
+		if ( !separator ) *len = 128;
+		return inet_pton(AF_INET6, str, &addr->v6) == 1 && *len <= 128;
+	}
+
+	char buf[INET_ADDRSTRLEN];
+	int parts = 1;
+	for ( const char* c = str; *c; c++ ) parts += *c == '.';
+	if ( separator && parts < 4 && strlen(str) + 2*(4-parts) < sizeof(buf) ){
+		strcpy(buf, str);
+		while ( parts++ < 4 ) strcat(buf, ".0");
+		str = buf;
+	}
+
+	*family = AF_INET;
+	if ( !separator ) *len = 32;
+	return inet_pton(AF_INET, str, &addr->v4) == 1 && *len <= 32;
+}
+
+int ipset_load(struct ipset* set, const char* filename, const char* flag){
+	FILE* fp = fopen(filename, "r");
+	if ( !fp ){
+		const int ret = errno;
+		fprintf(stderr, "Failed to open prefix set passed to --%s: %s: %s\n", flag, filename, strerror(ret));
+		return ret;
+	}
+
+	/* prefixes is loaded into a new set so a failure leaves the old one as-is */
+	struct ipset* tmp = ipset_new();
+	if ( !tmp ){
+		fclose(fp);
+		return ENOMEM;
+	}
+
+	char* line = NULL;
+	size_t size = 0;
+	int lineno = 0;
+	int ret = 0;
+	while ( ret == 0 && getline(&line, &size, fp) != -1 ){
+		lineno++;
+
+		/* strip comments and whitespace */
+		char* comment = strchr(line, '#');
+		if ( comment ) *comment = 0;
+		char* begin = line;
+		while ( isspace((unsigned char)*begin) ) begin++;
+		char* end = begin + strlen(begin);
+		while ( end > begin && isspace((unsigned char)end[-1]) ) *--end = 0;
+		if ( *begin == 0 ) continue;
+
+		int family;
+		union prefix_addr addr;
+		unsigned int len = 0;
+		if ( !parse_prefix(begin, &family, &addr, &len) ){
+			fprintf(stderr, "Invalid prefix in %s:%d passed to --%s: %s\n", filename, lineno, flag, begin);
+			ret = EINVAL;
+			break;
+		}
+
+		ret = ipset_add(tmp, family, &addr, len);
+	}
+
+	free(line);
+	fclose(fp);
+
+	/* on success the old prefixes is merged into the new set and the two swapped */
+	if ( ret == 0 && (ret=ipset_merge(tmp, set)) == 0 ){
+		const struct ipset old = *set;
+		*set = *tmp;
+		*tmp = old;
+	}
+
+	ipset_free(tmp);
+	return ret;
+}
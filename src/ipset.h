@@ -0,0 +1,59 @@
+#ifndef CAPUTILS_IPSET_H
+#define CAPUTILS_IPSET_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+/**
+ * Set of IPv4 and IPv6 prefixes. An address is a member if any prefix in the
+ * set covers it (overlapping prefixes is allowed).
+ *
+ * IPv4 uses DIR-24-8: one entry per /24 which is either a member, not a member
+ * or refers to a 256-bit bitmap for prefixes longer than /24, i.e. a lookup is
+ * at most two memory accesses. The /24 table is large (64MB) but only the pages
+ * written to is actually used.
+ *
+ * IPv6 uses a path-compressed binary trie.
+ */
+struct ipset;
+
+struct ipset* ipset_new(void);
+void ipset_free(struct ipset* set);
+
+/**
+ * Add a prefix.
+ * @param family AF_INET or AF_INET6.
+ * @param addr struct in_addr or struct in6_addr.
+ * @return Zero if successful or an errno value.
+ */
+int ipset_add(struct ipset* set, int family, const void* addr, unsigned int prefixlen);
+
+/**
+ * Add prefixes from a file, one prefix (ADDRESS[/LEN]) per line. Empty lines
+ * and lines starting with # is ignored. On failure the set is left unchanged.
+ * @param flag Used in error messages.
+ * @return Zero if successful or an errno value.
+ */
+int ipset_load(struct ipset* set, const char* filename, const char* flag);
+
+/**
+ * @param addr Address in network byte order.
+ */
+int ipset_match_v4(const struct ipset* set, struct in_addr addr);
+int ipset_match_v6(const struct ipset* set, const struct in6_addr* addr);
+
+/**
+ * Number of prefixes added for a family.
+ */
+size_t ipset_size(const struct ipset* set, int family);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CAPUTILS_IPSET_H */
@@ -22,6 +22,7 @@
 #endif /* HAVE_CONFIG_H */
 
 #include "caputils/log.h"
+#include "src/format/format.h"
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
@@ -35,11 +36,11 @@ static void write_time(FILE* fp){
 	struct timeval tid1;
 	gettimeofday(&tid1,NULL);
 
-	struct tm *dagtid;
-	dagtid=localtime(&tid1.tv_sec);
+	struct tm dagtid;
+	localtime_r(&tid1.tv_sec, &dagtid);
 
 	char time[20] = {0,};
-	strftime(time, sizeof(time), "%Y-%m-%d %H.%M.%S", dagtid);
+	strftime(time, sizeof(time), "%Y-%m-%d %H.%M.%S", &dagtid);
 	fprintf(fp, "[%s] ", time);
 }
 
@@ -80,51 +81,181 @@ int logmsg(FILE* fp, const char* tag, const char* fmt, ...){
 	return ret;
 }
 
-void hexdump(FILE* dst, const char* data, size_t size){
-	char* tmp = hexdump_str(data, size);
-	fputs(tmp, dst);
-	free(tmp);
+static const char hexdigits[] = "0123456789ABCDEF";
+static const char hexdigits_lower[] = "0123456789abcdef";
+
+char* fmt_str(char* dst, const char* str){
+	while ( *str ){
+		*dst++ = *str++;
+	}
+	return dst;
+}
+
+char* fmt_uint(char* dst, uint64_t value, unsigned int width, char pad){
+	char tmp[20];
+	unsigned int n = 0;
+	do {
+		tmp[n++] = '0' + value % 10;
+		value /= 10;
+	} while ( value > 0 );
+
+	while ( width > n ){
+		*dst++ = pad;
+		width--;
+	}
+	while ( n > 0 ){
+		*dst++ = tmp[--n];
+	}
+	return dst;
+}
+
+char* fmt_int(char* dst, int value, unsigned int width){
+	if ( value >= 0 ){
+		return fmt_uint(dst, value, width, ' ');
+	}
+
+	/* format into a temporary buffer to place the sign before the digits */
+	char tmp[12];
+	char* end = fmt_uint(tmp + 1, -(int64_t)value, 0, ' ');
+	tmp[0] = '-';
+	const unsigned int n = end - tmp;
+	while ( width > n ){
+		*dst++ = ' ';
+		width--;
+	}
+	memcpy(dst, tmp, n);
+	return dst + n;
+}
+
+char* fmt_hex(char* dst, uint64_t value, unsigned int width){
+	char tmp[16];
+	unsigned int n = 0;
+	do {
+		tmp[n++] = hexdigits[value & 0xf];
+		value >>= 4;
+	} while ( value > 0 );
+
+	while ( width > n ){
+		*dst++ = '0';
+		width--;
+	}
+	while ( n > 0 ){
+		*dst++ = tmp[--n];
+	}
+	return dst;
+}
+
+char* fmt_ipv4(char* dst, struct in_addr addr){
+	const uint8_t* octet = (const uint8_t*)&addr.s_addr;
+	for ( unsigned int i = 0; i < 4; i++ ){
+		if ( i > 0 ) *dst++ = '.';
+		dst = fmt_uint(dst, octet[i], 0, ' ');
+	}
+	return dst;
+}
+
+char* fmt_printable(char* dst, const char* str, size_t max){
+	const size_t n = strnlen(str, max);
+	for ( size_t i = 0; i < n; i++ ){
+		if ( isprint(str[i]) && str[i] != '\n' ){
+			*dst++ = str[i];
+		} else {
+			*dst++ = '\\';
+			*dst++ = 'x';
+			*dst++ = hexdigits_lower[(str[i] >> 4) & 0xf];
+			*dst++ = hexdigits_lower[str[i] & 0xf];
+		}
+	}
+	return dst;
 }
 
 size_t aligned(size_t value, size_t n){
 	return n * (value / n + ((value % n) > 0 ? 1 : 0));
 }
 
-char* hexdump_str(const char* data, size_t size){
-	char* buffer = malloc(size*10+80); /* more than really needed */
-	char* dst = buffer;
+/* longest line is a full row: "[XXXX]  " + 16 bytes + gutter + ascii */
+#define HEXDUMP_ROW_SIZE 128
 
-	/* align the byte count to 16 */
-	const size_t align = aligned(size, 16);
+/**
+ * Format a single row (16 bytes starting at offset) of a hexdump.
+ */
+static char* hexdump_row(char* dst, const char* data, size_t size, size_t offset){
+	const size_t end = offset + 16 < size ? offset + 16 : size;
+
+	*dst++ = '[';
+	dst = fmt_hex(dst, offset, 4);
+	*dst++ = ']';
+	*dst++ = ' ';
+	*dst++ = ' ';
 
-	dst += sprintf(dst, "[0000]  ");
-	for( unsigned int i=0; i < align; i++){
+	for ( size_t i = offset; i < offset + 16; i++ ){
 		if ( i < size ){
-			dst += sprintf(dst, "%02X ", data[i] & 0xff);
+			*dst++ = hexdigits[(data[i] >> 4) & 0xf];
+			*dst++ = hexdigits[data[i] & 0xf];
+			*dst++ = ' ';
 		} else {
-			dst += sprintf(dst, "   ");
+			memcpy(dst, "   ", 3);
+			dst += 3;
 		}
 		if ( i % 4 == 3 ){
-			dst += sprintf(dst, "  ");
+			*dst++ = ' ';
+			*dst++ = ' ';
 		}
-		if ( i % 16 == 15 ){
-			dst += sprintf(dst, "    |");
-			for ( unsigned int j = i-15; j<=i; j++ ){
-				if ( j >= size ){
-					break;
-				}
-
-				const char ch = isprint(data[j]) ? data[j] : '.';
-				dst += sprintf(dst, "%c", ch);
-			}
-			dst += sprintf(dst, "|");
-			if ( (i+1) < align){
-				dst += sprintf(dst, "\n[%04X]  ", i+1);
-			}
+	}
+
+	memcpy(dst, "    |", 5);
+	dst += 5;
+	for ( size_t i = offset; i < end; i++ ){
+		*dst++ = isprint(data[i]) ? data[i] : '.';
+	}
+	*dst++ = '|';
+	*dst++ = '\n';
+	return dst;
+}
+
+static char* hexdump_end(char* dst, size_t size){
+	/* an empty dump still has an (empty) first row */
+	if ( size == 0 ){
+		dst = fmt_str(dst, "[0000]  \n");
+	}
+
+	*dst++ = '[';
+	dst = fmt_hex(dst, size, 4);
+	*dst++ = ']';
+	*dst++ = '\n';
+	return dst;
+}
+
+void hexdump(FILE* dst, const char* data, size_t size){
+	/* rows is formatted in batches to write in larger chunks */
+	char buf[HEXDUMP_ROW_SIZE * 32];
+	char* cur = buf;
+
+	for ( size_t offset = 0; offset < size; offset += 16 ){
+		if ( cur + HEXDUMP_ROW_SIZE > buf + sizeof(buf) ){
+			fwrite(buf, 1, cur - buf, dst);
+			cur = buf;
 		}
+		cur = hexdump_row(cur, data, size, offset);
+	}
+
+	if ( cur + HEXDUMP_ROW_SIZE > buf + sizeof(buf) ){
+		fwrite(buf, 1, cur - buf, dst);
+		cur = buf;
+	}
+	cur = hexdump_end(cur, size);
+	fwrite(buf, 1, cur - buf, dst);
+}
+
+char* hexdump_str(const char* data, size_t size){
+	char* buffer = malloc((aligned(size, 16) / 16 + 2) * HEXDUMP_ROW_SIZE);
+	char* dst = buffer;
+
+	for ( size_t offset = 0; offset < size; offset += 16 ){
+		dst = hexdump_row(dst, data, size, offset);
 	}
-	dst += sprintf(dst, "\n");
-	dst += sprintf(dst, "[%04X]\n", (unsigned int)size);
+	dst = hexdump_end(dst, size);
+	*dst = 0;
 
 	return buffer;
 }
@@ -24,6 +24,7 @@
 #include "caputils/marc.h"
 #include "caputils/marc_dstat.h"
 #include "caputils/version.h"
+#include "caputils_int.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <stddef.h> /* required for offsetof */
@@ -120,7 +121,7 @@ void mampid_set(mampid_t dst, const char* src){
 }
 
 const char* mampid_get(const mampid_t src){
-	static char buf[17];
+	static __thread char buf[17];
 
 	if ( src[0] != 0 ){
 		sprintf(buf, "%.16s", src);
@@ -237,17 +238,13 @@ int marc_init_client(marc_context_t* ctxptr, const char* iface, struct marc_clie
 	while ( n < max_retries ){
 		struct timeval timeout = { n * timeout_factor, 0 };
 		out_func(dst_verbose, "Sending init request to MArelayD (try: %d timeout: %d)\n", n, timeout.tv_sec);
-		fd_set fds;
 
-		FD_ZERO(&fds);
-		FD_SET(sd, &fds);
-
-		switch ( select(sd+1, &fds, NULL, NULL, &timeout) ){
+		switch ( poll_readable(sd, &timeout) ){
 		case -1:
 			if ( errno == EINTR ){ /* dont want to show perror for this */
 				return errno;
 			}
-			return perror2("select");
+			return perror2("poll");
 		case 0:
 			out_func(dst_verbose, "Request timed out.\n");
 			n++;
@@ -492,13 +489,9 @@ int marc_poll_event(marc_context_t ctx, MPMessage* event, size_t* size, struct s
 	//static socklen_t addrlen = sizeof(struct sockaddr_in);
 	struct client* client = (struct client*)ctx;
 
-	fd_set fds;
-
-	FD_ZERO(&fds);
-	FD_SET(ctx->sd, &fds);
 	memset(event, 0, sizeof(MPMessage));
 
-	switch ( select(ctx->sd+1, &fds, NULL, NULL, timeout) ){
+	switch ( poll_readable(ctx->sd, timeout) ){
 	case -1:
 		return errno;
 	case 0:
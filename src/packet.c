@@ -266,11 +266,52 @@ static int next_payload(struct header_chunk* header){
 void header_init(struct header_chunk* header, const struct cap_header* cp, int layer){
 	header->cp = cp;
 	header->protocol = NULL;
-	header->last_net = (struct network){"", "", 0};
+	header->last_net.family = 0;
+	header->last_net.plen = 0;
+	header->last_net.formatted = 0;
 	header->truncated = 0;
 	header->ptr = NULL;
 }
 
+enum {
+	FORMATTED_SRC = (1<<0),
+	FORMATTED_DST = (1<<1),
+};
+
+/**
+ * The cached string is not part of the logical state so it is updated even if
+ * net is const (the cast goes through uintptr_t as the object itself is never
+ * const, only the pointers handed to the protocol decoders).
+ */
+static const char* network_str(net_t ptr, int src){
+	struct network* net = (struct network*)(uintptr_t)ptr;
+	const int flag = src ? FORMATTED_SRC : FORMATTED_DST;
+	char* buf = src ? net->src_str : net->dst_str;
+
+	if ( net->family == 0 ){
+		return "";
+	}
+
+	if ( !(net->formatted & flag) ){
+		if ( net->family == AF_INET ){
+			*fmt_ipv4(buf, src ? net->src.v4 : net->dst.v4) = 0;
+		} else {
+			inet_ntop(net->family, src ? (const void*)&net->src : (const void*)&net->dst, buf, INET6_ADDRSTRLEN);
+		}
+		net->formatted |= flag;
+	}
+
+	return buf;
+}
+
+const char* network_src_str(net_t net){
+	return network_str(net, 1);
+}
+
+const char* network_dst_str(net_t net){
+	return network_str(net, 0);
+}
+
 int header_walk(struct header_chunk* header){
 	if ( !header->ptr ){
 		header->protocol = protocol_get(PROTOCOL_ETHERNET);
@@ -6,6 +6,8 @@
 #include "caputils/caputils.h"
 #include "src/format/format.h"
 #include "src/slist.h"
+#include <pthread.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <netinet/ip.h>
@@ -39,10 +41,15 @@ struct state {
  * bucket, e.g. (src^dst%N)
  */
 #define bucket_count 256
-static struct simple_list list[bucket_count];
 
-static int initialized = 0;
-static int counter = 0;
+struct connection_table {
+	struct simple_list list[bucket_count];
+	connection_id_t counter;
+};
+
+/* table used by connection_id, one per thread */
+static pthread_key_t default_table;
+static pthread_once_t default_table_once = PTHREAD_ONCE_INIT;
 
 static struct state* entry_put(struct simple_list* bucket, const struct entry* entry, connection_id_t id){
 	/* allocate new entry (key) */
@@ -99,7 +106,7 @@ static unsigned int ipv4_bucket_select(const struct ip* ip){
 	return (ip->ip_src.s_addr ^ ip->ip_dst.s_addr) % bucket_count;
 }
 
-static struct state* connection_id_tcp_syn(struct simple_list* bucket, const struct cap_header* cp, struct state* state){
+static struct state* connection_id_tcp_syn(struct connection_table* table, struct simple_list* bucket, const struct cap_header* cp, struct state* state){
 	const struct ip* ip = find_ipv4_header(cp->ethhdr, NULL);
 	if ( !ip ) return state;
 
@@ -112,7 +119,7 @@ static struct state* connection_id_tcp_syn(struct simple_list* bucket, const str
 	}
 
 	/* new SYN detected, assume new connection */
-	const connection_id_t id = ++counter;
+	const connection_id_t id = ++table->counter;
 	struct state* new[2] = {
 		entry_put(bucket, state->entry, id),
 		entry_put(bucket, state->sibling->entry, id),
@@ -131,15 +138,15 @@ static struct state* connection_id_tcp_syn(struct simple_list* bucket, const str
 	return new[0];
 }
 
-static connection_id_t connection_id_search(struct simple_list* bucket, const struct cap_header* cp, struct entry entry[2]){
+static connection_id_t connection_id_search(struct connection_table* table, struct simple_list* bucket, const struct cap_header* cp, struct entry entry[2]){
 	/* search both forward and backward entries for existing connection */
 	struct state* state = slist_find(bucket, &entry[0], connection_id_cmp);
 	if ( state ){
-		state = connection_id_tcp_syn(bucket, cp, state);
+		state = connection_id_tcp_syn(table, bucket, cp, state);
 		return state->id;
 	}
 
-	const int id = ++counter;
+	const connection_id_t id = ++table->counter;
 
 	/* create new entry for this connection */
 	struct state* new[2] = {0,};
@@ -160,22 +167,58 @@ static connection_id_t connection_id_search(struct simple_list* bucket, const st
 	return id;
 }
 
-connection_id_t connection_id(const struct cap_header* cp){
-	if ( !initialized ){
-		for ( unsigned int i = 0; i < bucket_count; i++ ){
-			slist_init(&list[i], sizeof(void*), sizeof(struct state), 32);
-		}
-		initialized = 1;
+struct connection_table* connection_table_alloc(void){
+	struct connection_table* table = malloc(sizeof(struct connection_table));
+	if ( !table ){
+		return NULL;
 	}
 
+	for ( unsigned int i = 0; i < bucket_count; i++ ){
+		slist_init(&table->list[i], sizeof(void*), sizeof(struct state), 32);
+	}
+	table->counter = 0;
+
+	return table;
+}
+
+void connection_table_free(struct connection_table* table){
+	if ( !table ) return;
+
+	for ( unsigned int i = 0; i < bucket_count; i++ ){
+		slist_free(&table->list[i]);
+	}
+	free(table);
+}
+
+connection_id_t connection_id_r(struct connection_table* table, const struct cap_header* cp){
 	struct entry entry[2];
 
 	/* IPv4 */
 	const struct ip* ip = find_ipv4_header(cp->ethhdr, NULL);
 	if ( ip && ipv4_connection_id(cp, ip, entry) ){
 		const unsigned int bucket = ipv4_bucket_select(ip);
-		return connection_id_search(&list[bucket], cp, entry);
+		return connection_id_search(table, &table->list[bucket], cp, entry);
 	}
 
 	return CONNECTION_ID_NONE;
 }
+
+static void default_table_destroy(void* table){
+	connection_table_free(table);
+}
+
+static void default_table_init(void){
+	pthread_key_create(&default_table, default_table_destroy);
+}
+
+connection_id_t connection_id(const struct cap_header* cp){
+	pthread_once(&default_table_once, default_table_init);
+
+	struct connection_table* table = pthread_getspecific(default_table);
+	if ( !table ){
+		table = connection_table_alloc();
+		pthread_setspecific(default_table, table);
+	}
+
+	return connection_id_r(table, cp);
+}
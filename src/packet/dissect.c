@@ -0,0 +1,240 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "caputils/packet.h"
+#include "caputils/caputils.h"
+#include "src/format/format.h"
+#include <string.h>
+
+extern enum caputils_protocol_type ethertype_next(const unsigned int ethertype);
+extern enum caputils_protocol_type ipproto_next(uint8_t proto);
+
+/**
+ * Append a layer.
+ * @return Non-zero if the dissection should continue after this layer.
+ */
+static int add_layer(struct layer_table* table, enum caputils_protocol_type protocol, size_t offset, size_t min_size){
+	if ( table->num_layers == LAYER_MAX ){
+		table->flags |= LAYER_TABLE_OVERFLOW;
+		return 0;
+	}
+
+	const size_t caplen = table->cp->caplen;
+	struct layer* layer = &table->layer[table->num_layers++];
+	layer->protocol = protocol;
+	layer->flags = 0;
+	layer->offset = offset;
+	layer->length = caplen - offset;
+
+	if ( offset + min_size > caplen ){
+		layer->flags |= LAYER_TRUNCATED;
+		table->flags |= LAYER_TABLE_TRUNCATED;
+		return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * Decode a header using the protocol registry.
+ * @param next Set to the offset of the next header.
+ * @return Protocol of the next header or PROTOCOL_DONE to stop.
+ */
+static enum caputils_protocol_type registry_next(struct layer_table* table, struct header_chunk* header, enum caputils_protocol_type type, size_t offset, size_t* next){
+	const char* ptr = table->cp->payload + offset;
+	const struct caputils_protocol* protocol = protocol_get(type);
+	if ( !protocol ){
+		table->flags |= LAYER_TABLE_CORRUPT;
+		return PROTOCOL_DONE;
+	}
+
+	header->protocol = protocol;
+	header->ptr = ptr;
+	const size_t min_size = protocol->size_dyn ? protocol->size_dyn(header, ptr) : protocol->size;
+	if ( !add_layer(table, type, offset, min_size) || !protocol->next_payload ){
+		return PROTOCOL_DONE;
+	}
+
+	const char* out = ptr;
+	const enum caputils_protocol_type next_type = protocol->next_payload(header, ptr, &out);
+	if ( !out ){
+		if ( next_type == PROTOCOL_DONE ) table->flags |= LAYER_TABLE_TRUNCATED;
+		return PROTOCOL_DONE;
+	}
+	if ( out < table->cp->payload ){
+		table->flags |= LAYER_TABLE_CORRUPT;
+		return PROTOCOL_DONE;
+	}
+
+	*next = out - table->cp->payload;
+	return next_type;
+}
+
+unsigned int packet_dissect(const struct cap_header* cp, struct layer_table* table){
+	const char* base = cp->payload;
+	const size_t caplen = cp->caplen;
+
+	table->cp = cp;
+	table->num_layers = 0;
+	table->flags = 0;
+
+	/* only used when calling into the registry, the network layer is stored
+	 * directly in header.last_net and copied to the table when done */
+	struct header_chunk header;
+	header.layer = 0;
+	header.cp = cp;
+	header.truncated = 0;
+	header.last_net.family = 0;
+	header.last_net.plen = 0;
+	header.last_net.formatted = 0;
+	struct network* net = &header.last_net;
+
+	enum caputils_protocol_type type = PROTOCOL_ETHERNET;
+	size_t offset = 0;
+	while ( type != PROTOCOL_DONE && type != PROTOCOL_UNKNOWN ){
+		const char* ptr = base + offset;
+		size_t next = offset;
+		enum caputils_protocol_type next_type;
+
+		/* the common stacks is decoded inline, the min sizes matches the registry */
+		switch ( type ){
+		case PROTOCOL_ETHERNET:
+			if ( !add_layer(table, type, offset, sizeof(struct ethhdr)) ) goto done;
+			next_type = ethertype_next(ntohs(((const struct ethhdr*)ptr)->h_proto));
+			next = offset + sizeof(struct ethhdr);
+			break;
+
+		case PROTOCOL_VLAN:
+			if ( !add_layer(table, type, offset, sizeof(uint32_t)) ) goto done;
+			next_type = ethertype_next(ntohs(((const uint16_t*)ptr)[1]));
+			next = offset + sizeof(uint32_t);
+			break;
+
+		case PROTOCOL_MPLS:
+			if ( !add_layer(table, type, offset, sizeof(uint32_t)) ) goto done;
+			next = offset + sizeof(uint32_t);
+			if ( !(ntohl(*(const uint32_t*)ptr) & 0x100) ){
+				next_type = PROTOCOL_MPLS;
+			} else if ( next >= caplen ){
+				next_type = PROTOCOL_DATA;
+			} else {
+				switch ( base[next] & 0xf0 ){
+				case 0x00: next_type = PROTOCOL_PW; break;
+				case 0x40: next_type = PROTOCOL_IPV4; break;
+				case 0x60: next_type = PROTOCOL_IPV6; break;
+				default: next_type = PROTOCOL_DATA;
+				}
+			}
+			break;
+
+		case PROTOCOL_IPV4:
+			{
+				if ( !add_layer(table, type, offset, sizeof(struct ip)) ) goto done;
+				const struct ip* ip = (const struct ip*)ptr;
+				if ( ip->ip_hl < 5 ){
+					table->flags |= LAYER_TABLE_CORRUPT;
+					goto done;
+				}
+				net->family = AF_INET;
+				net->src.v4 = ip->ip_src;
+				net->dst.v4 = ip->ip_dst;
+				net->plen = ntohs(ip->ip_len) - 4*ip->ip_hl;
+				net->formatted = 0;
+				next_type = ipproto_next(ip->ip_p);
+				next = offset + 4*ip->ip_hl;
+			}
+			break;
+
+#ifdef HAVE_IPV6
+		case PROTOCOL_IPV6:
+			{
+				const struct ip6_hdr* ip = (const struct ip6_hdr*)ptr;
+				if ( offset + sizeof(struct ip6_hdr) > caplen || ip->ip6_nxt == IPPROTO_HOPOPTS ){
+					/* extension headers and truncated headers is left to the registry */
+					next_type = registry_next(table, &header, type, offset, &next);
+					break;
+				}
+				if ( !add_layer(table, type, offset, sizeof(struct ip6_hdr)) ) goto done;
+				net->family = AF_INET6;
+				net->src.v6 = ip->ip6_src;
+				net->dst.v6 = ip->ip6_dst;
+				net->plen = ntohs(ip->ip6_plen);
+				net->formatted = 0;
+				next_type = ipproto_next(ip->ip6_nxt);
+				next = offset + sizeof(struct ip6_hdr);
+			}
+			break;
+#endif
+
+		case PROTOCOL_TCP:
+			{
+				/* segments without payload is common, the registry is only used to
+				 * detect the application protocol */
+				if ( offset + sizeof(struct tcphdr) <= caplen ){
+					const struct tcphdr* tcp = (const struct tcphdr*)ptr;
+					if ( net->plen == 4*(size_t)tcp->doff ){
+						add_layer(table, type, offset, sizeof(struct tcphdr));
+						table->layer[table->num_layers-1].length = 4*tcp->doff;
+						goto done;
+					}
+				}
+				next_type = registry_next(table, &header, type, offset, &next);
+			}
+			break;
+
+		case PROTOCOL_UDP:
+			{
+				/* as with tcp the registry is only used to detect the application
+				 * protocol, i.e. when there is payload */
+				const struct udphdr* udp = (const struct udphdr*)ptr;
+				if ( offset + sizeof(struct udphdr) == caplen ||
+				     (offset + sizeof(struct udphdr) <= caplen && ntohs(udp->len) == sizeof(struct udphdr)) ){
+					add_layer(table, type, offset, sizeof(struct udphdr));
+					goto done;
+				}
+				next_type = registry_next(table, &header, type, offset, &next);
+			}
+			break;
+
+		case PROTOCOL_DATA:
+			add_layer(table, type, offset, 0);
+			goto done;
+
+		default:
+			next_type = registry_next(table, &header, type, offset, &next);
+			break;
+		}
+
+		if ( next_type == PROTOCOL_DONE || next_type == PROTOCOL_UNKNOWN ){
+			/* the header length is known even if there is no more headers */
+			if ( table->num_layers > 0 && next > offset && next <= caplen ){
+				table->layer[table->num_layers-1].length = next - offset;
+			}
+			break;
+		}
+
+		/* next header must start within the captured data */
+		if ( next > caplen ){
+			table->flags |= LAYER_TABLE_TRUNCATED;
+			break;
+		}
+
+		table->layer[table->num_layers-1].length = next - offset;
+		offset = next;
+		type = next_type;
+	}
+
+  done:
+	table->net = *net;
+	return table->num_layers;
+}
+
+const struct layer* layer_find(const struct layer_table* table, enum caputils_protocol_type protocol){
+	for ( unsigned int i = 0; i < table->num_layers; i++ ){
+		if ( table->layer[i].protocol == protocol ){
+			return &table->layer[i];
+		}
+	}
+	return NULL;
+}
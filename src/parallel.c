@@ -0,0 +1,487 @@
+/**
+ * libcap_utils - DPMI capture utilities
+ * Copyright (C) 2003-2013 (see AUTHORS)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include "caputils/caputils.h"
+#include "caputils/parallel.h"
+#include "caputils_int.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ * Capfiles has no sync markers so a chunk (except the first) is started by
+ * searching for an offset where a chain of plausible headers begin. Each task
+ * records the offset of the first packet after its range and when reducing
+ * (in order) the next task is verified to have started at exactly that
+ * offset, if not it is reprocessed from the correct offset.
+ */
+
+#define DEFAULT_CHUNK_SIZE (64*1024*1024)
+#define SYNC_CHAIN 8           /* number of consecutive headers required to sync */
+#define MAX_CAPLEN (1<<20)     /* larger caplen is considered bogus when syncing */
+
+struct parallel_file {
+	const char* path;
+	size_t index;
+	char* data;                /* mapped file (read-only), NULL if the file is read as a stream */
+	size_t size;
+};
+
+struct parallel_task {
+	struct parallel_file* file;
+	size_t begin;              /* packets starting in [begin, end) belongs to this task */
+	size_t end;
+	size_t first;              /* offset of first processed packet */
+	size_t next;               /* offset of first packet after the range */
+	int ret;
+	int file_error;            /* ret is an error reading the file (not from map) */
+	int done;
+	void* state;
+};
+
+struct parallel_context {
+	const struct caputils_parallel* job;
+	struct parallel_task* task;
+	size_t num_tasks;
+	size_t next_task;          /* next task to hand out (atomic) */
+	int abort;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+};
+
+int caputils_parallel_filter_supported(const struct filter* filter){
+	/* flow sampling only depends on the packet itself */
+	return !filter->frame_num && !(filter->index & (FILTER_FRAME_MAX_DT | FILTER_SAMPLE | FILTER_SAMPLE_RANDOM));
+}
+
+/**
+ * Make a private copy of the job filter as filter_match updates the filter
+ * state. The BPF program is shared (read-only).
+ */
+static struct filter* filter_copy(const struct caputils_parallel* job, struct filter* copy){
+	if ( !job->filter ){
+		return NULL;
+	}
+
+	*copy = *job->filter;
+	copy->first = 1;
+	copy->frame_counter = 0;
+	copy->sample_counter = 0;
+	return copy;
+}
+
+/**
+ * Test if a plausible header is located at offset.
+ */
+static int valid_header(const struct parallel_file* file, size_t offset, size_t* next){
+	if ( offset + sizeof(struct cap_header) > file->size ){
+		return 0;
+	}
+
+	const struct cap_header* cp = (const struct cap_header*)(file->data + offset);
+	if ( cp->caplen > MAX_CAPLEN || cp->ts.tv_psec >= 1000000000000ULL ){
+		return 0;
+	}
+
+	/* nic and mampid is NUL-padded strings */
+	const char* str[2] = {cp->nic, cp->mampid};
+	for ( int i = 0; i < 2; i++ ){
+		int nul = 0;
+		for ( int j = 0; j < 8; j++ ){
+			const unsigned char c = str[i][j];
+			if ( c == 0 ){
+				nul = 1;
+			} else if ( nul || c < 0x20 || c > 0x7e ){
+				return 0;
+			}
+		}
+	}
+
+	*next = offset + sizeof(struct cap_header) + cp->caplen;
+	return *next <= file->size;
+}
+
+static int valid_chain(const struct parallel_file* file, size_t offset){
+	for ( int i = 0; i < SYNC_CHAIN; i++ ){
+		if ( offset == file->size ){
+			return 1; /* reached end of file */
+		}
+		if ( !valid_header(file, offset, &offset) ){
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/**
+ * Find the first packet boundary in [begin, end).
+ * @return Offset of packet or end if none was found.
+ */
+static size_t find_sync(const struct parallel_file* file, size_t begin, size_t end){
+	for ( size_t offset = begin; offset < end; offset++ ){
+		if ( valid_chain(file, offset) ){
+			return offset;
+		}
+	}
+	return end;
+}
+
+static int map_packet(const struct caputils_parallel* job, struct filter* filter, void* state, struct cap_header* cp){
+	const int match = !filter || filter_match(filter, cp->payload, cp);
+	return job->map(state, cp, match, job->user);
+}
+
+/**
+ * Process all packets starting in the task range, beginning at offset.
+ */
+static int process_range(const struct caputils_parallel* job, struct parallel_task* task, struct filter* filter, size_t offset){
+	const struct parallel_file* file = task->file;
+	int ret;
+
+	task->first = offset;
+	while ( offset < task->end ){
+		struct cap_header* cp = (struct cap_header*)(file->data + offset);
+		if ( offset + sizeof(struct cap_header) > file->size || offset + sizeof(struct cap_header) + cp->caplen > file->size ){
+			task->next = file->size;
+			task->file_error = 1;
+			return ERROR_CAPFILE_TRUNCATED;
+		}
+
+		if ( (ret=map_packet(job, filter, task->state, cp)) != 0 ){
+			return ret;
+		}
+
+		offset += sizeof(struct cap_header) + cp->caplen;
+	}
+
+	task->next = offset;
+	return 0;
+}
+
+static int process_stream(const struct caputils_parallel* job, struct parallel_task* task, struct filter* filter){
+	stream_addr_t addr = STREAM_ADDR_INITIALIZER;
+	stream_t st;
+	int ret;
+
+	stream_addr_str(&addr, task->file->path, 0);
+	if ( (ret=stream_open(&st, &addr, NULL, 0)) != 0 ){
+		task->file_error = 1;
+		return ret;
+	}
+
+	cap_head* cp;
+	while ( (ret=stream_read(st, &cp, NULL, NULL)) == 0 ){
+		if ( (ret=map_packet(job, filter, task->state, cp)) != 0 ){
+			stream_close(st);
+			return ret;
+		}
+	}
+
+	stream_close(st);
+	if ( ret == -1 ){
+		return 0;
+	}
+
+	task->file_error = 1;
+	return ret;
+}
+
+static void* state_alloc(const struct caputils_parallel* job){
+	void* state = calloc(1, job->state_size > 0 ? job->state_size : 1);
+	if ( state && job->init ){
+		job->init(state, job->user);
+	}
+	return state;
+}
+
+static void state_free(const struct caputils_parallel* job, void* state){
+	if ( !state ) return;
+	if ( job->cleanup ){
+		job->cleanup(state, job->user);
+	}
+	free(state);
+}
+
+static void run_task(struct parallel_context* ctx, struct parallel_task* task, struct filter* filter){
+	const struct caputils_parallel* job = ctx->job;
+
+	if ( !(task->state=state_alloc(job)) ){
+		task->ret = ENOMEM;
+		return;
+	}
+
+	if ( !task->file->data ){
+		task->ret = process_stream(job, task, filter);
+		return;
+	}
+
+	/* first task of each file starts at a known offset */
+	const int first_in_file = task == ctx->task || (task-1)->file != task->file;
+	const size_t offset = first_in_file ? task->begin : find_sync(task->file, task->begin, task->end);
+	task->ret = process_range(job, task, filter, offset);
+}
+
+static void* worker(void* ptr){
+	struct parallel_context* ctx = (struct parallel_context*)ptr;
+
+	struct filter copy;
+	struct filter* filter = filter_copy(ctx->job, &copy);
+
+	while ( !__sync_fetch_and_add(&ctx->abort, 0) ){
+		const size_t index = __sync_fetch_and_add(&ctx->next_task, 1);
+		if ( index >= ctx->num_tasks ) break;
+
+		struct parallel_task* task = &ctx->task[index];
+		run_task(ctx, task, filter);
+
+		pthread_mutex_lock(&ctx->mutex);
+		task->done = 1;
+		pthread_cond_broadcast(&ctx->cond);
+		pthread_mutex_unlock(&ctx->mutex);
+	}
+
+	return NULL;
+}
+
+/**
+ * Map a file and get the offset of the first packet.
+ * @return Zero if the file can be split into chunks.
+ */
+static int map_file(struct parallel_file* file, size_t* offset){
+	const int fd = open(file->path, O_RDONLY);
+	if ( fd < 0 ){
+		return errno;
+	}
+
+	struct stat st;
+	if ( fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || (size_t)st.st_size < sizeof(struct file_header_t) ){
+		close(fd);
+		return EINVAL;
+	}
+
+	void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if ( data == MAP_FAILED ){
+		return errno;
+	}
+
+	/* only the current version is split, legacy formats is read as streams */
+	const struct file_header_t* fh = (const struct file_header_t*)data;
+	*offset = (size_t)fh->header_offset + fh->comment_size;
+	if ( fh->magic != CAPUTILS_FILE_MAGIC || fh->version.major != VERSION_MAJOR || fh->version.minor != VERSION_MINOR || *offset > (size_t)st.st_size ){
+		munmap(data, st.st_size);
+		return EINVAL;
+	}
+
+	madvise(data, st.st_size, MADV_SEQUENTIAL);
+	file->data = (char*)data;
+	file->size = st.st_size;
+	return 0;
+}
+
+/**
+ * Split files into tasks.
+ */
+static int plan_tasks(struct parallel_context* ctx, struct parallel_file* file, const char* const* paths, size_t num_paths){
+	const size_t chunk_size = ctx->job->chunk_size > 0 ? ctx->job->chunk_size : DEFAULT_CHUNK_SIZE;
+	size_t capacity = num_paths;
+
+	ctx->num_tasks = 0;
+	ctx->task = malloc(sizeof(struct parallel_task) * capacity);
+	if ( !ctx->task ){
+		return ENOMEM;
+	}
+
+	for ( size_t i = 0; i < num_paths; i++ ){
+		file[i].path = paths[i];
+		file[i].index = i;
+		file[i].data = NULL;
+		file[i].size = 0;
+
+		size_t offset = 0;
+		const int chunked = map_file(&file[i], &offset) == 0;
+		const size_t data_size = chunked ? file[i].size - offset : 0;
+		const size_t chunks = chunked && data_size > chunk_size ? (data_size + chunk_size - 1) / chunk_size : 1;
+
+		if ( ctx->num_tasks + chunks > capacity ){
+			capacity = (ctx->num_tasks + chunks) * 2;
+			struct parallel_task* tmp = realloc(ctx->task, sizeof(struct parallel_task) * capacity);
+			if ( !tmp ){
+				return ENOMEM;
+			}
+			ctx->task = tmp;
+		}
+
+		for ( size_t j = 0; j < chunks; j++ ){
+			struct parallel_task* task = &ctx->task[ctx->num_tasks++];
+			memset(task, 0, sizeof(struct parallel_task));
+			task->file = &file[i];
+			task->begin = offset + j * chunk_size;
+			task->end = (j+1 == chunks) ? file[i].size : offset + (j+1) * chunk_size;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Ensure the task started at the right offset, reprocess it otherwise.
+ * @param expected Offset of the first packet after the previous task (updated).
+ */
+static int verify_task(struct parallel_context* ctx, struct parallel_task* task, size_t* expected){
+	const struct caputils_parallel* job = ctx->job;
+	const int first_in_file = task == ctx->task || (task-1)->file != task->file;
+
+	if ( !task->file->data || first_in_file ){
+		*expected = task->next;
+		return 0;
+	}
+
+	/* previous task already covered this range */
+	if ( *expected >= task->end ){
+		if ( task->first < task->end ){
+			state_free(job, task->state);
+			if ( !(task->state=state_alloc(job)) ){
+				return ENOMEM;
+			}
+			task->ret = 0;
+		}
+		return 0;
+	}
+
+	if ( task->first != *expected ){
+		struct filter copy;
+		struct filter* filter = filter_copy(job, &copy);
+
+		state_free(job, task->state);
+		if ( !(task->state=state_alloc(job)) ){
+			return ENOMEM;
+		}
+		task->file_error = 0;
+		task->ret = process_range(job, task, filter, *expected);
+	}
+
+	*expected = task->next;
+	return 0;
+}
+
+int caputils_parallel_foreach(const char* const* paths, size_t num_paths, unsigned int threads, const struct caputils_parallel* job){
+	if ( !job || !job->map || !job->reduce || (num_paths > 0 && !paths) ){
+		return EINVAL;
+	}
+
+	if ( job->filter && !caputils_parallel_filter_supported(job->filter) ){
+		return EINVAL;
+	}
+
+	if ( threads == 0 ){
+		const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = cpus > 0 ? cpus : 1;
+	}
+
+	struct parallel_file* file = calloc(num_paths > 0 ? num_paths : 1, sizeof(struct parallel_file));
+	if ( !file ){
+		return ENOMEM;
+	}
+
+	struct parallel_context ctx;
+	ctx.job = job;
+	ctx.task = NULL;
+	ctx.next_task = 0;
+	ctx.abort = 0;
+	pthread_mutex_init(&ctx.mutex, NULL);
+	pthread_cond_init(&ctx.cond, NULL);
+
+	int ret = plan_tasks(&ctx, file, paths, num_paths);
+
+	/* start workers */
+	if ( ret == 0 && threads > ctx.num_tasks ){
+		threads = ctx.num_tasks;
+	}
+	pthread_t thread[threads > 0 ? threads : 1];
+	unsigned int started = 0;
+	for ( ; ret == 0 && started < threads; started++ ){
+		if ( (ret=pthread_create(&thread[started], NULL, worker, &ctx)) != 0 ){
+			break;
+		}
+	}
+
+	/* reduce in order as tasks finish. A file which cannot be read (or is
+	 * truncated) does not stop the others, the packets read so far is still
+	 * reduced and the first such error is returned at the end. */
+	int file_ret = 0;
+	size_t expected = 0;
+	for ( size_t i = 0; ret == 0 && i < ctx.num_tasks; i++ ){
+		struct parallel_task* task = &ctx.task[i];
+
+		pthread_mutex_lock(&ctx.mutex);
+		while ( !task->done ){
+			pthread_cond_wait(&ctx.cond, &ctx.mutex);
+		}
+		pthread_mutex_unlock(&ctx.mutex);
+
+		if ( (ret=verify_task(&ctx, task, &expected)) != 0 ){
+			break;
+		}
+
+		if ( task->ret != 0 && !task->file_error ){
+			ret = task->ret;
+			break;
+		}
+		if ( task->ret != 0 && file_ret == 0 ){
+			file_ret = task->ret;
+		}
+
+		job->reduce(task->state, task->file->index, job->user);
+		state_free(job, task->state);
+		task->state = NULL;
+	}
+
+	/* stop workers (if aborted) and wait for them to finish */
+	__sync_fetch_and_add(&ctx.abort, 1);
+	for ( unsigned int i = 0; i < started; i++ ){
+		pthread_join(thread[i], NULL);
+	}
+
+	/* release resources */
+	for ( size_t i = 0; i < ctx.num_tasks; i++ ){
+		state_free(job, ctx.task[i].state);
+	}
+	for ( size_t i = 0; i < num_paths; i++ ){
+		if ( file[i].data ){
+			munmap(file[i].data, file[i].size);
+		}
+	}
+	free(ctx.task);
+	free(file);
+	pthread_mutex_destroy(&ctx.mutex);
+	pthread_cond_destroy(&ctx.cond);
+
+	return ret != 0 ? ret : file_ret;
+}
@@ -0,0 +1,449 @@
+/**
+ * libcap_utils - DPMI capture utilities
+ * Copyright (C) 2003-2013 (see AUTHORS)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include "caputils/caputils.h"
+#include "caputils/pcap_writer.h"
+#include "caputils_int.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define PCAP_WRITER_BUFFER (1024*1024)
+#define PCAP_DEFAULT_SNAPLEN 65535
+#define PCAP_MAX_SNAPLEN 262144          /* same limit as libpcap */
+
+#define PCAP_MAGIC         0xa1b2c3d4
+#define PCAP_MAGIC_NSEC    0xa1b23c4d
+#define PCAPNG_BYTE_ORDER  0x1a2b3c4d
+
+enum pcapng_block {
+	PCAPNG_SHB = 0x0a0d0d0a,
+	PCAPNG_IDB = 1,
+	PCAPNG_EPB = 6,
+};
+
+enum pcapng_option {
+	PCAPNG_OPT_END = 0,
+	PCAPNG_OPT_SHB_USERAPPL = 4,
+	PCAPNG_OPT_IF_NAME = 2,
+	PCAPNG_OPT_IF_DESCRIPTION = 3,
+	PCAPNG_OPT_IF_TSRESOL = 9,
+};
+
+/* pcapng interface, identified by nic and mampid */
+struct pcap_iface {
+	char nic[CAPHEAD_NICLEN];
+	char mampid[8];
+};
+
+struct pcap_iface_table {
+	struct pcap_iface* iface;
+	size_t num_iface;
+	size_t last;                       /* last found, most packets belong to the same interface */
+};
+
+struct pcap_writer {
+	int fd;
+	enum pcap_format format;
+	int linktype;
+	uint32_t snaplen;
+	uint64_t packets;
+	struct pcap_iface_table table;
+
+	char* buffer;
+	size_t used;
+};
+
+struct pcap_batch {
+	const struct pcap_writer* writer;
+	struct pcap_iface_table table;   /* interface ids in the batch is local to it */
+	uint64_t packets;
+
+	char* data;
+	size_t size;
+	size_t capacity;
+};
+
+static size_t pad32(size_t size){
+	return (size + 3) & ~(size_t)3;
+}
+
+static char* put32(char* dst, uint32_t value){
+	memcpy(dst, &value, sizeof(uint32_t));
+	return dst + sizeof(uint32_t);
+}
+
+static char* put_option(char* dst, uint16_t code, const void* value, uint16_t len){
+	memcpy(dst, &code, sizeof(uint16_t));
+	memcpy(dst + 2, &len, sizeof(uint16_t));
+	memset(dst + 4, 0, pad32(len));
+	memcpy(dst + 4, value, len);
+	return dst + 4 + pad32(len);
+}
+
+static uint32_t packet_caplen(const struct pcap_writer* writer, const struct cap_header* cp){
+	return cp->caplen < writer->snaplen ? cp->caplen : writer->snaplen;
+}
+
+static size_t record_size(const struct pcap_writer* writer, const struct cap_header* cp){
+	const uint32_t caplen = packet_caplen(writer, cp);
+	if ( writer->format == PCAP_FORMAT_PCAPNG ){
+		return 32 + pad32(caplen);
+	}
+	return 16 + caplen;
+}
+
+/**
+ * Encode a packet record (dst must hold record_size bytes).
+ */
+static void encode_packet(const struct pcap_writer* writer, char* dst, const struct cap_header* cp, uint32_t iface){
+	const uint32_t caplen = packet_caplen(writer, cp);
+
+	switch ( writer->format ){
+	case PCAP_FORMAT_USEC:
+	case PCAP_FORMAT_NSEC:
+		dst = put32(dst, cp->ts.tv_sec);
+		dst = put32(dst, writer->format == PCAP_FORMAT_NSEC ? cp->ts.tv_psec / 1000 : cp->ts.tv_psec / 1000000);
+		dst = put32(dst, caplen);
+		dst = put32(dst, cp->len);
+		memcpy(dst, cp->payload, caplen);
+		break;
+
+	case PCAP_FORMAT_PCAPNG:
+		{
+			const uint32_t total = 32 + pad32(caplen);
+			const uint64_t ts = (uint64_t)cp->ts.tv_sec * 1000000000 + cp->ts.tv_psec / 1000;
+			dst = put32(dst, PCAPNG_EPB);
+			dst = put32(dst, total);
+			dst = put32(dst, iface);
+			dst = put32(dst, (uint32_t)(ts >> 32));
+			dst = put32(dst, (uint32_t)ts);
+			dst = put32(dst, caplen);
+			dst = put32(dst, cp->len);
+			memcpy(dst, cp->payload, caplen);
+			memset(dst + caplen, 0, pad32(caplen) - caplen);
+			put32(dst + pad32(caplen), total);
+		}
+		break;
+	}
+}
+
+/**
+ * Get the id of the interface the packet belongs to.
+ * @return Non-zero if the interface is new (added last) or negative if out of memory.
+ */
+static int find_iface(struct pcap_iface_table* table, const char* nic, const char* mampid, uint32_t* id){
+	if ( table->last < table->num_iface ){
+		const struct pcap_iface* iface = &table->iface[table->last];
+		if ( strncmp(iface->nic, nic, CAPHEAD_NICLEN) == 0 && strncmp(iface->mampid, mampid, 8) == 0 ){
+			*id = table->last;
+			return 0;
+		}
+	}
+
+	for ( size_t i = 0; i < table->num_iface; i++ ){
+		const struct pcap_iface* iface = &table->iface[i];
+		if ( strncmp(iface->nic, nic, CAPHEAD_NICLEN) == 0 && strncmp(iface->mampid, mampid, 8) == 0 ){
+			*id = table->last = i;
+			return 0;
+		}
+	}
+
+	struct pcap_iface* tmp = realloc(table->iface, (table->num_iface + 1) * sizeof(struct pcap_iface));
+	if ( !tmp ){
+		return -1;
+	}
+
+	struct pcap_iface* iface = &tmp[table->num_iface];
+	memset(iface, 0, sizeof(struct pcap_iface));
+	memcpy(iface->nic, nic, strnlen(nic, CAPHEAD_NICLEN));
+	memcpy(iface->mampid, mampid, strnlen(mampid, 8));
+	table->iface = tmp;
+	*id = table->last = table->num_iface++;
+	return 1;
+}
+
+int pcap_writer_flush(pcap_writer_t writer){
+	const int ret = write_all(writer->fd, writer->buffer, writer->used);
+	writer->used = 0;
+	return ret;
+}
+
+/**
+ * Reserve space in the buffer, flushing it if needed.
+ * @return Pointer to size bytes or NULL on errors (errno is set).
+ */
+static char* reserve(struct pcap_writer* writer, size_t size){
+	if ( writer->used + size > PCAP_WRITER_BUFFER ){
+		int ret;
+		if ( (ret=pcap_writer_flush(writer)) != 0 ){
+			errno = ret;
+			return NULL;
+		}
+	}
+
+	char* dst = writer->buffer + writer->used;
+	writer->used += size;
+	return dst;
+}
+
+static int write_shb(struct pcap_writer* writer){
+	static const char userappl[] = "caputils-" VERSION;
+	const uint32_t total = 28 + 4 + pad32(strlen(userappl)) + 4;
+	const uint16_t version[2] = {1, 0};
+	const int64_t section_length = -1;
+
+	char* dst = reserve(writer, total);
+	dst = put32(dst, PCAPNG_SHB);
+	dst = put32(dst, total);
+	dst = put32(dst, PCAPNG_BYTE_ORDER);
+	memcpy(dst, version, sizeof(version));
+	memcpy(dst + 4, &section_length, sizeof(int64_t));
+	dst = put_option(dst + 12, PCAPNG_OPT_SHB_USERAPPL, userappl, strlen(userappl));
+	dst = put32(dst, PCAPNG_OPT_END);
+	put32(dst, total);
+	return 0;
+}
+
+static int write_idb(struct pcap_writer* writer, const struct pcap_iface* iface){
+	const uint8_t tsresol = 9; /* nanoseconds */
+	const uint16_t nic_len = strnlen(iface->nic, CAPHEAD_NICLEN);
+	const uint16_t mampid_len = strnlen(iface->mampid, 8);
+	const uint32_t total = 20 + (nic_len ? 4 + pad32(nic_len) : 0) + (mampid_len ? 4 + pad32(mampid_len) : 0) + 8 + 4;
+
+	char* dst = reserve(writer, total);
+	if ( !dst ){
+		return errno;
+	}
+
+	const uint16_t linktype[2] = {writer->linktype, 0};
+	dst = put32(dst, PCAPNG_IDB);
+	dst = put32(dst, total);
+	memcpy(dst, linktype, sizeof(linktype));
+	dst = put32(dst + 4, writer->snaplen);
+	if ( nic_len > 0 ){
+		dst = put_option(dst, PCAPNG_OPT_IF_NAME, iface->nic, nic_len);
+	}
+	if ( mampid_len > 0 ){
+		dst = put_option(dst, PCAPNG_OPT_IF_DESCRIPTION, iface->mampid, mampid_len);
+	}
+	dst = put_option(dst, PCAPNG_OPT_IF_TSRESOL, &tsresol, 1);
+	dst = put32(dst, PCAPNG_OPT_END);
+	put32(dst, total);
+	return 0;
+}
+
+static int write_header(struct pcap_writer* writer){
+	if ( writer->format == PCAP_FORMAT_PCAPNG ){
+		return write_shb(writer);
+	}
+
+	const uint16_t version[2] = {2, 4};
+	char* dst = reserve(writer, 24);
+	dst = put32(dst, writer->format == PCAP_FORMAT_NSEC ? PCAP_MAGIC_NSEC : PCAP_MAGIC);
+	memcpy(dst, version, sizeof(version));
+	dst = put32(dst + 4, 0); /* thiszone */
+	dst = put32(dst, 0);     /* sigfigs */
+	dst = put32(dst, writer->snaplen);
+	put32(dst, writer->linktype);
+	return 0;
+}
+
+/**
+ * Get the pcapng interface id for nic and mampid, writing an interface
+ * description block if it is new.
+ */
+static int writer_iface(struct pcap_writer* writer, const char* nic, const char* mampid, uint32_t* id){
+	switch ( find_iface(&writer->table, nic, mampid, id) ){
+	case 0:
+		return 0;
+	case 1:
+		return write_idb(writer, &writer->table.iface[*id]);
+	default:
+		return ENOMEM;
+	}
+}
+
+int pcap_writer_open(pcap_writer_t* writerptr, const char* filename, enum pcap_format format, int linktype, size_t snaplen){
+	if ( !writerptr || !filename || format > PCAP_FORMAT_PCAPNG || snaplen > PCAP_MAX_SNAPLEN ){
+		return EINVAL;
+	}
+
+	struct pcap_writer* writer = calloc(1, sizeof(struct pcap_writer));
+	if ( !writer || !(writer->buffer=malloc(PCAP_WRITER_BUFFER)) ){
+		free(writer);
+		return ENOMEM;
+	}
+
+	writer->format = format;
+	writer->linktype = linktype;
+	writer->snaplen = snaplen > 0 ? snaplen : PCAP_DEFAULT_SNAPLEN;
+	writer->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if ( writer->fd == -1 ){
+		const int ret = errno;
+		free(writer->buffer);
+		free(writer);
+		return ret;
+	}
+
+	write_header(writer);
+	*writerptr = writer;
+	return 0;
+}
+
+int pcap_writer_write(pcap_writer_t writer, const struct cap_header* cp){
+	uint32_t iface = 0;
+	int ret;
+
+	if ( writer->format == PCAP_FORMAT_PCAPNG && (ret=writer_iface(writer, cp->nic, cp->mampid, &iface)) != 0 ){
+		return ret;
+	}
+
+	char* dst = reserve(writer, record_size(writer, cp));
+	if ( !dst ){
+		return errno;
+	}
+
+	encode_packet(writer, dst, cp, iface);
+	writer->packets++;
+	return 0;
+}
+
+int pcap_writer_close(pcap_writer_t writer){
+	int ret = pcap_writer_flush(writer);
+	if ( close(writer->fd) == -1 && ret == 0 ){
+		ret = errno;
+	}
+
+	free(writer->table.iface);
+	free(writer->buffer);
+	free(writer);
+	return ret;
+}
+
+uint64_t pcap_writer_packets(const pcap_writer_t writer){
+	return writer->packets;
+}
+
+pcap_batch_t pcap_batch_new(const pcap_writer_t writer){
+	struct pcap_batch* batch = calloc(1, sizeof(struct pcap_batch));
+	if ( batch ){
+		batch->writer = writer;
+	}
+	return batch;
+}
+
+int pcap_batch_add(pcap_batch_t batch, const struct cap_header* cp){
+	const struct pcap_writer* writer = batch->writer;
+	uint32_t iface = 0;
+
+	if ( writer->format == PCAP_FORMAT_PCAPNG && find_iface(&batch->table, cp->nic, cp->mampid, &iface) < 0 ){
+		return ENOMEM;
+	}
+
+	const size_t size = record_size(writer, cp);
+	if ( batch->size + size > batch->capacity ){
+		const size_t capacity = batch->capacity > 0 ? batch->capacity * 2 : PCAP_WRITER_BUFFER;
+		char* tmp = realloc(batch->data, capacity > batch->size + size ? capacity : batch->size + size);
+		if ( !tmp ){
+			return ENOMEM;
+		}
+		batch->data = tmp;
+		batch->capacity = capacity > batch->size + size ? capacity : batch->size + size;
+	}
+
+	encode_packet(writer, batch->data + batch->size, cp, iface);
+	batch->size += size;
+	batch->packets++;
+	return 0;
+}
+
+/**
+ * Replace the batch-local interface ids with the ids used by the writer.
+ */
+static int remap_batch(struct pcap_writer* writer, struct pcap_batch* batch){
+	const size_t n = batch->table.num_iface;
+	uint32_t map[n > 0 ? n : 1];
+	int identity = 1;
+	int ret;
+
+	for ( size_t i = 0; i < n; i++ ){
+		const struct pcap_iface* iface = &batch->table.iface[i];
+		if ( (ret=writer_iface(writer, iface->nic, iface->mampid, &map[i])) != 0 ){
+			return ret;
+		}
+		identity &= map[i] == i;
+	}
+
+	if ( identity ){
+		return 0;
+	}
+
+	/* batches only holds enhanced packet blocks */
+	for ( size_t offset = 0; offset < batch->size; ){
+		char* block = batch->data + offset;
+		uint32_t total;
+		uint32_t id;
+		memcpy(&total, block + 4, sizeof(uint32_t));
+		memcpy(&id, block + 8, sizeof(uint32_t));
+		put32(block + 8, map[id]);
+		offset += total;
+	}
+
+	return 0;
+}
+
+int pcap_writer_write_batch(pcap_writer_t writer, pcap_batch_t batch){
+	int ret;
+
+	if ( writer->format == PCAP_FORMAT_PCAPNG && (ret=remap_batch(writer, batch)) != 0 ){
+		return ret;
+	}
+
+	/* large batches is written directly instead of copied to the buffer */
+	if ( batch->size > PCAP_WRITER_BUFFER - writer->used ){
+		if ( (ret=pcap_writer_flush(writer)) != 0 || (ret=write_all(writer->fd, batch->data, batch->size)) != 0 ){
+			return ret;
+		}
+	} else {
+		memcpy(writer->buffer + writer->used, batch->data, batch->size);
+		writer->used += batch->size;
+	}
+
+	writer->packets += batch->packets;
+	batch->size = 0;
+	batch->packets = 0;
+	batch->table.num_iface = 0;
+	batch->table.last = 0;
+	return 0;
+}
+
+void pcap_batch_free(pcap_batch_t batch){
+	if ( !batch ) return;
+	free(batch->table.iface);
+	free(batch->data);
+	free(batch);
+}
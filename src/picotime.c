@@ -55,28 +55,6 @@ timepico timepico_new(long int sec, long int psec){
 	return (timepico){sec, psec};
 }
 
-/***************************************************************************
- This function compares two struct timepico (ts1<ts2=-1, ts1>ts2=1, ts1==ts2=0)
-***************************************************************************/
-int timecmp(const timepico *ts1, const timepico *ts2)
-{
-	if (ts1->tv_sec < ts2->tv_sec){ //if ts1 is before ts2
-		return -1;
-	}
-	if (ts1->tv_sec > ts2->tv_sec){//if ts1 is after ts2
-		return 1;
-	}
-
-	//same second
-	if (ts1->tv_psec < ts2->tv_psec){//if ts1 is before ts2
-		return -1;
-	}
-	if (ts1->tv_psec > ts2->tv_psec){//if ts1 is before ts2
-		return 1;
-	}
-	return 0; // if ts1 and ts2 are identical
-}
-
 timepico timepico_now(){
 	struct timespec ts;
 	clock_gettime(CLOCK_REALTIME, &ts);
@@ -138,48 +116,41 @@ const char* timepico_to_string_r(const timepico* src, char* dst, size_t bytes, c
 }
 
 const char* timepico_to_string(const timepico* src, const char* fmt){
-	static char buffer[128];
+	static __thread char buffer[128];
 	return timepico_to_string_r(src, buffer, 128, fmt);
 }
 
 double timepico_to_double(timepico tp){
-	return (double)tp.tv_sec + (double)tp.tv_psec/PICODIVIDER;
+	return (double)tp.tv_sec + (double)tp.tv_psec / (double)PICOSECONDS_PER_SECOND;
 }
 
-timepico timepico_sub(timepico x, timepico y){
-	timepico result;
+/* The batch functions is written as simple loops without early exits so the
+ * compiler can vectorize them. */
 
-	/* Perform the carry for the later subtraction by updating y. */
-	if (x.tv_psec < y.tv_psec) {
-		int psec = (y.tv_psec - x.tv_psec) / PICODIVIDER + 1;
-		y.tv_psec -= PICODIVIDER * psec;
-		y.tv_sec += psec;
-	}
-	if (x.tv_psec - y.tv_psec > PICODIVIDER) {
-		int psec = (x.tv_psec - y.tv_psec) / PICODIVIDER;
-		y.tv_psec += PICODIVIDER * psec;
-		y.tv_sec -= psec;
-	}
+size_t timepico_min(const timepico* ts, size_t n){
+	size_t min = 0;
+	uint32_t sec = n > 0 ? ts[0].tv_sec : 0;
+	uint64_t psec = n > 0 ? ts[0].tv_psec : 0;
 
-	/* Compute the time remaining to wait.
-	   tv_psec is certainly positive. */
-	result.tv_sec = x.tv_sec - y.tv_sec;
-	result.tv_psec = x.tv_psec - y.tv_psec;
+	/* branch-free selection (the order is mostly random when merging) */
+	for ( size_t i = 1; i < n; i++ ){
+		const int less = (ts[i].tv_sec < sec) | ((ts[i].tv_sec == sec) & (ts[i].tv_psec < psec));
+		min  = less ? i : min;
+		sec  = less ? ts[i].tv_sec : sec;
+		psec = less ? ts[i].tv_psec : psec;
+	}
 
-	/* Return 1 if result is negative. */
-	return result;
+	return min;
 }
 
-timepico timepico_add(timepico a, timepico b){
-	timepico tmp = {
-		a.tv_sec + b.tv_sec,
-		a.tv_psec + b.tv_psec,
-	};
-
-	while ( tmp.tv_psec > PICODIVIDER ){
-		tmp.tv_sec++;
-		tmp.tv_psec -= PICODIVIDER;
+void timepico_deltas(const timepico* ts, size_t n, int64_t* dt){
+	for ( size_t i = 1; i < n; i++ ){
+		dt[i-1] = timepico_diff_ps(ts[i], ts[i-1]);
 	}
+}
 
-	return tmp;
+void timepico_diff_batch(const timepico* ts, size_t n, timepico ref, int64_t* dt){
+	for ( size_t i = 0; i < n; i++ ){
+		dt[i] = timepico_diff_ps(ts[i], ref);
+	}
 }
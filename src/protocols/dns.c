@@ -26,6 +26,7 @@
 #include <string.h>
 #include <ctype.h>
 #include <arpa/inet.h>
+#include <pthread.h>
 
 static const unsigned int MAX_LABEL_REFERENCES = 32;    /* how many label references (depth) is allowed */
 
@@ -114,7 +115,7 @@ enum response_code {
 static const char* dns_type_lut[TYPE_ANY+1] = {0,};
 static const char* dns_class_lut[CLASS_MAX] = {0,};
 static const char* dns_opcode_lut[OPCODE_MAX] = {0,};
-static int initialized = 0;
+static pthread_once_t dns_once = PTHREAD_ONCE_INIT;
 
 static void dns_initialize(){
 	dns_type_lut[TYPE_A]     = "A";
@@ -138,7 +139,6 @@ static void dns_initialize(){
 	dns_opcode_lut[STATUS]   = "Status";
 	dns_opcode_lut[NOTIFY]   = "Notify";
 	dns_opcode_lut[UPDATE]   = "Update";
-	initialized = 1;
 }
 
 static const char* dns_class_name(int class){
@@ -428,9 +428,7 @@ static const char* dns_dump_answer(FILE* fp, const char* prefix, const char* sec
 }
 
 static void dns_dump(FILE* fp, const struct header_chunk* header, const char* ptr, const char* prefix, int flags){
-	if ( !initialized ){
-		dns_initialize();
-	}
+	pthread_once(&dns_once, dns_initialize);
 
 	struct dns_header h = *(const struct dns_header*)ptr;
 	const char* cur = ptr + sizeof(struct dns_header);
@@ -476,9 +474,7 @@ static void dns_dump(FILE* fp, const struct header_chunk* header, const char* pt
 }
 
 static void dns_format(FILE* fp, const struct header_chunk* header, const char* ptr, unsigned int flags){
-	if ( !initialized ){
-		dns_initialize();
-	}
+	pthread_once(&dns_once, dns_initialize);
 
 	struct dns_header h = *(const struct dns_header*)ptr;
 	h.flags = ntohs(h.flags);
@@ -577,6 +573,43 @@ static void dns_format(FILE* fp, const struct header_chunk* header, const char*
 	}
 }
 
+/**
+ * Extract the first question name in wire format. Compressed names (label
+ * references) is not followed, the name ends at the first reference.
+ */
+static int dns_qname(const char* ptr, size_t size, struct field_value* value){
+	const size_t begin = sizeof(struct dns_header);
+	size_t offset = begin;
+
+	if ( size <= begin || ntohs(((const struct dns_header*)ptr)->qdcount) == 0 ){
+		return 0;
+	}
+
+	for (;;){
+		if ( offset >= size || offset - begin >= 255 ) return 0;
+
+		const uint8_t len = (uint8_t)ptr[offset];
+		if ( len == 0 || (len & 0xc0) == 0xc0 ) break;
+		offset += 1 + len;
+	}
+
+	value->ptr = ptr + begin;
+	value->len = offset - begin;
+	return 1;
+}
+
+const struct caputils_field protocol_dns_fields[] = {
+	{"id",      FIELD_UINT,     0,  2, 0,  0, NULL},
+	{"flags",   FIELD_UINT,     2,  2, 0,  0, NULL},
+	{"qr",      FIELD_UINT,     2,  2, 15, 0x1, NULL},
+	{"opcode",  FIELD_UINT,     2,  2, 11, 0xf, NULL},
+	{"rcode",   FIELD_UINT,     2,  2, 0,  0xf, NULL},
+	{"qdcount", FIELD_UINT,     4,  2, 0,  0, NULL},
+	{"ancount", FIELD_UINT,     6,  2, 0,  0, NULL},
+	{"qname",   FIELD_DNSNAME,  0,  0, 0,  0, dns_qname},
+	{NULL, 0, 0, 0, 0, 0, NULL}, /* sentinel */
+};
+
 struct caputils_protocol protocol_dns = {
 	.name = "DNS",
 	.size = sizeof(struct dns_header),
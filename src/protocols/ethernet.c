@@ -97,6 +97,13 @@ static void ethernet_dump(FILE* fp, const struct header_chunk* header, const cha
 	fprintf(fp, "%sh_proto:            0x%04x\n", prefix, ntohs(eth->h_proto));
 }
 
+const struct caputils_field protocol_ethernet_fields[] = {
+	{"dst",     FIELD_MAC,   0,  6, 0, 0, NULL},
+	{"src",     FIELD_MAC,   6,  6, 0, 0, NULL},
+	{"type",    FIELD_UINT, 12,  2, 0, 0, NULL},
+	{NULL, 0, 0, 0, 0, 0, NULL}, /* sentinel */
+};
+
 struct caputils_protocol protocol_ethernet = {
 	.name = "ethernet",
 	.size = sizeof(struct ethhdr),
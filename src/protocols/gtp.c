@@ -28,6 +28,7 @@ enum gtp_version {
 	GTPv1,
 	GTPv2,
 	GTPvP,
+	GTP_INVALID,
 };
 
 enum {
@@ -97,8 +98,7 @@ static enum gtp_version gtp_version(const union gtp_header* ptr){
 	} else if ( gtp->version == 2 ){
 		return GTPv2;
 	} else {
-		fprintf(stderr, "invalid GTP version 0x%02x\n", gtp->version);
-		abort();
+		return GTP_INVALID;
 	}
 }
 
@@ -107,6 +107,7 @@ static const char* gtp_version_str(const union gtp_header* gtp){
 	case GTPv1: return "GTPv1";
 	case GTPv2: return "GTPv2";
 	case GTPvP: return "GTP'";
+	case GTP_INVALID: break;
 	}
 	return "GTP";
 }
@@ -116,6 +117,7 @@ static int gtp_message_type(const union gtp_header* gtp){
 	case GTPv1: return gtp->v1.message;
 	case GTPv2: return gtp->v2.message;
 	case GTPvP: return gtp->vp.message;
+	case GTP_INVALID: break;
 	}
 	return 0;
 }
@@ -174,20 +176,35 @@ static const char* gtp_message_type_str(const union gtp_header* gtp){
 	return "Unknown";
 }
 
-static size_t gtp_header_size(const union gtp_header* gtp){
+/**
+ * @param available Captured bytes starting at the header.
+ * @return Header size (including extension headers) or 0 if the header is
+ *         invalid or extension headers is truncated.
+ */
+static size_t gtp_header_size(const union gtp_header* gtp, size_t available){
 	switch ( gtp_version(gtp) ){
 	case GTPv1:
-		if ( gtp->v1.ext_flag ){
-			fprintf(stderr, "GTPv1 extension headers isn't supported (yet)\n");
-			abort();
-		}
-
 		/* if either flag is set all fields is sent (but must not be interpreted
 		 * unless the specific flag is set) */
-		if ( gtp->v1.seq_flag || gtp->v1.npdu_flag || gtp->v1.ext_flag ){
-			return sizeof(struct gtp_v1_header) + sizeof(uint32_t);
-		} else {
+		if ( !(gtp->v1.seq_flag || gtp->v1.npdu_flag || gtp->v1.ext_flag) ){
 			return sizeof(struct gtp_v1_header);
+		} else {
+			size_t size = sizeof(struct gtp_v1_header) + sizeof(uint32_t);
+			if ( !gtp->v1.ext_flag ){
+				return size;
+			}
+
+			/* extension headers: length (in 4 octets), content, next type */
+			if ( size > available ) return 0;
+			const uint8_t* ptr = (const uint8_t*)gtp;
+			uint8_t next = gtp->v1.optional[0].ext_type;
+			while ( next != 0 ){
+				if ( size >= available || ptr[size] == 0 ) return 0;
+				size += 4 * ptr[size];
+				if ( size > available ) return 0;
+				next = ptr[size - 1];
+			}
+			return size;
 		}
 
 	case GTPv2:
@@ -196,21 +213,35 @@ static size_t gtp_header_size(const union gtp_header* gtp){
 
 	case GTPvP:
 		return sizeof(struct gtp_prime_header);
+
+	case GTP_INVALID:
+		break;
 	}
 
-	return sizeof(struct gtp_stub_header);
+	return 0;
+}
+
+static size_t gtp_available(const struct header_chunk* header, const char* ptr){
+	return header->cp->caplen - (ptr - header->cp->payload);
 }
 
 static size_t gtp_header_size_adapter(const struct header_chunk* header, const char* ptr){
 	const union gtp_header* gtp = (const union gtp_header*)ptr;
-	return gtp_header_size(gtp);
+	const size_t size = gtp_header_size(gtp, gtp_available(header, ptr));
+	return size > 0 ? size : sizeof(struct gtp_stub_header);
 }
 
 static enum caputils_protocol_type gtp_next(struct header_chunk* header, const char* ptr, const char** out){
 	const union gtp_header* gtp = (const union gtp_header*)ptr;
 	const enum gtp_version version = gtp_version(gtp);
 	const int message_type = gtp_message_type(gtp);
-	const char* payload = ptr + gtp_header_size(gtp);
+	const size_t size = gtp_header_size(gtp, gtp_available(header, ptr));
+	if ( size == 0 ){
+		/* unknown version or broken extension headers */
+		*out = NULL;
+		return PROTOCOL_DATA;
+	}
+	const char* payload = ptr + size;
 	*out = payload;
 
 	if ( version == GTPv2 && gtp->v2.piggyback ){
@@ -221,6 +252,10 @@ static enum caputils_protocol_type gtp_next(struct header_chunk* header, const c
 		return PROTOCOL_DATA;
 	}
 
+	if ( size >= gtp_available(header, ptr) ){
+		return PROTOCOL_DATA;
+	}
+
 	/* detect IPv4 */
 	if ( (payload[0] & 0xf0) == 0x40 ){
 		return PROTOCOL_IPV4;
@@ -236,7 +271,7 @@ static enum caputils_protocol_type gtp_next(struct header_chunk* header, const c
 
 static void gtp_format(FILE* fp, const struct header_chunk* header, const char* ptr, unsigned int flags){
 	const union gtp_header* gtp = (const union gtp_header*)ptr;
-	fprintf(fp, ": %s[%zd]", gtp_version_str(gtp), gtp_header_size(gtp));
+	fprintf(fp, ": %s[%zd]", gtp_version_str(gtp), gtp_header_size(gtp, gtp_available(header, ptr)));
 }
 
 static void gtp_dump(FILE* fp, const struct header_chunk* header, const char* ptr, const char* prefix, int flags){
@@ -267,6 +302,7 @@ static void gtp_dump(FILE* fp, const struct header_chunk* header, const char* pt
 		break;
 
 	case GTPvP:
+	case GTP_INVALID:
 		break;
 	}
 }
@@ -50,7 +50,7 @@ static void icmp_format(FILE* fp, const struct header_chunk* header, const char*
 	  fprintf(fp, "[Type=%d, code=%d]", ntohs(icmp->type), ntohs(icmp->code));
 	}
 
-	fprintf(fp, ": %s --> %s",  header->last_net.net_src, header->last_net.net_dst);
+	fprintf(fp, ": %s --> %s",  network_src_str(&header->last_net), network_dst_str(&header->last_net));
 
 	if ( flags < (unsigned int)FORMAT_LAYER_APPLICATION ){
 		return;
@@ -79,7 +79,7 @@ static void igmp_format(FILE* fp, const struct header_chunk* header, const char*
 
 	const struct igmp* igmp = (const struct igmp*)ptr;
 
-	fprintf(fp, " %s %s", header->last_net.net_dst, igmp_type_name(igmp->type));
+	fprintf(fp, " %s %s", network_dst_str(&header->last_net), igmp_type_name(igmp->type));
 }
 
 static void igmp_dump(FILE* fp, const struct header_chunk* header, const char* ptr, const char* prefix, int flags){
@@ -35,8 +35,11 @@ static enum caputils_protocol_type ipv4_next(struct header_chunk* header, const
 		return PROTOCOL_DONE;
 	}
 
-	inet_ntop(AF_INET, &ip->ip_src, header->last_net.net_src, sizeof(header->last_net.net_src));
-	inet_ntop(AF_INET, &ip->ip_dst, header->last_net.net_dst, sizeof(header->last_net.net_dst));
+	/* addresses is only formatted when requested (see network_src_str) */
+	header->last_net.family = AF_INET;
+	header->last_net.src.v4 = ip->ip_src;
+	header->last_net.dst.v4 = ip->ip_dst;
+	header->last_net.formatted = 0;
 	header->last_net.plen = ntohs(ip->ip_len) - 4*ip->ip_hl;
 
 	*out = payload;
@@ -44,7 +47,8 @@ static enum caputils_protocol_type ipv4_next(struct header_chunk* header, const
 }
 
 static void ipv4_format(FILE* fp, const struct header_chunk* header, const char* ptr, unsigned int flags){
-	fprintf(fp, ": %s", header->protocol->name);
+	fputs(": ", fp);
+	fputs(header->protocol->name, fp);
 
 	const struct ip* ip = (const struct ip*)ptr;
 
@@ -86,6 +90,20 @@ static void ipv4_dump(FILE* fp, const struct header_chunk* header, const char* p
 	/** @todo option headers */
 }
 
+const struct caputils_field protocol_ipv4_fields[] = {
+	{"version", FIELD_UINT,  0,  1, 4, 0xf, NULL},
+	{"hl",      FIELD_UINT,  0,  1, 0, 0xf, NULL},
+	{"tos",     FIELD_UINT,  1,  1, 0, 0, NULL},
+	{"len",     FIELD_UINT,  2,  2, 0, 0, NULL},
+	{"id",      FIELD_UINT,  4,  2, 0, 0, NULL},
+	{"ttl",     FIELD_UINT,  8,  1, 0, 0, NULL},
+	{"proto",   FIELD_UINT,  9,  1, 0, 0, NULL},
+	{"checksum",FIELD_UINT, 10,  2, 0, 0, NULL},
+	{"src",     FIELD_IPV4, 12,  4, 0, 0, NULL},
+	{"dst",     FIELD_IPV4, 16,  4, 0, 0, NULL},
+	{NULL, 0, 0, 0, 0, 0, NULL}, /* sentinel */
+};
+
 struct caputils_protocol protocol_ipv4 = {
 	.name = "IPv4",
 	.size = sizeof(struct ip),
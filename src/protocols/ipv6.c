@@ -99,9 +99,12 @@ static enum caputils_protocol_type ipv6_next(struct header_chunk* header, const
 		return PROTOCOL_DONE;
 	}
 
-	inet_ntop(AF_INET6, &ip->ip6_src, header->last_net.net_src, sizeof(header->last_net.net_src));
-	inet_ntop(AF_INET6, &ip->ip6_dst, header->last_net.net_dst, sizeof(header->last_net.net_dst));
-	header->last_net.plen = ip->ip6_plen + sizeof(struct ip6_hdr) - header_size;
+	/* addresses is only formatted when requested (see network_src_str) */
+	header->last_net.family = AF_INET6;
+	header->last_net.src.v6 = ip->ip6_src;
+	header->last_net.dst.v6 = ip->ip6_dst;
+	header->last_net.formatted = 0;
+	header->last_net.plen = ntohs(ip->ip6_plen) + sizeof(struct ip6_hdr) - header_size;
 
 	*out = payload;
 	return ipproto_next(proto);
@@ -154,6 +157,16 @@ static void ipv6_dump(FILE* fp, const struct header_chunk* header, const char* p
 
 #endif /* HAVE_IPV6 */
 
+const struct caputils_field protocol_ipv6_fields[] = {
+	{"flow",    FIELD_UINT,  0,  4, 0, 0xfffff, NULL},
+	{"plen",    FIELD_UINT,  4,  2, 0, 0, NULL},
+	{"nxt",     FIELD_UINT,  6,  1, 0, 0, NULL},
+	{"hlim",    FIELD_UINT,  7,  1, 0, 0, NULL},
+	{"src",     FIELD_IPV6,  8, 16, 0, 0, NULL},
+	{"dst",     FIELD_IPV6, 24, 16, 0, 0, NULL},
+	{NULL, 0, 0, 0, 0, 0, NULL}, /* sentinel */
+};
+
 struct caputils_protocol protocol_ipv6 = {
 	.name = "IPv6",
 	.size = sizeof(struct ip),
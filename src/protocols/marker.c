@@ -33,9 +33,8 @@
 
 
 
-static const char* marker_flags(const struct marker marker){
-	static char buf[12];
-	static char flag[8] = {'T', 0, };
+static const char* marker_flags(const struct marker marker, char buf[12]){
+	static const char flag[8] = {'T', 0, };
 	if ( marker.flags == (0) ){
 		return "(not set)";
 	}
@@ -48,6 +47,7 @@ static const char* marker_flags(const struct marker marker){
 		}
 	}
 	*dst++ = ']';
+	*dst = 0;
 	return buf;
 }
 
@@ -57,6 +57,7 @@ static void marker_dump(FILE* fp, const struct header_chunk* header, const char*
 
   //  fprintf(fp," CP \n");
   struct marker h = *(const struct marker*)ptr;
+  char buf[12];
 
 //  const char* cur = ptr + sizeof(struct marker); /* Not used, commented */
   const char* end = header->cp->payload + header->cp->caplen;
@@ -70,7 +71,7 @@ static void marker_dump(FILE* fp, const struct header_chunk* header, const char*
 
   fprintf(fp, "magic     = %d \n",ntohl(h.magic));
   fprintf(fp, "version   = %d \n",h.version);
-  fprintf(fp, "flags     = %s [%02x] \n",marker_flags(h), h.flags);
+  fprintf(fp, "flags     = %s [%02x] \n",marker_flags(h, buf), h.flags);
   fprintf(fp, "reserved  = %d \n",ntohs(h.reserved));
   fprintf(fp, "expid     = %d \n",ntohl(h.exp_id));
   fprintf(fp, "runid     = %d \n",ntohl(h.run_id));
@@ -84,6 +85,7 @@ static void marker_format(FILE* fp, const struct header_chunk* header, const cha
 
   
   struct marker h = *(const struct marker*)ptr;
+  char buf[12];
   
   const struct cap_header* cp = header->cp;
   const size_t offset         = ptr - cp->payload;     /* how many bytes into the packet are we? */
@@ -97,7 +99,7 @@ static void marker_format(FILE* fp, const struct header_chunk* header, const cha
   /* The size isnt enough. */  
   if (full_size >= sizeof(struct marker)){
     //    fprintf(fp, "FLAGS/EXPID/RUNID/KEYID/SEQNR %d/%d/%d/%d ",ntohl(h.exp_id),ntohl(h.run_id),ntohl(h.key_id),ntohl(h.counter));
-    fprintf(fp, "%s[0x%02x]:%d:%d:%d:%d ",marker_flags(h),h.flags,ntohl(h.exp_id),ntohl(h.run_id),ntohl(h.key_id),ntohl(h.seq_num));
+    fprintf(fp, "%s[0x%02x]:%d:%d:%d:%d ",marker_flags(h, buf),h.flags,ntohl(h.exp_id),ntohl(h.run_id),ntohl(h.key_id),ntohl(h.seq_num));
     /*    
     fprintf(fp, "\n");
     fprintf(fp, "magic     = %x \n",ntohl(h.magic));
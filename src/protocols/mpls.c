@@ -116,6 +116,14 @@ static void pw_dump(FILE* fp, const struct header_chunk* header, const char* ptr
 	fprintf(fp, "%ssequence:           %d\n", prefix, pw.sequence);
 }
 
+const struct caputils_field protocol_mpls_fields[] = {
+	{"label",   FIELD_UINT,  0,  4, 12, 0xfffff, NULL},
+	{"exp",     FIELD_UINT,  0,  4, 9,  0x7, NULL},
+	{"bottom",  FIELD_UINT,  0,  4, 8,  0x1, NULL},
+	{"ttl",     FIELD_UINT,  0,  4, 0,  0xff, NULL},
+	{NULL, 0, 0, 0, 0, 0, NULL}, /* sentinel */
+};
+
 struct caputils_protocol protocol_mpls = {
 	.name = "MPLS",
 	.size = sizeof(uint32_t),
@@ -78,7 +78,7 @@ static void ospf_format(FILE* fp, const struct header_chunk* header, const char*
 	const struct ospf* ospf = (const struct ospf*)ptr;
 
 	fprintf(fp, " v%d %s %s --> %s", ospf->version, ospf_type_name(ospf->type),
-		        header->last_net.net_src, header->last_net.net_dst);
+		        network_src_str(&header->last_net), network_dst_str(&header->last_net));
 }
 
 static void ospf_dump(FILE* fp, const struct header_chunk* header, const char* ptr, const char* prefix, int flags){
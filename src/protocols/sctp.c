@@ -129,7 +129,7 @@ static void sctp_format(FILE* fp, const struct header_chunk* header, const char*
 	const uint16_t sport = ntohs(sctp->source);
 	const uint16_t dport = ntohs(sctp->dest);
 
-	fprintf(fp, ": %s:%d --> %s:%d", header->last_net.net_src, sport, header->last_net.net_dst, dport);
+	fprintf(fp, ": %s:%d --> %s:%d", network_src_str(&header->last_net), sport, network_dst_str(&header->last_net), dport);
 	sctp_chunks(header->cp, sctp, payload_size, fp);
 }
 
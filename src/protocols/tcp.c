@@ -44,8 +44,7 @@ typedef struct {
 	u_int16_t mss;
 } tcpopt_mss_t;
 
-static const char* tcp_flags(const struct tcphdr* tcp){
-	static char buf[12];
+static const char* tcp_flags(const struct tcphdr* tcp, char buf[12]){
 	size_t i = 0;
 
 	if (tcp->syn) buf[i++] = 'S';
@@ -73,11 +72,11 @@ static size_t tcp_option_size(const tcp_option_t* opt){
 static void tcp_options(const struct cap_header* cp,const struct tcphdr* tcp, FILE* dst){
 	if ( tcp->doff <= 5 ) return; /* no options present */
 
-	fprintf(dst,"|");
+	fputc('|', dst);
 	const uint8_t* ptr = (const u_int8_t*)((const char*)tcp) + sizeof(struct tcphdr);
 
 	int optlen = sizeof(struct tcphdr);
-	while ( *ptr != 0 && optlen < 4*tcp->doff ){
+	while ( optlen < 4*tcp->doff ){
 		const tcp_option_t* opt = (const tcp_option_t*)ptr;
 
 		/* Ensure there is enough data left in packet. (used + 1) is used to tell if
@@ -88,7 +87,12 @@ static void tcp_options(const struct cap_header* cp,const struct tcphdr* tcp, FI
 			(used + (opt->kind > NOP ? 2 : 1)) > cp->caplen ||      /* ensure option size is present if needed */
 			(used + tcp_option_size(opt)) > cp->caplen ){           /* ensure option data is present */
 
-			fprintf(dst,"tcp option truncated (caplen)");
+			fputs("tcp option truncated (caplen)", dst);
+			break;
+		}
+
+		/* end of option list (kind is only read once it is known to be captured) */
+		if ( *ptr == 0 ){
 			break;
 		}
 
@@ -99,11 +103,11 @@ static void tcp_options(const struct cap_header* cp,const struct tcphdr* tcp, FI
 
 		switch ( opt->kind ){
 		case EOL:
-			fprintf(dst, "EOL|");
+			fputs("EOL|", dst);
 			return;
 
 		case NOP:
-			fprintf(dst, "NOP|");
+			fputs("NOP|", dst);
 			ptr += 1;
 			optlen += 1;
 			continue;
@@ -124,11 +128,11 @@ static void tcp_options(const struct cap_header* cp,const struct tcphdr* tcp, FI
 
 		case SACK_PERMITTED:
 		case SACK:
-			fprintf(dst, "SAC|");
+			fputs("SAC|", dst);
 			break;
 
 		case TSOPT:
-			fprintf(dst, "TSS|");
+			fputs("TSS|", dst);
 			break;
 
 		default:
@@ -186,11 +190,27 @@ static void tcp_format(FILE* fp, const struct header_chunk* header, const char*
 	const uint16_t sport = ntohs(tcp->source);
 	const uint16_t dport = ntohs(tcp->dest);
 
-	fprintf(fp, ": [%s] %s:%d --> %s:%d", tcp_flags(tcp),
-	        header->last_net.net_src, sport,
-	        header->last_net.net_dst, dport);
-
-	fprintf(fp, " ws=%d seq=%u ack=%u ", ntohs(tcp->window), ntohl(tcp->seq), ntohl(tcp->ack_seq));
+	char flags_buf[12];
+	char buf[160];
+	char* dst = buf;
+	dst = fmt_str(dst, ": [");
+	dst = fmt_str(dst, tcp_flags(tcp, flags_buf));
+	dst = fmt_str(dst, "] ");
+	dst = fmt_str(dst, network_src_str(&header->last_net));
+	*dst++ = ':';
+	dst = fmt_uint(dst, sport, 0, ' ');
+	dst = fmt_str(dst, " --> ");
+	dst = fmt_str(dst, network_dst_str(&header->last_net));
+	*dst++ = ':';
+	dst = fmt_uint(dst, dport, 0, ' ');
+	dst = fmt_str(dst, " ws=");
+	dst = fmt_uint(dst, ntohs(tcp->window), 0, ' ');
+	dst = fmt_str(dst, " seq=");
+	dst = fmt_uint(dst, ntohl(tcp->seq), 0, ' ');
+	dst = fmt_str(dst, " ack=");
+	dst = fmt_uint(dst, ntohl(tcp->ack_seq), 0, ' ');
+	*dst++ = ' ';
+	fwrite(buf, 1, dst - buf, fp);
 	tcp_options(header->cp, tcp, fp);
 
 	const char* payload = (const char*)tcp + 4*tcp->doff;
@@ -232,6 +252,18 @@ static void tcp_dump(FILE* fp, const struct header_chunk* header, const char* pt
 	fprintf(fp, "%surg:                %u\n", prefix, ntohs(tcp->urg_ptr));
 }
 
+const struct caputils_field protocol_tcp_fields[] = {
+	{"sport",   FIELD_UINT,  0,  2, 0, 0, NULL},
+	{"dport",   FIELD_UINT,  2,  2, 0, 0, NULL},
+	{"seq",     FIELD_UINT,  4,  4, 0, 0, NULL},
+	{"ack",     FIELD_UINT,  8,  4, 0, 0, NULL},
+	{"doff",    FIELD_UINT, 12,  1, 4, 0xf, NULL},
+	{"flags",   FIELD_UINT, 13,  1, 0, 0, NULL},
+	{"win",     FIELD_UINT, 14,  2, 0, 0, NULL},
+	{"check",   FIELD_UINT, 16,  2, 0, 0, NULL},
+	{NULL, 0, 0, 0, 0, 0, NULL}, /* sentinel */
+};
+
 struct caputils_protocol protocol_tcp = {
 	.name = "TCP",
 	.size = sizeof(struct tcphdr),
@@ -91,17 +91,33 @@ static void udp_dump(FILE* fp, const struct header_chunk* header, const char* pt
 
 static void udp_format(FILE* fp, const struct header_chunk* header, const char* ptr, unsigned int flags){
 	const struct udphdr* udp = (const struct udphdr*)ptr;
-  fputs(": UDP", fp);
-
-  const uint16_t sport = ntohs(udp->source);
-  const uint16_t dport = ntohs(udp->dest);
-  fprintf(fp, ": %s:%d --> %s:%d",
-	  header->last_net.net_src, sport,
-	  header->last_net.net_dst, dport);
-
-  fprintf(fp, " len=%d check=%d ", ntohs(udp->len), ntohs(udp->check));
+	char buf[128];
+	char* dst = buf;
+
+	dst = fmt_str(dst, ": UDP: ");
+	dst = fmt_str(dst, network_src_str(&header->last_net));
+	*dst++ = ':';
+	dst = fmt_uint(dst, ntohs(udp->source), 0, ' ');
+	dst = fmt_str(dst, " --> ");
+	dst = fmt_str(dst, network_dst_str(&header->last_net));
+	*dst++ = ':';
+	dst = fmt_uint(dst, ntohs(udp->dest), 0, ' ');
+	dst = fmt_str(dst, " len=");
+	dst = fmt_uint(dst, ntohs(udp->len), 0, ' ');
+	dst = fmt_str(dst, " check=");
+	dst = fmt_uint(dst, ntohs(udp->check), 0, ' ');
+	*dst++ = ' ';
+	fwrite(buf, 1, dst - buf, fp);
 }
 
+const struct caputils_field protocol_udp_fields[] = {
+	{"sport",   FIELD_UINT,  0,  2, 0, 0, NULL},
+	{"dport",   FIELD_UINT,  2,  2, 0, 0, NULL},
+	{"len",     FIELD_UINT,  4,  2, 0, 0, NULL},
+	{"check",   FIELD_UINT,  6,  2, 0, 0, NULL},
+	{NULL, 0, 0, 0, 0, 0, NULL}, /* sentinel */
+};
+
 struct caputils_protocol protocol_udp = {
 	.name = "UDP",
 	.size = sizeof(struct udphdr),
@@ -51,6 +51,15 @@ static void vlan_dump(FILE* fp, const struct header_chunk* header, const char* p
 	fprintf(fp, "%sVID:                %d\n", prefix, vid);
 }
 
+const struct caputils_field protocol_vlan_fields[] = {
+	{"tci",     FIELD_UINT,  0,  2, 0,  0, NULL},
+	{"pcp",     FIELD_UINT,  0,  2, 13, 0x7, NULL},
+	{"dei",     FIELD_UINT,  0,  2, 12, 0x1, NULL},
+	{"id",      FIELD_UINT,  0,  2, 0,  0xfff, NULL},
+	{"type",    FIELD_UINT,  2,  2, 0,  0, NULL},
+	{NULL, 0, 0, 0, 0, 0, NULL}, /* sentinel */
+};
+
 struct caputils_protocol protocol_vlan = {
 	.name = "vlan",
 	.size = sizeof(uint32_t),
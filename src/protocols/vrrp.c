@@ -120,7 +120,7 @@ static void vrrp_format(FILE* fp, const struct header_chunk* header, const char*
 	int vrrp_version = (vrrp->version_type>>4)& 0x0F;
 	/*
 	fprintf(fp, " v%d %s(%d) VRID=%d Prio=%d Count=%d  %s--> %s", vrrp_version , vrrp_type_name(vrrp->version_type&0x0F), (vrrp->version_type&0x0F), (vrrp->virtual_router_id),(vrrp->priority),vrrp->count_ipvx_addresses, 
-		header->last_net.net_src, header->last_net.net_dst);
+		network_src_str(&header->last_net), network_dst_str(&header->last_net));
 	*/
 
 	fprintf(fp, " v%d %s(%d) VRID=%d Prio=%d Count=%d  ", (vrrp->version_type>>4)& 0x0F , vrrp_type_name(vrrp->version_type&0x0F), (vrrp->version_type&0x0F), (vrrp->virtual_router_id),(vrrp->priority),vrrp->count_ipvx_addresses);
@@ -140,7 +140,7 @@ static void vrrp_format(FILE* fp, const struct header_chunk* header, const char*
 	  
 	} 
 
-	fprintf(fp, " %s --> %s", header->last_net.net_src, header->last_net.net_dst);
+	fprintf(fp, " %s --> %s", network_src_str(&header->last_net), network_dst_str(&header->last_net));
 }
 
 static void vrrp_dump(FILE* fp, const struct header_chunk* header, const char* ptr, const char* prefix, int flags){
@@ -0,0 +1,250 @@
+/**
+ * libcap_utils - DPMI capture utilities
+ * Copyright (C) 2003-2013 (see AUTHORS)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include "caputils/caputils.h"
+#include "caputils/sender.h"
+#include "caputils_int.h"
+#include "stream.h"
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+/**
+ * Frames is built in place in a fixed set of slots, one per frame in a batch.
+ * Completed frames is queued and the current frame is always built in the slot
+ * following the last queued frame. When all slots is used (or the latency
+ * expires) the queued frames is passed to the stream in a single transmit call
+ * (sendmmsg for ethernet and udp).
+ */
+
+#define SENDER_BATCH 32                /* frames per transmit call */
+
+struct sender {
+	stream_t st;
+	size_t header;                       /* size of link header in front of each frame */
+	size_t stride;                       /* size of a frame slot (link header and measurement frame) */
+	int use_latency;
+	struct timespec latency;
+	struct timespec deadline;            /* when the oldest pending packet must be sent */
+	uint32_t seqnr;                      /* sequence number of the next frame */
+
+	size_t first;                        /* first queued frame not yet transmitted */
+	size_t num_queued;                   /* number of completed frames */
+	size_t used;                         /* bytes used in current frame (including headers) */
+	uint32_t nopkts;                     /* packets in current frame */
+
+	struct sender_stat stat;
+	struct iovec iov[SENDER_BATCH];
+	char buffer[];
+};
+
+static char* current_frame(struct sender* s){
+	return s->buffer + s->num_queued * s->stride;
+}
+
+static void frame_reset(struct sender* s){
+	s->used = s->header + sizeof(struct sendhead);
+	s->nopkts = 0;
+}
+
+/**
+ * Fill in the sendhead and queue the current frame.
+ */
+static void frame_complete(struct sender* s, int flags){
+	char* frame = current_frame(s);
+	struct sendhead* sh = (struct sendhead*)(frame + s->header);
+	sh->sequencenr = htonl(s->seqnr);
+	sh->nopkts = htonl(s->nopkts);
+	sh->flags = htonl(flags);
+	sh->version.major = htons(VERSION_MAJOR);
+	sh->version.minor = htons(VERSION_MINOR);
+
+	s->iov[s->num_queued].iov_base = frame;
+	s->iov[s->num_queued].iov_len = s->used;
+	s->num_queued++;
+
+	/* wraps the same way as the receiver (see match_inc_seqnr) */
+	if ( ++s->seqnr >= 0xFFFF ){
+		s->seqnr = 0;
+	}
+
+	frame_reset(s);
+}
+
+/**
+ * Transmit all queued frames. On errors the frames not yet sent is kept and
+ * retried on the next call.
+ */
+static int transmit(struct sender* s){
+	while ( s->first < s->num_queued ){
+		const int sent = s->st->transmit(s->st, &s->iov[s->first], s->num_queued - s->first);
+		if ( sent < 0 ){
+			if ( errno == EINTR ) continue;
+			return errno;
+		}
+
+		for ( size_t i = 0; i < (size_t)sent; i++ ){
+			s->stat.bytes += s->iov[s->first + i].iov_len;
+		}
+		s->stat.frames += sent;
+		s->stat.batches++;
+		s->first += sent;
+	}
+
+	s->first = 0;
+	s->num_queued = 0;
+	return 0;
+}
+
+static int is_pending(const struct sender* s){
+	return s->nopkts > 0 || s->num_queued > 0;
+}
+
+int sender_open(sender_t* sender, stream_t st, size_t frame_size, const struct timeval* latency){
+	assert(sender);
+	assert(st);
+	*sender = NULL;
+
+	if ( !st->transmit ){
+		return ERROR_NOT_IMPLEMENTED;
+	}
+
+	if ( frame_size == 0 ){
+		frame_size = st->frame_size;
+	}
+
+	/* must be able to hold at least one (empty) packet */
+	if ( frame_size > st->frame_size || frame_size < sizeof(struct sendhead) + sizeof(struct cap_header) ){
+		return EINVAL;
+	}
+
+	const size_t stride = st->frame_header + frame_size;
+	struct sender* s = malloc(sizeof(struct sender) + stride * SENDER_BATCH);
+	if ( !s ){
+		return ENOMEM;
+	}
+
+	s->st = st;
+	s->header = st->frame_header;
+	s->stride = stride;
+	s->use_latency = latency != NULL;
+	s->latency.tv_sec = latency ? latency->tv_sec : 0;
+	s->latency.tv_nsec = latency ? latency->tv_usec * 1000 : 0;
+	s->seqnr = 0;
+	s->first = 0;
+	s->num_queued = 0;
+	memset(&s->stat, 0, sizeof(struct sender_stat));
+	frame_reset(s);
+
+	*sender = s;
+	return 0;
+}
+
+int sender_write(sender_t s, const struct cap_header* cp){
+	const size_t bytes = sizeof(struct cap_header) + cp->caplen;
+	int ret;
+
+	if ( s->header + sizeof(struct sendhead) + bytes > s->stride ){
+		return EMSGSIZE;
+	}
+
+	/* all slots is still in use after a failed transmission */
+	if ( s->num_queued == SENDER_BATCH && (ret=transmit(s)) != 0 ){
+		return ret;
+	}
+
+	/* packet doesn't fit in current frame */
+	if ( s->used + bytes > s->stride ){
+		frame_complete(s, 0);
+		if ( s->num_queued == SENDER_BATCH && (ret=transmit(s)) != 0 ){
+			return ret;
+		}
+	}
+
+	/* latency is measured from the oldest pending packet */
+	if ( s->use_latency && !is_pending(s) ){
+		clock_gettime(CLOCK_MONOTONIC, &s->deadline);
+		s->deadline.tv_sec += s->latency.tv_sec;
+		s->deadline.tv_nsec += s->latency.tv_nsec;
+		if ( s->deadline.tv_nsec >= 1000000000 ){
+			s->deadline.tv_sec++;
+			s->deadline.tv_nsec -= 1000000000;
+		}
+	}
+
+	memcpy(current_frame(s) + s->used, cp, bytes);
+	s->used += bytes;
+	s->nopkts++;
+	s->stat.packets++;
+
+	return sender_poll(s);
+}
+
+int sender_poll(sender_t s){
+	if ( !s->use_latency || !is_pending(s) ){
+		return 0;
+	}
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if ( now.tv_sec < s->deadline.tv_sec || (now.tv_sec == s->deadline.tv_sec && now.tv_nsec < s->deadline.tv_nsec) ){
+		return 0;
+	}
+
+	return sender_flush(s);
+}
+
+int sender_flush(sender_t s){
+	/* there is always a free slot when the current frame holds packets */
+	if ( s->nopkts > 0 ){
+		frame_complete(s, 0);
+	}
+
+	return transmit(s);
+}
+
+int sender_close(sender_t s){
+	if ( !s ){
+		return EINVAL;
+	}
+
+	/* mark the last frame, an empty frame is only sent if nothing is pending */
+	if ( s->nopkts == 0 && s->num_queued > 0 ){
+		struct sendhead* sh = (struct sendhead*)((char*)s->iov[s->num_queued-1].iov_base + s->header);
+		sh->flags |= htonl(SENDER_FLUSH);
+	} else {
+		frame_complete(s, SENDER_FLUSH);
+	}
+
+	const int ret = transmit(s);
+	free(s);
+	return ret;
+}
+
+const struct sender_stat* sender_get_stat(const sender_t s){
+	return &s->stat;
+}
@@ -30,6 +30,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <assert.h>
 #include <arpa/inet.h>
 #include <errno.h>
@@ -39,6 +40,107 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 
+void stream_chunk_init(struct stream* st, char* base, size_t size, size_t num_chunks){
+	st->chunk_base = base;
+	st->chunk_size = size;
+	st->num_chunks = num_chunks;
+}
+
+/**
+ * Find the chunk holding ptr, chunks within the stream buffer is added on
+ * demand.
+ */
+static struct stream_chunk* stream_chunk_find(struct stream* st, const char* ptr){
+	for ( struct stream_chunk* chunk = st->chunks; chunk; chunk = chunk->next ){
+		if ( ptr >= chunk->data && ptr < chunk->data + chunk->size ){
+			return chunk;
+		}
+	}
+
+	if ( ptr < st->chunk_base || ptr >= st->chunk_base + st->chunk_size * st->num_chunks ){
+		return NULL;
+	}
+
+	struct stream_chunk* chunk = malloc(sizeof(struct stream_chunk));
+	if ( !chunk ){
+		return NULL;
+	}
+
+	chunk->data = st->chunk_base + (ptr - st->chunk_base) / st->chunk_size * st->chunk_size;
+	chunk->size = st->chunk_size;
+	chunk->refs = 0;
+	chunk->live = 1;
+	chunk->owned = 0;
+	chunk->next = st->chunks;
+	st->chunks = chunk;
+	return chunk;
+}
+
+static int stream_chunk_retain(struct stream* st, const cap_head* cp){
+	struct stream_chunk* chunk = stream_chunk_find(st, (const char*)cp);
+	if ( !chunk ){
+		return EINVAL;
+	}
+
+	chunk->refs++;
+	return 0;
+}
+
+static int stream_chunk_release(struct stream* st, const cap_head* cp){
+	struct stream_chunk* chunk = stream_chunk_find(st, (const char*)cp);
+	if ( !chunk || chunk->refs == 0 ){
+		return EINVAL;
+	}
+
+	/* when the last packet of a replaced chunk is released it is free for reuse */
+	chunk->refs--;
+	return 0;
+}
+
+char* stream_chunk_reuse(struct stream* st, char* data){
+	struct stream_chunk* chunk;
+	for ( chunk = st->chunks; chunk; chunk = chunk->next ){
+		if ( chunk->data == data ) break;
+	}
+
+	/* common case, nothing retained */
+	if ( !chunk || chunk->refs == 0 ){
+		return data;
+	}
+
+	/* replace with a free chunk of the same size */
+	chunk->live = 0;
+	for ( struct stream_chunk* cur = st->chunks; cur; cur = cur->next ){
+		if ( !cur->live && cur->refs == 0 && cur->size == chunk->size ){
+			cur->live = 1;
+			return cur->data;
+		}
+	}
+
+	struct stream_chunk* fresh = malloc(sizeof(struct stream_chunk) + chunk->size);
+	if ( !fresh ){
+		chunk->live = 1;
+		return NULL;
+	}
+
+	fresh->data = (char*)(fresh + 1);
+	fresh->size = chunk->size;
+	fresh->refs = 0;
+	fresh->live = 1;
+	fresh->owned = 1;
+	fresh->next = st->chunks;
+	st->chunks = fresh;
+	return fresh->data;
+}
+
+static void stream_chunk_free(struct stream_chunk* chunk){
+	while ( chunk ){
+		struct stream_chunk* next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+}
+
 int stream_alloc(struct stream** stptr, enum protocol_t protocol, size_t size, size_t buffer_size, size_t mtu){
 	assert(stptr);
 
@@ -63,6 +165,10 @@ int stream_alloc(struct stream** stptr, enum protocol_t protocol, size_t size, s
 	st->num_addresses = 0;
 	st->if_mtu = mtu;
 	st->if_loopback = 0;
+	st->fd = -1;
+	st->loopback_warned = 0;
+	st->frame_header = 0;
+	st->frame_size = 0;
 	st->stat.read = 0;
 	st->stat.recv = 0;
 	st->stat.matched = 0;
@@ -75,6 +181,14 @@ int stream_alloc(struct stream** stptr, enum protocol_t protocol, size_t size, s
 	st->write = NULL;
 	st->read = NULL;
 	st->flush = NULL;
+	st->peek = NULL;
+	st->retain = stream_chunk_retain;
+	st->release = stream_chunk_release;
+	st->transmit = NULL;
+
+	/* the whole buffer is a single chunk unless the stream splits it */
+	st->chunks = NULL;
+	stream_chunk_init(st, st->buffer, buffer_size, 1);
 
 	/* reset memory */
 	memset(st->buffer, 0, buffer_size);
@@ -88,36 +202,35 @@ int stream_alloc(struct stream** stptr, enum protocol_t protocol, size_t size, s
 
 /**
  * Return current time as a string.
- * @return pointer to internal memory, not threadsafe. Subsequent calls will overwrite data.
+ * @return pointer to buf.
  */
-static const char* timestr(){
-	static char timestr[64];
-
+static const char* timestr(char buf[64]){
 	time_t t = time(NULL);
-	struct tm tm = *localtime(&t);
-	strftime(timestr, sizeof(timestr), "%a, %d %b %Y %H:%M:%S %z", &tm);
+	struct tm tm;
+	localtime_r(&t, &tm);
+	strftime(buf, 64, "%a, %d %b %Y %H:%M:%S %z", &tm);
 
-	return timestr;
+	return buf;
 }
 
-void match_inc_seqnr(const struct stream* st, long unsigned int* restrict seq, const struct sendhead* restrict sh){
+void match_inc_seqnr(struct stream* st, long unsigned int* restrict seq, const struct sendhead* restrict sh){
+	char buf[64];
 	const int expected = *seq;
 	const int got = ntohl(sh->sequencenr);
 
 	/* detect loopback device with duplicate packets */
 	const int loopback_dup = st->if_loopback && expected == got + 1;
 	if ( __builtin_expect(loopback_dup, 0) ){
-		static int loopback_warning = 1;
-		if ( loopback_warning ){
-			fprintf(stderr, "[%s] Warning: a loopback device receiving duplicate packets has been detected, duplicates will be ignored but it will incur degraded performance.\n", timestr());
-			loopback_warning = 0;
+		if ( !st->loopback_warned ){
+			fprintf(stderr, "[%s] Warning: a loopback device receiving duplicate packets has been detected, duplicates will be ignored but it will incur degraded performance.\n", timestr(buf));
+			st->loopback_warned = 1;
 		}
 		return;
 	}
 
 	/* validate sequence number */
 	if( __builtin_expect(expected != got, 0) ){
-		fprintf(stderr,"[%s] Mismatch of sequence numbers. Expected %d got %d (%d frame(s) missing, pkgcount: %"PRIu64")\n", timestr(), expected, got, (got-expected), st->stat.recv);
+		fprintf(stderr,"[%s] Mismatch of sequence numbers. Expected %d got %d (%d frame(s) missing, pkgcount: %"PRIu64")\n", timestr(buf), expected, got, (got-expected), st->stat.recv);
 		*seq = ntohl(sh->sequencenr); /* reset sequence number */
 		abort();
 	}
@@ -140,6 +253,40 @@ const char* stream_get_comment(const stream_t st){
 	return st->comment;
 }
 
+/**
+ * Tell if c delimits a key=value tag in a comment.
+ */
+static int is_tag_delimiter(char c){
+	return c == 0 || c == ' ' || c == '(' || c == ')' || c == ',' || c == ';';
+}
+
+uint64_t stream_get_sample_rate(const stream_t st){
+	static const char key[] = "sample-rate=";
+	const char* cur = st->comment;
+
+	/* the key must be a separate word and the value a plain number, e.g. a
+	 * comment mentioning "resample-rate=2" or "sample-rate=2x" is ignored */
+	while ( cur && (cur=strstr(cur, key)) ){
+		const int delimited = cur == st->comment || is_tag_delimiter(cur[-1]);
+		const char* value = cur + sizeof(key) - 1;
+		cur = value;
+		if ( !delimited || !isdigit((unsigned char)*value) ){
+			continue;
+		}
+
+		char* end;
+		errno = 0;
+		const uint64_t rate = strtoull(value, &end, 10);
+		if ( errno != 0 || !is_tag_delimiter(*end) ){
+			continue;
+		}
+
+		return rate > 0 ? rate : 1;
+	}
+
+	return 1;
+}
+
 const char* stream_get_mampid(const stream_t st){
 	return st->FH.mpid;
 }
@@ -204,12 +351,24 @@ int stream_open(stream_t* stptr, const stream_addr_t* dest, const char* iface, s
 		//ret = stream_udp_open(stptr, &dest->ipv4, iface); /* Old */ 
 		struct sockaddr_in tmp;
 		memcpy(&tmp, &dest->ipv4, sizeof tmp);
-		ret = stream_udp_open(stptr, &tmp, iface);
+		ret = stream_udp_open(stptr, &tmp, iface, stream_addr_flags(dest));
 		break;
 	  }
 	case STREAM_ADDR_TCP:
-		fprintf(stderr, "Unhandled protocol %d\n", stream_addr_type(dest));
-		return ERROR_NOT_IMPLEMENTED;
+	  {
+		struct sockaddr_in tmp;
+		memcpy(&tmp, &dest->ipv4, sizeof tmp);
+		ret = stream_tcp_open(stptr, &tmp, buffer_size);
+		break;
+	  }
+
+	case STREAM_ADDR_SHM:
+		ret = stream_shm_open(stptr, stream_addr_have_flag(dest, STREAM_ADDR_LOCAL) ? dest->local_filename : dest->filename);
+		break;
+
+	case STREAM_ADDR_IFACE:
+		ret = stream_iface_open(stptr, stream_addr_have_flag(dest, STREAM_ADDR_LOCAL) ? dest->local_filename : dest->filename, iface, buffer_size);
+		break;
 	}
 
 	/** @note Only shallow copy, it might cause issues if using a local path which
@@ -270,7 +429,19 @@ int stream_create(stream_t* stptr, const stream_addr_t* dest, const char* nic, c
 		break;
 	  }
 	case STREAM_ADDR_TCP:
-		return ERROR_NOT_IMPLEMENTED;
+	  {
+		struct sockaddr_in tmp;
+		memcpy(&tmp, &dest->ipv4, sizeof tmp);
+		ret = stream_tcp_create(stptr, &tmp, mpid, comment, flags);
+		break;
+	  }
+
+	case STREAM_ADDR_SHM:
+		ret = stream_shm_create(stptr, stream_addr_have_flag(dest, STREAM_ADDR_LOCAL) ? dest->local_filename : dest->filename, mpid, comment);
+		break;
+
+	case STREAM_ADDR_IFACE:
+		return EINVAL; /* capture only */
 	}
 
 	/** @note Only shallow copy, it might cause issues if using a local path which
@@ -305,7 +476,12 @@ int stream_create(stream_t* stptr, const stream_addr_t* dest, const char* nic, c
 
 int stream_close(stream_t st){
 	if ( st == NULL ) return 0;
-	return st->destroy ? st->destroy(st) : 0;
+
+	/* chunks may be used as the buffer so they are free'd after the stream */
+	struct stream_chunk* chunks = st->chunks;
+	const int ret = st->destroy ? st->destroy(st) : 0;
+	stream_chunk_free(chunks);
+	return ret;
 
 	/* ret */
 	/* errno=0; */
@@ -394,10 +570,18 @@ static int fill_buffer(stream_t st, struct timeval* timeout){
 		return 0;
 	}
 
-	/* copy old content */
+	/* copy old content (to a new chunk if the current holds retained packets) */
 	if ( st->readPos > 0 ){
 		size_t bytes = st->writePos - st->readPos;
-		memmove(st->buffer, st->buffer + st->readPos, bytes); /* move content */
+		char* buffer = stream_chunk_reuse(st, st->buffer);
+		if ( !buffer ){
+			return ENOMEM;
+		} else if ( buffer != st->buffer ){
+			memcpy(buffer, st->buffer + st->readPos, bytes);
+			st->buffer = buffer;
+		} else {
+			memmove(st->buffer, st->buffer + st->readPos, bytes); /* move content */
+		}
 		st->writePos = bytes;
 		st->readPos = 0;
 		available = st->buffer_size - bytes;
@@ -523,10 +707,36 @@ int stream_read_cb(stream_t st, stream_read_callback_t callback, struct filter*
 	return callback(st, cp);
 }
 
+int stream_retain(stream_t st, const cap_head* cp){
+	if ( !st->retain ){
+		return ERROR_NOT_IMPLEMENTED;
+	}
+	return st->retain(st, cp);
+}
+
+int stream_release(stream_t st, const cap_head* cp){
+	if ( !st->release ){
+		return ERROR_NOT_IMPLEMENTED;
+	}
+	return st->release(st, cp);
+}
+
+int stream_get_fd(const stream_t st){
+	return st->fd;
+}
+
+int stream_try_read(stream_t st, cap_head** header, struct filter* filter){
+	struct timeval timeout = {0,0};
+	return stream_read(st, header, filter, &timeout);
+}
+
 int stream_peek(stream_t st, cap_head** header, struct filter* filter){
+	if ( st->peek ){
+		return st->peek(st, header, filter);
+	}
+
 	if ( st->read ){
-		fprintf(stderr, "stream_peek not implemented for this stream type\n");
-		abort();
+		return ERROR_NOT_IMPLEMENTED;
 	}
 
 	struct timeval timeout = {0,0};
@@ -568,7 +778,7 @@ int stream_peek(stream_t st, cap_head** header, struct filter* filter){
 	return 0;
 }
 
-static const char* type[6] = {"file", "ethernet", "udp", "tcp", "file", "fifo"};
+static const char* type[8] = {"file", "ethernet", "udp", "tcp", "file", "fifo", "shm", "iface"};
 int stream_from_getopt(stream_t* st, char* argv[], int optind, int argc, const char* iface, const char* defaddr, const char* program_name, size_t buffer_size){
 	int ret;
 	stream_addr_t addr = STREAM_ADDR_INITIALIZER;
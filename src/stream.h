@@ -23,6 +23,7 @@
 #include <caputils/caputils.h>
 #include <caputils/send.h>
 #include <caputils/stream.h>
+#include <sys/uio.h>
 
 /**
  * Allocate and initialize a stream.
@@ -54,6 +55,34 @@ typedef int (*read_callback)(struct stream* st, cap_head** header, const struct
 
 typedef int (*flush_callback)(struct stream* st);
 
+typedef int (*peek_callback)(struct stream* st, cap_head** header, struct filter* filter);
+
+typedef int (*retain_callback)(struct stream* st, const cap_head* header);
+
+typedef int (*release_callback)(struct stream* st, const cap_head* header);
+
+/**
+ * Transmit a batch of measurement frames (see caputils/sender.h). Each frame
+ * starts with frame_header bytes reserved for the link header, which is filled
+ * in by the stream.
+ * @return Number of frames sent or negative on errors (errno is set).
+ */
+typedef int (*transmit_callback)(struct stream* st, struct iovec* frame, size_t num);
+
+/**
+ * A region of the stream buffer holding retained packets (see stream_retain).
+ * Before a region is overwritten it is swapped for a free chunk (allocated if
+ * needed) and the old region is kept until all packets are released.
+ */
+struct stream_chunk {
+	char* data;
+	size_t size;
+	unsigned int refs;                    // Number of retained packets in this chunk
+	int live;                             // Set while the chunk is part of the stream buffer
+	int owned;                            // Set if data is allocated separately (free'd with the stream)
+	struct stream_chunk* next;
+};
+
 // Stream structure, used to manage different types of streams
 struct stream {
 	enum protocol_t type;                 // What type of stream do we have?
@@ -73,30 +102,59 @@ struct stream {
 	unsigned int num_addresses;           // Number of addresses associated with stream
 	size_t if_mtu;                        // Interface MTU (size of the largest measurement frame we may receive on this interface)
 	int if_loopback;                      // Set to non-zero if the stream is a loopback interface.
+	int loopback_warned;                  // Set when the loopback duplicate warning has been shown.
+	int fd;                               // Descriptor which becomes readable when data arrives (-1 if unavailable)
+	size_t frame_header;                  // Size of link header in front of transmitted measurement frames
+	size_t frame_size;                    // Largest measurement frame (sendhead and packets) the stream can transmit
 
 	/* stats */
 	struct stream_stat stat;
 
+	/* retained packets */
+	struct stream_chunk* chunks;          // Chunks with retained packets or available for reuse
+	char* chunk_base;                     // Start of first chunk within the stream buffer
+	size_t chunk_size;                    // Size of each chunk within the stream buffer
+	size_t num_chunks;                    // Number of chunks within the stream buffer
+
 	/* Callback functions */
 	fill_buffer_callback fill_buffer;
 	destroy_callback destroy;
 	write_callback write;
 	read_callback read;
 	flush_callback flush;
+	peek_callback peek;
+	retain_callback retain;
+	release_callback release;
+	transmit_callback transmit;
 };
 
 int is_valid_version(struct file_header_t* fhptr);
 
+/**
+ * Set how the stream buffer is split into chunks, by default the whole buffer
+ * is a single chunk.
+ */
+void stream_chunk_init(struct stream* st, char* base, size_t size, size_t num_chunks);
+
+/**
+ * Must be called before overwriting a chunk of the stream buffer.
+ * @param data Start of the chunk.
+ * @return Pointer to use instead of data (same as data unless it holds
+ *         retained packets) or NULL if allocation failed.
+ */
+char* stream_chunk_reuse(struct stream* st, char* data);
+
 /**
  * Check and increment sequencenumber.
  * prints to stderr on mismatch.
  */
-void match_inc_seqnr(const struct stream* st, long unsigned int* restrict seq, const struct sendhead* restrict sh);
+void match_inc_seqnr(struct stream* st, long unsigned int* restrict seq, const struct sendhead* restrict sh);
 
 int stream_udp_create(stream_t* st, const struct sockaddr_in* addr, const char* iface, int flags);
-int stream_udp_open(stream_t* st, const struct sockaddr_in* addr, const char* iface);
+int stream_udp_open(stream_t* st, const struct sockaddr_in* addr, const char* iface, int flags);
 int stream_udp_add(stream_t stt, const struct in_addr addr);
-int stream_tcp_init(struct stream* st, const char* address, int port);
+int stream_tcp_open(struct stream** stptr, const struct sockaddr_in* addr, size_t buffer_size);
+int stream_tcp_create(struct stream** stptr, const struct sockaddr_in* addr, const char* mpid, const char* comment, int flags);
 
 #ifdef HAVE_PFRING
 long stream_pfring_open(struct stream** stptr, const struct ether_addr* addr, const char* iface, size_t buffer_size);
@@ -118,6 +176,32 @@ int stream_file_open(struct stream** stptr, FILE* fp, const char* filename, size
  */
 int stream_file_create(struct stream** stptr, FILE* fp, const char* filename, const char* mpid, const char* comment, int flags);
 
+/**
+ * pcap and pcapng files (read-only), see stream_file_open.
+ * @param fp Must be a regular file, it is mapped into memory.
+ * @param filename Optional, only used for the comment.
+ */
+int stream_pcap_open(struct stream** stptr, FILE* fp, const char* filename);
+
+/**
+ * Test if the first four bytes of a file is a pcap or pcapng magic number.
+ */
+int stream_pcap_magic(uint32_t magic);
+
+/**
+ * Shared memory stream.
+ * @param address Name with optional options, see stream-address(3).
+ */
+int stream_shm_open(struct stream** stptr, const char* address);
+int stream_shm_create(struct stream** stptr, const char* address, const char* mpid, const char* comment);
+
+/**
+ * Interface capture stream (read-only).
+ * @param address Interface name with optional options, see stream-address(3).
+ * @param iface Interface to use if the address doesn't name one.
+ */
+int stream_iface_open(struct stream** stptr, const char* address, const char* iface, size_t buffer_size);
+
 /**
  * Test if the received number of bytes is valid for this MA frame.
  */
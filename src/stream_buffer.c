@@ -25,12 +25,13 @@
 #include "stream.h"
 #include "caputils/filter.h"
 #include <errno.h>
+#include <string.h>
 
 size_t stream_frame_buffer_size(size_t num_frames, size_t mtu){
 	return num_frames * mtu + sizeof(char*) * num_frames;
 }
 
-void stream_frame_init(struct stream_frame_buffer* fb, read_frame_callback cb, char* src, size_t num_frames, size_t frame_size){
+void stream_frame_init(stream_t st, struct stream_frame_buffer* fb, read_frame_callback cb, char* src, size_t num_frames, size_t frame_size){
 	const size_t frame_offset = sizeof(char*) * num_frames;
 
 	fb->read_frame = cb;
@@ -39,54 +40,118 @@ void stream_frame_init(struct stream_frame_buffer* fb, read_frame_callback cb, c
 	fb->num_frames = num_frames;
 	fb->num_packets = 0;
 	fb->header_offset = 0;
+	fb->read_coalesced = NULL;
+	fb->coalesced = NULL;
+	fb->coalesced_size = 0;
+	fb->segment_ptr = NULL;
+	fb->segment_left = 0;
+	fb->segment_size = 0;
 
 	/* setup buffer pointers (see brief overview at struct declaration) */
 	fb->read_ptr = NULL;
 	for ( unsigned int i = 0; i < num_frames; i++ ){
 		fb->frame[i] = src + frame_offset + i * frame_size;
 	}
+
+	/* each frame is retained separately (see stream_retain) */
+	stream_chunk_init(st, src + frame_offset, frame_size, num_frames);
 }
 
-static int read_frame(stream_t st, struct stream_frame_buffer* fb, struct timeval* timeout){
-	if ( !fb->read_frame(st, fb->frame[st->writePos], timeout) ){
-		return 0;
+void stream_frame_coalesce(struct stream_frame_buffer* fb, read_coalesced_callback cb, char* buffer, size_t size){
+	fb->read_coalesced = cb;
+	fb->coalesced = buffer;
+	fb->coalesced_size = size;
+	fb->segment_ptr = NULL;
+	fb->segment_left = 0;
+	fb->segment_size = 0;
+}
+
+/**
+ * Copy the next frame from the coalesced buffer, receiving more frames if it is
+ * empty.
+ */
+static int split_frame(stream_t st, struct stream_frame_buffer* fb, char* dst, struct timeval* timeout){
+	while ( fb->segment_left == 0 ){
+		size_t segment = 0;
+		const size_t bytes = fb->read_coalesced(st, fb->coalesced, fb->coalesced_size, &segment, timeout);
+		if ( bytes == 0 ){
+			return 0;
+		}
+
+		/* frames larger than a buffer region cannot be stored */
+		if ( segment == 0 || segment > fb->frame_size ){
+			continue;
+		}
+
+		fb->segment_ptr = fb->coalesced;
+		fb->segment_left = bytes;
+		fb->segment_size = segment;
 	}
 
-	/* increment write position */
-	st->writePos = (st->writePos+1) % fb->num_frames;
+	const size_t size = fb->segment_left < fb->segment_size ? fb->segment_left : fb->segment_size;
+	memcpy(dst, fb->segment_ptr, size);
+	fb->segment_ptr += size;
+	fb->segment_left -= size;
 	return 1;
 }
 
-int stream_frame_buffer_read(stream_t st, struct stream_frame_buffer* fb, struct cap_header** header, struct filter* filter, struct timeval* timeout){
-	/* I heard ext is a pretty cool guy, uses goto and doesn't afraid of anything */
-	retry:
+static int read_frame(stream_t st, struct stream_frame_buffer* fb, struct timeval* timeout){
+	/* sender has terminated, no more frames will arrive (but some might still be coalesced) */
+	if ( st->flushed && fb->segment_left == 0 ){
+		return 0;
+	}
 
-	/* empty buffer */
-	if ( !fb->read_ptr ){
-		if ( !read_frame(st, fb, timeout) ){
-			return EAGAIN;
+	/* the frame might hold retained packets */
+	char* frame = stream_chunk_reuse(st, fb->frame[st->writePos]);
+	if ( !frame ){
+		return 0;
+	}
+	fb->frame[st->writePos] = frame;
+
+	if ( fb->read_coalesced ){
+		if ( !split_frame(st, fb, frame, timeout) ){
+			return 0;
 		}
+	} else if ( !fb->read_frame(st, frame, timeout) ){
+		return 0;
+	}
 
-		char* frame = fb->frame[st->readPos];
-		struct sendhead* sh = (struct sendhead*)(frame + fb->header_offset);
-		fb->read_ptr = frame + fb->header_offset + sizeof(struct sendhead);
-		fb->num_packets = ntohl(sh->nopkts);
+	/* empty frames (a sender flushing with no pending packets) is not buffered */
+	const struct sendhead* sh = (const struct sendhead*)(frame + fb->header_offset);
+	if ( ntohl(sh->nopkts) == 0 ){
+		return 0;
 	}
 
-	/* always read if there is space available */
-	if ( st->writePos != st->readPos ){
-		struct timeval tv = {0,0}; /* dont read with a timeout as we don't want to introduce delays here */
-		read_frame(st, fb, &tv);
+	/* increment write position */
+	st->writePos = (st->writePos+1) % fb->num_frames;
+	return 1;
+}
+
+/**
+ * Ensure the current frame is loaded, reading a new frame if needed.
+ * @return Non-zero if a frame is available.
+ */
+static int load_frame(stream_t st, struct stream_frame_buffer* fb, struct timeval* timeout){
+	if ( fb->read_ptr ){
+		return 1;
 	}
 
-	/* no packets available */
-	if ( fb->num_packets == 0 ){
-		fprintf(stderr, "stream_frame_buffer_read: st->num_packets is 0 but st->read_ptr is set\n");
-		abort();
+	if ( !read_frame(st, fb, timeout) ){
+		return 0;
 	}
 
-	/* find next packet */
-	struct cap_header* cp = (struct cap_header*)(fb->read_ptr);
+	char* frame = fb->frame[st->readPos];
+	struct sendhead* sh = (struct sendhead*)(frame + fb->header_offset);
+	fb->read_ptr = frame + fb->header_offset + sizeof(struct sendhead);
+	fb->num_packets = ntohl(sh->nopkts);
+	return 1;
+}
+
+/**
+ * Move past the packet currently pointed to by the read pointer.
+ */
+static void next_packet(stream_t st, struct stream_frame_buffer* fb){
+	const struct cap_header* cp = (const struct cap_header*)(fb->read_ptr);
 	const size_t packet_size = sizeof(struct cap_header) + cp->caplen;
 	fb->num_packets--;
 	fb->read_ptr += packet_size;
@@ -103,6 +168,33 @@ int stream_frame_buffer_read(stream_t st, struct stream_frame_buffer* fb, struct
 			fb->num_packets = ntohl(sh->nopkts);
 		}
 	}
+}
+
+int stream_frame_buffer_read(stream_t st, struct stream_frame_buffer* fb, struct cap_header** header, struct filter* filter, struct timeval* timeout){
+	/* I heard ext is a pretty cool guy, uses goto and doesn't afraid of anything */
+	retry:
+
+	/* empty buffer */
+	if ( !load_frame(st, fb, timeout) ){
+		/* sender has terminated and all frames have been consumed */
+		return st->flushed ? -1 : EAGAIN;
+	}
+
+	/* always read if there is space available */
+	if ( st->writePos != st->readPos ){
+		struct timeval tv = {0,0}; /* dont read with a timeout as we don't want to introduce delays here */
+		read_frame(st, fb, &tv);
+	}
+
+	/* no packets available */
+	if ( fb->num_packets == 0 ){
+		fprintf(stderr, "stream_frame_buffer_read: st->num_packets is 0 but st->read_ptr is set\n");
+		abort();
+	}
+
+	/* find next packet */
+	struct cap_header* cp = (struct cap_header*)(fb->read_ptr);
+	next_packet(st, fb);
 
 	/* set next packet and advance the read pointer */
 	*header = cp;
@@ -116,3 +208,22 @@ int stream_frame_buffer_read(stream_t st, struct stream_frame_buffer* fb, struct
 	st->stat.matched++;
 	return 0;
 }
+
+int stream_frame_buffer_peek(stream_t st, struct stream_frame_buffer* fb, struct cap_header** header, struct filter* filter){
+	struct timeval timeout = {0,0};
+
+	do {
+		if ( !load_frame(st, fb, &timeout) ){
+			return st->flushed ? -1 : EAGAIN;
+		}
+
+		struct cap_header* cp = (struct cap_header*)(fb->read_ptr);
+		if ( !filter || filter_match(filter, cp->payload, cp) ){
+			*header = cp;
+			return 0;
+		}
+
+		/* discard non-matching packet (see stream_peek) */
+		next_packet(st, fb);
+	} while (1);
+}
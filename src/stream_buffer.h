@@ -53,10 +53,18 @@ extern "C" {
  *    beginning of the layout.
  *  - `stream_frame_buffer_init(..)`.
  *  - Use a custom `read_callback` which calls `stream_frame_buffer_read`.
+ *  - Use a custom `peek_callback` which calls `stream_frame_buffer_peek`.
  */
 
 typedef int (*read_frame_callback)(stream_t st, char* dst, struct timeval* timeout);
 
+/**
+ * Read multiple frames at once (e.g. UDP GRO). Frames is stored back-to-back
+ * in dst and each is segment bytes long (the last frame may be shorter).
+ * @return Number of bytes read or zero if nothing was read.
+ */
+typedef size_t (*read_coalesced_callback)(stream_t st, char* dst, size_t max, size_t* segment, struct timeval* timeout);
+
 struct stream_frame_buffer {
 	read_frame_callback read_frame;  /* Read next frame */
 	size_t frame_size;               /* Number of bytes in one frame */
@@ -65,6 +73,14 @@ struct stream_frame_buffer {
 	size_t header_offset;            /* How many bytes of headers to skip to get to sendheader */
 	char* read_ptr;                  /* Where inside a frame it currently is or NULL if a frame hasn't been processed yet */
 	char** frame;                    /* Pointer to first frame */
+
+	/* coalesced frames (see stream_frame_coalesce) */
+	read_coalesced_callback read_coalesced;
+	char* coalesced;                 /* Buffer holding frames received at once */
+	size_t coalesced_size;           /* Size of the coalesced buffer */
+	const char* segment_ptr;         /* Next frame in the coalesced buffer */
+	size_t segment_left;             /* Bytes left in the coalesced buffer */
+	size_t segment_size;             /* Size of each frame in the coalesced buffer */
 };
 
 /**
@@ -78,13 +94,26 @@ size_t stream_frame_buffer_size(size_t num_frames, size_t mtu);
  * @param src Pointer to the start of the stream buffer.
  * @param frame_size Usually MTU + sizeof(struct ethhdr)
  */
-void stream_frame_init(struct stream_frame_buffer* buf, read_frame_callback cb, char* src, size_t num_frames, size_t frame_size);
+void stream_frame_init(stream_t st, struct stream_frame_buffer* buf, read_frame_callback cb, char* src, size_t num_frames, size_t frame_size);
+
+/**
+ * Receive frames using a coalesced buffer instead of one frame at a time. The
+ * buffer is split into frames as they are needed, replacing read_frame.
+ * @param buffer Coalesced buffer, owned by the caller.
+ */
+void stream_frame_coalesce(struct stream_frame_buffer* fb, read_coalesced_callback cb, char* buffer, size_t size);
 
 /**
  * Read the next packet from the buffer.
  */
 int stream_frame_buffer_read(stream_t st, struct stream_frame_buffer* fb, struct cap_header** cp, struct filter* filter, struct timeval* timeout);
 
+/**
+ * Get the next packet from the buffer without consuming it. Never blocks.
+ * @return Same as stream_peek.
+ */
+int stream_frame_buffer_peek(stream_t st, struct stream_frame_buffer* fb, struct cap_header** cp, struct filter* filter);
+
 #ifdef __cplusplus
 }
 #endif
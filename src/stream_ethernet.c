@@ -82,11 +82,7 @@ static int stream_ethernet_read_frame(struct stream_ethernet* st, char* dst, str
 	assert(dst);
 
 	do {
-		fd_set fds;
-		FD_ZERO(&fds);
-		FD_SET(st->socket, &fds);
-
-		if ( select(st->socket+1, &fds, NULL, NULL, timeout) != 1 ){
+		if ( poll_readable(st->socket, timeout) != 1 ){
 			break;
 		}
 
@@ -162,6 +158,10 @@ int stream_ethernet_read(struct stream_ethernet* st, cap_head** cp, struct filte
 	return stream_frame_buffer_read(&st->base, &st->fb, cp, filter, timeout);
 }
 
+static int stream_ethernet_peek(struct stream_ethernet* st, cap_head** cp, struct filter* filter){
+	return stream_frame_buffer_peek(&st->base, &st->fb, cp, filter);
+}
+
 static long stream_ethernet_write(struct stream_ethernet* st, const void* data, size_t size){
 	const size_t payload_size = size - sizeof(struct ethhdr);
 	if ( payload_size > st->base.if_mtu ){
@@ -174,6 +174,25 @@ static long stream_ethernet_write(struct stream_ethernet* st, const void* data,
 	return 0;
 }
 
+static int stream_ethernet_transmit(struct stream_ethernet* st, struct iovec* frame, size_t num){
+	struct mmsghdr msg[num];
+	memset(msg, 0, sizeof(struct mmsghdr) * num);
+
+	for ( size_t i = 0; i < num; i++ ){
+		struct ethhdr* eh = (struct ethhdr*)frame[i].iov_base;
+		memcpy(eh->h_dest, &st->address[0], ETH_ALEN);
+		memcpy(eh->h_source, st->sll.sll_addr, ETH_ALEN);
+		eh->h_proto = htons(ETHERTYPE_MP);
+
+		msg[i].msg_hdr.msg_name = &st->sll;
+		msg[i].msg_hdr.msg_namelen = sizeof(st->sll);
+		msg[i].msg_hdr.msg_iov = &frame[i];
+		msg[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	return sendmmsg(st->socket, msg, num, 0);
+}
+
 long stream_ethernet_add(struct stream* stt, const struct ether_addr* addr){
 	struct stream_ethernet* st= (struct stream_ethernet*)stt;
 
@@ -259,13 +278,14 @@ static int stream_ethernet_init(struct stream** stptr, const struct ether_addr*
 		return ret;
 	}
 	struct stream_ethernet* st = (struct stream_ethernet*)*stptr;
-	stream_frame_init(&st->fb, (read_frame_callback)stream_ethernet_read_frame, (char*)st->frame, num_frames, frame_size);
+	stream_frame_init(&st->base, &st->fb, (read_frame_callback)stream_ethernet_read_frame, (char*)st->frame, num_frames, frame_size);
 
 	/* open raw socket */
 	if ( (st->socket=socket(AF_PACKET, SOCK_RAW, htons(proto))) < 0 ){
 		return errno;
 	}
 
+	st->base.fd = st->socket;
 	st->fb.header_offset = sizeof(struct ethhdr);
 	st->if_index = ifstat.if_index;
 	st->base.if_loopback = ifstat.if_loopback;
@@ -313,6 +333,9 @@ long stream_ethernet_create(struct stream** stptr, const struct ether_addr* addr
 	st->base.fill_buffer = NULL;
 	st->base.destroy = (destroy_callback)destroy;
 	st->base.write = (write_callback)stream_ethernet_write;
+	st->base.transmit = (transmit_callback)stream_ethernet_transmit;
+	st->base.frame_header = sizeof(struct ethhdr);
+	st->base.frame_size = st->base.if_mtu;
 
 	return 0;
 }
@@ -335,6 +358,7 @@ long stream_ethernet_open(struct stream** stptr, const struct ether_addr* addr,
 	st->base.destroy = (destroy_callback)destroy;
 	st->base.write = NULL;
 	st->base.read = (read_callback)stream_ethernet_read;
+	st->base.peek = (peek_callback)stream_ethernet_peek;
 
 	return 0;
 }
@@ -0,0 +1,439 @@
+/**
+ * libcap_utils - DPMI capture utilities
+ * Copyright (C) 2003-2013 (see AUTHORS)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include "caputils/caputils.h"
+#include "caputils_int.h"
+#include "stream.h"
+#include <assert.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Fan-out stream.
+ *
+ * Packets read from the source is retained in the source stream once per child
+ * (see stream_retain) so all children share the same packet without copying
+ * it. Packets is kept in a queue indexed by a sequence number and each child
+ * has its own cursor into the queue. A child releases its reference on the
+ * next read (or when closed) so the packet is released as soon as the slowest
+ * child passes it. If the queue grows larger than the buffer size the oldest
+ * packets is dropped for children lagging behind.
+ *
+ * If the source doesn't support retaining packets each packet is instead
+ * copied once into a reference counted entry.
+ */
+
+#define FANOUT_DEFAULT_BUFFER (16*1024*1024)
+
+enum fanout_mode {
+	FANOUT_UNKNOWN = 0,            /* no packet read yet */
+	FANOUT_RETAIN,                 /* packets is retained in the source */
+	FANOUT_COPY,                   /* source cannot retain, packets is copied */
+};
+
+struct fanout_copy {
+	size_t refs;                   /* children which hasn't released the packet */
+	struct cap_header cp;          /* copy of the packet (followed by payload) */
+};
+
+struct fanout_slot {
+	cap_head* cp;
+	size_t size;                   /* size of packet (cp might be released already) */
+};
+
+struct fanout {
+	stream_t src;
+	size_t num_children;
+	size_t num_open;               /* children not yet closed */
+	int eof;                       /* set when the source is exhausted */
+	enum fanout_mode mode;
+
+	uint64_t first;                /* sequence number of the oldest queued packet */
+	uint64_t last;                 /* sequence number of the next packet */
+	size_t capacity;               /* size of queue (power of two) */
+	struct fanout_slot* queue;
+	size_t bytes;                  /* size of all queued packets */
+	size_t max_bytes;
+
+	struct stream_fanout* child[];
+};
+
+struct stream_fanout {
+	struct stream base;
+	struct fanout* shared;
+	uint64_t cursor;               /* sequence number of the next packet to read */
+	cap_head* current;             /* packet handed to the user, released on next read */
+	int closed;
+};
+
+static struct fanout_slot* slot_at(const struct fanout* fo, uint64_t seq){
+	return &fo->queue[seq & (fo->capacity - 1)];
+}
+
+static struct fanout_copy* copy_from_packet(const cap_head* cp){
+	return (struct fanout_copy*)((uintptr_t)cp - offsetof(struct fanout_copy, cp));
+}
+
+static int packet_retain(struct fanout* fo, const cap_head* cp){
+	if ( fo->mode == FANOUT_COPY ){
+		copy_from_packet(cp)->refs++;
+		return 0;
+	}
+	return stream_retain(fo->src, cp);
+}
+
+static int packet_release(struct fanout* fo, const cap_head* cp){
+	if ( !cp ){
+		return 0;
+	}
+
+	if ( fo->mode == FANOUT_COPY ){
+		struct fanout_copy* copy = copy_from_packet(cp);
+		if ( --copy->refs == 0 ){
+			free(copy);
+		}
+		return 0;
+	}
+
+	return stream_release(fo->src, cp);
+}
+
+/**
+ * Take one reference per open child on a packet read from the source.
+ * @return Packet to queue or NULL on errors (errno is set).
+ */
+static cap_head* packet_share(struct fanout* fo, cap_head* cp){
+	int ret;
+
+	if ( fo->mode != FANOUT_COPY ){
+		for ( size_t i = 0; i < fo->num_open; i++ ){
+			if ( (ret=stream_retain(fo->src, cp)) == 0 ) continue;
+
+			/* only the first packet can tell if the source supports it */
+			if ( fo->mode == FANOUT_UNKNOWN && ret == ERROR_NOT_IMPLEMENTED ){
+				fo->mode = FANOUT_COPY;
+				break;
+			}
+
+			while ( i-- > 0 ){
+				stream_release(fo->src, cp);
+			}
+			errno = ret;
+			return NULL;
+		}
+
+		if ( fo->mode != FANOUT_COPY ){
+			fo->mode = FANOUT_RETAIN;
+			return cp;
+		}
+	}
+
+	const size_t bytes = sizeof(struct cap_header) + cp->caplen;
+	struct fanout_copy* copy = malloc(offsetof(struct fanout_copy, cp) + bytes);
+	if ( !copy ){
+		errno = ENOMEM;
+		return NULL;
+	}
+	memcpy(&copy->cp, cp, bytes);
+	copy->refs = fo->num_open;
+	return &copy->cp;
+}
+
+/**
+ * Remove the oldest packet from the queue, children which hasn't read it yet
+ * will skip it.
+ */
+static void queue_pop(struct fanout* fo){
+	const struct fanout_slot* slot = slot_at(fo, fo->first);
+
+	for ( size_t i = 0; i < fo->num_children; i++ ){
+		struct stream_fanout* child = fo->child[i];
+		if ( child->closed || child->cursor > fo->first ) continue;
+		child->cursor = fo->first + 1;
+		child->base.stat.dropped++;
+		child->base.stat.buffer_usage -= slot->size;
+		packet_release(fo, slot->cp);
+	}
+
+	fo->bytes -= slot->size;
+	fo->first++;
+}
+
+/**
+ * Remove packets all open children has passed. The packets themselves might
+ * still be alive as the last read packet is held by the child.
+ */
+static void queue_reclaim(struct fanout* fo){
+	uint64_t min = fo->last;
+	for ( size_t i = 0; i < fo->num_children; i++ ){
+		const struct stream_fanout* child = fo->child[i];
+		if ( !child->closed && child->cursor < min ){
+			min = child->cursor;
+		}
+	}
+
+	while ( fo->first < min ){
+		fo->bytes -= slot_at(fo, fo->first)->size;
+		fo->first++;
+	}
+}
+
+static int queue_push(struct fanout* fo, cap_head* cp){
+	/* grow queue */
+	if ( fo->last - fo->first == fo->capacity ){
+		const size_t capacity = fo->capacity * 2;
+		struct fanout_slot* queue = malloc(sizeof(struct fanout_slot) * capacity);
+		if ( !queue ){
+			return ENOMEM;
+		}
+		for ( uint64_t seq = fo->first; seq < fo->last; seq++ ){
+			queue[seq & (capacity - 1)] = *slot_at(fo, seq);
+		}
+		free(fo->queue);
+		fo->queue = queue;
+		fo->capacity = capacity;
+	}
+
+	const size_t bytes = sizeof(struct cap_header) + cp->caplen;
+	struct fanout_slot* slot = slot_at(fo, fo->last);
+	if ( !(slot->cp=packet_share(fo, cp)) ){
+		return errno;
+	}
+	slot->size = bytes;
+	fo->last++;
+	fo->bytes += bytes;
+
+	for ( size_t i = 0; i < fo->num_children; i++ ){
+		struct stream_fanout* child = fo->child[i];
+		if ( child->closed ) continue;
+		child->base.stat.recv++;
+		child->base.stat.buffer_usage += bytes;
+	}
+
+	/* always keep the newest packet */
+	while ( fo->bytes > fo->max_bytes && fo->last - fo->first > 1 ){
+		queue_pop(fo);
+	}
+
+	return 0;
+}
+
+/**
+ * Read the next packet from the source into the queue.
+ */
+static int fanout_fill(struct fanout* fo, struct timeval* timeout){
+	if ( fo->eof ){
+		return -1;
+	}
+
+	cap_head* cp;
+	int ret;
+	switch ( (ret=stream_read(fo->src, &cp, NULL, timeout)) ){
+	case 0:
+		return queue_push(fo, cp);
+	case -1:
+		fo->eof = 1;
+		return -1;
+	default:
+		return ret;
+	}
+}
+
+/**
+ * Get the next packet for child (reading from the source if needed).
+ * @param consume If zero the cursor is not moved (see stream_peek).
+ */
+static int fanout_next(struct stream_fanout* st, cap_head** cp, struct timeval* timeout, int consume){
+	struct fanout* fo = st->shared;
+	int ret;
+
+	if ( st->cursor == fo->last && (ret=fanout_fill(fo, timeout)) != 0 ){
+		return ret;
+	}
+
+	const struct fanout_slot* slot = slot_at(fo, st->cursor);
+	*cp = slot->cp;
+	if ( consume ){
+		st->cursor++;
+		st->base.stat.buffer_usage -= slot->size;
+		queue_reclaim(fo);
+	}
+
+	return 0;
+}
+
+static int stream_fanout_read(struct stream_fanout* st, cap_head** header, struct filter* filter, struct timeval* timeout){
+	int ret;
+
+	/* the previous packet is only valid until the next read */
+	packet_release(st->shared, st->current);
+	st->current = NULL;
+
+	do {
+		if ( (ret=fanout_next(st, &st->current, timeout, 1)) != 0 ){
+			return ret;
+		}
+		st->base.stat.read++;
+
+		if ( !filter || filter_match(filter, st->current->payload, st->current) ){
+			break;
+		}
+
+		packet_release(st->shared, st->current);
+		st->current = NULL;
+	} while (1);
+
+	*header = st->current;
+	st->base.stat.matched++;
+	return 0;
+}
+
+static int stream_fanout_peek(struct stream_fanout* st, cap_head** header, struct filter* filter){
+	struct timeval zero = {0,0};
+	cap_head* cp;
+	int ret;
+
+	do {
+		if ( (ret=fanout_next(st, &cp, &zero, 0)) != 0 ){
+			return ret;
+		}
+
+		if ( !filter || filter_match(filter, cp->payload, cp) ){
+			*header = cp;
+			return 0;
+		}
+
+		/* discard non-matching packet (see stream_peek) */
+		fanout_next(st, &cp, &zero, 1);
+		packet_release(st->shared, cp);
+	} while (1);
+}
+
+static int stream_fanout_retain(struct stream_fanout* st, const cap_head* cp){
+	return packet_retain(st->shared, cp);
+}
+
+static int stream_fanout_release(struct stream_fanout* st, const cap_head* cp){
+	return packet_release(st->shared, cp);
+}
+
+static long stream_fanout_destroy(struct stream_fanout* st){
+	struct fanout* fo = st->shared;
+	long ret = 0;
+
+	/* release the held packet and all packets not yet read */
+	packet_release(fo, st->current);
+	for ( uint64_t seq = st->cursor; seq < fo->last; seq++ ){
+		packet_release(fo, slot_at(fo, seq)->cp);
+	}
+	st->closed = 1;
+	free(st->base.comment);
+	queue_reclaim(fo);
+
+	/* the source and shared state is released with the last child */
+	if ( --fo->num_open == 0 ){
+		ret = stream_close(fo->src);
+		for ( size_t i = 0; i < fo->num_children; i++ ){
+			free(fo->child[i]);
+		}
+		free(fo->queue);
+		free(fo);
+	}
+
+	return ret;
+}
+
+int stream_fanout_open(stream_t* children, stream_t src, size_t num_children, size_t buffer_size){
+	int ret;
+	assert(children);
+
+	if ( !src || num_children == 0 ){
+		return EINVAL;
+	}
+
+	struct fanout* fo = malloc(sizeof(struct fanout) + sizeof(struct stream_fanout*) * num_children);
+	if ( !fo ){
+		return ENOMEM;
+	}
+
+	fo->src = src;
+	fo->num_children = 0;
+	fo->num_open = num_children;
+	fo->eof = 0;
+	fo->mode = FANOUT_UNKNOWN;
+	fo->first = 0;
+	fo->last = 0;
+	fo->capacity = 64;
+	fo->queue = malloc(sizeof(struct fanout_slot) * fo->capacity);
+	fo->bytes = 0;
+	fo->max_bytes = buffer_size > 0 ? buffer_size : FANOUT_DEFAULT_BUFFER;
+
+	if ( !fo->queue ){
+		free(fo);
+		return ENOMEM;
+	}
+
+	for ( size_t i = 0; i < num_children; i++ ){
+		/* the base buffer is unused as packets is held in the shared queue */
+		struct stream_fanout* st;
+		if ( (ret=stream_alloc((struct stream**)&st, src->type, sizeof(struct stream_fanout), 1, src->if_mtu)) != 0 ){
+			for ( size_t j = 0; j < fo->num_children; j++ ){
+				free(fo->child[j]->base.comment);
+				free(fo->child[j]);
+			}
+			free(fo->queue);
+			free(fo);
+			return ret;
+		}
+
+		st->shared = fo;
+		st->cursor = 0;
+		st->current = NULL;
+		st->closed = 0;
+
+		/* present the same header as the source stream */
+		st->base.addr = src->addr;
+		st->base.FH = src->FH;
+		st->base.comment = src->comment ? strdup(src->comment) : NULL;
+		st->base.num_addresses = src->num_addresses;
+		st->base.fd = src->fd;
+		st->base.stat.buffer_size = fo->max_bytes;
+
+		/* callbacks */
+		st->base.destroy = (destroy_callback)stream_fanout_destroy;
+		st->base.read = (read_callback)stream_fanout_read;
+		st->base.peek = (peek_callback)stream_fanout_peek;
+		st->base.retain = (retain_callback)stream_fanout_retain;
+		st->base.release = (release_callback)stream_fanout_release;
+
+		fo->child[fo->num_children++] = st;
+	}
+
+	for ( size_t i = 0; i < num_children; i++ ){
+		children[i] = &fo->child[i]->base;
+	}
+
+	return 0;
+}
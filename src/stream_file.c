@@ -29,6 +29,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/stat.h>
+
+#define FILE_WRITE_BUFFER (1024*1024) /* stdio buffer used when writing regular files */
 
 enum extension_type {
 	HEADER_EXT_NONE = 0,
@@ -44,6 +47,7 @@ struct stream_file {
 	struct stream base;
 	FILE* file;
 	int force_flush; /* force stream to be flushed on every write */
+	int pipe;        /* not a regular file (pipe, fifo, terminal) */
 };
 
 static int stream_file_fillbuffer(struct stream_file* st, struct timeval* timeout, char* dst, size_t max){
@@ -51,6 +55,21 @@ static int stream_file_fillbuffer(struct stream_file* st, struct timeval* timeou
 	assert(st->file);
 	assert(st->base.buffer_size);
 
+	/* pipes is read directly (stdio buffering is disabled when opened) so the
+	 * timeout is honoured and a partial buffer is returned as soon as any data
+	 * is available, fread would block until max bytes has been read. */
+	if ( st->pipe ){
+		switch ( poll_readable(st->base.fd, timeout) ){
+		case -1:
+			return -1;
+		case 0:
+			errno = EAGAIN;
+			return -1;
+		}
+
+		return read(st->base.fd, dst, max); /* zero when the writer closes */
+	}
+
 	size_t readBytes = fread(dst, 1, max, st->file);
 
 	/* check if an error occured, EOF is not considered an error. */
@@ -153,6 +172,16 @@ int stream_file_open(struct stream** stptr, FILE* fp, const char* filename, size
 		}
 	}
 
+	/* pcap and pcapng files is read by a separate parser (only regular files
+	 * as they are mapped into memory, pipes fails the check below) */
+	uint32_t magic;
+	if ( pread(fileno(fp), &magic, sizeof(uint32_t), 0) == sizeof(uint32_t) && stream_pcap_magic(magic) ){
+		if ( (ret=stream_pcap_open(stptr, fp, filename)) != 0 && filename ){
+			fclose(fp);
+		}
+		return ret;
+	}
+
 	/* Use a relative smaller buffer-size by default as it will yield faster
 	 * response-times when using pipes. */
 	if ( buffer_size == 0 ){
@@ -170,8 +199,16 @@ int stream_file_open(struct stream** stptr, FILE* fp, const char* filename, size
 
 	st->base.num_addresses = 1;
 	st->file = fp;
+	st->base.fd = fileno(fp);
 	st->force_flush = 0;
 
+	/* no read-ahead for pipes as the stdio buffer would hide data from poll */
+	struct stat sb;
+	st->pipe = fstat(st->base.fd, &sb) == 0 && !S_ISREG(sb.st_mode);
+	if ( st->pipe ){
+		setvbuf(fp, NULL, _IONBF, 0);
+	}
+
 	/* load stream file header */
 	size_t bytes = fread(fhptr, 1, sizeof(struct file_header_t), st->file);
 	if ( bytes < sizeof(struct file_header_t) ){ /* even if this struct is larger */
@@ -277,6 +314,13 @@ int stream_file_create(struct stream** stptr, FILE* fp, const char* filename, co
 		if( !fp ){
 			return errno;
 		}
+
+		/* larger writes to regular files (pipes keeps the default buffer so
+		 * readers doesn't have to wait as long) */
+		struct stat sb;
+		if ( fstat(fileno(fp), &sb) == 0 && S_ISREG(sb.st_mode) ){
+			setvbuf(fp, NULL, _IOFBF, FILE_WRITE_BUFFER);
+		}
 	}
 
 	/* sanitize comment */
@@ -292,7 +336,9 @@ int stream_file_create(struct stream** stptr, FILE* fp, const char* filename, co
 	struct stream_file* st = (struct stream_file*)*stptr;
 
 	st->file = fp;
+	st->base.fd = fileno(fp);
 	st->force_flush = flags & STREAM_ADDR_FLUSH;
+	st->pipe = 0;
 
 	st->base.num_addresses = 1;
 	st->base.comment = strdup(comment);
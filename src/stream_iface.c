@@ -0,0 +1,455 @@
+/**
+ * libcap_utils - DPMI capture utilities
+ * Copyright (C) 2003-2013 (see AUTHORS)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include "caputils/caputils.h"
+#include "caputils/interface.h"
+#include "caputils_int.h"
+#include "stream.h"
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <net/if.h>
+
+/**
+ * Interface capture stream.
+ *
+ * Captures all traffic on a local interface using an AF_PACKET socket with a
+ * TPACKET_V3 ring. The kernel fills blocks of packets which is handed over when
+ * full or when the block timeout expires. Packets is read directly from the
+ * ring: the cap_header is written in place in front of the packet data (over
+ * the unused part of the kernel header), so no packet is copied. A block is
+ * returned to the kernel when the last packet in it has been read and the
+ * next read is made.
+ */
+
+#define IFACE_BLOCK_SIZE (1024*1024)                /* size of each ring block */
+#define IFACE_DEFAULT_BUFFER (64*IFACE_BLOCK_SIZE)  /* default ring size */
+#define IFACE_FRAME_SIZE 2048                       /* only used to validate the ring */
+#define IFACE_BLOCK_TIMEOUT 10                      /* ms until a partially filled block is handed over */
+#define IFACE_VLAN_HLEN 4                           /* room reserved to re-insert a stripped vlan tag */
+
+#ifndef PACKET_IGNORE_OUTGOING
+#define PACKET_IGNORE_OUTGOING 23
+#endif /* PACKET_IGNORE_OUTGOING */
+
+#ifndef TP_STATUS_VLAN_TPID_VALID
+#define TP_STATUS_VLAN_TPID_VALID (1 << 6)
+#endif /* TP_STATUS_VLAN_TPID_VALID */
+
+struct iface_options {
+	char name[IF_NAMESIZE];
+	char nic[CAPHEAD_NICLEN];
+	char mampid[8];
+	uint32_t caplen;                     /* truncate packets (0 to keep the whole packet) */
+	int promisc;
+	int fanout;                          /* fanout group id or -1 */
+	int fanout_mode;
+	int timeout;                         /* block timeout (ms) */
+};
+
+struct stream_iface {
+	struct stream base;
+	int socket;
+	struct iface_options opt;
+
+	char* map;                           /* the ring */
+	size_t map_size;
+	unsigned int num_blocks;
+	unsigned int block_index;            /* block currently being read */
+	struct tpacket_block_desc* block;    /* current block or NULL if waiting for one */
+	char* next;                          /* next packet in current block */
+	uint32_t remaining;                  /* packets left in current block */
+};
+
+static struct tpacket_block_desc* block_at(const struct stream_iface* st, unsigned int index){
+	return (struct tpacket_block_desc*)(st->map + (size_t)index * IFACE_BLOCK_SIZE);
+}
+
+/**
+ * Return the current block to the kernel and move on to the next.
+ */
+static void release_block(struct stream_iface* st){
+	__atomic_store_n(&st->block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+	st->block = NULL;
+	st->block_index = (st->block_index + 1) % st->num_blocks;
+
+	/* packets the kernel couldn't fit in the ring (counters is reset by the kernel when read) */
+	struct tpacket_stats_v3 stats;
+	socklen_t len = sizeof(stats);
+	if ( getsockopt(st->socket, SOL_PACKET, PACKET_STATISTICS, &stats, &len) == 0 ){
+		st->base.stat.dropped += stats.tp_drops;
+	}
+}
+
+/**
+ * Wait for the next block to be handed over by the kernel.
+ * @return 0 if a block is available, EAGAIN on timeout or errno.
+ */
+static int next_block(struct stream_iface* st, struct timeval* timeout){
+	struct tpacket_block_desc* block = block_at(st, st->block_index);
+
+	while ( !(__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) ){
+		switch ( poll_readable(st->socket, timeout) ){
+		case 1:
+			continue;
+		case 0:
+			return EAGAIN;
+		default:
+			return errno;
+		}
+	}
+
+	st->block = block;
+	st->next = (char*)block + block->hdr.bh1.offset_to_first_pkt;
+	st->remaining = block->hdr.bh1.num_pkts;
+	return 0;
+}
+
+/**
+ * Convert the packet to a capture packet (in place). The cap_header is placed
+ * right before the packet data, over the sockaddr_ll and padding following the
+ * tpacket3_hdr. tp_mac is at least TPACKET3_HDRLEN plus the reserved
+ * IFACE_VLAN_HLEN so the fields up to and including tp_mac is never
+ * overwritten and a packet can be converted again (see stream_iface_peek).
+ *
+ * The kernel strips the vlan tag and passes it in tp_vlan_tci, it is
+ * re-inserted in the reserved room and the header is updated to describe the
+ * tagged frame so the tag is only inserted once.
+ */
+static cap_head* convert_packet(const struct stream_iface* st, struct tpacket3_hdr* hdr){
+	if ( (hdr->tp_status & TP_STATUS_VLAN_VALID) && hdr->tp_snaplen >= 2 * ETH_ALEN ){
+		const uint16_t tpid = (hdr->tp_status & TP_STATUS_VLAN_TPID_VALID) ? hdr->hv1.tp_vlan_tpid : ETH_P_8021Q;
+		const uint16_t tag[2] = {htons(tpid), htons(hdr->hv1.tp_vlan_tci)};
+		char* mac = (char*)hdr + hdr->tp_mac;
+		memmove(mac - IFACE_VLAN_HLEN, mac, 2 * ETH_ALEN);
+		memcpy(mac - IFACE_VLAN_HLEN + 2 * ETH_ALEN, tag, IFACE_VLAN_HLEN);
+		hdr->tp_mac -= IFACE_VLAN_HLEN;
+		hdr->tp_len += IFACE_VLAN_HLEN;
+		hdr->tp_snaplen += IFACE_VLAN_HLEN;
+		hdr->tp_status &= ~TP_STATUS_VLAN_VALID;
+	}
+
+	const uint32_t sec = hdr->tp_sec;
+	const uint32_t nsec = hdr->tp_nsec;
+	const uint32_t len = hdr->tp_len;
+	uint32_t caplen = hdr->tp_snaplen;
+	char* data = (char*)hdr + hdr->tp_mac;
+	if ( st->opt.caplen > 0 && caplen > st->opt.caplen ){
+		caplen = st->opt.caplen;
+	}
+
+	cap_head* cp = (cap_head*)(data - sizeof(struct cap_header));
+	memcpy(cp->nic, st->opt.nic, CAPHEAD_NICLEN);
+	memcpy(cp->mampid, st->opt.mampid, sizeof(cp->mampid));
+	cp->ts.tv_sec = sec;
+	cp->ts.tv_psec = (uint64_t)nsec * 1000;
+	cp->len = len;
+	cp->caplen = caplen;
+	return cp;
+}
+
+static cap_head* next_packet(struct stream_iface* st){
+	struct tpacket3_hdr* hdr = (struct tpacket3_hdr*)st->next;
+	st->next += hdr->tp_next_offset;
+	st->remaining--;
+	return convert_packet(st, hdr);
+}
+
+static int stream_iface_read(struct stream_iface* st, cap_head** header, struct filter* filter, struct timeval* timeout){
+	int ret;
+
+	do {
+		if ( st->block && st->remaining == 0 ){
+			release_block(st);
+		}
+
+		if ( !st->block ){
+			if ( (ret=next_block(st, timeout)) != 0 ){
+				return ret;
+			}
+			continue; /* block might be empty */
+		}
+
+		cap_head* cp = next_packet(st);
+		st->base.stat.recv++;
+		st->base.stat.read++;
+
+		if ( !filter || filter_match(filter, cp->payload, cp) ){
+			*header = cp;
+			st->base.stat.matched++;
+			return 0;
+		}
+	} while (1);
+}
+
+static int stream_iface_peek(struct stream_iface* st, cap_head** header, struct filter* filter){
+	do {
+		struct tpacket3_hdr* hdr;
+		if ( st->block && st->remaining > 0 ){
+			hdr = (struct tpacket3_hdr*)st->next;
+		} else {
+			/* an exhausted block might hold the last read packet, look ahead without releasing it */
+			const unsigned int index = st->block ? (st->block_index + 1) % st->num_blocks : st->block_index;
+			struct tpacket_block_desc* block = block_at(st, index);
+			if ( !(__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) || block->hdr.bh1.num_pkts == 0 ){
+				return EAGAIN;
+			}
+			hdr = (struct tpacket3_hdr*)((char*)block + block->hdr.bh1.offset_to_first_pkt);
+		}
+
+		cap_head* cp = convert_packet(st, hdr);
+		if ( !filter || filter_match(filter, cp->payload, cp) ){
+			*header = cp;
+			return 0;
+		}
+
+		/* discard non-matching packet (see stream_peek) */
+		struct timeval zero = {0,0};
+		stream_iface_read(st, &cp, NULL, &zero);
+	} while (1);
+}
+
+static long stream_iface_destroy(struct stream_iface* st){
+	if ( st->map ){
+		munmap(st->map, st->map_size);
+	}
+	if ( st->socket != -1 ){
+		close(st->socket);
+	}
+	free(st->base.comment);
+	free(st);
+	return 0;
+}
+
+/**
+ * Parse "NAME[?OPTION[&OPTION]..]", see stream-address(3) for options.
+ */
+static int parse_options(const char* address, const char* iface, struct iface_options* opt){
+	char buf[256];
+	if ( strlen(address) >= sizeof(buf) ){
+		return EINVAL;
+	}
+	strcpy(buf, address);
+
+	char* options = strchr(buf, '?');
+	if ( options ){
+		*options++ = 0;
+	}
+
+	/* interface name can be passed separately (e.g. --iface) */
+	const char* name = buf[0] ? buf : iface;
+	if ( !name || strlen(name) >= IF_NAMESIZE ){
+		return EINVAL;
+	}
+
+	memset(opt, 0, sizeof(struct iface_options));
+	strcpy(opt->name, name);
+	memcpy(opt->nic, name, strnlen(name, CAPHEAD_NICLEN - 1));
+	gethostname(opt->mampid, sizeof(opt->mampid) - 1);
+	opt->promisc = 1;
+	opt->fanout = -1;
+	opt->fanout_mode = PACKET_FANOUT_HASH;
+	opt->timeout = IFACE_BLOCK_TIMEOUT;
+
+	char* saveptr = NULL;
+	for ( char* o = options ? strtok_r(options, "&", &saveptr) : NULL; o; o = strtok_r(NULL, "&", &saveptr) ){
+		char* value = strchr(o, '=');
+		if ( !value ){
+			return EINVAL;
+		}
+		*value++ = 0;
+
+		if ( strcmp(o, "caplen") == 0 ){
+			opt->caplen = atoi(value);
+		} else if ( strcmp(o, "promisc") == 0 ){
+			opt->promisc = atoi(value);
+		} else if ( strcmp(o, "fanout") == 0 ){
+			opt->fanout = atoi(value) & 0xffff;
+		} else if ( strcmp(o, "fanout_mode") == 0 ){
+			if      ( strcmp(value, "hash") == 0 ) opt->fanout_mode = PACKET_FANOUT_HASH;
+			else if ( strcmp(value, "lb")   == 0 ) opt->fanout_mode = PACKET_FANOUT_LB;
+			else if ( strcmp(value, "cpu")  == 0 ) opt->fanout_mode = PACKET_FANOUT_CPU;
+			else return EINVAL;
+		} else if ( strcmp(o, "timeout") == 0 ){
+			opt->timeout = atoi(value);
+		} else if ( strcmp(o, "mampid") == 0 ){
+			memset(opt->mampid, 0, sizeof(opt->mampid));
+			memcpy(opt->mampid, value, strnlen(value, sizeof(opt->mampid) - 1));
+		} else if ( strcmp(o, "nic") == 0 ){
+			memset(opt->nic, 0, sizeof(opt->nic));
+			memcpy(opt->nic, value, strnlen(value, sizeof(opt->nic) - 1));
+		} else {
+			return EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+static int setup_socket(struct stream_iface* st, size_t buffer_size){
+	const struct iface_options* opt = &st->opt;
+
+	struct iface ifstat;
+	int ret;
+	if ( (ret=iface_get(opt->name, &ifstat)) != 0 ){
+		return ret;
+	}
+	st->base.if_mtu = ifstat.if_mtu;
+	st->base.if_loopback = ifstat.if_loopback;
+
+	if ( (st->socket=socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL))) == -1 ){
+		return errno;
+	}
+	st->base.fd = st->socket;
+
+	int version = TPACKET_V3;
+	if ( setsockopt(st->socket, SOL_PACKET, PACKET_VERSION, &version, sizeof(int)) == -1 ){
+		return errno;
+	}
+
+	/* headroom for re-inserting stripped vlan tags (see convert_packet) */
+	int reserve = IFACE_VLAN_HLEN;
+	if ( setsockopt(st->socket, SOL_PACKET, PACKET_RESERVE, &reserve, sizeof(int)) == -1 ){
+		return errno;
+	}
+
+	/* ring */
+	st->num_blocks = buffer_size / IFACE_BLOCK_SIZE;
+	if ( st->num_blocks < 2 ){
+		st->num_blocks = 2;
+	}
+	struct tpacket_req3 req;
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = IFACE_BLOCK_SIZE;
+	req.tp_block_nr = st->num_blocks;
+	req.tp_frame_size = IFACE_FRAME_SIZE;
+	req.tp_frame_nr = (IFACE_BLOCK_SIZE / IFACE_FRAME_SIZE) * st->num_blocks;
+	req.tp_retire_blk_tov = opt->timeout;
+	if ( setsockopt(st->socket, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) == -1 ){
+		return errno;
+	}
+
+	st->map_size = (size_t)IFACE_BLOCK_SIZE * st->num_blocks;
+	st->map = mmap(NULL, st->map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, st->socket, 0);
+	if ( st->map == MAP_FAILED ){
+		/* MAP_LOCKED might fail due to RLIMIT_MEMLOCK */
+		st->map = mmap(NULL, st->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, st->socket, 0);
+	}
+	if ( st->map == MAP_FAILED ){
+		st->map = NULL;
+		return errno;
+	}
+
+	struct sockaddr_ll sll;
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_protocol = htons(ETH_P_ALL);
+	sll.sll_ifindex = ifstat.if_index;
+	if ( bind(st->socket, (struct sockaddr*)&sll, sizeof(sll)) == -1 ){
+		return errno;
+	}
+
+	if ( opt->promisc ){
+		struct packet_mreq mreq;
+		memset(&mreq, 0, sizeof(mreq));
+		mreq.mr_ifindex = ifstat.if_index;
+		mreq.mr_type = PACKET_MR_PROMISC;
+		if ( setsockopt(st->socket, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) == -1 ){
+			return errno;
+		}
+	}
+
+	/* loopback devices shows each packet twice (outgoing and incoming), only
+	 * keep the incoming (not supported by older kernels) */
+	if ( ifstat.if_loopback ){
+		int on = 1;
+		setsockopt(st->socket, SOL_PACKET, PACKET_IGNORE_OUTGOING, &on, sizeof(int));
+	}
+
+	/* must be set after bind */
+	if ( opt->fanout >= 0 ){
+		int arg = opt->fanout | (opt->fanout_mode << 16);
+		if ( setsockopt(st->socket, SOL_PACKET, PACKET_FANOUT, &arg, sizeof(int)) == -1 ){
+			return errno;
+		}
+	}
+
+	return 0;
+}
+
+int stream_iface_open(struct stream** stptr, const char* address, const char* iface, size_t buffer_size){
+	assert(stptr);
+	*stptr = NULL;
+
+	struct stream_iface* st;
+	int ret;
+	if ( (ret=stream_alloc((struct stream**)&st, PROTOCOL_ETHERNET_MULTICAST, sizeof(struct stream_iface), 1, 0)) != 0 ){
+		return ret;
+	}
+
+	st->socket = -1;
+	st->map = NULL;
+	st->block_index = 0;
+	st->block = NULL;
+	st->next = NULL;
+	st->remaining = 0;
+	st->base.num_addresses = 1;
+
+	/* the header is not sent by anyone, present it as this version */
+	st->base.FH.magic = CAPUTILS_FILE_MAGIC;
+	st->base.FH.version.major = VERSION_MAJOR;
+	st->base.FH.version.minor = VERSION_MINOR;
+	st->base.FH.header_offset = sizeof(struct file_header_t);
+
+	/* callbacks, packets is in the ring so retaining is not supported */
+	st->base.destroy = (destroy_callback)stream_iface_destroy;
+	st->base.read = (read_callback)stream_iface_read;
+	st->base.peek = (peek_callback)stream_iface_peek;
+	st->base.retain = NULL;
+	st->base.release = NULL;
+
+	if ( (ret=parse_options(address, iface, &st->opt)) != 0 ||
+	     (ret=setup_socket(st, buffer_size > 0 ? buffer_size : IFACE_DEFAULT_BUFFER)) != 0 ){
+		stream_iface_destroy(st);
+		return ret;
+	}
+
+	char comment[64];
+	snprintf(comment, sizeof(comment), "iface://%s", st->opt.name);
+	st->base.comment = strdup(comment);
+	st->base.FH.comment_size = strlen(comment);
+	memcpy(st->base.FH.mpid, st->opt.mampid, sizeof(st->opt.mampid));
+	st->base.stat.buffer_size = st->map_size;
+
+	*stptr = &st->base;
+	return 0;
+}
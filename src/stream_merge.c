@@ -0,0 +1,407 @@
+/**
+ * libcap_utils - DPMI capture utilities
+ * Copyright (C) 2003-2013 (see AUTHORS)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include "caputils/caputils.h"
+#include "caputils_int.h"
+#include "stream.h"
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+/**
+ * Merge stream.
+ *
+ * Holds one pending packet per input (read using stream_read, so the packet
+ * stays valid until the input is read again) and a watermark which is the
+ * timestamp of the last packet read from the input. The oldest pending packet
+ * is released once every other input either has a pending packet, a watermark
+ * past it, has reached EOF or has been idle longer than the idle timeout.
+ */
+
+struct merge_input {
+	stream_t st;
+	struct cap_header* pending;    /* next packet from this input (NULL if none) */
+	int have_watermark;
+	timepico watermark;            /* timestamp of last packet read from this input */
+	struct timespec last_activity; /* time of last packet read from this input */
+	int eof;
+};
+
+struct stream_merge {
+	struct stream base;
+	int use_idle;
+	struct timespec idle;          /* inputs idle longer than this is not waited for */
+	int current;                   /* input holding the packet handed to the user (-1 if none) */
+	size_t num_inputs;
+	struct merge_input input[];
+};
+
+static void monotonic_now(struct timespec* ts){
+	clock_gettime(CLOCK_MONOTONIC, ts);
+}
+
+/* a - b */
+static struct timespec timespec_sub(struct timespec a, struct timespec b){
+	struct timespec r = { a.tv_sec - b.tv_sec, a.tv_nsec - b.tv_nsec };
+	if ( r.tv_nsec < 0 ){
+		r.tv_sec--;
+		r.tv_nsec += 1000000000;
+	}
+	return r;
+}
+
+static int timespec_less(struct timespec a, struct timespec b){
+	return a.tv_sec < b.tv_sec || (a.tv_sec == b.tv_sec && a.tv_nsec < b.tv_nsec);
+}
+
+static int input_read(struct stream_merge* st, struct merge_input* in, struct timeval* timeout){
+	int ret;
+	switch ( (ret=stream_read(in->st, &in->pending, NULL, timeout)) ){
+	case 0:
+		in->watermark = in->pending->ts;
+		in->have_watermark = 1;
+		monotonic_now(&in->last_activity);
+		st->base.stat.recv++;
+		return 0;
+
+	case -1:
+		in->pending = NULL;
+		in->eof = 1;
+		return 0;
+
+	case EAGAIN:
+		in->pending = NULL;
+		return 0;
+
+	case EINTR:
+		in->pending = NULL;
+		return ret;
+
+	default:
+		/* drop the failing input, the remaining inputs is still merged */
+		fprintf(stderr, "stream_merge: dropping input `%s': %s\n", stream_addr_ntoa(&in->st->addr), caputils_error_string(ret));
+		in->pending = NULL;
+		in->eof = 1;
+		return 0;
+	}
+}
+
+/**
+ * Fetch a pending packet from all inputs which has data ready, without blocking.
+ */
+static int poll_inputs(struct stream_merge* st){
+	int ret;
+	for ( size_t i = 0; i < st->num_inputs; i++ ){
+		struct merge_input* in = &st->input[i];
+		if ( in->eof || in->pending ) continue;
+
+		struct timeval zero = {0,0};
+		if ( (ret=input_read(st, in, &zero)) != 0 ){
+			return ret;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Find the input with the oldest pending packet. Ties is resolved in favour of
+ * the lowest input index.
+ * @return Input index or -1 if no input has a pending packet.
+ */
+static int oldest_pending(const struct stream_merge* st){
+	int oldest = -1;
+	for ( size_t i = 0; i < st->num_inputs; i++ ){
+		const struct merge_input* in = &st->input[i];
+		if ( !in->pending ) continue;
+		if ( oldest < 0 || timecmp(&in->pending->ts, &st->input[oldest].pending->ts) < 0 ){
+			oldest = (int)i;
+		}
+	}
+	return oldest;
+}
+
+/**
+ * Find an input which prevents a packet with timestamp ts from being released.
+ * @param remaining Set to the time left until the blocking input is considered idle.
+ * @return Input index or -1 if the packet can be released.
+ */
+static int blocking_input(const struct stream_merge* st, const timepico* ts, const struct timespec* now, struct timespec* remaining){
+	for ( size_t i = 0; i < st->num_inputs; i++ ){
+		const struct merge_input* in = &st->input[i];
+		if ( in->eof || in->pending ) continue;
+		if ( in->have_watermark && timecmp(&in->watermark, ts) >= 0 ) continue;
+
+		if ( st->use_idle ){
+			const struct timespec idle = timespec_sub(*now, in->last_activity);
+			if ( !timespec_less(idle, st->idle) ) continue;
+			*remaining = timespec_sub(st->idle, idle);
+		}
+
+		return (int)i;
+	}
+
+	return -1;
+}
+
+static int all_eof(const struct stream_merge* st){
+	for ( size_t i = 0; i < st->num_inputs; i++ ){
+		if ( !st->input[i].eof ) return 0;
+	}
+	return 1;
+}
+
+static void release_current(struct stream_merge* st){
+	if ( st->current >= 0 ){
+		st->input[st->current].pending = NULL;
+		st->current = -1;
+	}
+}
+
+/**
+ * Find the next packet which can be released.
+ * @param blocker Set to the input to wait for when no packet can be released.
+ * @return Zero if a packet can be released (index in *index), otherwise EAGAIN, -1 on EOF or error code.
+ */
+static int next_packet(struct stream_merge* st, int* index, int* blocker, struct timespec* remaining){
+	int ret;
+	if ( (ret=poll_inputs(st)) != 0 ){
+		return ret;
+	}
+
+	const int oldest = oldest_pending(st);
+	if ( oldest < 0 ){
+		if ( all_eof(st) ){
+			return -1;
+		}
+
+		/* wait for any input, using a short wait so the other inputs is polled regularly */
+		for ( size_t i = 0; i < st->num_inputs; i++ ){
+			if ( !st->input[i].eof ){
+				*blocker = (int)i;
+				break;
+			}
+		}
+		remaining->tv_sec = 0;
+		remaining->tv_nsec = 100000000;
+		return EAGAIN;
+	}
+
+	struct timespec now;
+	monotonic_now(&now);
+	remaining->tv_sec = 1;
+	remaining->tv_nsec = 0;
+	if ( (*blocker=blocking_input(st, &st->input[oldest].pending->ts, &now, remaining)) >= 0 ){
+		return EAGAIN;
+	}
+
+	*index = oldest;
+	return 0;
+}
+
+static int stream_merge_read(struct stream_merge* st, cap_head** header, struct filter* filter, struct timeval* timeout){
+	int ret;
+	struct timespec deadline = {0,0};
+
+	release_current(st);
+
+	if ( timeout ){
+		monotonic_now(&deadline);
+		deadline.tv_sec += timeout->tv_sec;
+		deadline.tv_nsec += timeout->tv_usec * 1000;
+		if ( deadline.tv_nsec >= 1000000000 ){
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+	}
+
+	do {
+		int index = -1;
+		int blocker = -1;
+		struct timespec remaining;
+
+		switch ( (ret=next_packet(st, &index, &blocker, &remaining)) ){
+		case 0:
+			break;
+
+		case EAGAIN:
+			{
+				/* wait no longer than the user timeout or until the input is considered idle */
+				if ( timeout ){
+					struct timespec now;
+					monotonic_now(&now);
+					if ( !timespec_less(now, deadline) ){
+						return EAGAIN;
+					}
+
+					const struct timespec left = timespec_sub(deadline, now);
+					if ( timespec_less(left, remaining) ){
+						remaining = left;
+					}
+				}
+
+				struct timeval tv = { remaining.tv_sec, remaining.tv_nsec / 1000 };
+				if ( (ret=input_read(st, &st->input[blocker], &tv)) != 0 ){
+					return ret;
+				}
+			}
+			continue;
+
+		default:
+			return ret;
+		}
+
+		struct cap_header* cp = st->input[index].pending;
+		st->base.stat.read++;
+
+		if ( !filter || filter_match(filter, cp->payload, cp) ){
+			st->current = index;
+			*header = cp;
+			st->base.stat.matched++;
+			return 0;
+		}
+
+		st->input[index].pending = NULL;
+	} while (1);
+}
+
+static int stream_merge_peek(struct stream_merge* st, cap_head** header, struct filter* filter){
+	int ret;
+
+	release_current(st);
+
+	do {
+		int index = -1;
+		int blocker = -1;
+		struct timespec remaining;
+		if ( (ret=next_packet(st, &index, &blocker, &remaining)) != 0 ){
+			return ret;
+		}
+
+		struct cap_header* cp = st->input[index].pending;
+		if ( !filter || filter_match(filter, cp->payload, cp) ){
+			*header = cp;
+			return 0;
+		}
+
+		/* discard non-matching packet (see stream_peek) */
+		st->input[index].pending = NULL;
+	} while (1);
+}
+
+static long stream_merge_destroy(struct stream_merge* st){
+	long ret = 0;
+
+	for ( size_t i = 0; i < st->num_inputs; i++ ){
+		const long tmp = stream_close(st->input[i].st);
+		if ( ret == 0 ) ret = tmp;
+	}
+
+	if ( st->base.fd >= 0 ){
+		close(st->base.fd);
+	}
+
+	free(st->base.comment);
+	free(st);
+	return ret;
+}
+
+int stream_merge_open(stream_t* stptr, stream_t* inputs, size_t num_inputs, const struct timeval* idle){
+	int ret;
+	assert(stptr);
+	*stptr = NULL;
+
+	if ( !inputs || num_inputs == 0 ){
+		return EINVAL;
+	}
+
+	for ( size_t i = 0; i < num_inputs; i++ ){
+		if ( !inputs[i] ){
+			return EINVAL;
+		}
+	}
+
+	/* the base buffer is unused as packets is kept in the buffers of the inputs */
+	const size_t size = sizeof(struct stream_merge) + sizeof(struct merge_input) * num_inputs;
+	if ( (ret=stream_alloc(stptr, inputs[0]->type, size, 1, inputs[0]->if_mtu)) != 0 ){
+		return ret;
+	}
+
+	struct stream_merge* st = (struct stream_merge*)*stptr;
+	st->use_idle = idle != NULL;
+	st->idle.tv_sec = idle ? idle->tv_sec : 0;
+	st->idle.tv_nsec = idle ? idle->tv_usec * 1000 : 0;
+	st->current = -1;
+	st->num_inputs = num_inputs;
+
+	struct timespec now;
+	monotonic_now(&now);
+	for ( size_t i = 0; i < num_inputs; i++ ){
+		struct merge_input* in = &st->input[i];
+		in->st = inputs[i];
+		in->pending = NULL;
+		in->have_watermark = 0;
+		in->watermark = (timepico){0, 0};
+		in->last_activity = now;
+		in->eof = 0;
+		st->base.num_addresses += inputs[i]->num_addresses;
+	}
+
+	/* the merged stream is pollable if all inputs are, readiness of the epoll
+	 * descriptor only tells that an input has data, not that a packet can be
+	 * released. */
+	int pollable = 1;
+	for ( size_t i = 0; i < num_inputs; i++ ){
+		pollable &= inputs[i]->fd >= 0;
+	}
+	if ( pollable && (st->base.fd=epoll_create1(EPOLL_CLOEXEC)) >= 0 ){
+		for ( size_t i = 0; i < num_inputs; i++ ){
+			struct epoll_event ev = { .events = EPOLLIN, .data.u64 = i };
+			if ( epoll_ctl(st->base.fd, EPOLL_CTL_ADD, inputs[i]->fd, &ev) != 0 ){
+				/* e.g. regular files cannot be used with epoll */
+				close(st->base.fd);
+				st->base.fd = -1;
+				break;
+			}
+		}
+	}
+
+	/* present the header of the first input */
+	st->base.addr = inputs[0]->addr;
+	st->base.FH = inputs[0]->FH;
+	st->base.comment = inputs[0]->comment ? strdup(inputs[0]->comment) : NULL;
+	st->base.stat.buffer_size = 0;
+
+	/* callbacks */
+	st->base.destroy = (destroy_callback)stream_merge_destroy;
+	st->base.read = (read_callback)stream_merge_read;
+	st->base.peek = (peek_callback)stream_merge_peek;
+	st->base.retain = NULL;
+	st->base.release = NULL;
+
+	return 0;
+}
@@ -0,0 +1,532 @@
+/**
+ * libcap_utils - DPMI capture utilities
+ * Copyright (C) 2003-2013 (see AUTHORS)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include "caputils/caputils.h"
+#include "caputils_int.h"
+#include "stream.h"
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <byteswap.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ * pcap and pcapng files.
+ *
+ * The file is mapped into memory and parsed in place, for each packet a
+ * cap_header is synthesized in front of a copy of the packet data so the
+ * packet is valid until the next read (same as for capfiles). Both byte
+ * orders, microsecond and nanosecond pcap and all pcapng timestamp
+ * resolutions are supported but only ethernet can be represented as cap
+ * packets.
+ */
+
+#define PCAP_MAGIC         0xa1b2c3d4   /* microsecond timestamps */
+#define PCAP_MAGIC_NSEC    0xa1b23c4d   /* nanosecond timestamps */
+#define PCAP_CIGAM         0xd4c3b2a1   /* byte-swapped */
+#define PCAP_CIGAM_NSEC    0x4d3cb2a1
+#define PCAPNG_BYTE_ORDER  0x1a2b3c4d
+#define LINKTYPE_ETHERNET  1
+
+enum pcapng_block {
+	PCAPNG_SHB = 0x0a0d0d0a,            /* section header */
+	PCAPNG_IDB = 1,                     /* interface description */
+	PCAPNG_OPB = 2,                     /* packet (obsolete) */
+	PCAPNG_SPB = 3,                     /* simple packet */
+	PCAPNG_EPB = 6,                     /* enhanced packet */
+};
+
+enum pcapng_option {
+	PCAPNG_OPT_END = 0,
+	PCAPNG_OPT_IF_NAME = 2,
+	PCAPNG_OPT_IF_DESCRIPTION = 3,
+	PCAPNG_OPT_IF_TSRESOL = 9,
+	PCAPNG_OPT_IF_TSOFFSET = 14,
+};
+
+struct pcap_iface {
+	uint16_t linktype;
+	uint64_t units;                     /* timestamp units per second */
+	int64_t offset;                     /* seconds added to timestamps */
+	char nic[CAPHEAD_NICLEN];
+	char mampid[8];
+};
+
+struct stream_pcap {
+	struct stream base;
+	FILE* file;
+	char* map;
+	size_t map_size;
+	size_t pos;                         /* offset of next record or block */
+	size_t next;                        /* offset after the last converted packet */
+	int ng;                             /* set if pcapng */
+	int swapped;                        /* set if byte order differs from host */
+
+	/* interfaces, classic pcap always has one */
+	struct pcap_iface* iface;
+	size_t num_iface;
+
+	/* converted packet */
+	char* packet;
+	size_t packet_size;
+};
+
+int stream_pcap_magic(uint32_t magic){
+	switch ( magic ){
+	case PCAP_MAGIC:
+	case PCAP_MAGIC_NSEC:
+	case PCAPNG_SHB:
+	case PCAP_CIGAM:
+	case PCAP_CIGAM_NSEC:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+static uint16_t read16(const struct stream_pcap* st, const char* ptr){
+	uint16_t value;
+	memcpy(&value, ptr, sizeof(uint16_t));
+	return st->swapped ? bswap_16(value) : value;
+}
+
+static uint32_t read32(const struct stream_pcap* st, const char* ptr){
+	uint32_t value;
+	memcpy(&value, ptr, sizeof(uint32_t));
+	return st->swapped ? bswap_32(value) : value;
+}
+
+static uint64_t read64(const struct stream_pcap* st, const char* ptr){
+	uint64_t value;
+	memcpy(&value, ptr, sizeof(uint64_t));
+	return st->swapped ? bswap_64(value) : value;
+}
+
+static struct pcap_iface* add_iface(struct stream_pcap* st, uint16_t linktype){
+	struct pcap_iface* tmp = realloc(st->iface, (st->num_iface + 1) * sizeof(struct pcap_iface));
+	if ( !tmp ){
+		return NULL;
+	}
+
+	struct pcap_iface* iface = &tmp[st->num_iface];
+	iface->linktype = linktype;
+	iface->units = 1000000;
+	iface->offset = 0;
+	memset(iface->nic, 0, CAPHEAD_NICLEN);
+	strcpy(iface->nic, "pcap");
+	memcpy(iface->mampid, st->base.FH.mpid, sizeof(iface->mampid));
+
+	st->iface = tmp;
+	st->num_iface++;
+	return iface;
+}
+
+/**
+ * Convert a timestamp in units per second to picoseconds.
+ */
+static timepico convert_timestamp(const struct pcap_iface* iface, uint64_t ts){
+	timepico tp;
+	const uint64_t frac = ts % iface->units;
+	tp.tv_sec = ts / iface->units + iface->offset;
+	if ( UINT64_C(1000000000000) % iface->units == 0 ){
+		tp.tv_psec = frac * (UINT64_C(1000000000000) / iface->units);
+	} else {
+		tp.tv_psec = (uint64_t)((long double)frac * 1e12 / iface->units);
+	}
+	return tp;
+}
+
+/**
+ * Copy the packet data and fill in the cap_header.
+ */
+static int convert_packet(struct stream_pcap* st, const struct pcap_iface* iface, uint64_t ts, uint32_t len, uint32_t caplen, const char* data){
+	if ( iface->linktype != LINKTYPE_ETHERNET ){
+		return ERROR_PCAP_LINKTYPE;
+	}
+
+	const size_t required = sizeof(struct cap_header) + caplen;
+	if ( required > st->packet_size ){
+		char* tmp = realloc(st->packet, required);
+		if ( !tmp ){
+			return ENOMEM;
+		}
+		st->packet = tmp;
+		st->packet_size = required;
+	}
+
+	cap_head* cp = (cap_head*)st->packet;
+	memcpy(cp->nic, iface->nic, CAPHEAD_NICLEN);
+	memcpy(cp->mampid, iface->mampid, sizeof(cp->mampid));
+	cp->ts = convert_timestamp(iface, ts);
+	cp->len = len;
+	cp->caplen = caplen;
+	memcpy(cp->payload, data, caplen);
+	return 0;
+}
+
+static int next_pcap(struct stream_pcap* st){
+	const char* rec = st->map + st->pos;
+	const size_t left = st->map_size - st->pos;
+	if ( left == 0 ){
+		return -1;
+	} else if ( left < 16 ){
+		return ERROR_CAPFILE_TRUNCATED;
+	}
+
+	const uint64_t ts = (uint64_t)read32(st, rec) * st->iface[0].units + read32(st, rec + 4);
+	const uint32_t caplen = read32(st, rec + 8);
+	const uint32_t len = read32(st, rec + 12);
+	if ( caplen > left - 16 ){
+		return ERROR_CAPFILE_TRUNCATED;
+	}
+
+	st->next = st->pos + 16 + caplen;
+	return convert_packet(st, &st->iface[0], ts, len, caplen, rec + 16);
+}
+
+static int parse_shb(struct stream_pcap* st, const char* body, size_t size){
+	uint32_t magic;
+	if ( size < 4 ){
+		return ERROR_CAPFILE_INVALID;
+	}
+
+	memcpy(&magic, body, sizeof(uint32_t));
+	if ( magic == PCAPNG_BYTE_ORDER ){
+		st->swapped = 0;
+	} else if ( magic == bswap_32(PCAPNG_BYTE_ORDER) ){
+		st->swapped = 1;
+	} else {
+		return ERROR_CAPFILE_INVALID;
+	}
+
+	/* interface ids is local to each section */
+	st->num_iface = 0;
+	return 0;
+}
+
+static int parse_idb(struct stream_pcap* st, const char* body, size_t size){
+	if ( size < 8 ){
+		return ERROR_CAPFILE_INVALID;
+	}
+
+	struct pcap_iface* iface = add_iface(st, read16(st, body));
+	if ( !iface ){
+		return ENOMEM;
+	}
+
+	/* options */
+	const char* opt = body + 8;
+	const char* end = body + size;
+	while ( opt + 4 <= end ){
+		const uint16_t code = read16(st, opt);
+		const uint16_t len = read16(st, opt + 2);
+		const char* value = opt + 4;
+		if ( code == PCAPNG_OPT_END || value + len > end ){
+			break;
+		}
+
+		switch ( code ){
+		case PCAPNG_OPT_IF_NAME:
+			memset(iface->nic, 0, CAPHEAD_NICLEN);
+			memcpy(iface->nic, value, strnlen(value, len < CAPHEAD_NICLEN ? len : CAPHEAD_NICLEN - 1));
+			break;
+
+		case PCAPNG_OPT_IF_DESCRIPTION:
+			memset(iface->mampid, 0, sizeof(iface->mampid));
+			memcpy(iface->mampid, value, strnlen(value, len < sizeof(iface->mampid) ? len : sizeof(iface->mampid) - 1));
+			break;
+
+		case PCAPNG_OPT_IF_TSRESOL:
+			if ( len >= 1 ){
+				/* MSB set means negative power of two, otherwise power of ten */
+				const unsigned int base = (value[0] & 0x80) ? 2 : 10;
+				const unsigned int exp = value[0] & 0x7f;
+				if ( exp > (base == 2 ? 63 : 19) ){
+					return ERROR_CAPFILE_INVALID;
+				}
+				iface->units = 1;
+				for ( unsigned int i = 0; i < exp; i++ ){
+					iface->units *= base;
+				}
+			}
+			break;
+
+		case PCAPNG_OPT_IF_TSOFFSET:
+			if ( len >= 8 ){
+				iface->offset = (int64_t)read64(st, value);
+			}
+			break;
+		}
+
+		opt = value + ((len + 3) & ~3); /* options is padded to 32 bits */
+	}
+
+	return 0;
+}
+
+static const struct pcap_iface* find_iface(const struct stream_pcap* st, uint32_t id){
+	return id < st->num_iface ? &st->iface[id] : NULL;
+}
+
+static int next_pcapng(struct stream_pcap* st){
+	int ret;
+
+	do {
+		const char* block = st->map + st->pos;
+		const size_t left = st->map_size - st->pos;
+		if ( left == 0 ){
+			return -1;
+		} else if ( left < 12 ){
+			return ERROR_CAPFILE_TRUNCATED;
+		}
+
+		/* the section header decides the byte order of the length */
+		const uint32_t type = read32(st, block);
+		if ( type == PCAPNG_SHB && (ret=parse_shb(st, block + 8, left - 8)) != 0 ){
+			return ret;
+		}
+
+		const uint32_t total = read32(st, block + 4);
+		if ( total < 12 || total % 4 != 0 ){
+			return ERROR_CAPFILE_INVALID;
+		} else if ( total > left ){
+			return ERROR_CAPFILE_TRUNCATED;
+		}
+
+		const char* body = block + 8;
+		const size_t size = total - 12;
+		const struct pcap_iface* iface;
+		st->next = st->pos + total;
+
+		switch ( type ){
+		case PCAPNG_IDB:
+			if ( (ret=parse_idb(st, body, size)) != 0 ){
+				return ret;
+			}
+			break;
+
+		case PCAPNG_EPB:
+		case PCAPNG_OPB:
+			{
+				if ( size < 20 ){
+					return ERROR_CAPFILE_INVALID;
+				}
+				iface = find_iface(st, type == PCAPNG_EPB ? read32(st, body) : read16(st, body));
+				const uint64_t ts = (uint64_t)read32(st, body + 4) << 32 | read32(st, body + 8);
+				const uint32_t caplen = read32(st, body + 12);
+				if ( !iface || caplen > size - 20 ){
+					return ERROR_CAPFILE_INVALID;
+				}
+				return convert_packet(st, iface, ts, read32(st, body + 16), caplen, body + 20);
+			}
+
+		case PCAPNG_SPB:
+			{
+				if ( size < 4 || !(iface=find_iface(st, 0)) ){
+					return ERROR_CAPFILE_INVALID;
+				}
+				/* no caplen is stored, the packet is truncated to the block */
+				const uint32_t len = read32(st, body);
+				return convert_packet(st, iface, 0, len, len < size - 4 ? len : size - 4, body + 4);
+			}
+		}
+
+		/* other blocks is ignored */
+		st->pos = st->next;
+	} while (1);
+}
+
+/**
+ * Convert the packet at the current position (without consuming it).
+ */
+static int next_packet(struct stream_pcap* st){
+	return st->ng ? next_pcapng(st) : next_pcap(st);
+}
+
+static int stream_pcap_read(struct stream_pcap* st, cap_head** header, struct filter* filter, struct timeval* timeout){
+	int ret;
+
+	do {
+		if ( (ret=next_packet(st)) != 0 ){
+			return ret;
+		}
+
+		st->pos = st->next;
+		st->base.stat.recv++;
+		st->base.stat.read++;
+		st->base.stat.buffer_usage = st->map_size - st->pos;
+
+		cap_head* cp = (cap_head*)st->packet;
+		if ( !filter || filter_match(filter, cp->payload, cp) ){
+			*header = cp;
+			st->base.stat.matched++;
+			return 0;
+		}
+	} while (1);
+}
+
+static int stream_pcap_peek(struct stream_pcap* st, cap_head** header, struct filter* filter){
+	int ret;
+
+	do {
+		if ( (ret=next_packet(st)) != 0 ){
+			return ret;
+		}
+
+		cap_head* cp = (cap_head*)st->packet;
+		if ( !filter || filter_match(filter, cp->payload, cp) ){
+			*header = cp;
+			return 0;
+		}
+
+		/* discard non-matching packet (see stream_peek) */
+		st->pos = st->next;
+	} while (1);
+}
+
+static int need_fclose(const struct stream_pcap* st){
+	return stream_addr_type(&st->base.addr) == STREAM_ADDR_CAPFILE || stream_addr_have_flag(&st->base.addr, STREAM_ADDR_FCLOSE);
+}
+
+static long stream_pcap_destroy(struct stream_pcap* st){
+	if ( st->map ){
+		munmap(st->map, st->map_size);
+	}
+	if ( need_fclose(st) ){
+		fclose(st->file);
+	}
+	free(st->iface);
+	free(st->packet);
+	free(st->base.comment);
+	free(st);
+	return 0;
+}
+
+static int parse_header(struct stream_pcap* st){
+	uint32_t magic;
+	if ( st->map_size < 24 ){
+		return ERROR_CAPFILE_TRUNCATED;
+	}
+
+	memcpy(&magic, st->map, sizeof(uint32_t));
+	if ( magic == PCAPNG_SHB ){
+		/* the section header is parsed as any other block */
+		st->ng = 1;
+		return 0;
+	}
+
+	st->swapped = magic == PCAP_CIGAM || magic == PCAP_CIGAM_NSEC;
+	struct pcap_iface* iface = add_iface(st, (uint16_t)read32(st, st->map + 20));
+	if ( !iface ){
+		return ENOMEM;
+	}
+	if ( read32(st, st->map) == PCAP_MAGIC_NSEC ){
+		iface->units = 1000000000;
+	}
+
+	st->pos = 24;
+	return 0;
+}
+
+int stream_pcap_open(struct stream** stptr, FILE* fp, const char* filename){
+	assert(stptr);
+	assert(fp);
+	*stptr = NULL;
+
+	struct stream_pcap* st;
+	int ret;
+	if ( (ret=stream_alloc((struct stream**)&st, PROTOCOL_LOCAL_FILE, sizeof(struct stream_pcap), 1, 0)) != 0 ){
+		return ret;
+	}
+
+	st->file = fp;
+	st->map = NULL;
+	st->pos = 0;
+	st->next = 0;
+	st->ng = 0;
+	st->swapped = 0;
+	st->iface = NULL;
+	st->num_iface = 0;
+	st->packet = NULL;
+	st->packet_size = 0;
+	st->base.num_addresses = 1;
+	st->base.fd = fileno(fp);
+
+	/* present it as a capfile of this version */
+	st->base.FH.magic = CAPUTILS_FILE_MAGIC;
+	st->base.FH.version.major = VERSION_MAJOR;
+	st->base.FH.version.minor = VERSION_MINOR;
+	st->base.FH.header_offset = sizeof(struct file_header_t);
+	strcpy(st->base.FH.mpid, "pcap");
+
+	/* callbacks, packets is converted into a single buffer so retaining is not supported */
+	st->base.destroy = (destroy_callback)stream_pcap_destroy;
+	st->base.read = (read_callback)stream_pcap_read;
+	st->base.peek = (peek_callback)stream_pcap_peek;
+	st->base.retain = NULL;
+	st->base.release = NULL;
+
+	struct stat sb;
+	if ( fstat(st->base.fd, &sb) == -1 ){
+		ret = errno;
+		free(st);
+		return ret;
+	}
+
+	st->map_size = sb.st_size;
+	if ( st->map_size > 0 ){
+		void* map = mmap(NULL, st->map_size, PROT_READ, MAP_PRIVATE, st->base.fd, 0);
+		if ( map == MAP_FAILED ){
+			ret = errno;
+			free(st);
+			return ret;
+		}
+		madvise(map, st->map_size, MADV_SEQUENTIAL);
+		st->map = (char*)map;
+	}
+
+	if ( (ret=parse_header(st)) != 0 ){
+		munmap(st->map, st->map_size);
+		free(st->iface);
+		free(st);
+		return ret;
+	}
+
+	const char* format = st->ng ? "pcapng" : "pcap";
+	char comment[256];
+	if ( filename ){
+		snprintf(comment, sizeof(comment), "%s file %s", format, filename);
+	} else {
+		snprintf(comment, sizeof(comment), "%s file", format);
+	}
+	st->base.comment = strdup(comment);
+	st->base.FH.comment_size = strlen(comment);
+	st->base.stat.buffer_size = st->map_size;
+
+	*stptr = &st->base;
+	return 0;
+}
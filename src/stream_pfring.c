@@ -168,34 +168,31 @@ static int stream_pfring_read_frame(struct stream_pfring* st, int block){
 	return 0;
 }
 
-int stream_pfring_read(struct stream_pfring* st, cap_head** header, struct filter* filter, struct timeval* timeout){
-	/* I heard ext is a pretty cool guy, uses goto and doesn't afraid of anything */
-  retry:
-
-	/* empty buffer */
-	if ( !st->read_ptr ){
-		if ( !stream_pfring_read_frame(st, BLOCK) ){
-			return EAGAIN;
-		}
-
-		char* frame = st->frame[st->base.readPos];
-		struct sendhead* sh = (struct sendhead*)(frame + sizeof(struct ethhdr));
-		st->read_ptr = frame + sizeof(struct ethhdr) + sizeof(struct sendhead);
-		st->num_packets = ntohl(sh->nopkts);
+/**
+ * Ensure the current frame is loaded, reading a new frame if needed.
+ * @return Non-zero if a frame is available.
+ */
+static int load_frame(struct stream_pfring* st, int block){
+	if ( st->read_ptr ){
+		return 1;
 	}
 
-	/* always read if there is space available */
-	if ( st->base.writePos != st->base.readPos ){
-		stream_pfring_read_frame(st, NONBLOCK);
+	if ( !stream_pfring_read_frame(st, block) ){
+		return 0;
 	}
 
-	/* no packets available */
-	if ( st->num_packets == 0 ){
-		return EAGAIN;
-	}
+	char* frame = st->frame[st->base.readPos];
+	struct sendhead* sh = (struct sendhead*)(frame + sizeof(struct ethhdr));
+	st->read_ptr = frame + sizeof(struct ethhdr) + sizeof(struct sendhead);
+	st->num_packets = ntohl(sh->nopkts);
+	return 1;
+}
 
-	/* fetch next matching packet */
-	struct cap_header* cp = (struct cap_header*)(st->read_ptr);
+/**
+ * Move past the packet currently pointed to by the read pointer.
+ */
+static void next_packet(struct stream_pfring* st){
+	const struct cap_header* cp = (const struct cap_header*)(st->read_ptr);
 	const size_t packet_size = sizeof(struct cap_header) + cp->caplen;
 	st->num_packets--;
 	st->read_ptr += packet_size;
@@ -211,6 +208,31 @@ int stream_pfring_read(struct stream_pfring* st, cap_head** header, struct filte
 			st->num_packets = ntohl(sh->nopkts);
 		}
 	}
+}
+
+int stream_pfring_read(struct stream_pfring* st, cap_head** header, struct filter* filter, struct timeval* timeout){
+	/* I heard ext is a pretty cool guy, uses goto and doesn't afraid of anything */
+  retry:
+
+	/* empty buffer */
+	if ( !load_frame(st, BLOCK) ){
+		return EAGAIN;
+	}
+
+	/* always read if there is space available */
+	if ( st->base.writePos != st->base.readPos ){
+		stream_pfring_read_frame(st, NONBLOCK);
+	}
+
+	/* no packets available */
+	if ( st->num_packets == 0 ){
+		return EAGAIN;
+	}
+
+	/* fetch next matching packet */
+	struct cap_header* cp = (struct cap_header*)(st->read_ptr);
+	const size_t packet_size = sizeof(struct cap_header) + cp->caplen;
+	next_packet(st);
 
 	if ( cp->caplen == 0 ){
 		return ERROR_CAPFILE_INVALID;
@@ -231,6 +253,27 @@ int stream_pfring_read(struct stream_pfring* st, cap_head** header, struct filte
 	return 0;
 }
 
+static int stream_pfring_peek(struct stream_pfring* st, cap_head** header, struct filter* filter){
+	do {
+		if ( !load_frame(st, NONBLOCK) || st->num_packets == 0 ){
+			return EAGAIN;
+		}
+
+		struct cap_header* cp = (struct cap_header*)(st->read_ptr);
+		if ( cp->caplen == 0 ){
+			return ERROR_CAPFILE_INVALID;
+		}
+
+		if ( !filter || filter_match(filter, cp->payload, cp) ){
+			*header = cp;
+			return 0;
+		}
+
+		/* discard non-matching packet (see stream_peek) */
+		next_packet(st);
+	} while (1);
+}
+
 long stream_pfring_add(struct stream* stt, const struct ether_addr* addr){
 	struct stream_pfring* st= (struct stream_pfring*)stt;
 
@@ -367,6 +410,7 @@ long stream_pfring_open(struct stream** stptr, const struct ether_addr* addr, co
 	}
 	struct stream_pfring* st = (struct stream_pfring*)*stptr;
 	st->pd = pd;
+	st->base.fd = pfring_get_selectable_fd(pd);
 	st->if_mtu = if_mtu;
 	memset(st->seqnum, 0, sizeof(long unsigned int) * MAX_ADDRESS);
 
@@ -405,6 +449,9 @@ long stream_pfring_open(struct stream** stptr, const struct ether_addr* addr, co
 	st->base.destroy = (destroy_callback)destroy;
 	st->base.write = NULL;
 	st->base.read = (read_callback)stream_pfring_read;
+	st->base.peek = (peek_callback)stream_pfring_peek;
+	st->base.retain = NULL; /* frames is owned by pfring */
+	st->base.release = NULL;
 
 	fprintf(stderr,"PF ring setup done.\n");
 	return 0;
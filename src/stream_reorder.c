@@ -0,0 +1,332 @@
+/**
+ * libcap_utils - DPMI capture utilities
+ * Copyright (C) 2003-2013 (see AUTHORS)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include "caputils/caputils.h"
+#include "caputils_int.h"
+#include "stream.h"
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Reorder stream.
+ *
+ * Wraps another stream and holds packets in a min-heap (ordered by timestamp)
+ * until either the time between the oldest held packet and the newest seen
+ * packet exceeds the window or the number of held packets exceeds the packet
+ * limit. Packets are copied when read from the inner stream as the inner
+ * buffer is recycled on the next read.
+ */
+
+struct reorder_entry {
+	timepico ts;
+	uint64_t seq;                  /* arrival order, keeps output stable for equal timestamps */
+	struct cap_header* cp;         /* private copy of the packet */
+};
+
+struct stream_reorder {
+	struct stream base;
+	stream_t inner;
+	timepico window;               /* max timestamp difference to hold packets for (zero to disable) */
+	size_t max_packets;            /* max number of packets to hold (zero to disable) */
+	int flags;
+	int eof;                       /* set when inner stream is exhausted */
+
+	uint64_t seq;                  /* arrival counter */
+	int have_last;                 /* set after first packet has been released */
+	timepico last;                 /* timestamp of the last released packet */
+	timepico newest;               /* newest timestamp seen so far */
+	struct cap_header* current;    /* packet handed to the user, released on next read */
+
+	size_t num_entries;
+	size_t capacity;
+	struct reorder_entry* heap;
+};
+
+static int entry_less(const struct reorder_entry* a, const struct reorder_entry* b){
+	const int cmp = timecmp(&a->ts, &b->ts);
+	return cmp < 0 || (cmp == 0 && a->seq < b->seq);
+}
+
+static void entry_swap(struct reorder_entry* a, struct reorder_entry* b){
+	struct reorder_entry tmp = *a;
+	*a = *b;
+	*b = tmp;
+}
+
+static int heap_push(struct stream_reorder* st, const struct cap_header* cp){
+	if ( st->num_entries == st->capacity ){
+		const size_t capacity = st->capacity > 0 ? st->capacity * 2 : 64;
+		struct reorder_entry* heap = realloc(st->heap, sizeof(struct reorder_entry) * capacity);
+		if ( !heap ){
+			return ENOMEM;
+		}
+		st->heap = heap;
+		st->capacity = capacity;
+	}
+
+	const size_t bytes = sizeof(struct cap_header) + cp->caplen;
+	struct cap_header* copy = malloc(bytes);
+	if ( !copy ){
+		return ENOMEM;
+	}
+	memcpy(copy, cp, bytes);
+
+	size_t i = st->num_entries++;
+	st->heap[i].ts = cp->ts;
+	st->heap[i].seq = st->seq++;
+	st->heap[i].cp = copy;
+	st->base.stat.buffer_usage += bytes;
+
+	/* sift up */
+	while ( i > 0 ){
+		const size_t parent = (i - 1) / 2;
+		if ( !entry_less(&st->heap[i], &st->heap[parent]) ) break;
+		entry_swap(&st->heap[i], &st->heap[parent]);
+		i = parent;
+	}
+
+	return 0;
+}
+
+static struct cap_header* heap_pop(struct stream_reorder* st){
+	struct cap_header* cp = st->heap[0].cp;
+	st->heap[0] = st->heap[--st->num_entries];
+	st->base.stat.buffer_usage -= sizeof(struct cap_header) + cp->caplen;
+
+	/* sift down */
+	size_t i = 0;
+	while ( 1 ){
+		const size_t left = 2 * i + 1;
+		const size_t right = left + 1;
+		size_t smallest = i;
+		if ( left  < st->num_entries && entry_less(&st->heap[left],  &st->heap[smallest]) ) smallest = left;
+		if ( right < st->num_entries && entry_less(&st->heap[right], &st->heap[smallest]) ) smallest = right;
+		if ( smallest == i ) break;
+		entry_swap(&st->heap[i], &st->heap[smallest]);
+		i = smallest;
+	}
+
+	return cp;
+}
+
+/**
+ * Test if the oldest held packet has fallen outside the window.
+ */
+static int releasable(const struct stream_reorder* st){
+	if ( st->num_entries == 0 ){
+		return 0;
+	}
+
+	if ( st->max_packets > 0 && st->num_entries > st->max_packets ){
+		return 1;
+	}
+
+	if ( st->window.tv_sec > 0 || st->window.tv_psec > 0 ){
+		const timepico dt = timepico_sub(st->newest, st->heap[0].ts);
+		return timecmp(&dt, &st->window) > 0;
+	}
+
+	return 0;
+}
+
+static int accept_packet(struct stream_reorder* st, const struct cap_header* cp){
+	st->base.stat.recv++;
+
+	/* packet is older than what has already been released */
+	if ( st->have_last && timecmp(&cp->ts, &st->last) < 0 ){
+		st->base.stat.late++;
+		if ( st->flags & STREAM_REORDER_DROP_LATE ){
+			return 0;
+		}
+	}
+
+	if ( timecmp(&cp->ts, &st->newest) > 0 ){
+		st->newest = cp->ts;
+	}
+
+	return heap_push(st, cp);
+}
+
+/**
+ * Read from the inner stream until the oldest held packet may be released.
+ * @return Zero if a packet can be released, otherwise same as stream_read.
+ */
+static int fill_heap(struct stream_reorder* st, const struct timeval* timeout){
+	int ret;
+
+	while ( !st->eof && !releasable(st) ){
+		/* always use a timeout so held packets is released on idle streams */
+		struct timeval tv = {1,0};
+		if ( timeout ){
+			tv = *timeout;
+		}
+
+		cap_head* cp;
+		switch ( (ret=stream_read(st->inner, &cp, NULL, &tv)) ){
+		case 0:
+			if ( (ret=accept_packet(st, cp)) != 0 ){
+				return ret;
+			}
+			continue;
+
+		case -1:
+			st->eof = 1;
+			break;
+
+		case EAGAIN:
+			/* the inner stream is idle, release the oldest packet instead of waiting for the window to pass */
+			if ( st->num_entries > 0 ){
+				return 0;
+			}
+
+			/* If the user requested a blocking call we must retry no matter what */
+			if ( !timeout ){
+				continue;
+			}
+
+			return EAGAIN;
+
+		default:
+			return ret;
+		}
+	}
+
+	if ( st->num_entries == 0 ){
+		return st->eof ? -1 : EAGAIN;
+	}
+
+	return 0;
+}
+
+static int stream_reorder_read(struct stream_reorder* st, cap_head** header, struct filter* filter, struct timeval* timeout){
+	int ret;
+
+	/* the previous packet is only valid until the next read */
+	free(st->current);
+	st->current = NULL;
+
+	do {
+		if ( (ret=fill_heap(st, timeout)) != 0 ){
+			return ret;
+		}
+
+		st->current = heap_pop(st);
+		st->last = st->current->ts;
+		st->have_last = 1;
+		st->base.stat.read++;
+
+		if ( !filter || filter_match(filter, st->current->payload, st->current) ){
+			break;
+		}
+
+		free(st->current);
+		st->current = NULL;
+	} while (1);
+
+	*header = st->current;
+	st->base.stat.matched++;
+	return 0;
+}
+
+static int stream_reorder_peek(struct stream_reorder* st, cap_head** header, struct filter* filter){
+	const struct timeval zero = {0,0};
+	int ret;
+
+	do {
+		if ( (ret=fill_heap(st, &zero)) != 0 ){
+			return ret;
+		}
+
+		struct cap_header* cp = st->heap[0].cp;
+		if ( !filter || filter_match(filter, cp->payload, cp) ){
+			*header = cp;
+			return 0;
+		}
+
+		/* discard non-matching packet (see stream_peek) */
+		free(heap_pop(st));
+	} while (1);
+}
+
+static long stream_reorder_destroy(struct stream_reorder* st){
+	const long ret = stream_close(st->inner);
+
+	for ( size_t i = 0; i < st->num_entries; i++ ){
+		free(st->heap[i].cp);
+	}
+
+	free(st->heap);
+	free(st->current);
+	free(st->base.comment);
+	free(st);
+	return ret;
+}
+
+int stream_reorder_open(stream_t* stptr, stream_t inner, const timepico window, size_t max_packets, int flags){
+	int ret;
+	assert(stptr);
+	*stptr = NULL;
+
+	/* at least one of the limits must be used or packets would be held forever */
+	if ( !inner || (window.tv_sec == 0 && window.tv_psec == 0 && max_packets == 0) ){
+		return EINVAL;
+	}
+
+	/* the base buffer is unused as packets is held in separate copies */
+	if ( (ret=stream_alloc(stptr, inner->type, sizeof(struct stream_reorder), 1, inner->if_mtu)) != 0 ){
+		return ret;
+	}
+
+	struct stream_reorder* st = (struct stream_reorder*)*stptr;
+	st->inner = inner;
+	st->window = window;
+	st->max_packets = max_packets;
+	st->flags = flags;
+	st->eof = 0;
+	st->seq = 0;
+	st->have_last = 0;
+	st->newest = (timepico){0, 0};
+	st->current = NULL;
+	st->num_entries = 0;
+	st->capacity = 0;
+	st->heap = NULL;
+
+	/* present the same header as the inner stream */
+	st->base.addr = inner->addr;
+	st->base.FH = inner->FH;
+	st->base.comment = inner->comment ? strdup(inner->comment) : NULL;
+	st->base.num_addresses = inner->num_addresses;
+	st->base.fd = inner->fd;
+	st->base.stat.buffer_size = 0;
+
+	/* callbacks */
+	st->base.destroy = (destroy_callback)stream_reorder_destroy;
+	st->base.read = (read_callback)stream_reorder_read;
+	st->base.peek = (peek_callback)stream_reorder_peek;
+	st->base.retain = NULL; /* packets is private copies (see stream_retain) */
+	st->base.release = NULL;
+
+	return 0;
+}
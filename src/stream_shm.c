@@ -0,0 +1,740 @@
+/**
+ * libcap_utils - DPMI capture utilities
+ * Copyright (C) 2003-2013 (see AUTHORS)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include "caputils/caputils.h"
+#include "caputils_int.h"
+#include "stream.h"
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+/**
+ * Shared memory stream.
+ *
+ * One writer and up to SHM_MAX_READERS readers share a ring of packets
+ * (cap_header followed by caplen bytes, same as in capfiles). The ring is
+ * mapped twice back-to-back so a packet wrapping the end is still contiguous
+ * and readers get a pointer directly into shared memory.
+ *
+ * Positions is monotonic byte offsets. Each reader publishes pos (next unread
+ * byte) and hold (start of the packet it is currently processing, released on
+ * the next read) and the writer never overwrites anything after the lowest
+ * hold. With the block policy the writer waits for readers, with the drop
+ * policy the writer instead moves pos of lagging readers forward (dropping
+ * their oldest unread packets) or, if a reader is still processing the packet
+ * in the way, drops the new packet. Wakeups use process-shared futexes.
+ */
+
+#define SHM_MAGIC UINT64_C(0x4d48535350414344) /* "DCAPSHM" */
+#define SHM_VERSION 1
+#define SHM_MAX_READERS 16
+#define SHM_DEFAULT_SIZE (16*1024*1024)
+#define SHM_MIN_SIZE (1024*1024)
+#define SHM_REAP_INTERVAL 100 /* ms between checking for dead processes */
+
+enum shm_policy {
+	SHM_POLICY_BLOCK = 0,
+	SHM_POLICY_DROP,
+};
+
+struct shm_reader {
+	uint64_t pos;                  /* next unread byte */
+	uint64_t hold;                 /* first byte which may still be accessed by the reader */
+	uint64_t dropped;              /* packets skipped by the writer */
+	int32_t pid;                   /* owning process, 0 if unused and -1 while attaching */
+} __attribute__((aligned(64)));
+
+struct shm_header {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t policy;
+	uint64_t size;                 /* ring size, power of two */
+	uint64_t offset;               /* offset of the ring (page-aligned) */
+	int32_t writer;                /* pid of the writer */
+	char mpid[200];
+	char comment[2048];
+
+	/* writer state */
+	uint64_t head __attribute__((aligned(64)));  /* end of the last published packet */
+	uint32_t data_seq;             /* futex: bumped when packets is published or the writer closes */
+	uint32_t data_waiters;
+	uint32_t space_seq;            /* futex: bumped when a reader releases space */
+	uint32_t space_waiters;
+	uint32_t closed;               /* set when the writer is closed */
+	uint32_t attached;             /* set when the first reader attaches */
+
+	struct shm_reader reader[SHM_MAX_READERS];
+};
+
+struct stream_shm {
+	struct stream base;
+	struct shm_header* shm;
+	char* ring;
+	char* map;
+	size_t map_size;
+	char name[NAME_MAX];
+	int writer;
+	time_t last_reap;              /* monotonic time (ms) of last check for dead processes */
+
+	/* writer: packet being written (stream_write may split a packet) */
+	struct cap_header stage;       /* header is staged until the full size is known */
+	size_t staged;
+	size_t pending;                /* bytes of the current packet copied to the ring */
+	size_t record;                 /* size of the current packet, zero until the header is staged */
+	size_t discard;                /* bytes left of a dropped packet */
+
+	/* reader */
+	struct shm_reader* slot;
+};
+
+static int futex_wait(uint32_t* addr, uint32_t value, const struct timespec* timeout){
+	return syscall(SYS_futex, addr, FUTEX_WAIT, value, timeout, NULL, 0);
+}
+
+static void futex_wake(uint32_t* addr){
+	syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+static void wake(uint32_t* seq, uint32_t* waiters){
+	if ( __atomic_load_n(waiters, __ATOMIC_SEQ_CST) > 0 ){
+		__atomic_add_fetch(seq, 1, __ATOMIC_SEQ_CST);
+		futex_wake(seq);
+	}
+}
+
+static time_t now_ms(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int process_alive(pid_t pid){
+	return kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+static size_t page_align(size_t size){
+	const size_t page = sysconf(_SC_PAGESIZE);
+	return (size + page - 1) & ~(page - 1);
+}
+
+static size_t packet_size(const char* ptr){
+	return sizeof(struct cap_header) + ((const struct cap_header*)ptr)->caplen;
+}
+
+/**
+ * Map the header followed by the ring twice.
+ */
+static int shm_map(struct stream_shm* st, int fd, size_t offset, size_t size){
+	st->map_size = offset + 2 * size;
+	st->map = mmap(NULL, st->map_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if ( st->map == MAP_FAILED ){
+		st->map = NULL;
+		return errno;
+	}
+
+	if ( mmap(st->map, offset + size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+	     mmap(st->map + offset + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, offset) == MAP_FAILED ){
+		const int ret = errno;
+		munmap(st->map, st->map_size);
+		st->map = NULL;
+		return ret;
+	}
+
+	st->shm = (struct shm_header*)st->map;
+	st->ring = st->map + offset;
+	return 0;
+}
+
+static int shm_name(char* dst, const char* name){
+	if ( !name || name[0] == 0 || strchr(name, '/') || strlen(name) + 10 > NAME_MAX ){
+		return EINVAL;
+	}
+	sprintf(dst, "/caputils-%s", name);
+	return 0;
+}
+
+/**
+ * Parse "NAME[?OPTION[&OPTION]..]" where option is size=BYTES[kMG] or
+ * policy=block|drop.
+ */
+static int parse_options(const char* address, char* name, size_t* size, enum shm_policy* policy){
+	char buf[NAME_MAX];
+	if ( strlen(address) >= sizeof(buf) ){
+		return EINVAL;
+	}
+	strcpy(buf, address);
+
+	char* options = strchr(buf, '?');
+	if ( options ){
+		*options++ = 0;
+	}
+
+	char* saveptr = NULL;
+	for ( char* opt = options ? strtok_r(options, "&", &saveptr) : NULL; opt; opt = strtok_r(NULL, "&", &saveptr) ){
+		if ( strncmp(opt, "size=", 5) == 0 ){
+			char* end;
+			unsigned long long value = strtoull(opt + 5, &end, 10);
+			switch ( *end ){
+			case 'k': case 'K': value <<= 10; end++; break;
+			case 'm': case 'M': value <<= 20; end++; break;
+			case 'g': case 'G': value <<= 30; end++; break;
+			}
+			if ( *end != 0 || value == 0 ){
+				return EINVAL;
+			}
+			*size = value;
+		} else if ( strcmp(opt, "policy=block") == 0 ){
+			*policy = SHM_POLICY_BLOCK;
+		} else if ( strcmp(opt, "policy=drop") == 0 ){
+			*policy = SHM_POLICY_DROP;
+		} else {
+			return EINVAL;
+		}
+	}
+
+	return shm_name(name, buf);
+}
+
+static void reap_readers(struct stream_shm* st){
+	const time_t now = now_ms();
+	if ( now - st->last_reap < SHM_REAP_INTERVAL ){
+		return;
+	}
+	st->last_reap = now;
+
+	for ( int i = 0; i < SHM_MAX_READERS; i++ ){
+		struct shm_reader* slot = &st->shm->reader[i];
+		int32_t pid = __atomic_load_n(&slot->pid, __ATOMIC_SEQ_CST);
+		if ( pid > 0 && !process_alive(pid) ){
+			__atomic_compare_exchange_n(&slot->pid, &pid, 0, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+		}
+	}
+}
+
+/**
+ * Drop the oldest unread packets of a reader until target. If the reader isn't
+ * holding any packet (hold == pos) the hold is moved as well.
+ */
+static void skip_oldest(struct stream_shm* st, struct shm_reader* slot, uint64_t target){
+	const uint64_t head = st->shm->head;
+	const uint64_t mask = st->shm->size - 1;
+	uint64_t hold = __atomic_load_n(&slot->hold, __ATOMIC_SEQ_CST);
+	uint64_t pos = __atomic_load_n(&slot->pos, __ATOMIC_SEQ_CST);
+	uint64_t next = pos;
+	uint64_t dropped = 0;
+	while ( next < target && next < head ){
+		next += packet_size(st->ring + (next & mask));
+		dropped++;
+	}
+
+	/* fails if the reader claimed a packet meanwhile, it is retried by the caller */
+	if ( dropped == 0 || !__atomic_compare_exchange_n(&slot->pos, &pos, next, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST) ){
+		return;
+	}
+
+	__atomic_add_fetch(&slot->dropped, dropped, __ATOMIC_SEQ_CST);
+	if ( hold == pos ){
+		__atomic_compare_exchange_n(&slot->hold, &hold, next, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	}
+}
+
+/**
+ * Wait until the ring has room for bytes after the current packet.
+ * @return Zero if successful, EAGAIN if the packet should be dropped and EPIPE
+ *         if all readers has detached.
+ */
+static int shm_reserve(struct stream_shm* st, size_t bytes){
+	struct shm_header* shm = st->shm;
+	const uint64_t end = shm->head + bytes;
+	int retry = 1;
+
+	while ( 1 ){
+		const uint32_t seq = __atomic_load_n(&shm->space_seq, __ATOMIC_SEQ_CST);
+		uint64_t limit = UINT64_MAX;
+		int readers = 0;
+
+		for ( int i = 0; i < SHM_MAX_READERS; i++ ){
+			struct shm_reader* slot = &shm->reader[i];
+			if ( __atomic_load_n(&slot->pid, __ATOMIC_SEQ_CST) <= 0 ) continue;
+			readers++;
+
+			uint64_t hold = __atomic_load_n(&slot->hold, __ATOMIC_SEQ_CST);
+			if ( shm->policy == SHM_POLICY_DROP && end > hold + shm->size ){
+				skip_oldest(st, slot, end - shm->size);
+				hold = __atomic_load_n(&slot->hold, __ATOMIC_SEQ_CST);
+			}
+
+			if ( hold + shm->size < limit ){
+				limit = hold + shm->size;
+			}
+		}
+
+		if ( readers == 0 && __atomic_load_n(&shm->attached, __ATOMIC_SEQ_CST) ){
+			/* same as writing to a pipe without readers */
+			return shm->policy == SHM_POLICY_BLOCK ? EPIPE : 0;
+		}
+
+		if ( end <= limit && (readers > 0 || shm->policy == SHM_POLICY_DROP) ){
+			return 0;
+		}
+
+		/* a crashed reader would otherwise block (or drop) forever */
+		reap_readers(st);
+
+		if ( shm->policy == SHM_POLICY_DROP ){
+			if ( retry-- > 0 ) continue;
+			return EAGAIN;
+		}
+
+		/* block until a reader releases space (or attaches) */
+		const struct timespec timeout = {0, SHM_REAP_INTERVAL * 1000000};
+		__atomic_add_fetch(&shm->space_waiters, 1, __ATOMIC_SEQ_CST);
+		futex_wait(&shm->space_seq, seq, &timeout);
+		__atomic_sub_fetch(&shm->space_waiters, 1, __ATOMIC_SEQ_CST);
+	}
+}
+
+static void shm_copy(struct stream_shm* st, const void* src, size_t bytes){
+	char* dst = st->ring + ((st->shm->head + st->pending) & (st->shm->size - 1));
+	memcpy(dst, src, bytes);
+	st->pending += bytes;
+}
+
+static int stream_shm_write(struct stream_shm* st, const void* data, size_t size){
+	struct shm_header* shm = st->shm;
+	const char* src = (const char*)data;
+	int ret;
+
+	while ( size > 0 ){
+		/* skip remaining part of a dropped packet */
+		if ( st->discard > 0 ){
+			const size_t n = size < st->discard ? size : st->discard;
+			st->discard -= n;
+			src += n;
+			size -= n;
+			continue;
+		}
+
+		/* stage header until the size of the packet is known */
+		if ( st->record == 0 ){
+			const size_t n = size < sizeof(struct cap_header) - st->staged ? size : sizeof(struct cap_header) - st->staged;
+			memcpy((char*)&st->stage + st->staged, src, n);
+			st->staged += n;
+			src += n;
+			size -= n;
+			if ( st->staged < sizeof(struct cap_header) ){
+				continue;
+			}
+
+			st->staged = 0;
+			const size_t record = sizeof(struct cap_header) + st->stage.caplen;
+			if ( record > shm->size / 2 ){
+				return EMSGSIZE;
+			}
+
+			switch ( (ret=shm_reserve(st, record)) ){
+			case 0:
+				break;
+			case EAGAIN:
+				st->base.stat.dropped++;
+				st->discard = st->stage.caplen;
+				continue;
+			default:
+				return ret;
+			}
+
+			st->record = record;
+			shm_copy(st, &st->stage, sizeof(struct cap_header));
+		}
+
+		/* payload */
+		const size_t left = st->record - st->pending;
+		const size_t n = size < left ? size : left;
+		shm_copy(st, src, n);
+		src += n;
+		size -= n;
+
+		/* publish */
+		if ( st->pending == st->record ){
+			__atomic_store_n(&shm->head, shm->head + st->record, __ATOMIC_SEQ_CST);
+			st->pending = 0;
+			st->record = 0;
+			st->base.stat.recv++;
+			wake(&shm->data_seq, &shm->data_waiters);
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Claim the next packet.
+ * @param consume If zero the packet is only claimed (see stream_peek).
+ * @return Zero if successful or EAGAIN if there is no packet available.
+ */
+static int shm_next(struct stream_shm* st, struct cap_header** cp, int consume){
+	struct shm_header* shm = st->shm;
+	struct shm_reader* slot = st->slot;
+
+	while ( 1 ){
+		/* releases the previous packet */
+		uint64_t pos = __atomic_load_n(&slot->pos, __ATOMIC_SEQ_CST);
+		__atomic_store_n(&slot->hold, pos, __ATOMIC_SEQ_CST);
+		wake(&shm->space_seq, &shm->space_waiters);
+
+		if ( pos == __atomic_load_n(&shm->head, __ATOMIC_SEQ_CST) ){
+			return EAGAIN;
+		}
+
+		/* the size may be garbage if the writer skipped this packet meanwhile
+		 * but then the exchange fails */
+		char* ptr = st->ring + (pos & (shm->size - 1));
+		const uint64_t next = consume ? pos + packet_size(ptr) : pos;
+		if ( !__atomic_compare_exchange_n(&slot->pos, &pos, next, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST) ){
+			continue;
+		}
+
+		st->base.stat.dropped = __atomic_load_n(&slot->dropped, __ATOMIC_SEQ_CST);
+		*cp = (struct cap_header*)ptr;
+		return 0;
+	}
+}
+
+/**
+ * Wait for the writer to publish more packets.
+ * @return Zero when there might be packets available, EAGAIN on timeout, EINTR
+ *         if interrupted and -1 if the writer has closed.
+ */
+static int shm_wait(struct stream_shm* st, const struct timeval* timeout){
+	struct shm_header* shm = st->shm;
+	struct shm_reader* slot = st->slot;
+	const time_t deadline = timeout ? now_ms() + timeout->tv_sec * 1000 + timeout->tv_usec / 1000 : 0;
+
+	__atomic_add_fetch(&shm->data_waiters, 1, __ATOMIC_SEQ_CST);
+	int ret = 0;
+	while ( 1 ){
+		const uint32_t seq = __atomic_load_n(&shm->data_seq, __ATOMIC_SEQ_CST);
+		if ( __atomic_load_n(&slot->pos, __ATOMIC_SEQ_CST) != __atomic_load_n(&shm->head, __ATOMIC_SEQ_CST) ){
+			break;
+		}
+
+		if ( __atomic_load_n(&shm->closed, __ATOMIC_SEQ_CST) || !process_alive(shm->writer) ){
+			ret = -1;
+			break;
+		}
+
+		/* wait at most the reap interval to detect a crashed writer */
+		time_t left = SHM_REAP_INTERVAL;
+		if ( timeout ){
+			left = deadline - now_ms();
+			if ( left <= 0 ){
+				ret = EAGAIN;
+				break;
+			}
+			if ( left > SHM_REAP_INTERVAL ) left = SHM_REAP_INTERVAL;
+		}
+
+		const struct timespec ts = {0, left * 1000000};
+		if ( futex_wait(&shm->data_seq, seq, &ts) == -1 && errno == EINTR ){
+			ret = EINTR;
+			break;
+		}
+	}
+	__atomic_sub_fetch(&shm->data_waiters, 1, __ATOMIC_SEQ_CST);
+
+	return ret;
+}
+
+static int stream_shm_read(struct stream_shm* st, cap_head** header, struct filter* filter, struct timeval* timeout){
+	int ret;
+	struct cap_header* cp;
+
+	do {
+		while ( (ret=shm_next(st, &cp, 1)) == EAGAIN ){
+			if ( (ret=shm_wait(st, timeout)) != 0 ){
+				return ret;
+			}
+		}
+		st->base.stat.read++;
+	} while ( filter && !filter_match(filter, cp->payload, cp) );
+
+	*header = cp;
+	st->base.stat.matched++;
+	return 0;
+}
+
+static int stream_shm_peek(struct stream_shm* st, cap_head** header, struct filter* filter){
+	const struct timeval zero = {0,0};
+	struct cap_header* cp;
+	int ret;
+
+	while ( 1 ){
+		while ( (ret=shm_next(st, &cp, 0)) == EAGAIN ){
+			if ( (ret=shm_wait(st, &zero)) != 0 ){
+				return ret;
+			}
+		}
+
+		if ( !filter || filter_match(filter, cp->payload, cp) ){
+			*header = cp;
+			return 0;
+		}
+
+		/* discard non-matching packet (see stream_peek) */
+		shm_next(st, &cp, 1);
+	}
+}
+
+static long stream_shm_destroy(struct stream_shm* st){
+	if ( st->shm ){
+		if ( st->writer ){
+			__atomic_store_n(&st->shm->closed, 1, __ATOMIC_SEQ_CST);
+			__atomic_add_fetch(&st->shm->data_seq, 1, __ATOMIC_SEQ_CST);
+			futex_wake(&st->shm->data_seq);
+			shm_unlink(st->name);
+		} else if ( st->slot ){
+			__atomic_store_n(&st->slot->pid, 0, __ATOMIC_SEQ_CST);
+			__atomic_add_fetch(&st->shm->space_seq, 1, __ATOMIC_SEQ_CST);
+			futex_wake(&st->shm->space_seq);
+		}
+	}
+
+	if ( st->map ){
+		munmap(st->map, st->map_size);
+	}
+
+	free(st->base.comment);
+	free(st);
+	return 0;
+}
+
+static int shm_alloc(struct stream_shm** stptr){
+	int ret;
+	if ( (ret=stream_alloc((struct stream**)stptr, PROTOCOL_LOCAL_FILE, sizeof(struct stream_shm), 1, 0)) != 0 ){
+		return ret;
+	}
+
+	struct stream_shm* st = *stptr;
+	st->base.destroy = (destroy_callback)stream_shm_destroy;
+	st->base.num_addresses = 1;
+	st->base.FH.magic = CAPUTILS_FILE_MAGIC;
+	st->base.FH.version.major = VERSION_MAJOR;
+	st->base.FH.version.minor = VERSION_MINOR;
+	st->base.FH.header_offset = sizeof(struct file_header_t);
+	return 0;
+}
+
+/**
+ * Open the shared memory or remove it if it belongs to a writer which is no
+ * longer running.
+ */
+static int create_fd(const char* name){
+	for ( int attempt = 0; attempt < 2; attempt++ ){
+		const int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0660);
+		if ( fd != -1 ){
+			return fd;
+		}
+		if ( errno != EEXIST ){
+			return -1;
+		}
+
+		/* check for a stale stream */
+		const int old = shm_open(name, O_RDONLY, 0);
+		if ( old == -1 ) continue;
+		struct shm_header hdr;
+		const ssize_t bytes = read(old, &hdr, sizeof(hdr));
+		close(old);
+		if ( bytes == sizeof(hdr) && hdr.magic == SHM_MAGIC && (hdr.closed || !process_alive(hdr.writer)) ){
+			shm_unlink(name);
+			continue;
+		}
+
+		errno = EEXIST;
+		return -1;
+	}
+
+	errno = EEXIST;
+	return -1;
+}
+
+int stream_shm_create(struct stream** stptr, const char* address, const char* mpid, const char* comment){
+	assert(stptr);
+	*stptr = NULL;
+
+	char name[NAME_MAX];
+	size_t size = SHM_DEFAULT_SIZE;
+	enum shm_policy policy = SHM_POLICY_BLOCK;
+	int ret;
+	if ( (ret=parse_options(address, name, &size, &policy)) != 0 ){
+		return ret;
+	}
+
+	/* power of two (for masking) and page-aligned (for the mirrored mapping) */
+	size_t ring = SHM_MIN_SIZE;
+	while ( ring < size ) ring <<= 1;
+	const size_t offset = page_align(sizeof(struct shm_header));
+
+	const int fd = create_fd(name);
+	if ( fd == -1 ){
+		return errno == EEXIST ? ERROR_CAPFILE_FIFO_EXIST : errno;
+	}
+
+	struct stream_shm* st;
+	if ( ftruncate(fd, offset + ring) == -1 ){
+		ret = errno;
+	} else {
+		ret = shm_alloc(&st);
+	}
+	if ( ret != 0 ){
+		close(fd);
+		shm_unlink(name);
+		return ret;
+	}
+
+	strcpy(st->name, name);
+	st->writer = 1;
+	ret = shm_map(st, fd, offset, ring);
+	close(fd);
+	if ( ret != 0 ){
+		shm_unlink(name);
+		stream_shm_destroy(st);
+		return ret;
+	}
+
+	struct shm_header* shm = st->shm;
+	shm->version = SHM_VERSION;
+	shm->policy = policy;
+	shm->size = ring;
+	shm->offset = offset;
+	shm->writer = getpid();
+	if ( mpid ) strncpy(shm->mpid, mpid, sizeof(shm->mpid) - 1);
+	if ( comment ) strncpy(shm->comment, comment, sizeof(shm->comment) - 1);
+	__atomic_store_n(&shm->magic, SHM_MAGIC, __ATOMIC_SEQ_CST); /* readers validate magic last */
+
+	memcpy(st->base.FH.mpid, shm->mpid, sizeof(shm->mpid));
+	st->base.comment = strdup(shm->comment);
+	st->base.FH.comment_size = strlen(shm->comment);
+	st->base.stat.buffer_size = ring;
+	st->base.write = (write_callback)stream_shm_write;
+
+	*stptr = &st->base;
+	return 0;
+}
+
+static int attach(struct stream_shm* st){
+	struct shm_header* shm = st->shm;
+
+	for ( int i = 0; i < SHM_MAX_READERS; i++ ){
+		struct shm_reader* slot = &shm->reader[i];
+		int32_t pid = 0;
+		if ( !__atomic_compare_exchange_n(&slot->pid, &pid, -1, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST) ){
+			continue;
+		}
+
+		/* start at the newest packet, the writer ignores the slot until pid is set */
+		uint64_t head = __atomic_load_n(&shm->head, __ATOMIC_SEQ_CST);
+		slot->dropped = 0;
+		__atomic_store_n(&slot->hold, head, __ATOMIC_SEQ_CST);
+		__atomic_store_n(&slot->pos, head, __ATOMIC_SEQ_CST);
+		__atomic_store_n(&slot->pid, getpid(), __ATOMIC_SEQ_CST);
+
+		/* in case the writer wrapped the ring before the slot was active */
+		const uint64_t now = __atomic_load_n(&shm->head, __ATOMIC_SEQ_CST);
+		if ( now - head > shm->size / 2 ){
+			__atomic_store_n(&slot->hold, now, __ATOMIC_SEQ_CST);
+			__atomic_store_n(&slot->pos, now, __ATOMIC_SEQ_CST);
+		}
+
+		st->slot = slot;
+		__atomic_store_n(&shm->attached, 1, __ATOMIC_SEQ_CST);
+		wake(&shm->space_seq, &shm->space_waiters);
+		return 0;
+	}
+
+	return EUSERS;
+}
+
+int stream_shm_open(struct stream** stptr, const char* address){
+	assert(stptr);
+	*stptr = NULL;
+
+	char name[NAME_MAX];
+	size_t size;
+	enum shm_policy policy;
+	int ret;
+	if ( (ret=parse_options(address, name, &size, &policy)) != 0 ){
+		return ret;
+	}
+
+	const int fd = shm_open(name, O_RDWR, 0);
+	if ( fd == -1 ){
+		return errno;
+	}
+
+	struct shm_header hdr;
+	if ( read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) || hdr.magic != SHM_MAGIC ){
+		close(fd);
+		return ERROR_CAPFILE_INVALID;
+	}
+	if ( hdr.version != SHM_VERSION ){
+		close(fd);
+		return ERROR_INVALID_PROTOCOL;
+	}
+
+	struct stream_shm* st;
+	if ( (ret=shm_alloc(&st)) != 0 ){
+		close(fd);
+		return ret;
+	}
+
+	strcpy(st->name, name);
+	ret = shm_map(st, fd, hdr.offset, hdr.size);
+	close(fd);
+	if ( ret != 0 || (ret=attach(st)) != 0 ){
+		stream_shm_destroy(st);
+		return ret;
+	}
+
+	memcpy(st->base.FH.mpid, hdr.mpid, sizeof(hdr.mpid));
+	st->base.comment = strdup(hdr.comment);
+	st->base.FH.comment_size = strlen(hdr.comment);
+	st->base.stat.buffer_size = hdr.size;
+	st->base.read = (read_callback)stream_shm_read;
+	st->base.peek = (peek_callback)stream_shm_peek;
+	st->base.retain = NULL; /* the ring is shared with the writer */
+	st->base.release = NULL;
+
+	*stptr = &st->base;
+	return 0;
+}
@@ -22,69 +22,289 @@
 #endif /* HAVE_CONFIG_H */
 
 #include "caputils/caputils.h"
+#include "caputils_int.h"
+#include "stream.h"
 #include <assert.h>
-#include <string.h>
 #include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <sys/socket.h>
-#include <sys/ioctl.h>
-#include <net/if.h>
 #include <netinet/in.h>
-#include <arpa/inet.h>
+#include <netinet/tcp.h>
+
+/**
+ * TCP stream.
+ *
+ * The receiver (stream_open) listens on the address and accepts a single
+ * sender (stream_create). The byte stream has the same layout as a capfile, a
+ * file header and comment followed by packets, so the receiver reads it using
+ * the regular stream buffer. The sender batches packets in a userspace buffer
+ * and sends a full buffer at a time (TCP_NODELAY is set so the last partial
+ * batch isn't delayed when flushed). Writes block when the socket buffer is
+ * full, which propagates backpressure to the producer.
+ */
+
+#define TCP_SEND_BUFFER (256*1024)       /* userspace batch size */
+#define TCP_RECV_BUFFER (1024*1024)      /* default stream buffer for receivers */
+#define TCP_SOCKET_BUFFER (4*1024*1024)  /* kernel socket buffers (SO_SNDBUF/SO_RCVBUF) */
+
+struct stream_tcp {
+	struct stream base;
+	int socket;
+	int force_flush;                     /* send on every write */
+	size_t pending;                      /* bytes buffered by the sender */
+};
+
+static int send_all(int fd, const char* data, size_t size){
+	while ( size > 0 ){
+		const ssize_t bytes = send(fd, data, size, MSG_NOSIGNAL);
+		if ( bytes < 0 ){
+			if ( errno == EINTR ) continue;
+			return errno;
+		}
+		data += bytes;
+		size -= bytes;
+	}
+	return 0;
+}
+
+static int recv_all(int fd, void* dst, size_t size){
+	char* ptr = (char*)dst;
+	while ( size > 0 ){
+		const ssize_t bytes = recv(fd, ptr, size, 0);
+		if ( bytes < 0 ){
+			if ( errno == EINTR ) continue;
+			return errno;
+		} else if ( bytes == 0 ){
+			return ERROR_CAPFILE_TRUNCATED;
+		}
+		ptr += bytes;
+		size -= bytes;
+	}
+	return 0;
+}
+
+static void set_socket_options(int fd, int optname){
+	int size = TCP_SOCKET_BUFFER;
+	int on = 1;
+	setsockopt(fd, SOL_SOCKET, optname, &size, sizeof(int));
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(int));
+}
 
-int stream_tcp_init(struct stream* st, const char* address, int port){
-	struct sockaddr_in sender, client;
-	struct ifreq ifr;
-	int listen_socket;
+static int stream_tcp_fillbuffer(struct stream_tcp* st, struct timeval* timeout, char* dst, size_t max){
+	switch ( poll_readable(st->socket, timeout) ){
+	case -1:
+		return -1;
+	case 0:
+		errno = EAGAIN;
+		return -1;
+	}
 
-	assert(st);
-	assert(address);
+	return recv(st->socket, dst, max, 0); /* zero when the sender closes the connection */
+}
 
-	/* open tcp socket */
-	listen_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_IP); /** @todo Verify that IPPROTO_IP correct, was 0 before */
-	if ( st->mySocket < 0 ){
-		perror("socket open failed");
-		return errno;
+static int stream_tcp_flush(struct stream_tcp* st){
+	if ( st->pending == 0 ){
+		return 0;
 	}
 
-	setsockopt(listen_socket, SOL_SOCKET, SO_REUSEADDR,(void*)1, sizeof(int));
+	const int ret = send_all(st->socket, st->base.buffer, st->pending);
+	st->pending = 0;
+	return ret;
+}
+
+static int stream_tcp_write(struct stream_tcp* st, const void* data, size_t size){
+	int ret;
+
+	/* batch writes */
+	if ( st->pending + size <= st->base.buffer_size ){
+		memcpy(st->base.buffer + st->pending, data, size);
+		st->pending += size;
+		if ( st->pending == st->base.buffer_size || st->force_flush ){
+			return stream_tcp_flush(st);
+		}
+		return 0;
+	}
+
+	/* too large for the buffer, send directly */
+	if ( (ret=stream_tcp_flush(st)) != 0 ){
+		return ret;
+	}
+	return send_all(st->socket, data, size);
+}
 
-	sender.sin_family = AF_INET;
-	inet_aton(address, &sender.sin_addr);
-	sender.sin_port = htons(port);
+static long stream_tcp_destroy(struct stream_tcp* st){
+	long ret = 0;
+	if ( st->base.write ){
+		ret = stream_tcp_flush(st);
+	}
 
-	if( bind (listen_socket, (struct sockaddr *) &sender, sizeof(sender)) < 0 ){
-		perror("Cannot bind port number");
-		return errno;
+	if ( st->socket != -1 ){
+		close(st->socket);
 	}
-	listen(listen_socket, 1);
 
-	socklen_t len = sizeof(client);
-	st->mySocket = accept(listen_socket, (struct sockaddr *)&client, &len);
-	if( st->mySocket < 0 ){
-		perror("Cannot accept new connection.");
-		return errno;
+	free(st->base.comment);
+	free(st);
+	return ret;
+}
+
+static int tcp_alloc(struct stream_tcp** stptr, size_t buffer_size){
+	int ret;
+	if ( (ret=stream_alloc((struct stream**)stptr, PROTOCOL_TCP_UNICAST, sizeof(struct stream_tcp), buffer_size, 0)) != 0 ){
+		return ret;
 	}
 
-#ifdef DEBUG
-	printf("TCP unicast\nIP.destination=%s port=%d\n", address,port);
-	printf("Client: %s  %d\n",inet_ntoa(client.sin_addr), ntohs(client.sin_port));
-#endif
+	struct stream_tcp* st = *stptr;
+	st->socket = -1;
+	st->force_flush = 0;
+	st->pending = 0;
+	st->base.num_addresses = 1;
+	st->base.destroy = (destroy_callback)stream_tcp_destroy;
+	return 0;
+}
+
+/**
+ * Wait for a sender to connect.
+ */
+static int tcp_accept(const struct sockaddr_in* addr){
+	const int fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if ( fd == -1 ){
+		return -1;
+	}
 
-	st->address = strdup(address);
+	int on = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(int));
 
-	/* query interface index */
-	if ( ioctl(st->mySocket, SIOCGIFINDEX, &ifr) == -1 ){
-		perror("SIOCGIFINDEX error");
-		return errno;
+	/* set before accept so the window scale is negotiated with the large buffer */
+	set_socket_options(fd, SO_RCVBUF);
+
+	if ( bind(fd, (const struct sockaddr*)addr, sizeof(struct sockaddr_in)) == -1 || listen(fd, 1) == -1 ){
+		const int saved = errno;
+		close(fd);
+		errno = saved;
+		return -1;
+	}
+
+	int client;
+	do {
+		client = accept(fd, NULL, NULL);
+	} while ( client == -1 && errno == ECONNABORTED );
+
+	const int saved = errno;
+	close(fd);
+	errno = saved;
+	return client;
+}
+
+int stream_tcp_open(struct stream** stptr, const struct sockaddr_in* addr, size_t buffer_size){
+	assert(stptr);
+	*stptr = NULL;
+
+	struct stream_tcp* st;
+	int ret;
+	if ( (ret=tcp_alloc(&st, buffer_size > 0 ? buffer_size : TCP_RECV_BUFFER)) != 0 ){
+		return ret;
+	}
+
+	if ( (st->socket=tcp_accept(addr)) == -1 ){
+		ret = errno;
+		stream_tcp_destroy(st);
+		return ret;
+	}
+	st->base.fd = st->socket;
+
+	/* header, same as capfiles */
+	struct file_header_t* fhptr = &st->base.FH;
+	if ( (ret=recv_all(st->socket, fhptr, sizeof(struct file_header_t))) != 0 ){
+		stream_tcp_destroy(st);
+		return ret;
+	}
+
+	if ( fhptr->magic != CAPUTILS_FILE_MAGIC || fhptr->header_offset != sizeof(struct file_header_t) ){
+		stream_tcp_destroy(st);
+		return ERROR_CAPFILE_INVALID;
+	}
+
+	if ( !is_valid_version(fhptr) ){
+		stream_tcp_destroy(st);
+		return EINVAL;
+	}
+
+	st->base.comment = (char*)malloc(fhptr->comment_size + 1);
+	if ( !st->base.comment ){
+		stream_tcp_destroy(st);
+		return ENOMEM;
+	}
+	if ( (ret=recv_all(st->socket, st->base.comment, fhptr->comment_size)) != 0 ){
+		stream_tcp_destroy(st);
+		return ret;
+	}
+	st->base.comment[fhptr->comment_size] = 0;
+
+	st->base.fill_buffer = (fill_buffer_callback)stream_tcp_fillbuffer;
+	*stptr = &st->base;
+	return 0;
+}
+
+int stream_tcp_create(struct stream** stptr, const struct sockaddr_in* addr, const char* mpid, const char* comment, int flags){
+	assert(stptr);
+	*stptr = NULL;
+
+	if ( !comment ){
+		comment = "";
+	}
+
+	/* comment_size in the header is 16 bits */
+	if ( strlen(comment) > UINT16_MAX ){
+		return EMSGSIZE;
+	}
+
+	struct stream_tcp* st;
+	int ret;
+	if ( (ret=tcp_alloc(&st, TCP_SEND_BUFFER)) != 0 ){
+		return ret;
+	}
+
+	st->force_flush = flags & STREAM_ADDR_FLUSH;
+	st->socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if ( st->socket == -1 ){
+		ret = errno;
+		stream_tcp_destroy(st);
+		return ret;
+	}
+
+	set_socket_options(st->socket, SO_SNDBUF);
+	if ( connect(st->socket, (const struct sockaddr*)addr, sizeof(struct sockaddr_in)) == -1 ){
+		ret = errno;
+		stream_tcp_destroy(st);
+		return ret;
+	}
+	st->base.fd = st->socket;
+
+	if ( !(st->base.comment=strdup(comment)) ){
+		stream_tcp_destroy(st);
+		return ENOMEM;
+	}
+	st->base.FH.magic = CAPUTILS_FILE_MAGIC;
+	st->base.FH.version.major = VERSION_MAJOR;
+	st->base.FH.version.minor = VERSION_MINOR;
+	st->base.FH.header_offset = sizeof(struct file_header_t);
+	st->base.FH.comment_size = strlen(comment);
+	if ( mpid ){
+		strncpy(st->base.FH.mpid, mpid, sizeof(st->base.FH.mpid) - 1);
 	}
-	st->ifindex=ifr.ifr_ifindex;
 
-	/* query default MTU */
-	if(ioctl(st->mySocket,SIOCGIFMTU,&ifr) == -1 ) {
-		perror("SIOCGIIFMTU");
-		return errno;
+	/* header is sent right away as the receiver waits for it in stream_open
+	 * (directly, the comment might not fit in the batch buffer) */
+	st->base.write = (write_callback)stream_tcp_write;
+	st->base.flush = (flush_callback)stream_tcp_flush;
+	if ( (ret=send_all(st->socket, (const char*)&st->base.FH, sizeof(struct file_header_t))) != 0 ||
+	     (ret=send_all(st->socket, comment, st->base.FH.comment_size)) != 0 ){
+		stream_tcp_destroy(st);
+		return ret;
 	}
-	st->if_mtu=ifr.ifr_mtu;
 
+	*stptr = &st->base;
 	return 0;
 }
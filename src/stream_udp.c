@@ -27,6 +27,7 @@
 #include "stream.h"
 #include "stream_buffer.h"
 #include <assert.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <sys/socket.h>
@@ -34,15 +35,33 @@
 #include <net/if.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
+#include <netinet/udp.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif /* UDP_SEGMENT */
+
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif /* UDP_GRO */
+
 #define MAX_ADDRESS 100
+#define UDP_MAX_PAYLOAD 65507          /* largest datagram (and GSO send) */
+#define UDP_MAX_SEGMENTS 64            /* kernel limit of segments per GSO send */
+#define UDP_COALESCED_SIZE 65536       /* receive buffer for GRO */
+#define UDP_SOCKET_BUFFER (4*1024*1024) /* kernel socket buffer (SO_RCVBUF) */
+
+/* padding for segments shorter than the GSO segment size (always zero) */
+static char padding[UDP_MAX_PAYLOAD];
 
 struct stream_udp {
 	struct stream base;
 	int socket;
 	int if_index;
+	int gso;                             /* transmit using UDP_SEGMENT */
+	char* coalesced;                     /* receive buffer when UDP_GRO is enabled */
 	struct in_addr address[MAX_ADDRESS];
 	unsigned int seqnum[MAX_ADDRESS];
 
@@ -72,6 +91,10 @@ static int stream_udp_read(struct stream_udp* st, cap_head** cp, struct filter*
 	return stream_frame_buffer_read(&st->base, &st->fb, cp, filter, timeout);
 }
 
+static int stream_udp_peek(struct stream_udp* st, cap_head** cp, struct filter* filter){
+	return stream_frame_buffer_peek(&st->base, &st->fb, cp, filter);
+}
+
 static int stream_udp_write(struct stream_udp* st, const void* data, size_t size){
 	if ( size > st->base.if_mtu ){
 		fprintf(stderr, "packet is larger (%zd) than MTU (%zd), ignoring\n", size, st->base.if_mtu);
@@ -83,14 +106,149 @@ static int stream_udp_write(struct stream_udp* st, const void* data, size_t size
 	return 0;
 }
 
+static int transmit_datagrams(struct stream_udp* st, struct iovec* frame, size_t num){
+	struct mmsghdr msg[num];
+	memset(msg, 0, sizeof(struct mmsghdr) * num);
+
+	for ( size_t i = 0; i < num; i++ ){
+		msg[i].msg_hdr.msg_iov = &frame[i];
+		msg[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	return sendmmsg(st->socket, msg, num, 0);
+}
+
+/**
+ * Send multiple frames per datagram and let the kernel (or NIC) split them
+ * using UDP_SEGMENT. All segments except the last must have the same size so
+ * shorter frames is padded to the largest frame in the batch. The receiver
+ * ignores the padding as frames is parsed using the packet count.
+ */
+static int transmit_segmented(struct stream_udp* st, struct iovec* frame, size_t num){
+	size_t segment = 0;
+	for ( size_t i = 0; i < num; i++ ){
+		if ( frame[i].iov_len > segment ){
+			segment = frame[i].iov_len;
+		}
+	}
+
+	size_t per_msg = UDP_MAX_PAYLOAD / segment;
+	if ( per_msg > UDP_MAX_SEGMENTS ){
+		per_msg = UDP_MAX_SEGMENTS;
+	}
+	if ( per_msg < 2 ){
+		return transmit_datagrams(st, frame, num);
+	}
+
+	const size_t num_msg = (num + per_msg - 1) / per_msg;
+	struct mmsghdr msg[num_msg];
+	struct iovec iov[num * 2];
+	char control[num_msg][CMSG_SPACE(sizeof(uint16_t))];
+	memset(msg, 0, sizeof(struct mmsghdr) * num_msg);
+	memset(control, 0, sizeof(control));
+
+	size_t n = 0;
+	for ( size_t m = 0; m < num_msg; m++ ){
+		const size_t first = m * per_msg;
+		const size_t last = first + per_msg < num ? first + per_msg : num;
+		struct msghdr* hdr = &msg[m].msg_hdr;
+		hdr->msg_iov = &iov[n];
+
+		for ( size_t i = first; i < last; i++ ){
+			iov[n++] = frame[i];
+			if ( i + 1 < last && frame[i].iov_len < segment ){
+				iov[n].iov_base = padding;
+				iov[n].iov_len = segment - frame[i].iov_len;
+				n++;
+			}
+		}
+		hdr->msg_iovlen = &iov[n] - hdr->msg_iov;
+
+		hdr->msg_control = control[m];
+		hdr->msg_controllen = sizeof(control[m]);
+		struct cmsghdr* cmsg = CMSG_FIRSTHDR(hdr);
+		cmsg->cmsg_level = IPPROTO_UDP;
+		cmsg->cmsg_type = UDP_SEGMENT;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+		const uint16_t size = segment;
+		memcpy(CMSG_DATA(cmsg), &size, sizeof(uint16_t));
+	}
+
+	const int sent = sendmmsg(st->socket, msg, num_msg, 0);
+	if ( sent < 0 ){
+		return -1;
+	}
+
+	/* number of frames in the sent datagrams */
+	const size_t frames = sent * per_msg;
+	return frames < num ? frames : num;
+}
+
+static int stream_udp_transmit(struct stream_udp* st, struct iovec* frame, size_t num){
+	if ( st->gso && num > 1 ){
+		const int ret = transmit_segmented(st, frame, num);
+		if ( ret >= 0 || errno != EIO ){
+			return ret;
+		}
+
+		/* segmentation is not possible on this route (e.g. the device lacks checksum offloading) */
+		st->gso = 0;
+	}
+
+	return transmit_datagrams(st, frame, num);
+}
+
+/**
+ * Mark the stream as flushed if any of the frames has SENDER_FLUSH set.
+ */
+static void check_flush(struct stream_udp* st, const char* data, size_t bytes, size_t segment){
+	for ( size_t offset = 0; offset + sizeof(struct sendhead) <= bytes; offset += segment ){
+		const struct sendhead* sh = (const struct sendhead*)(data + offset);
+		if ( ntohl(sh->flags) & SENDER_FLUSH ){
+			st->base.flushed = 1;
+		}
+	}
+}
+
+static size_t stream_udp_read_coalesced(struct stream_udp* st, char* dst, size_t max, size_t* segment, struct timeval* timeout){
+	if ( poll_readable(st->socket, timeout) != 1 ){
+		errno = EAGAIN;
+		return 0;
+	}
+
+	char control[CMSG_SPACE(sizeof(int))];
+	struct iovec iov = {dst, max};
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(struct msghdr));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	const ssize_t bytes = recvmsg(st->socket, &msg, 0);
+	if ( bytes <= 0 ){
+		perror("Cannot receive UDP data.");
+		return 0;
+	}
+
+	/* a single frame unless the segment size is passed */
+	*segment = bytes;
+	for ( struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg) ){
+		if ( cmsg->cmsg_level == IPPROTO_UDP && cmsg->cmsg_type == UDP_GRO ){
+			int size;
+			memcpy(&size, CMSG_DATA(cmsg), sizeof(int));
+			*segment = size;
+		}
+	}
+
+	check_flush(st, dst, bytes, *segment);
+	return bytes;
+}
+
 static int stream_udp_read_frame(struct stream_udp* st, char* dst, struct timeval* timeout){
 	assert(st);
 
-	fd_set fds;
-	FD_ZERO(&fds);
-	FD_SET(st->socket, &fds);
-
-	if ( select(st->socket+1, &fds, NULL, NULL, timeout) != 1 ){
+	if ( poll_readable(st->socket, timeout) != 1 ){
 		errno = EAGAIN;
 		return 0;
 	}
@@ -106,6 +264,9 @@ static int stream_udp_read_frame(struct stream_udp* st, char* dst, struct timeva
 		return 0;
 	}
 
+	/* This indicates a flush from the sender. */
+	check_flush(st, dst, bytes, bytes);
+
 	/* Check if it is a valid packet and if it was destinationed here */
 	int match;
 	if ( (match=match_ma_pkt(st, src.sin_addr)) == -1 ){
@@ -113,7 +274,7 @@ static int stream_udp_read_frame(struct stream_udp* st, char* dst, struct timeva
 	}
 
 #ifdef DEBUG
-	fprintf(stderr, "got measurement frame with %d capture packets [BU: %3.2f%%]\n", ntohl(sh->nopkts), 0.0f);
+	fprintf(stderr, "got measurement frame with %d capture packets [BU: %3.2f%%]\n", ntohl(((const struct sendhead*)dst)->nopkts), 0.0f);
 #endif
 
 	return 1;
@@ -177,10 +338,13 @@ static int stream_udp_init(stream_t* stptr, size_t mtu){
 		return ret;
 	}
 	struct stream_udp* st = (struct stream_udp*)*stptr;
-	stream_frame_init(&st->fb, (read_frame_callback)stream_udp_read_frame, (char*)st->frame, num_frames, mtu);
+	stream_frame_init(&st->base, &st->fb, (read_frame_callback)stream_udp_read_frame, (char*)st->frame, num_frames, mtu);
 
 	st->socket = fd;
+	st->base.fd = fd;
 	st->if_index = 0;
+	st->gso = 0;
+	st->coalesced = NULL;
 	st->base.if_mtu = mtu;
 	memset(st->seqnum, 0, sizeof(unsigned int) * MAX_ADDRESS);
 
@@ -190,6 +354,7 @@ static int stream_udp_init(stream_t* stptr, size_t mtu){
 static int stream_udp_destroy(struct stream_udp* st){
 	shutdown(st->socket, SHUT_RDWR);
 	close(st->socket);
+	free(st->coalesced);
 	free(st);
 	return 0;
 }
@@ -237,11 +402,20 @@ int stream_udp_create(struct stream** stptr, const struct sockaddr_in* addr, con
 	/* callbacks */
 	st->base.destroy = (destroy_callback)stream_udp_destroy;
 	st->base.write = (write_callback)stream_udp_write;
+	st->base.transmit = (transmit_callback)stream_udp_transmit;
+	st->base.frame_size = mtu - sizeof(struct iphdr) - sizeof(struct udphdr);
+
+	/* segmentation offloading (GSO) if supported by the kernel */
+	int segment;
+	socklen_t optlen = sizeof(int);
+	if ( !(flags & STREAM_ADDR_NO_OFFLOAD) && getsockopt(st->socket, IPPROTO_UDP, UDP_SEGMENT, &segment, &optlen) == 0 ){
+		st->gso = 1;
+	}
 
 	return 0;
 }
 
-int stream_udp_open(stream_t* stptr, const struct sockaddr_in* addr, const char* iface){
+int stream_udp_open(stream_t* stptr, const struct sockaddr_in* addr, const char* iface, int flags){
 	int ret = 0;
 
 	/* multicasting requires a known interface to get properties */
@@ -278,9 +452,22 @@ int stream_udp_open(stream_t* stptr, const struct sockaddr_in* addr, const char*
 		}
 	}
 
+	/* large socket buffer to handle bursts (limited by net.core.rmem_max) */
+	int size = UDP_SOCKET_BUFFER;
+	setsockopt(st->socket, SOL_SOCKET, SO_RCVBUF, &size, sizeof(int));
+
+	/* receive coalesced frames (GRO) if supported by the kernel */
+	int on = 1;
+	if ( !(flags & STREAM_ADDR_NO_OFFLOAD) && setsockopt(st->socket, IPPROTO_UDP, UDP_GRO, &on, sizeof(int)) == 0 ){
+		if ( (st->coalesced=malloc(UDP_COALESCED_SIZE)) != NULL ){
+			stream_frame_coalesce(&st->fb, (read_coalesced_callback)stream_udp_read_coalesced, st->coalesced, UDP_COALESCED_SIZE);
+		}
+	}
+
 	/* callbacks */
 	st->base.destroy = (destroy_callback)stream_udp_destroy;
 	st->base.read = (read_callback)stream_udp_read;
+	st->base.peek = (peek_callback)stream_udp_peek;
 
 	return 0;
 }
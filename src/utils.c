@@ -27,6 +27,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
 
 int eth_aton(struct ether_addr* dst, const char* addr){
 	assert(dst);
@@ -55,10 +59,51 @@ const char* hexdump_address_r(const struct ether_addr* address, char buf[IFHWADD
 }
 
 const char* hexdump_address(const struct ether_addr* address){
-	static char buf[IFHWADDRLEN*3];
+	static __thread char buf[IFHWADDRLEN*3];
 	return hexdump_address_r(address, buf);
 }
 
+int poll_readable(int fd, struct timeval* timeout){
+	struct pollfd pfd = { .fd = fd, .events = POLLIN, .revents = 0 };
+
+	if ( !timeout ){
+		return poll(&pfd, 1, -1) > 0 ? 1 : -1;
+	}
+
+	struct timespec begin, end;
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+
+	/* round up so a short timeout doesn't turn into a busy-wait */
+	const long ms = timeout->tv_sec * 1000 + (timeout->tv_usec + 999) / 1000;
+	const int ret = poll(&pfd, 1, ms);
+
+	/* update timeout with the remaining time */
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	long long left = (long long)timeout->tv_sec * 1000000 + timeout->tv_usec;
+	left -= (long long)(end.tv_sec - begin.tv_sec) * 1000000 + (end.tv_nsec - begin.tv_nsec) / 1000;
+	if ( left < 0 ) left = 0;
+	timeout->tv_sec = left / 1000000;
+	timeout->tv_usec = left % 1000000;
+
+	if ( ret < 0 ){
+		return -1;
+	}
+	return ret > 0 ? 1 : 0;
+}
+
+int write_all(int fd, const char* data, size_t size){
+	while ( size > 0 ){
+		const ssize_t bytes = write(fd, data, size);
+		if ( bytes < 0 ){
+			if ( errno == EINTR ) continue;
+			return errno;
+		}
+		data += bytes;
+		size -= bytes;
+	}
+	return 0;
+}
+
 const char* caputils_version(caputils_version_t* version){
 	int features = 0
 #ifdef HAVE_PFRING
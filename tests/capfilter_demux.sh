@@ -0,0 +1,51 @@
+#!/bin/bash
+# capfilter --demux must write the same packets as one capfilter run per output
+
+source tests/init.sh
+
+tmpdir=$(mktemp -d)
+trap "rm -rf $tmpdir" EXIT
+
+function count(){
+	./capfilter -q -c "$@" 2> /dev/null
+}
+
+function check(){
+	local name=$1 expected=$2 actual=$3
+	if [[ "$expected" != "$actual" ]]; then
+		echo "$name: expected $expected packets, got $actual"
+		exit 1
+	fi
+}
+
+cat > $tmpdir/rules <<RULES
+# per-interface outputs and a shared output for two rules
+iface * $tmpdir/iface-%s.cap
+iface d00 $tmpdir/both.cap
+expr  tcp.port 80 or udp $tmpdir/both.cap
+expr  not eth.type ip $tmpdir/nonip.cap
+vlan  * $tmpdir/vlan-%s.cap
+RULES
+
+for trace in $traces/t2.cap $traces/802.1Q_tunneling.cap; do
+	rm -f $tmpdir/*.cap
+	if ! ./capfilter -q --demux $tmpdir/rules -o $tmpdir/rest.cap $trace; then
+		echo "$trace: capfilter --demux failed"
+		exit 1
+	fi
+
+	for output in $tmpdir/iface-*.cap; do
+		iface=${output##*/iface-}
+		iface=${iface%.cap}
+		check "$trace (iface $iface)" $(count --iface $iface $trace) $(count $output)
+	done
+	check "$trace (rest)" 0 $(count $tmpdir/rest.cap)
+	check "$trace (both)" $(count --expr "iface d00 or tcp.port 80 or udp" $trace) $(count $tmpdir/both.cap)
+	check "$trace (nonip)" $(count --expr "not eth.type ip" $trace) $(count $tmpdir/nonip.cap)
+	for output in $tmpdir/vlan-*.cap; do
+		[[ -e $output ]] || continue
+		vid=${output##*/vlan-}
+		vid=${vid%.cap}
+		check "$trace (vlan $vid)" $(count --eth.vlan $vid/0x0fff $trace) $(count $output)
+	done
+done
@@ -0,0 +1,19 @@
+#!/bin/bash
+# capshow --jobs must give the same output as the single-threaded mode
+
+source tests/init.sh
+
+if ! ls $traces/*.cap > /dev/null; then
+	exit 1
+fi
+
+for trace in $traces/*.cap; do
+	for args in "" "-d -x -H" "-1"; do
+		expected=$(./capshow $args $trace 2> /dev/null | md5sum)
+		actual=$(./capshow -j 3 $args $trace 2> /dev/null | md5sum)
+		if [[ "$expected" != "$actual" ]]; then
+			echo "$trace ($args): output differs when using --jobs"
+			exit 1
+		fi
+	done
+done
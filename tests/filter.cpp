@@ -1,13 +1,16 @@
 #include "test.hpp"
 
 #include <caputils/filter.h>
+#include "src/ipset.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
 #include <errno.h>
+#include <unistd.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <netinet/ip6.h>
 
 extern "C" {
 int filter_iface(const struct filter* filter, const char* iface);
@@ -26,6 +29,17 @@ int filter_start_time(const struct filter* filter, const timepico* time);
 int filter_end_time(const struct filter* filter, const timepico* time);
 int filter_frame_dt(const struct filter* filter, const timepico time);
 int filter_frame_num(const struct filter* filter);
+int filter_ip_src_in_set(const struct filter* filter, const struct ip* ip, const struct ip6_hdr* ip6);
+int filter_ip_proto_in_set(const struct filter* filter, const struct ip* ip);
+int filter_port_in_set(const struct filter* filter, uint16_t src, uint16_t dst);
+}
+
+static uint64_t xorshift(uint64_t* state){
+	uint64_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	return *state = x;
 }
 
 class Test: public CppUnit::TestFixture {
@@ -46,6 +60,11 @@ class Test: public CppUnit::TestFixture {
 	CPPUNIT_TEST(test_end_time);
 	CPPUNIT_TEST(test_frame_dt);
 	CPPUNIT_TEST(test_frame_num);
+	CPPUNIT_TEST(test_ipset_v4);
+	CPPUNIT_TEST(test_ipset_v6);
+	CPPUNIT_TEST(test_ipset_load);
+	CPPUNIT_TEST(test_ip_src_set);
+	CPPUNIT_TEST(test_bitmap_sets);
 	CPPUNIT_TEST_SUITE_END();
 
 	void test_ci(){
@@ -260,6 +279,183 @@ class Test: public CppUnit::TestFixture {
 		filter.frame_counter = 3; CPPUNIT_ASSERT_MESSAGE("Frame 3",  filter_frame_num(&filter));
 		filter.frame_counter = 4; CPPUNIT_ASSERT_MESSAGE("Frame 4", !filter_frame_num(&filter));
 	}
+
+	/* DIR-24-8 compared with a linear search of all prefixes */
+	void test_ipset_v4(){
+		static const int num_prefixes = 2000;
+		uint32_t prefix[num_prefixes];
+		uint32_t mask[num_prefixes];
+		struct ipset* set = ipset_new();
+		uint64_t state = 0x2545f4914f6cdd1d;
+
+		for ( int i = 0; i < num_prefixes; i++ ){
+			const uint64_t r = xorshift(&state);
+			const unsigned int len = i < 100 ? 8 + r % 17 : 25 + r % 8; /* mostly longer than /24 */
+			mask[i] = ~0U << (32 - len);
+			prefix[i] = (uint32_t)(r >> 32) & mask[i] & 0x0fffffff; /* denser in 0/4 */
+			struct in_addr addr = {htonl(prefix[i])};
+			CPPUNIT_ASSERT_EQUAL(0, ipset_add(set, AF_INET, &addr, len));
+		}
+		CPPUNIT_ASSERT_EQUAL((size_t)num_prefixes, ipset_size(set, AF_INET));
+
+		for ( int n = 0; n < 20000; n++ ){
+			const uint64_t r = xorshift(&state);
+			uint32_t addr = (uint32_t)r & 0x0fffffff;
+			if ( n % 2 ){ /* near a prefix */
+				addr = prefix[(r >> 32) % num_prefixes] | (addr & 0x3ff);
+			}
+
+			int expected = 0;
+			for ( int i = 0; i < num_prefixes; i++ ){
+				expected |= (addr & mask[i]) == prefix[i];
+			}
+
+			struct in_addr in = {htonl(addr)};
+			CPPUNIT_ASSERT_EQUAL_MESSAGE(inet_ntoa(in), expected, ipset_match_v4(set, in));
+		}
+
+		/* a shorter prefix covers existing longer ones */
+		struct in_addr in = {inet_addr("172.16.2.0")};
+		CPPUNIT_ASSERT_EQUAL(0, ipset_add(set, AF_INET, &in, 28));
+		in.s_addr = inet_addr("172.16.2.17"); CPPUNIT_ASSERT_EQUAL(0, ipset_match_v4(set, in));
+		in.s_addr = inet_addr("172.16.0.0"); CPPUNIT_ASSERT_EQUAL(0, ipset_add(set, AF_INET, &in, 16));
+		in.s_addr = inet_addr("172.16.2.17"); CPPUNIT_ASSERT_EQUAL(1, ipset_match_v4(set, in));
+		in.s_addr = inet_addr("172.17.0.1"); CPPUNIT_ASSERT_EQUAL(0, ipset_match_v4(set, in));
+
+		CPPUNIT_ASSERT_EQUAL(EINVAL, ipset_add(set, AF_INET, &in, 33));
+		ipset_free(set);
+	}
+
+	static int match_v6(const struct in6_addr& addr, const struct in6_addr& prefix, unsigned int len){
+		for ( unsigned int i = 0; i < len; i++ ){
+			const int bit = 7 - (i % 8);
+			if ( ((addr.s6_addr[i/8] ^ prefix.s6_addr[i/8]) >> bit) & 1 ) return 0;
+		}
+		return 1;
+	}
+
+	/* trie compared with a linear search of all prefixes */
+	void test_ipset_v6(){
+		static const int num_prefixes = 1000;
+		struct in6_addr prefix[num_prefixes];
+		unsigned int len[num_prefixes];
+		struct ipset* set = ipset_new();
+		uint64_t state = 0x9e3779b97f4a7c15;
+
+		for ( int i = 0; i < num_prefixes; i++ ){
+			len[i] = 16 + xorshift(&state) % 113;
+			for ( int j = 0; j < 16; j++ ){
+				/* few distinct values in each octet to get shared paths */
+				prefix[i].s6_addr[j] = j < 2 ? 0x20 : xorshift(&state) % 4;
+			}
+			CPPUNIT_ASSERT_EQUAL(0, ipset_add(set, AF_INET6, &prefix[i], len[i]));
+		}
+
+		for ( int n = 0; n < 5000; n++ ){
+			struct in6_addr addr = prefix[xorshift(&state) % num_prefixes];
+			const int octet = 2 + xorshift(&state) % 14;
+			addr.s6_addr[octet] = xorshift(&state) % 4;
+
+			int expected = 0;
+			for ( int i = 0; i < num_prefixes; i++ ){
+				expected |= match_v6(addr, prefix[i], len[i]);
+			}
+			CPPUNIT_ASSERT_EQUAL(expected, ipset_match_v6(set, &addr));
+		}
+
+		ipset_free(set);
+	}
+
+	static void write_prefixes(char* filename, const char* content){
+		const int fd = mkstemp(filename);
+		CPPUNIT_ASSERT(fd != -1);
+		CPPUNIT_ASSERT_EQUAL((ssize_t)strlen(content), write(fd, content, strlen(content)));
+		close(fd);
+	}
+
+	void test_ipset_load(){
+		char first[] = "/tmp/caputils-test-XXXXXX";
+		char second[] = "/tmp/caputils-test-XXXXXX";
+		char invalid[] = "/tmp/caputils-test-XXXXXX";
+		write_prefixes(first, "10.1.2.0/28\n2001:db8::/32\n");
+		write_prefixes(second, "10.1.2.128/25\n10.2/16\n2001:db9::/32\n2001:db8:1::/48\n");
+		write_prefixes(invalid, "172.16/12\n2001:dba::/32\nfoo\n");
+
+		struct ipset* set = ipset_new();
+		CPPUNIT_ASSERT_EQUAL(0, ipset_load(set, first, "test"));
+		CPPUNIT_ASSERT_EQUAL(0, ipset_load(set, second, "test"));
+		CPPUNIT_ASSERT_EQUAL(EINVAL, ipset_load(set, invalid, "test"));
+		unlink(first);
+		unlink(second);
+		unlink(invalid);
+
+		CPPUNIT_ASSERT_EQUAL((size_t)3, ipset_size(set, AF_INET));
+		CPPUNIT_ASSERT_EQUAL((size_t)3, ipset_size(set, AF_INET6));
+
+		static const struct { const char* addr; int expected; } v4[] = {
+			{"10.1.2.7", 1}, {"10.1.2.64", 0}, {"10.1.2.200", 1}, {"10.2.3.4", 1}, {"172.16.1.1", 0},
+		};
+		for ( unsigned int i = 0; i < sizeof(v4) / sizeof(v4[0]); i++ ){
+			struct in_addr in;
+			in.s_addr = inet_addr(v4[i].addr);
+			CPPUNIT_ASSERT_EQUAL_MESSAGE(v4[i].addr, v4[i].expected, ipset_match_v4(set, in));
+		}
+
+		static const struct { const char* addr; int expected; } v6[] = {
+			{"2001:db8:2::1", 1}, {"2001:db9::1", 1}, {"2001:dba::1", 0},
+		};
+		for ( unsigned int i = 0; i < sizeof(v6) / sizeof(v6[0]); i++ ){
+			struct in6_addr addr;
+			inet_pton(AF_INET6, v6[i].addr, &addr);
+			CPPUNIT_ASSERT_EQUAL_MESSAGE(v6[i].addr, v6[i].expected, ipset_match_v6(set, &addr));
+		}
+
+		ipset_free(set);
+	}
+
+	void test_ip_src_set(){
+		struct filter filter;
+		filter_init(&filter);
+		filter.index = FILTER_IP_SRC_SET;
+		filter.ip_src_set = ipset_new();
+
+		struct in_addr addr4;
+		struct in6_addr addr6;
+		inet_pton(AF_INET, "192.168.0.0", &addr4);   ipset_add(filter.ip_src_set, AF_INET, &addr4, 16);
+		inet_pton(AF_INET6, "2001:db8::", &addr6);    ipset_add(filter.ip_src_set, AF_INET6, &addr6, 32);
+
+		struct ip ip;
+		struct ip6_hdr ip6;
+		ip.ip_src.s_addr = inet_addr("192.168.1.1"); CPPUNIT_ASSERT_EQUAL_MESSAGE("[1] 192.168.1.1", 1, filter_ip_src_in_set(&filter, &ip, NULL));
+		ip.ip_src.s_addr = inet_addr("192.169.1.1"); CPPUNIT_ASSERT_EQUAL_MESSAGE("[2] 192.169.1.1", 0, filter_ip_src_in_set(&filter, &ip, NULL));
+		inet_pton(AF_INET6, "2001:db8:1::1", &ip6.ip6_src); CPPUNIT_ASSERT_EQUAL_MESSAGE("[3] 2001:db8:1::1", 1, filter_ip_src_in_set(&filter, NULL, &ip6));
+		inet_pton(AF_INET6, "2001:db9::1", &ip6.ip6_src);   CPPUNIT_ASSERT_EQUAL_MESSAGE("[4] 2001:db9::1", 0, filter_ip_src_in_set(&filter, NULL, &ip6));
+		CPPUNIT_ASSERT_EQUAL_MESSAGE("[5] not ip", 0, filter_ip_src_in_set(&filter, NULL, NULL));
+
+		filter_close(&filter);
+	}
+
+	void test_bitmap_sets(){
+		uint64_t ports[1024] = {0,};
+		uint64_t protos[4] = {0,};
+		struct filter filter;
+		filter_init(&filter);
+		filter.index = FILTER_PORT_SET | FILTER_IP_PROTO_SET;
+		filter.port_set = ports;
+		filter.ip_proto_set = protos;
+		ports[80 / 64] |= UINT64_C(1) << (80 % 64);
+		ports[65535 / 64] |= UINT64_C(1) << (65535 % 64);
+		protos[IPPROTO_UDP / 64] |= UINT64_C(1) << (IPPROTO_UDP % 64);
+
+		CPPUNIT_ASSERT_EQUAL_MESSAGE("[1] 80", 1, filter_port_in_set(&filter, 1234, 80));
+		CPPUNIT_ASSERT_EQUAL_MESSAGE("[2] 80", 1, filter_port_in_set(&filter, 80, 1234));
+		CPPUNIT_ASSERT_EQUAL_MESSAGE("[3] 65535", 1, filter_port_in_set(&filter, 65535, 1234));
+		CPPUNIT_ASSERT_EQUAL_MESSAGE("[4] 81", 0, filter_port_in_set(&filter, 81, 1234));
+
+		struct ip ip;
+		ip.ip_p = IPPROTO_UDP; CPPUNIT_ASSERT_EQUAL_MESSAGE("[5] udp", 1, filter_ip_proto_in_set(&filter, &ip));
+		ip.ip_p = IPPROTO_TCP; CPPUNIT_ASSERT_EQUAL_MESSAGE("[6] tcp", 0, filter_ip_proto_in_set(&filter, &ip));
+	}
 };
 
 CPPUNIT_TEST_SUITE_REGISTRATION(Test);
@@ -8,11 +8,14 @@
 #include <string.h>
 #include <stdarg.h>
 #include <errno.h>
+#include <unistd.h>
 #include <algorithm>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <netinet/ip.h>
 #include <list>
+#include <vector>
 
 #include <cppunit/CompilerOutputter.h>
 #include <cppunit/extensions/TestFactoryRegistry.h>
@@ -24,6 +27,7 @@
  * should be released at some point to valgrind won't whine about it. (helps
  * when debugging actual memory-related errors in the code) */
 static std::list<char*> strings;
+static std::list<char*> tempfiles;
 
 extern "C" const char* hexdump_address_r(const struct ether_addr* address, char* buf);
 void check_eth_addr(const struct ether_addr& a, const struct ether_addr& b, CppUnit::SourceLine sourceLine){
@@ -109,6 +113,19 @@ class FilterCreate : public CppUnit::TestFixture {
 	CPPUNIT_TEST( test_ethertype3   );
 	CPPUNIT_TEST( test_ethertype4   );
 	CPPUNIT_TEST( test_frame_range   );
+	CPPUNIT_TEST( test_ip_src_prefix );
+	CPPUNIT_TEST( test_expr_valid    );
+	CPPUNIT_TEST( test_expr_join     );
+	CPPUNIT_TEST( test_expr_invalid  );
+	CPPUNIT_TEST( test_expr_match    );
+	CPPUNIT_TEST( test_expr_precedence );
+	CPPUNIT_TEST( test_sets          );
+	CPPUNIT_TEST( test_sets_invalid  );
+	CPPUNIT_TEST( test_sets_repeated );
+	CPPUNIT_TEST( test_sample        );
+	CPPUNIT_TEST( test_sample_random );
+	CPPUNIT_TEST( test_sample_flow   );
+	CPPUNIT_TEST( test_sample_invalid );
 	CPPUNIT_TEST_SUITE_END();
 
 	struct filter filter;
@@ -468,6 +485,283 @@ public:
 
 		CPPUNIT_ASSERT_EQUAL_MESSAGE("num ranges", 4, i);
 	}
+
+	void test_ip_src_prefix(){
+		in_addr addr = {inet_addr("10.0.0.0")};
+		in_addr mask = {inet_addr("255.0.0.0")};
+
+		generate_argv("programname", "--ip.src", "10/8", NULL);
+		CPPUNIT_ASSERT_SUCCESS(filter_from_argv(&argc, argv, &filter), 1);
+		CPPUNIT_ASSERT_INET_ADDR(addr, filter.ip_src);
+		CPPUNIT_ASSERT_INET_ADDR(mask, filter.ip_src_mask);
+
+		addr.s_addr = inet_addr("192.168.0.0");
+		mask.s_addr = inet_addr("255.255.0.0");
+		generate_argv("programname", "--ip.src", "192.168/16", NULL);
+		CPPUNIT_ASSERT_SUCCESS(filter_from_argv(&argc, argv, &filter), 1);
+		CPPUNIT_ASSERT_INET_ADDR(addr, filter.ip_src);
+		CPPUNIT_ASSERT_INET_ADDR(mask, filter.ip_src_mask);
+	}
+
+	void test_expr_valid(){
+		const std::string expr = "(tcp.port 80 or udp.port=53) and not ip.src 10/8";
+		generate_argv("programname", "--expr", expr.c_str(), NULL);
+		CPPUNIT_ASSERT_SUCCESS(filter_from_argv(&argc, argv, &filter), 1);
+		CPPUNIT_ASSERT_EQUAL(std::string(filter.expr), expr);
+		CPPUNIT_ASSERT_EQUAL((uint32_t)0, filter.index);
+	}
+
+	void test_expr_join(){
+		generate_argv("programname", "--expr", "tcp", "--expr", "tp.port 80", NULL);
+		CPPUNIT_ASSERT_SUCCESS(filter_from_argv(&argc, argv, &filter), 1);
+		CPPUNIT_ASSERT_EQUAL(std::string("(tcp) and (tp.port 80)"), std::string(filter.expr));
+	}
+
+	void test_expr_invalid(){
+		static const char* invalid[] = {
+			"", "tcp and", "(tcp", "tcp)", "tcp udp", "foo.bar 1", "ip.src", "not",
+			"ip.src nonsense", "frame-num 1-3", "and tcp",
+			"\"", "'", "ip.src '10.0.0.1", "'ip.src", "tcp and \"udp",
+			"tcp and \xff", "\xa0tcp",
+		};
+		for ( unsigned int i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++ ){
+			generate_argv("programname", "--expr", invalid[i], NULL);
+			CPPUNIT_ASSERT_EQUAL_MESSAGE(invalid[i], EINVAL, filter_from_argv(&argc, argv, &filter));
+		}
+		/* nesting is limited (but not by the number of nodes as double negations is folded) */
+		std::string nested(10000, '!');
+		nested += "tcp";
+		generate_argv("programname", "--expr", nested.c_str(), NULL);
+		CPPUNIT_ASSERT_EQUAL(EINVAL, filter_from_argv(&argc, argv, &filter));
+		nested = std::string(64, '(') + "tcp" + std::string(64, ')');
+		generate_argv("programname", "--expr", nested.c_str(), NULL);
+		CPPUNIT_ASSERT_EQUAL(0, filter_from_argv(&argc, argv, &filter));
+	}
+
+	/* ethernet, ipv4 and transport ports */
+	struct cap_header* packet(uint8_t proto, const char* src, uint16_t sport, const char* dst, uint16_t dport){
+		static char buf[sizeof(struct cap_header) + 64];
+		memset(buf, 0, sizeof(buf));
+		struct cap_header* cp = (struct cap_header*)buf;
+		cp->caplen = cp->len = sizeof(struct ethhdr) + sizeof(struct ip) + 8;
+
+		struct ethhdr* eth = (struct ethhdr*)cp->payload;
+		eth->h_proto = htons(ETHERTYPE_IP);
+		struct ip* ip = (struct ip*)(eth + 1);
+		ip->ip_v = 4;
+		ip->ip_hl = 5;
+		ip->ip_p = proto;
+		ip->ip_src.s_addr = inet_addr(src);
+		ip->ip_dst.s_addr = inet_addr(dst);
+		uint16_t* port = (uint16_t*)(ip + 1);
+		port[0] = htons(sport);
+		port[1] = htons(dport);
+
+		return cp;
+	}
+
+	int match(struct cap_header* cp){
+		return filter_match(&filter, cp->payload, cp);
+	}
+
+	void test_expr_match(){
+		generate_argv("programname", "--expr", "(tcp.port 80 or udp.port 53) and not ip.src 10/8", NULL);
+		CPPUNIT_ASSERT_SUCCESS(filter_from_argv(&argc, argv, &filter), 1);
+
+		CPPUNIT_ASSERT_EQUAL(1, match(packet(IPPROTO_TCP, "1.2.3.4", 1234, "5.6.7.8", 80)));
+		CPPUNIT_ASSERT_EQUAL(1, match(packet(IPPROTO_TCP, "1.2.3.4", 80, "5.6.7.8", 1234)));
+		CPPUNIT_ASSERT_EQUAL(1, match(packet(IPPROTO_UDP, "1.2.3.4", 1234, "5.6.7.8", 53)));
+		CPPUNIT_ASSERT_EQUAL(0, match(packet(IPPROTO_TCP, "10.2.3.4", 1234, "5.6.7.8", 80)));
+		CPPUNIT_ASSERT_EQUAL(0, match(packet(IPPROTO_UDP, "1.2.3.4", 1234, "5.6.7.8", 80)));
+		CPPUNIT_ASSERT_EQUAL(0, match(packet(IPPROTO_TCP, "1.2.3.4", 1234, "5.6.7.8", 53)));
+		CPPUNIT_ASSERT_EQUAL(1, match(packet(IPPROTO_TCP, "11.2.3.4", 1234, "10.6.7.8", 80)));
+	}
+
+	void test_expr_precedence(){
+		/* and binds tighter than or, identical predicates is shared */
+		generate_argv("programname", "--expr", "udp or tcp and tp.port 80 or ! ! (tp.port 80 and tcp)", NULL);
+		CPPUNIT_ASSERT_SUCCESS(filter_from_argv(&argc, argv, &filter), 1);
+		CPPUNIT_ASSERT_EQUAL(1, match(packet(IPPROTO_UDP, "1.2.3.4", 1, "5.6.7.8", 2)));
+		CPPUNIT_ASSERT_EQUAL(1, match(packet(IPPROTO_TCP, "1.2.3.4", 1, "5.6.7.8", 80)));
+		CPPUNIT_ASSERT_EQUAL(0, match(packet(IPPROTO_TCP, "1.2.3.4", 1, "5.6.7.8", 2)));
+
+		/* joined with the regular filter using and */
+		filter_close(&filter);
+		generate_argv("programname", "--ip.dst", "5.6.7.8", "--expr", "not tcp", NULL);
+		CPPUNIT_ASSERT_SUCCESS(filter_from_argv(&argc, argv, &filter), 1);
+		CPPUNIT_ASSERT_EQUAL(1, match(packet(IPPROTO_UDP, "1.2.3.4", 1, "5.6.7.8", 2)));
+		CPPUNIT_ASSERT_EQUAL(0, match(packet(IPPROTO_TCP, "1.2.3.4", 1, "5.6.7.8", 2)));
+		CPPUNIT_ASSERT_EQUAL(0, match(packet(IPPROTO_UDP, "1.2.3.4", 1, "5.6.7.9", 2)));
+	}
+
+	/* write a temporary file (removed when the test finishes) */
+	const char* tempfile(const char* content){
+		char* filename = strdup("/tmp/caputils-test-XXXXXX");
+		strings.push_back(filename);
+		const int fd = mkstemp(filename);
+		CPPUNIT_ASSERT(fd != -1);
+		CPPUNIT_ASSERT_EQUAL((ssize_t)strlen(content), write(fd, content, strlen(content)));
+		close(fd);
+		tempfiles.push_back(filename);
+		return filename;
+	}
+
+	void test_sets(){
+		const char* prefixes = tempfile("# blocklist\n10/8\n192.168.1.0/24  \n172.16.5.5\n\n2001:db8::/32\n");
+		const char* ports = tempfile("80, 443 # web\n8000-8010\ndomain\n");
+		const char* protos = tempfile("udp\n");
+
+		generate_argv("programname", "--ip.src-set", prefixes, "--tp.port-set", ports, "--ip.proto-set", protos, NULL);
+		CPPUNIT_ASSERT_SUCCESS(filter_from_argv(&argc, argv, &filter), 1);
+		CPPUNIT_ASSERT_EQUAL((uint32_t)(FILTER_IP_SRC_SET | FILTER_PORT_SET | FILTER_IP_PROTO_SET), filter.index);
+
+		CPPUNIT_ASSERT_EQUAL(1, match(packet(IPPROTO_UDP, "10.2.3.4", 1234, "5.6.7.8", 53)));
+		CPPUNIT_ASSERT_EQUAL(1, match(packet(IPPROTO_UDP, "192.168.1.7", 8005, "5.6.7.8", 1)));
+		CPPUNIT_ASSERT_EQUAL(1, match(packet(IPPROTO_UDP, "172.16.5.5", 443, "5.6.7.8", 1)));
+		CPPUNIT_ASSERT_EQUAL(0, match(packet(IPPROTO_UDP, "172.16.5.6", 443, "5.6.7.8", 1)));
+		CPPUNIT_ASSERT_EQUAL(0, match(packet(IPPROTO_UDP, "192.168.2.7", 80, "5.6.7.8", 1)));
+		CPPUNIT_ASSERT_EQUAL(0, match(packet(IPPROTO_UDP, "10.2.3.4", 8011, "5.6.7.8", 1)));
+		CPPUNIT_ASSERT_EQUAL(0, match(packet(IPPROTO_TCP, "10.2.3.4", 80, "5.6.7.8", 1)));
+
+		/* as predicate */
+		filter_close(&filter);
+		const std::string expr = std::string("not ip.dst-set ") + prefixes;
+		generate_argv("programname", "--expr", expr.c_str(), NULL);
+		CPPUNIT_ASSERT_SUCCESS(filter_from_argv(&argc, argv, &filter), 1);
+		CPPUNIT_ASSERT_EQUAL(1, match(packet(IPPROTO_UDP, "10.2.3.4", 1234, "5.6.7.8", 53)));
+		CPPUNIT_ASSERT_EQUAL(0, match(packet(IPPROTO_UDP, "5.6.7.8", 1234, "10.2.3.4", 53)));
+	}
+
+	void test_sets_invalid(){
+		const char* prefixes = tempfile("10.0.0.0/8\n10.0.0.0/33\n");
+		const char* ports = tempfile("80 70000\n");
+		const char* range = tempfile("90-80\n");
+
+		generate_argv("programname", "--ip.src-set", prefixes, "--tp.port-set", ports, "--tp.port-set", range, "--ip.dst-set", "/nonexistent", NULL);
+		CPPUNIT_ASSERT_SUCCESS(filter_from_argv(&argc, argv, &filter), 1);
+		CPPUNIT_ASSERT_EQUAL((uint32_t)0, filter.index);
+
+		generate_argv("programname", "--expr", "ip.src-set /nonexistent", NULL);
+		CPPUNIT_ASSERT_EQUAL(EINVAL, filter_from_argv(&argc, argv, &filter));
+	}
+
+	void test_sets_repeated(){
+		const char* first = tempfile("10.1.2.0/28\n");
+		const char* second = tempfile("10.1.2.128/25\n10.2/16\n");
+		const char* invalid = tempfile("172.16/12\nfoo\n");
+
+		/* repeated sets is merged */
+		generate_argv("programname", "--ip.src-set", first, "--ip.src-set", second, NULL);
+		CPPUNIT_ASSERT_SUCCESS(filter_from_argv(&argc, argv, &filter), 1);
+		CPPUNIT_ASSERT_EQUAL(1, match(packet(IPPROTO_UDP, "10.1.2.7", 1, "5.6.7.8", 2)));
+		CPPUNIT_ASSERT_EQUAL(1, match(packet(IPPROTO_UDP, "10.1.2.200", 1, "5.6.7.8", 2)));
+		CPPUNIT_ASSERT_EQUAL(0, match(packet(IPPROTO_UDP, "10.1.2.64", 1, "5.6.7.8", 2)));
+		CPPUNIT_ASSERT_EQUAL(1, match(packet(IPPROTO_UDP, "10.2.3.4", 1, "5.6.7.8", 2)));
+
+		/* a set failing to load leaves the previous prefixes as-is */
+		filter_close(&filter);
+		generate_argv("programname", "--ip.src-set", first, "--ip.src-set", invalid, NULL);
+		CPPUNIT_ASSERT_SUCCESS(filter_from_argv(&argc, argv, &filter), 1);
+		CPPUNIT_ASSERT_EQUAL((uint32_t)FILTER_IP_SRC_SET, filter.index);
+		CPPUNIT_ASSERT_EQUAL(1, match(packet(IPPROTO_UDP, "10.1.2.7", 1, "5.6.7.8", 2)));
+		CPPUNIT_ASSERT_EQUAL(0, match(packet(IPPROTO_UDP, "172.16.1.1", 1, "5.6.7.8", 2)));
+	}
+
+	void test_sample(){
+		generate_argv("programname", "--sample", "3", NULL);
+		CPPUNIT_ASSERT_SUCCESS(filter_from_argv(&argc, argv, &filter), 1);
+		CPPUNIT_ASSERT_EQUAL((uint64_t)3, filter_sample_rate(&filter));
+		for ( int i = 0; i < 9; i++ ){
+			CPPUNIT_ASSERT_EQUAL(i % 3 == 0, match(packet(IPPROTO_UDP, "1.2.3.4", 1, "5.6.7.8", 2)));
+		}
+
+		/* only packets matching the rest of the filter is sampled */
+		filter_close(&filter);
+		generate_argv("programname", "--ip.proto", "udp", "--sample", "2", NULL);
+		CPPUNIT_ASSERT_SUCCESS(filter_from_argv(&argc, argv, &filter), 1);
+		CPPUNIT_ASSERT_EQUAL(1, match(packet(IPPROTO_UDP, "1.2.3.4", 1, "5.6.7.8", 2)));
+		CPPUNIT_ASSERT_EQUAL(0, match(packet(IPPROTO_TCP, "1.2.3.4", 1, "5.6.7.8", 2)));
+		CPPUNIT_ASSERT_EQUAL(0, match(packet(IPPROTO_UDP, "1.2.3.4", 1, "5.6.7.8", 2)));
+		CPPUNIT_ASSERT_EQUAL(0, match(packet(IPPROTO_TCP, "1.2.3.4", 1, "5.6.7.8", 2)));
+		CPPUNIT_ASSERT_EQUAL(1, match(packet(IPPROTO_UDP, "1.2.3.4", 1, "5.6.7.8", 2)));
+
+		/* rates is combined */
+		filter_close(&filter);
+		generate_argv("programname", "--sample", "2", "--sample-flow", "5", NULL);
+		CPPUNIT_ASSERT_SUCCESS(filter_from_argv(&argc, argv, &filter), 1);
+		CPPUNIT_ASSERT_EQUAL((uint64_t)10, filter_sample_rate(&filter));
+	}
+
+	void test_sample_random(){
+		static const int n = 10000;
+		std::vector<int> first;
+
+		/* same seed gives the same packets, other seed is different */
+		const char* seeds[] = {"10:42", "10:42", "10:43"};
+		for ( int s = 0; s < 3; s++ ){
+			filter_close(&filter);
+			generate_argv("programname", "--sample-random", seeds[s], NULL);
+			CPPUNIT_ASSERT_SUCCESS(filter_from_argv(&argc, argv, &filter), 1);
+
+			int kept = 0;
+			int same = 0;
+			for ( int i = 0; i < n; i++ ){
+				const int m = match(packet(IPPROTO_UDP, "1.2.3.4", 1, "5.6.7.8", 2));
+				kept += m;
+				if ( s == 0 ){
+					first.push_back(m);
+				} else {
+					same += first[i] == m;
+				}
+			}
+
+			CPPUNIT_ASSERT_MESSAGE(seeds[s], kept > n / 10 * 8 / 10 && kept < n / 10 * 12 / 10);
+			if ( s == 1 ) CPPUNIT_ASSERT_EQUAL(n, same);
+			if ( s == 2 ) CPPUNIT_ASSERT(same < n);
+		}
+	}
+
+	void test_sample_flow(){
+		generate_argv("programname", "--sample-flow", "4:7", NULL);
+		CPPUNIT_ASSERT_SUCCESS(filter_from_argv(&argc, argv, &filter), 1);
+
+		/* both directions of a flow is kept or dropped together */
+		static const int flows = 2000;
+		int kept = 0;
+		for ( int i = 0; i < flows; i++ ){
+			const uint16_t sport = 1024 + i;
+			const uint16_t dport = i % 2 ? 80 : 443;
+			const int m = match(packet(IPPROTO_TCP, "10.0.0.1", sport, "10.0.0.2", dport));
+			CPPUNIT_ASSERT_EQUAL(m, match(packet(IPPROTO_TCP, "10.0.0.2", dport, "10.0.0.1", sport)));
+			CPPUNIT_ASSERT_EQUAL(m, match(packet(IPPROTO_TCP, "10.0.0.1", sport, "10.0.0.2", dport)));
+			kept += m;
+		}
+		CPPUNIT_ASSERT(kept > flows / 4 * 8 / 10 && kept < flows / 4 * 12 / 10);
+	}
+
+	void test_sample_invalid(){
+		const char* invalid[][2] = {
+			{"--sample", "0"},
+			{"--sample", "2x"},
+			{"--sample", "+2"},
+			{"--sample-random", "10:x"},
+			{"--sample-random", "0:5"},
+			{"--sample-flow", "abc"},
+		};
+		for ( size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++ ){
+			generate_argv("programname", invalid[i][0], invalid[i][1], NULL);
+			CPPUNIT_ASSERT_EQUAL_MESSAGE(invalid[i][1], EINVAL, filter_from_argv(&argc, argv, &filter));
+			CPPUNIT_ASSERT_EQUAL((uint64_t)1, filter_sample_rate(&filter));
+		}
+
+		generate_argv("programname", "--expr", "sample-flow 10", NULL);
+		CPPUNIT_ASSERT_EQUAL(EINVAL, filter_from_argv(&argc, argv, &filter));
+
+		CPPUNIT_ASSERT_EQUAL(EINVAL, filter_sample_set(&filter, FILTER_SAMPLE, 0, 0));
+		CPPUNIT_ASSERT_EQUAL(EINVAL, filter_sample_set(&filter, FILTER_IP_SRC, 10, 0));
+		CPPUNIT_ASSERT_EQUAL(0, filter_sample_set(&filter, FILTER_SAMPLE_FLOW, 10, 0));
+		CPPUNIT_ASSERT_EQUAL((uint32_t)FILTER_SAMPLE_FLOW, filter.index);
+	}
 };
 
 CPPUNIT_TEST_SUITE_REGISTRATION(FilterCreate);
@@ -482,6 +776,10 @@ int main(int argc, const char* argv[]){
 
 	int ret = runner.run() ? 0 : 1;
 
+	for ( std::list<char*>::iterator it = tempfiles.begin(); it != tempfiles.end(); ++it ){
+		unlink(*it);
+	}
+
 	for ( std::list<char*>::iterator it = strings.begin(); it != strings.end(); ++it ){
 		free(*it);
 	}
@@ -5,6 +5,8 @@
 
 #include <cstdlib>
 #include <cstring>
+#include <stdint.h>
+#include <string>
 
 class Data {
 public:
@@ -42,6 +44,9 @@ class Test: public CppUnit::TestFixture {
 	CPPUNIT_TEST_SUITE(Test);
 	CPPUNIT_TEST(test_aligned);
 	CPPUNIT_TEST(test_fin_address);
+	CPPUNIT_TEST(test_format);
+	CPPUNIT_TEST(test_empty);
+	CPPUNIT_TEST(test_fmt);
 	CPPUNIT_TEST_SUITE_END();
 
 public:
@@ -76,6 +81,45 @@ public:
 		CPPUNIT_ASSERT_EQUAL(data.size(), (size_t)addr);
 		free(dump);
 	}
+	void test_format(){
+		Data data(20);
+		char* dump = hexdump_str(data.get(), data.size());
+		CPPUNIT_ASSERT_EQUAL(std::string(
+			"[0000]  20 21 22 23   24 25 26 27   28 29 2A 2B   2C 2D 2E 2F       | !\"#$%&'()*+,-./|\n"
+			"[0010]  30 31 32 33                                                 |0123|\n"
+			"[0014]\n"), std::string(dump));
+		free(dump);
+	}
+
+	void test_empty(){
+		char* dump = hexdump_str(NULL, 0);
+		CPPUNIT_ASSERT_EQUAL(std::string("[0000]  \n[0000]\n"), std::string(dump));
+		free(dump);
+	}
+
+	static std::string str(const char* begin, const char* end){
+		return std::string(begin, end - begin);
+	}
+
+	void test_fmt(){
+		char buf[64];
+		CPPUNIT_ASSERT_EQUAL(std::string("   7"),         str(buf, fmt_uint(buf, 7, 4, ' ')));
+		CPPUNIT_ASSERT_EQUAL(std::string("12345"),        str(buf, fmt_uint(buf, 12345, 4, ' ')));
+		CPPUNIT_ASSERT_EQUAL(std::string("000000000042"), str(buf, fmt_uint(buf, 42, 12, '0')));
+		CPPUNIT_ASSERT_EQUAL(std::string("0"),            str(buf, fmt_uint(buf, 0, 0, ' ')));
+		CPPUNIT_ASSERT_EQUAL(std::string("18446744073709551615"), str(buf, fmt_uint(buf, UINT64_MAX, 0, ' ')));
+		CPPUNIT_ASSERT_EQUAL(std::string("  -5"),         str(buf, fmt_int(buf, -5, 4)));
+		CPPUNIT_ASSERT_EQUAL(std::string("-2147483648"),  str(buf, fmt_int(buf, INT32_MIN, 4)));
+		CPPUNIT_ASSERT_EQUAL(std::string("00AF"),         str(buf, fmt_hex(buf, 0xaf, 4)));
+		CPPUNIT_ASSERT_EQUAL(std::string("12345"),        str(buf, fmt_hex(buf, 0x12345, 4)));
+
+		struct in_addr addr;
+		inet_pton(AF_INET, "192.168.0.255", &addr);
+		CPPUNIT_ASSERT_EQUAL(std::string("192.168.0.255"), str(buf, fmt_ipv4(buf, addr)));
+
+		CPPUNIT_ASSERT_EQUAL(std::string("ab\\x0ac"),     str(buf, fmt_printable(buf, "ab\nc", 8)));
+		CPPUNIT_ASSERT_EQUAL(std::string("abcd"),         str(buf, fmt_printable(buf, "abcdefgh", 4)));
+	}
 };
 
 CPPUNIT_TEST_SUITE_REGISTRATION(Test);
@@ -1,7 +1,12 @@
 #include "test.hpp"
 
 #include <caputils/packet.h>
+#include <caputils/field.h>
+#include <caputils/stream.h>
 #include "src/format/format.h"
+#include <errno.h>
+#include <glob.h>
+#include <string.h>
 
 class Test: public CppUnit::TestFixture {
 	CPPUNIT_TEST_SUITE(Test);
@@ -16,6 +21,15 @@ class Test: public CppUnit::TestFixture {
 	CPPUNIT_TEST(test_payload_network);
 	CPPUNIT_TEST(test_payload_transport);
 	CPPUNIT_TEST(test_limited_caplen);
+	CPPUNIT_TEST(test_dissect);
+	CPPUNIT_TEST(test_dissect_truncated);
+	CPPUNIT_TEST(test_dissect_traces);
+	CPPUNIT_TEST(test_dissect_udp);
+	CPPUNIT_TEST(test_dissect_gtp_invalid);
+	CPPUNIT_TEST(test_field_compile);
+	CPPUNIT_TEST(test_field_extract);
+	CPPUNIT_TEST(test_field_batch);
+	CPPUNIT_TEST(test_field_dns);
 	CPPUNIT_TEST_SUITE_END();
 
 public:
@@ -84,6 +98,255 @@ public:
 		CPPUNIT_ASSERT_MESSAGE("cp.payload[ 2] <- 3 bytes",  limited_caplen(&cp, cp.payload+2, 3));
 		CPPUNIT_ASSERT_MESSAGE("cp.payload[-1] <- 1 bytes",  limited_caplen(&cp, cp.payload-1, 1));
 	}
+
+	void test_dissect(){
+		struct layer_table table;
+		CPPUNIT_ASSERT_EQUAL(4U, packet_dissect(caphead, &table));
+		CPPUNIT_ASSERT_EQUAL(0U, table.flags);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)PROTOCOL_ETHERNET, table.layer[0].protocol);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)PROTOCOL_IPV4,     table.layer[1].protocol);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)PROTOCOL_TCP,      table.layer[2].protocol);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)PROTOCOL_DATA,     table.layer[3].protocol);
+		CPPUNIT_ASSERT_EQUAL(0U,   table.layer[0].offset);
+		CPPUNIT_ASSERT_EQUAL(14U,  table.layer[0].length);
+		CPPUNIT_ASSERT_EQUAL(14U,  table.layer[1].offset);
+		CPPUNIT_ASSERT_EQUAL(20U,  table.layer[1].length);
+		CPPUNIT_ASSERT_EQUAL(34U,  table.layer[2].offset);
+		CPPUNIT_ASSERT_EQUAL(32U,  table.layer[2].length);
+		CPPUNIT_ASSERT_EQUAL(439U, table.layer[3].length);
+		CPPUNIT_ASSERT_EQUAL(AF_INET, table.net.family);
+
+		const struct layer* tcp = layer_find(&table, PROTOCOL_TCP);
+		CPPUNIT_ASSERT(tcp == &table.layer[2]);
+		CPPUNIT_ASSERT(layer_find(&table, PROTOCOL_UDP) == NULL);
+	}
+
+	void test_dissect_truncated(){
+		char buffer[1024];
+		struct cap_header* cp = (struct cap_header*)buffer;
+		memcpy(buffer, data, sizeof(buffer));
+		cp->caplen = 30; /* ethernet header and 16 bytes of ip */
+
+		struct layer_table table;
+		CPPUNIT_ASSERT_EQUAL(2U, packet_dissect(cp, &table));
+		CPPUNIT_ASSERT_EQUAL((unsigned int)LAYER_TABLE_TRUNCATED, table.flags);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)0, table.layer[0].flags);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)LAYER_TRUNCATED, table.layer[1].flags);
+		CPPUNIT_ASSERT_EQUAL(16U, table.layer[1].length);
+	}
+
+	/* the layer table must list the same headers as header_walk */
+	void test_dissect_traces(){
+		glob_t g;
+		glob(TOP_SRCDIR "/tests/traces/*.cap", 0, NULL, &g);
+		glob(TOP_SRCDIR "/tests/traces/protocols/*.cap", GLOB_APPEND, NULL, &g);
+		CPPUNIT_ASSERT(g.gl_pathc > 0);
+
+		for ( size_t i = 0; i < g.gl_pathc; i++ ){
+			stream_t st;
+			stream_addr_t addr = STREAM_ADDR_INITIALIZER;
+			stream_addr_str(&addr, g.gl_pathv[i], 0);
+			CPPUNIT_ASSERT_EQUAL(0, stream_open(&st, &addr, NULL, 0));
+
+			cap_head* cp;
+			while ( stream_read(st, &cp, NULL, NULL) == 0 ){
+				struct layer_table table;
+				packet_dissect(cp, &table);
+
+				unsigned int n = 0;
+				struct header_chunk header;
+				header_init(&header, cp, 0);
+				while ( header_walk(&header) && n < LAYER_MAX ){
+					CPPUNIT_ASSERT_MESSAGE(g.gl_pathv[i], n < table.num_layers);
+					CPPUNIT_ASSERT_EQUAL_MESSAGE(g.gl_pathv[i], (uint16_t)header.protocol->type, table.layer[n].protocol);
+					CPPUNIT_ASSERT_EQUAL_MESSAGE(g.gl_pathv[i], (uint32_t)(header.ptr - cp->payload), table.layer[n].offset);
+					n++;
+				}
+				CPPUNIT_ASSERT_EQUAL_MESSAGE(g.gl_pathv[i], n, table.num_layers);
+				CPPUNIT_ASSERT_EQUAL_MESSAGE(g.gl_pathv[i], header.last_net.plen, table.net.plen);
+			}
+
+			stream_close(st);
+		}
+
+		globfree(&g);
+	}
+	/* ethernet, ipv4 and udp with the given payload */
+	static struct cap_header* udp_packet(char* buffer, uint16_t port, const void* payload, size_t size){
+		static const unsigned char hdr[] = {
+			0x08, 0x00,                                           /* ipv4 */
+			0x45, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+			0x40, 0x11, 0x00, 0x00, 10, 0, 0, 1, 10, 0, 0, 2,     /* udp */
+		};
+		struct cap_header* cp = (struct cap_header*)buffer;
+		memset(buffer, 0, sizeof(struct cap_header) + 42 + size);
+		memcpy(cp->payload + 12, hdr, sizeof(hdr));
+		char* udp = cp->payload + 34;
+		const uint16_t nport = htons(port);
+		const uint16_t len = htons(8 + size);
+		memcpy(udp + 0, &nport, 2);
+		memcpy(udp + 2, &nport, 2);
+		memcpy(udp + 4, &len, 2);
+		memcpy(udp + 8, payload, size);
+		cp->len = cp->caplen = 42 + size;
+		return cp;
+	}
+
+	void test_dissect_udp(){
+		char buffer[sizeof(struct cap_header) + 128];
+		struct layer_table table;
+
+		/* no payload, decoded directly */
+		struct cap_header* cp = udp_packet(buffer, 53, NULL, 0);
+		CPPUNIT_ASSERT_EQUAL(3U, packet_dissect(cp, &table));
+		CPPUNIT_ASSERT_EQUAL(0U, table.flags);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)PROTOCOL_UDP, table.layer[2].protocol);
+		CPPUNIT_ASSERT_EQUAL(8U, table.layer[2].length);
+
+		/* payload is passed to the registry */
+		cp = udp_packet(buffer, 9, "payload", 7);
+		CPPUNIT_ASSERT_EQUAL(4U, packet_dissect(cp, &table));
+		CPPUNIT_ASSERT_EQUAL((uint16_t)PROTOCOL_DATA, table.layer[3].protocol);
+		CPPUNIT_ASSERT_EQUAL(42U, table.layer[3].offset);
+	}
+
+	/* malformed gtp must not abort (neither dissect nor header_walk) */
+	void test_dissect_gtp_invalid(){
+		static const unsigned char invalid_version[] = {0xe0, 0xff, 0x00, 0x00, 0, 0, 0, 0};
+		static const unsigned char truncated_ext[]   = {0x34, 0xff, 0x00, 0x00, 0, 0, 0, 1, 0, 0, 0, 0x85, 0x02};
+		static const unsigned char zero_ext[]        = {0x34, 0xff, 0x00, 0x00, 0, 0, 0, 1, 0, 0, 0, 0x85, 0x00, 0, 0, 0};
+		static const unsigned char valid_ext[]       = {0x34, 0xff, 0x00, 0x00, 0, 0, 0, 1, 0, 0, 0, 0x85, 0x01, 0xaa, 0xbb, 0x00, 0x45};
+		static const struct { const void* data; size_t size; } gtp[] = {
+			{invalid_version, sizeof(invalid_version)},
+			{truncated_ext,   sizeof(truncated_ext)},
+			{zero_ext,        sizeof(zero_ext)},
+			{valid_ext,       sizeof(valid_ext)},
+		};
+
+		char buffer[sizeof(struct cap_header) + 128];
+		for ( unsigned int i = 0; i < sizeof(gtp) / sizeof(gtp[0]); i++ ){
+			struct cap_header* cp = udp_packet(buffer, 2152, gtp[i].data, gtp[i].size);
+			struct layer_table table;
+			CPPUNIT_ASSERT(packet_dissect(cp, &table) >= 4);
+			CPPUNIT_ASSERT_EQUAL((uint16_t)PROTOCOL_GTP, table.layer[3].protocol);
+
+			struct header_chunk header;
+			header_init(&header, cp, 0);
+			while ( header_walk(&header) );
+		}
+
+		/* extension header is skipped (16 bytes) and the ipv4 payload detected */
+		struct layer_table table;
+		packet_dissect(udp_packet(buffer, 2152, valid_ext, sizeof(valid_ext)), &table);
+		CPPUNIT_ASSERT_EQUAL(16U, table.layer[3].length);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)PROTOCOL_IPV4, table.layer[4].protocol);
+	}
+
+	void test_field_compile(){
+		struct field_plan* plan;
+		CPPUNIT_ASSERT_EQUAL(EINVAL, field_compile(&plan, "ip"));
+		CPPUNIT_ASSERT_EQUAL(EINVAL, field_compile(&plan, ".src"));
+		CPPUNIT_ASSERT_EQUAL(EINVAL, field_compile(&plan, "ip."));
+		CPPUNIT_ASSERT_EQUAL(EINVAL, field_compile(&plan, "ip.src.foo"));
+		CPPUNIT_ASSERT_EQUAL(ENOENT, field_compile(&plan, "foo.src"));
+		CPPUNIT_ASSERT_EQUAL(ENOENT, field_compile(&plan, "ip.foo"));
+		CPPUNIT_ASSERT_EQUAL(ENOENT, field_compile(&plan, "arp.src")); /* protocol without fields */
+
+		/* both aliases and registry names is accepted */
+		CPPUNIT_ASSERT_EQUAL(0, field_compile(&plan, "IPv4.src"));
+		CPPUNIT_ASSERT_EQUAL(FIELD_IPV4, field_type(plan));
+		field_free(plan);
+		CPPUNIT_ASSERT_EQUAL(0, field_compile(&plan, "ethernet.dst"));
+		CPPUNIT_ASSERT_EQUAL(FIELD_MAC, field_type(plan));
+		field_free(plan);
+	}
+
+	static std::string extract(const char* path, const struct cap_header* cp){
+		struct field_plan* plan;
+		struct field_value value;
+		char buf[256];
+		CPPUNIT_ASSERT_EQUAL_MESSAGE(path, 0, field_compile(&plan, path));
+		const int found = field_extract(plan, cp, &value);
+		field_free(plan);
+		return found ? field_format(&value, buf, sizeof(buf)) : "(absent)";
+	}
+
+	void test_field_extract(){
+		CPPUNIT_ASSERT_EQUAL(std::string("00:1B:21:0C:66:CD"), extract("eth.dst", caphead));
+		CPPUNIT_ASSERT_EQUAL(std::string("2048"),              extract("eth.type", caphead));
+		CPPUNIT_ASSERT_EQUAL(std::string("4"),                 extract("ip.version", caphead));
+		CPPUNIT_ASSERT_EQUAL(std::string("5"),                 extract("ip.hl", caphead));
+		CPPUNIT_ASSERT_EQUAL(std::string("6"),                 extract("ip.proto", caphead));
+		CPPUNIT_ASSERT_EQUAL(std::string("91.198.174.225"),    extract("ip.src", caphead));
+		CPPUNIT_ASSERT_EQUAL(std::string("194.47.151.124"),    extract("ip.dst", caphead));
+		CPPUNIT_ASSERT_EQUAL(std::string("80"),                extract("tcp.sport", caphead));
+		CPPUNIT_ASSERT_EQUAL(std::string("53270"),             extract("tcp.dport", caphead));
+		CPPUNIT_ASSERT_EQUAL(std::string("8"),                 extract("tcp.doff", caphead));
+		CPPUNIT_ASSERT_EQUAL(std::string("24"),                extract("tcp.flags", caphead));
+		CPPUNIT_ASSERT_EQUAL(std::string("(absent)"),          extract("udp.dport", caphead));
+		CPPUNIT_ASSERT_EQUAL(std::string("(absent)"),          extract("ip6.src", caphead));
+
+		/* fields within the captured part of a truncated header is still present */
+		char buffer[1024];
+		struct cap_header* cp = (struct cap_header*)buffer;
+		memcpy(buffer, data, sizeof(buffer));
+		cp->caplen = 30;
+		CPPUNIT_ASSERT_EQUAL(std::string("6"),                 extract("ip.proto", cp));
+		CPPUNIT_ASSERT_EQUAL(std::string("(absent)"),          extract("ip.dst", cp));
+	}
+
+	void test_field_batch(){
+		char buffer[1024];
+		struct cap_header* truncated = (struct cap_header*)buffer;
+		memcpy(buffer, data, sizeof(buffer));
+		truncated->caplen = 20;
+
+		const struct cap_header* cp[3] = { caphead, truncated, caphead };
+		struct field_value values[3];
+		uint8_t present[3];
+		struct field_plan* plan;
+		CPPUNIT_ASSERT_EQUAL(0, field_compile(&plan, "tcp.dport"));
+		CPPUNIT_ASSERT_EQUAL((size_t)2, field_extract_batch(plan, cp, 3, values, present));
+		field_free(plan);
+
+		CPPUNIT_ASSERT_EQUAL((uint8_t)1, present[0]);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)0, present[1]);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)1, present[2]);
+		CPPUNIT_ASSERT_EQUAL((uint64_t)53270, values[0].u);
+		CPPUNIT_ASSERT_EQUAL((uint64_t)53270, values[2].u);
+	}
+
+	void test_field_dns(){
+		static const uint8_t query[] = {
+			/* ethernet */
+			0x00, 0x1b, 0x21, 0x0c, 0x66, 0xcd, 0x00, 0x19, 0xd1, 0xf5, 0x24, 0x04, 0x08, 0x00,
+			/* ipv4 */
+			0x45, 0x00, 0x00, 0x3d, 0x00, 0x00, 0x40, 0x00, 0x40, 0x11, 0x00, 0x00,
+			0x0a, 0x00, 0x00, 0x01, 0x0a, 0x00, 0x00, 0x02,
+			/* udp */
+			0xc0, 0x00, 0x00, 0x35, 0x00, 0x29, 0x00, 0x00,
+			/* dns */
+			0x12, 0x34, 0x01, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+			0x03, 'w', 'w', 'w', 0x07, 'e', 'x', 'a', 'm', 'p', 'l', 'e', 0x03, 'c', 'o', 'm', 0x00,
+			0x00, 0x01, 0x00, 0x01,
+		};
+
+		char buffer[sizeof(struct cap_header) + sizeof(query)];
+		struct cap_header* cp = (struct cap_header*)buffer;
+		memset(cp, 0, sizeof(struct cap_header));
+		memcpy(cp->payload, query, sizeof(query));
+		cp->len = cp->caplen = sizeof(query);
+
+		CPPUNIT_ASSERT_EQUAL(std::string("4660"),            extract("dns.id", cp));
+		CPPUNIT_ASSERT_EQUAL(std::string("0"),               extract("dns.qr", cp));
+		CPPUNIT_ASSERT_EQUAL(std::string("53"),              extract("udp.dport", cp));
+		CPPUNIT_ASSERT_EQUAL(std::string("www.example.com"), extract("dns.qname", cp));
+
+		/* name running past the captured data */
+		cp->caplen = sizeof(query) - 10;
+		CPPUNIT_ASSERT_EQUAL(std::string("(absent)"),        extract("dns.qname", cp));
+		CPPUNIT_ASSERT_EQUAL(std::string("(absent)"),        extract("dns.qname", caphead));
+	}
 };
 
 CPPUNIT_TEST_SUITE_REGISTRATION(Test);
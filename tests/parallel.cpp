@@ -0,0 +1,235 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <caputils/caputils.h>
+#include <caputils/stream.h>
+#include <caputils/filter.h>
+#include <caputils/parallel.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <vector>
+
+#include <cppunit/CompilerOutputter.h>
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+static const char* traces[] = {
+	TOP_SRCDIR "/tests/traces/dump_with_lldp.cap",
+	TOP_SRCDIR "/tests/traces/t2.cap",
+	TOP_SRCDIR "/tests/traces/vrrp.cap",
+};
+static const size_t num_traces = sizeof(traces) / sizeof(traces[0]);
+
+struct summary {
+	uint64_t packets;
+	uint64_t bytes;
+	uint64_t matched;
+
+	/* polynomial hash of the timestamps, detects packets processed out of order */
+	uint64_t hash;
+	uint64_t power;
+};
+
+static const uint64_t prime = 1099511628211ULL;
+
+struct result {
+	struct summary file[3];
+	size_t last_index;
+	int out_of_order;
+};
+
+static void summary_add(struct summary* sum, const struct cap_header* cp, int match){
+	if ( sum->packets == 0 ){
+		sum->power = 1;
+	}
+	sum->hash = sum->hash * prime + (cp->ts.tv_sec ^ cp->ts.tv_psec);
+	sum->power *= prime;
+	sum->packets++;
+	sum->bytes += cp->caplen;
+	sum->matched += match ? 1 : 0;
+}
+
+static int map(void* state, const struct cap_header* cp, int match, void* user){
+	summary_add((struct summary*)state, cp, match);
+	return 0;
+}
+
+static int map_abort(void* state, const struct cap_header* cp, int match, void* user){
+	return ERANGE;
+}
+
+static void reduce(void* state, size_t index, void* user){
+	const struct summary* part = (const struct summary*)state;
+	struct result* result = (struct result*)user;
+	struct summary* sum = &result->file[index];
+
+	/* files must be reduced in order (the hash verifies the order within the file) */
+	if ( index < result->last_index ){
+		result->out_of_order = 1;
+	}
+	result->last_index = index;
+
+	if ( part->packets == 0 ) return;
+	if ( sum->packets == 0 ){
+		sum->power = 1;
+	}
+	sum->hash = sum->hash * part->power + part->hash;
+	sum->power *= part->power;
+	sum->packets += part->packets;
+	sum->bytes += part->bytes;
+	sum->matched += part->matched;
+}
+
+/* reference using a regular sequential read */
+static void sequential(const char* filename, struct filter* filter, struct summary* sum){
+	stream_t st;
+	stream_addr_t addr = STREAM_ADDR_INITIALIZER;
+	stream_addr_str(&addr, filename, 0);
+	CPPUNIT_ASSERT_EQUAL(0, stream_open(&st, &addr, NULL, 0));
+
+	cap_head* cp;
+	while ( stream_read(st, &cp, NULL, NULL) == 0 ){
+		summary_add(sum, cp, !filter || filter_match(filter, cp->payload, cp));
+	}
+
+	stream_close(st);
+}
+
+class Test: public CppUnit::TestFixture {
+	CPPUNIT_TEST_SUITE(Test);
+	CPPUNIT_TEST( test_chunked );
+	CPPUNIT_TEST( test_single_thread );
+	CPPUNIT_TEST( test_filter );
+	CPPUNIT_TEST( test_stateful_filter );
+	CPPUNIT_TEST( test_map_error );
+	CPPUNIT_TEST( test_missing_file );
+	CPPUNIT_TEST( test_truncated_file );
+	CPPUNIT_TEST_SUITE_END();
+
+	void run(unsigned int threads, size_t chunk_size, struct filter* filter){
+		struct result result = {};
+		const struct caputils_parallel job = {
+			sizeof(struct summary), NULL, map, reduce, NULL, &result, filter, chunk_size,
+		};
+
+		CPPUNIT_ASSERT_EQUAL(0, caputils_parallel_foreach(traces, num_traces, threads, &job));
+		CPPUNIT_ASSERT_EQUAL(0, result.out_of_order);
+
+		for ( size_t i = 0; i < num_traces; i++ ){
+			struct summary ref = {};
+			sequential(traces[i], filter, &ref);
+			CPPUNIT_ASSERT(ref.packets > 0);
+			CPPUNIT_ASSERT_EQUAL(ref.packets, result.file[i].packets);
+			CPPUNIT_ASSERT_EQUAL(ref.bytes, result.file[i].bytes);
+			CPPUNIT_ASSERT_EQUAL(ref.matched, result.file[i].matched);
+			CPPUNIT_ASSERT_EQUAL(ref.hash, result.file[i].hash);
+		}
+	}
+
+public:
+	void test_chunked(){
+		/* small chunks so most packets boundaries must be found by syncing */
+		run(4, 4096, NULL);
+		run(3, 1000, NULL);
+		run(0, 0, NULL);
+	}
+
+	void test_single_thread(){
+		run(1, 4096, NULL);
+	}
+
+	void test_filter(){
+		struct filter filter;
+		filter_init(&filter);
+		filter_ip_proto_set(&filter, IPPROTO_UDP);
+		run(4, 4096, &filter);
+		filter_close(&filter);
+	}
+
+	void test_stateful_filter(){
+		struct filter filter;
+		filter_init(&filter);
+		filter_frame_num_set(&filter, "1-5");
+
+		struct result result = {};
+		const struct caputils_parallel job = {
+			sizeof(struct summary), NULL, map, reduce, NULL, &result, &filter, 0,
+		};
+		CPPUNIT_ASSERT_EQUAL(EINVAL, caputils_parallel_foreach(traces, num_traces, 2, &job));
+		filter_close(&filter);
+	}
+
+	void test_map_error(){
+		struct result result = {};
+		const struct caputils_parallel job = {
+			sizeof(struct summary), NULL, map_abort, reduce, NULL, &result, NULL, 4096,
+		};
+		CPPUNIT_ASSERT_EQUAL(ERANGE, caputils_parallel_foreach(traces, num_traces, 4, &job));
+	}
+
+	void test_missing_file(){
+		const char* missing[] = { TOP_SRCDIR "/tests/traces/missing.cap" };
+		struct result result = {};
+		const struct caputils_parallel job = {
+			sizeof(struct summary), NULL, map, reduce, NULL, &result, NULL, 0,
+		};
+		CPPUNIT_ASSERT(caputils_parallel_foreach(missing, 1, 2, &job) != 0);
+
+		/* the other files is still processed */
+		const char* paths[] = { traces[0], missing[0], traces[1] };
+		CPPUNIT_ASSERT(caputils_parallel_foreach(paths, 3, 2, &job) != 0);
+		struct summary ref[2] = {};
+		sequential(traces[0], NULL, &ref[0]);
+		sequential(traces[1], NULL, &ref[1]);
+		CPPUNIT_ASSERT_EQUAL(ref[0].hash, result.file[0].hash);
+		CPPUNIT_ASSERT_EQUAL((uint64_t)0, result.file[1].packets);
+		CPPUNIT_ASSERT_EQUAL(ref[1].hash, result.file[2].hash);
+	}
+
+	void test_truncated_file(){
+		/* cut the last packet in half */
+		static const char* filename = "test-parallel-truncated.cap";
+		struct stat sb;
+		CPPUNIT_ASSERT_EQUAL(0, stat(traces[0], &sb));
+		std::vector<char> buf(sb.st_size);
+		FILE* fp = fopen(traces[0], "rb");
+		CPPUNIT_ASSERT_EQUAL((size_t)sb.st_size, fread(&buf[0], 1, buf.size(), fp));
+		fclose(fp);
+		fp = fopen(filename, "wb");
+		fwrite(&buf[0], 1, buf.size() - 10, fp);
+		fclose(fp);
+
+		/* all complete packets is reduced */
+		struct summary ref = {};
+		sequential(filename, NULL, &ref);
+		CPPUNIT_ASSERT(ref.packets > 0);
+
+		const char* paths[] = { filename };
+		struct result result = {};
+		const struct caputils_parallel job = {
+			sizeof(struct summary), NULL, map, reduce, NULL, &result, NULL, 4096,
+		};
+		CPPUNIT_ASSERT(caputils_parallel_foreach(paths, 1, 4, &job) > 0);
+		CPPUNIT_ASSERT_EQUAL(ref.packets, result.file[0].packets);
+		CPPUNIT_ASSERT_EQUAL(ref.hash, result.file[0].hash);
+		unlink(filename);
+	}
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(Test);
+
+int main(int argc, const char* argv[]){
+	CppUnit::Test *suite = CppUnit::TestFactoryRegistry::getRegistry().makeTest();
+	CppUnit::TextUi::TestRunner runner;
+
+	runner.addTest(suite);
+	runner.setOutputter(new CppUnit::CompilerOutputter(&runner.result(), std::cerr));
+
+	return runner.run() ? 0 : 1;
+}
@@ -3,9 +3,22 @@
 #endif
 
 #include <caputils/stream.h>
+#include <caputils/sender.h>
+#include <caputils/pcap_writer.h>
+#include <caputils/column.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <vector>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <arpa/inet.h>
 
 #include <cppunit/CompilerOutputter.h>
 #include <cppunit/extensions/TestFactoryRegistry.h>
@@ -16,8 +29,249 @@
 class Test: public CppUnit::TestFixture {
 	CPPUNIT_TEST_SUITE(Test);
 	CPPUNIT_TEST( test_num_stream_single );
+	CPPUNIT_TEST( test_reorder_window );
+	CPPUNIT_TEST( test_reorder_late );
+	CPPUNIT_TEST( test_reorder_drop_late );
+	CPPUNIT_TEST( test_merge );
+	CPPUNIT_TEST( test_merge_peek );
+	CPPUNIT_TEST( test_merge_error );
+	CPPUNIT_TEST( test_try_read );
+	CPPUNIT_TEST( test_try_read_pipe );
+	CPPUNIT_TEST( test_sample_rate );
+	CPPUNIT_TEST( test_shm_basic );
+	CPPUNIT_TEST( test_shm_readers );
+	CPPUNIT_TEST( test_shm_drop );
+	CPPUNIT_TEST( test_shm_block );
+	CPPUNIT_TEST( test_fanout );
+	CPPUNIT_TEST( test_fanout_drop );
+	CPPUNIT_TEST( test_fanout_shared );
+	CPPUNIT_TEST( test_retain );
+	CPPUNIT_TEST( test_retain_fanout );
+	CPPUNIT_TEST( test_tcp_receive );
+	CPPUNIT_TEST( test_tcp_send );
+	CPPUNIT_TEST( test_tcp_large_comment );
+	CPPUNIT_TEST( test_sender );
+	CPPUNIT_TEST( test_sender_latency );
+	CPPUNIT_TEST( test_sender_no_offload );
+	CPPUNIT_TEST( test_sender_unsupported );
+	CPPUNIT_TEST( test_iface );
+	CPPUNIT_TEST( test_pcap );
+	CPPUNIT_TEST( test_pcapng );
+	CPPUNIT_TEST( test_pcap_writer );
+	CPPUNIT_TEST( test_column );
+	CPPUNIT_TEST( test_column_invalid );
 	CPPUNIT_TEST_SUITE_END();
 
+	/* write a trace where packets have the given timestamps (in seconds) */
+	static void write_trace(const char* filename, const unsigned int* ts, size_t n){
+		stream_t st;
+		stream_addr_t addr = STREAM_ADDR_INITIALIZER;
+		stream_addr_str(&addr, filename, 0);
+		CPPUNIT_ASSERT_EQUAL(0, stream_create(&st, &addr, NULL, "test", "reorder"));
+
+		char buf[sizeof(struct cap_header) + 14] = {0,};
+		struct cap_header* cp = (struct cap_header*)buf;
+		for ( size_t i = 0; i < n; i++ ){
+			cp->ts = timepico_new(ts[i], 0);
+			cp->len = 14;
+			cp->caplen = 14;
+			CPPUNIT_ASSERT_EQUAL(0, stream_write(st, buf, sizeof(buf)));
+		}
+
+		stream_close(st);
+	}
+
+	/* read all packets from a reorder stream wrapping filename */
+	static std::vector<unsigned int> read_reorder(const char* filename, timepico window, size_t max_packets, int flags, uint64_t* late){
+		stream_t inner;
+		stream_t st;
+		stream_addr_t addr = STREAM_ADDR_INITIALIZER;
+		stream_addr_str(&addr, filename, 0);
+		CPPUNIT_ASSERT_EQUAL(0, stream_open(&inner, &addr, NULL, 0));
+		CPPUNIT_ASSERT_EQUAL(0, stream_reorder_open(&st, inner, window, max_packets, flags));
+
+		std::vector<unsigned int> result;
+		cap_head* cp;
+		while ( stream_read(st, &cp, NULL, NULL) == 0 ){
+			result.push_back(cp->ts.tv_sec);
+		}
+
+		*late = stream_get_stat(st)->late;
+		stream_close(st);
+		unlink(filename);
+		return result;
+	}
+
+	static stream_t open_merge(const char** filename, size_t n){
+		stream_t inputs[n];
+		for ( size_t i = 0; i < n; i++ ){
+			stream_addr_t addr = STREAM_ADDR_INITIALIZER;
+			stream_addr_str(&addr, filename[i], 0);
+			CPPUNIT_ASSERT_EQUAL(0, stream_open(&inputs[i], &addr, NULL, 0));
+		}
+
+		stream_t st;
+		CPPUNIT_ASSERT_EQUAL(0, stream_merge_open(&st, inputs, n, NULL));
+		return st;
+	}
+
+	static stream_t shm_create(const char* address){
+		stream_t st;
+		stream_addr_t addr = STREAM_ADDR_INITIALIZER;
+		CPPUNIT_ASSERT_EQUAL(0, stream_addr_aton(&addr, address, STREAM_ADDR_GUESS, 0));
+		CPPUNIT_ASSERT_EQUAL(STREAM_ADDR_SHM, stream_addr_type(&addr));
+		CPPUNIT_ASSERT_EQUAL(0, stream_create(&st, &addr, NULL, "test", "shm"));
+		return st;
+	}
+
+	static stream_t shm_open(const char* address){
+		stream_t st;
+		stream_addr_t addr = STREAM_ADDR_INITIALIZER;
+		CPPUNIT_ASSERT_EQUAL(0, stream_addr_aton(&addr, address, STREAM_ADDR_GUESS, 0));
+		CPPUNIT_ASSERT_EQUAL(0, stream_open(&st, &addr, NULL, 0));
+		return st;
+	}
+
+	/* write packets with ts first..last (and caplen bytes of payload) */
+	static void shm_write(stream_t st, unsigned int first, unsigned int last, size_t caplen){
+		std::vector<char> buf(sizeof(struct cap_header) + caplen);
+		struct cap_header* cp = (struct cap_header*)&buf[0];
+		for ( unsigned int i = first; i <= last; i++ ){
+			cp->ts = timepico_new(i, 0);
+			cp->len = caplen;
+			cp->caplen = caplen;
+			memset(cp->payload, i & 0xff, caplen);
+			CPPUNIT_ASSERT_EQUAL(0, stream_write(st, &buf[0], buf.size()));
+		}
+	}
+
+	static void* shm_producer(void* arg){
+		shm_write((stream_t)arg, 0, 9999, 1000);
+		stream_close((stream_t)arg);
+		return NULL;
+	}
+
+	struct tcp_peer {
+		char address[64];
+		unsigned int num_packets;
+		unsigned int received;
+		std::string comment;                       /* received comment */
+		std::string send_comment;                  /* comment sent (default "tcp") */
+	};
+
+	static void tcp_address(char* dst, int offset){
+		sprintf(dst, "tcp://127.0.0.1:%d", 30000 + ((int)getpid() + offset) % 20000);
+	}
+
+	/* packets have varying size, with ts and the payload derived from the index */
+	static void* tcp_sender(void* arg){
+		struct tcp_peer* peer = (struct tcp_peer*)arg;
+		stream_addr_t addr = STREAM_ADDR_INITIALIZER;
+		stream_addr_aton(&addr, peer->address, STREAM_ADDR_GUESS, 0);
+
+		/* the receiver might not be listening yet */
+		stream_t st;
+		int ret;
+		for ( int retry = 0; (ret=stream_create(&st, &addr, NULL, "test", peer->send_comment.empty() ? "tcp" : peer->send_comment.c_str())) == ECONNREFUSED && retry < 500; retry++ ){
+			usleep(10000);
+		}
+		if ( ret != 0 ){
+			return NULL;
+		}
+
+		char buf[sizeof(struct cap_header) + 1500];
+		struct cap_header* cp = (struct cap_header*)buf;
+		for ( unsigned int i = 0; i < peer->num_packets; i++ ){
+			cp->ts = timepico_new(i, 0);
+			cp->caplen = 1 + i % 1500;
+			cp->len = cp->caplen;
+			memset(cp->payload, i & 0xff, cp->caplen);
+			if ( stream_write(st, buf, sizeof(struct cap_header) + cp->caplen) != 0 ) break;
+		}
+
+		stream_close(st);
+		return NULL;
+	}
+
+	static void* tcp_receiver(void* arg){
+		struct tcp_peer* peer = (struct tcp_peer*)arg;
+		stream_addr_t addr = STREAM_ADDR_INITIALIZER;
+		stream_addr_aton(&addr, peer->address, STREAM_ADDR_GUESS, 0);
+
+		/* small buffer so packets is split between reads */
+		stream_t st;
+		if ( stream_open(&st, &addr, NULL, 4096) != 0 ){
+			return NULL;
+		}
+		peer->comment = stream_get_comment(st);
+
+		cap_head* cp;
+		while ( stream_read(st, &cp, NULL, NULL) == 0 ){
+			const unsigned int i = peer->received;
+			if ( cp->ts.tv_sec != i || cp->caplen != 1 + i % 1500 || (unsigned char)cp->payload[cp->caplen - 1] != (i & 0xff) ){
+				break;
+			}
+			peer->received++;
+		}
+
+		stream_close(st);
+		return NULL;
+	}
+
+	/* open a udp receiver and sender on loopback, the receiver is bound first so no frames is lost */
+	static void udp_pair(stream_t* rx, stream_t* tx, int offset, int flags = 0){
+		char address[64];
+		sprintf(address, "udp://127.0.0.1:%d", 30000 + ((int)getpid() + offset) % 20000);
+		stream_addr_t addr = STREAM_ADDR_INITIALIZER;
+		CPPUNIT_ASSERT_EQUAL(0, stream_addr_aton(&addr, address, STREAM_ADDR_GUESS, flags));
+		CPPUNIT_ASSERT_EQUAL(0, stream_open(rx, &addr, NULL, 0));
+		CPPUNIT_ASSERT_EQUAL(0, stream_create(tx, &addr, NULL, "test", "udp"));
+	}
+
+	static unsigned int sender_write_packets(sender_t sender, unsigned int num_packets){
+		char buf[sizeof(struct cap_header) + 200];
+		struct cap_header* cp = (struct cap_header*)buf;
+		for ( unsigned int i = 0; i < num_packets; i++ ){
+			cp->ts = timepico_new(i, 0);
+			cp->caplen = 1 + i % 200;
+			cp->len = cp->caplen;
+			memset(cp->payload, i & 0xff, cp->caplen);
+			if ( sender_write(sender, cp) != 0 ) return i;
+		}
+		return num_packets;
+	}
+
+	/* read until the sender terminates the stream */
+	static unsigned int sender_read_packets(stream_t st){
+		struct timeval timeout = {1, 0};
+		unsigned int received = 0;
+		cap_head* cp;
+		int ret;
+		while ( (ret=stream_read(st, &cp, NULL, &timeout)) == 0 ){
+			const unsigned int i = received;
+			CPPUNIT_ASSERT_EQUAL((uint32_t)i, cp->ts.tv_sec);
+			CPPUNIT_ASSERT_EQUAL((uint32_t)(1 + i % 200), cp->caplen);
+			CPPUNIT_ASSERT_EQUAL((int)(i & 0xff), (int)(unsigned char)cp->payload[cp->caplen - 1]);
+			received++;
+		}
+		CPPUNIT_ASSERT_EQUAL(-1, ret);
+		return received;
+	}
+
+	/* append a pcapng block (body is padded to 32 bits) */
+	static void pcapng_block(std::vector<char>& dst, uint32_t type, const std::vector<char>& body){
+		const uint32_t total = 12 + ((body.size() + 3) & ~3);
+		dst.insert(dst.end(), (const char*)&type, (const char*)&type + 4);
+		dst.insert(dst.end(), (const char*)&total, (const char*)&total + 4);
+		dst.insert(dst.end(), body.begin(), body.end());
+		dst.insert(dst.end(), total - 12 - body.size(), 0);
+		dst.insert(dst.end(), (const char*)&total, (const char*)&total + 4);
+	}
+
+	static void append(std::vector<char>& dst, const void* data, size_t size){
+		dst.insert(dst.end(), (const char*)data, (const char*)data + size);
+	}
+
 public:
 	void test_num_stream_single(){
 		stream_t st;
@@ -29,6 +283,999 @@ public:
 		CPPUNIT_ASSERT_EQUAL(std::string(strerror(0)), std::string(strerror(ret)));
 		CPPUNIT_ASSERT_EQUAL((unsigned int)1, stream_num_address(st));
 	}
+
+	void test_reorder_window(){
+		static const unsigned int ts[] = {1, 3, 2, 5, 4, 9, 6};
+		static const unsigned int expected[] = {1, 2, 3, 4, 5, 6, 9};
+		write_trace("test-reorder.cap", ts, 7);
+
+		uint64_t late;
+		std::vector<unsigned int> result = read_reorder("test-reorder.cap", timepico_new(2, 0), 0, 0, &late);
+		CPPUNIT_ASSERT_EQUAL((size_t)7, result.size());
+		for ( size_t i = 0; i < 7; i++ ){
+			CPPUNIT_ASSERT_EQUAL(expected[i], result[i]);
+		}
+		CPPUNIT_ASSERT_EQUAL((uint64_t)0, late);
+	}
+
+	void test_reorder_late(){
+		static const unsigned int ts[] = {1, 3, 5, 2};
+		static const unsigned int expected[] = {1, 3, 2, 5};
+		write_trace("test-reorder.cap", ts, 4);
+
+		uint64_t late;
+		std::vector<unsigned int> result = read_reorder("test-reorder.cap", timepico_new(0, 0), 1, 0, &late);
+		CPPUNIT_ASSERT_EQUAL((size_t)4, result.size());
+		for ( size_t i = 0; i < 4; i++ ){
+			CPPUNIT_ASSERT_EQUAL(expected[i], result[i]);
+		}
+		CPPUNIT_ASSERT_EQUAL((uint64_t)1, late);
+	}
+
+	void test_reorder_drop_late(){
+		static const unsigned int ts[] = {1, 3, 5, 2};
+		static const unsigned int expected[] = {1, 3, 5};
+		write_trace("test-reorder.cap", ts, 4);
+
+		uint64_t late;
+		std::vector<unsigned int> result = read_reorder("test-reorder.cap", timepico_new(0, 0), 1, STREAM_REORDER_DROP_LATE, &late);
+		CPPUNIT_ASSERT_EQUAL((size_t)3, result.size());
+		for ( size_t i = 0; i < 3; i++ ){
+			CPPUNIT_ASSERT_EQUAL(expected[i], result[i]);
+		}
+		CPPUNIT_ASSERT_EQUAL((uint64_t)1, late);
+	}
+
+	void test_merge(){
+		static const unsigned int a[] = {1, 4, 4, 8};
+		static const unsigned int b[] = {2, 3, 4, 9, 10};
+		static const unsigned int expected[] = {1, 2, 3, 4, 4, 4, 8, 9, 10};
+		static const char* filename[] = {"test-merge-a.cap", "test-merge-b.cap"};
+		write_trace(filename[0], a, 4);
+		write_trace(filename[1], b, 5);
+
+		stream_t st = open_merge(filename, 2);
+		std::vector<unsigned int> result;
+		cap_head* cp;
+		while ( stream_read(st, &cp, NULL, NULL) == 0 ){
+			result.push_back(cp->ts.tv_sec);
+		}
+
+		CPPUNIT_ASSERT_EQUAL((uint64_t)9, stream_get_stat(st)->recv);
+		stream_close(st);
+		unlink(filename[0]);
+		unlink(filename[1]);
+
+		CPPUNIT_ASSERT_EQUAL((size_t)9, result.size());
+		for ( size_t i = 0; i < 9; i++ ){
+			CPPUNIT_ASSERT_EQUAL(expected[i], result[i]);
+		}
+	}
+
+	void test_merge_peek(){
+		static const unsigned int a[] = {2, 5};
+		static const unsigned int b[] = {1, 7};
+		static const char* filename[] = {"test-merge-a.cap", "test-merge-b.cap"};
+		write_trace(filename[0], a, 2);
+		write_trace(filename[1], b, 2);
+
+		stream_t st = open_merge(filename, 2);
+		cap_head* cp;
+
+		/* peek must not consume the packet */
+		CPPUNIT_ASSERT_EQUAL(0, stream_peek(st, &cp, NULL));
+		CPPUNIT_ASSERT_EQUAL((uint32_t)1, cp->ts.tv_sec);
+		CPPUNIT_ASSERT_EQUAL(0, stream_read(st, &cp, NULL, NULL));
+		CPPUNIT_ASSERT_EQUAL((uint32_t)1, cp->ts.tv_sec);
+		CPPUNIT_ASSERT_EQUAL(0, stream_peek(st, &cp, NULL));
+		CPPUNIT_ASSERT_EQUAL((uint32_t)2, cp->ts.tv_sec);
+		CPPUNIT_ASSERT_EQUAL(0, stream_read(st, &cp, NULL, NULL));
+		CPPUNIT_ASSERT_EQUAL((uint32_t)2, cp->ts.tv_sec);
+		CPPUNIT_ASSERT_EQUAL(0, stream_read(st, &cp, NULL, NULL));
+		CPPUNIT_ASSERT_EQUAL((uint32_t)5, cp->ts.tv_sec);
+		CPPUNIT_ASSERT_EQUAL(0, stream_read(st, &cp, NULL, NULL));
+		CPPUNIT_ASSERT_EQUAL((uint32_t)7, cp->ts.tv_sec);
+		CPPUNIT_ASSERT_EQUAL(-1, stream_peek(st, &cp, NULL));
+
+		stream_close(st);
+		unlink(filename[0]);
+		unlink(filename[1]);
+	}
+
+	void test_merge_error(){
+		static const unsigned int a[] = {1, 2, 3};
+		static const char* filename[] = {"test-merge-error.cap", "test-merge-error.pcap"};
+		write_trace(filename[0], a, 3);
+
+		/* truncate the last packet of a pcap trace (10 packets) */
+		char buf[4096];
+		FILE* src = fopen(TOP_SRCDIR "/tests/traces/GRE.pcap", "rb");
+		CPPUNIT_ASSERT(src);
+		const size_t size = fread(buf, 1, sizeof(buf), src);
+		fclose(src);
+		FILE* dst = fopen(filename[1], "wb");
+		CPPUNIT_ASSERT(dst);
+		CPPUNIT_ASSERT_EQUAL(size - 10, fwrite(buf, 1, size - 10, dst));
+		fclose(dst);
+
+		/* the failing input is dropped, the other is still merged */
+		stream_t st = open_merge(filename, 2);
+		cap_head* cp;
+		int packets = 0;
+		int ret;
+		while ( (ret=stream_read(st, &cp, NULL, NULL)) == 0 ){
+			packets++;
+		}
+		CPPUNIT_ASSERT_EQUAL(-1, ret);
+		CPPUNIT_ASSERT_EQUAL(3 + 9, packets);
+
+		stream_close(st);
+		unlink(filename[0]);
+		unlink(filename[1]);
+	}
+
+	void test_try_read(){
+		static const unsigned int ts[] = {1, 2, 3};
+		write_trace("test-try-read.cap", ts, 3);
+
+		stream_t st;
+		stream_addr_t addr = STREAM_ADDR_INITIALIZER;
+		stream_addr_str(&addr, "test-try-read.cap", 0);
+		CPPUNIT_ASSERT_EQUAL(0, stream_open(&st, &addr, NULL, 0));
+		CPPUNIT_ASSERT(stream_get_fd(st) >= 0);
+
+		cap_head* cp;
+		for ( unsigned int i = 0; i < 3; i++ ){
+			CPPUNIT_ASSERT_EQUAL(0, stream_try_read(st, &cp, NULL));
+			CPPUNIT_ASSERT_EQUAL(ts[i], cp->ts.tv_sec);
+		}
+		CPPUNIT_ASSERT_EQUAL(-1, stream_try_read(st, &cp, NULL));
+
+		stream_close(st);
+		unlink("test-try-read.cap");
+	}
+
+	void test_try_read_pipe(){
+		int fd[2];
+		CPPUNIT_ASSERT_EQUAL(0, pipe(fd));
+		FILE* rx = fdopen(fd[0], "r");
+		FILE* tx = fdopen(fd[1], "w");
+
+		stream_t dst;
+		stream_t src;
+		stream_addr_t addr = STREAM_ADDR_INITIALIZER;
+		stream_addr_fp(&addr, tx, STREAM_ADDR_FCLOSE);
+		CPPUNIT_ASSERT_EQUAL(0, stream_create(&dst, &addr, NULL, "test", "pipe"));
+		CPPUNIT_ASSERT_EQUAL(0, stream_flush(dst));
+		stream_addr_fp(&addr, rx, STREAM_ADDR_FCLOSE);
+		CPPUNIT_ASSERT_EQUAL(0, stream_open(&src, &addr, NULL, 0));
+
+		/* nothing written yet, must not block */
+		cap_head* cp;
+		CPPUNIT_ASSERT_EQUAL(EAGAIN, stream_try_read(src, &cp, NULL));
+
+		char buf[sizeof(struct cap_header) + 14] = {0,};
+		struct cap_header* head = (struct cap_header*)buf;
+		head->ts = timepico_new(7, 0);
+		head->len = 14;
+		head->caplen = 14;
+		CPPUNIT_ASSERT_EQUAL(0, stream_write(dst, buf, sizeof(buf)));
+		CPPUNIT_ASSERT_EQUAL(0, stream_flush(dst));
+		CPPUNIT_ASSERT_EQUAL(0, stream_try_read(src, &cp, NULL));
+		CPPUNIT_ASSERT_EQUAL((uint32_t)7, cp->ts.tv_sec);
+		CPPUNIT_ASSERT_EQUAL(EAGAIN, stream_try_read(src, &cp, NULL));
+
+		/* end of stream when the writer closes */
+		stream_close(dst);
+		CPPUNIT_ASSERT_EQUAL(-1, stream_try_read(src, &cp, NULL));
+		stream_close(src);
+	}
+
+	static uint64_t sample_rate(const char* comment){
+		char filename[64];
+		sprintf(filename, "/tmp/stream-sample-rate-%d.cap", (int)getpid());
+		stream_t st;
+		stream_addr_t addr = STREAM_ADDR_INITIALIZER;
+		stream_addr_str(&addr, filename, 0);
+		CPPUNIT_ASSERT_EQUAL(0, stream_create(&st, &addr, NULL, "test", comment));
+		stream_close(st);
+		CPPUNIT_ASSERT_EQUAL(0, stream_open(&st, &addr, NULL, 0));
+		const uint64_t rate = stream_get_sample_rate(st);
+		stream_close(st);
+		unlink(filename);
+		return rate;
+	}
+
+	void test_sample_rate(){
+		CPPUNIT_ASSERT_EQUAL((uint64_t)1,  sample_rate("file"));
+		CPPUNIT_ASSERT_EQUAL((uint64_t)8,  sample_rate("capfilter filtered stream (sample-rate=8)"));
+		CPPUNIT_ASSERT_EQUAL((uint64_t)8,  sample_rate("sample-rate=8"));
+		CPPUNIT_ASSERT_EQUAL((uint64_t)12, sample_rate("site=a, sample-rate=12; x"));
+		CPPUNIT_ASSERT_EQUAL((uint64_t)1,  sample_rate("resample-rate=8"));
+		CPPUNIT_ASSERT_EQUAL((uint64_t)1,  sample_rate("sample-rate=8x"));
+		CPPUNIT_ASSERT_EQUAL((uint64_t)1,  sample_rate("sample-rate=-8"));
+		CPPUNIT_ASSERT_EQUAL((uint64_t)1,  sample_rate("sample-rate=0"));
+		CPPUNIT_ASSERT_EQUAL((uint64_t)1,  sample_rate("sample-rate=99999999999999999999"));
+		CPPUNIT_ASSERT_EQUAL((uint64_t)4,  sample_rate("presample-rate=2 (sample-rate=4)"));
+	}
+
+	void test_shm_basic(){
+		char address[64];
+		sprintf(address, "shm://test-basic-%d", (int)getpid());
+		stream_t dst = shm_create(address);
+		stream_t src = shm_open(address);
+		CPPUNIT_ASSERT_EQUAL(std::string("shm"), std::string(stream_get_comment(src)));
+
+		/* nothing written yet */
+		cap_head* cp;
+		CPPUNIT_ASSERT_EQUAL(EAGAIN, stream_try_read(src, &cp, NULL));
+
+		shm_write(dst, 1, 3, 64);
+		CPPUNIT_ASSERT_EQUAL(0, stream_peek(src, &cp, NULL));
+		CPPUNIT_ASSERT_EQUAL((uint32_t)1, cp->ts.tv_sec);
+		for ( unsigned int i = 1; i <= 3; i++ ){
+			CPPUNIT_ASSERT_EQUAL(0, stream_read(src, &cp, NULL, NULL));
+			CPPUNIT_ASSERT_EQUAL(i, cp->ts.tv_sec);
+			CPPUNIT_ASSERT_EQUAL((uint32_t)64, cp->caplen);
+			CPPUNIT_ASSERT_EQUAL((unsigned char)i, (unsigned char)cp->payload[63]);
+		}
+
+		/* end of stream when the writer closes */
+		stream_close(dst);
+		CPPUNIT_ASSERT_EQUAL(-1, stream_read(src, &cp, NULL, NULL));
+		stream_close(src);
+
+		/* the name is removed with the writer */
+		stream_addr_t addr = STREAM_ADDR_INITIALIZER;
+		stream_addr_aton(&addr, address, STREAM_ADDR_GUESS, 0);
+		CPPUNIT_ASSERT_EQUAL(ENOENT, stream_open(&src, &addr, NULL, 0));
+	}
+
+	void test_shm_readers(){
+		char address[64];
+		sprintf(address, "shm://test-readers-%d", (int)getpid());
+		stream_t dst = shm_create(address);
+		stream_t src[2] = {shm_open(address), shm_open(address)};
+		shm_write(dst, 1, 100, 100);
+		stream_close(dst);
+
+		for ( int j = 0; j < 2; j++ ){
+			cap_head* cp;
+			unsigned int n = 0;
+			while ( stream_read(src[j], &cp, NULL, NULL) == 0 ){
+				CPPUNIT_ASSERT_EQUAL(++n, cp->ts.tv_sec);
+			}
+			CPPUNIT_ASSERT_EQUAL(100U, n);
+			stream_close(src[j]);
+		}
+	}
+
+	void test_shm_drop(){
+		char address[64];
+		sprintf(address, "shm://test-drop-%d?size=1M&policy=drop", (int)getpid());
+		stream_t dst = shm_create(address);
+		stream_t src = shm_open(address);
+
+		/* about 5 MiB to a 1 MiB ring without reading, writer must not block */
+		shm_write(dst, 0, 4999, 1000);
+		stream_close(dst);
+
+		/* the newest packets is kept */
+		cap_head* cp;
+		unsigned int n = 0;
+		unsigned int last = 0;
+		while ( stream_read(src, &cp, NULL, NULL) == 0 ){
+			CPPUNIT_ASSERT(n == 0 || cp->ts.tv_sec > last);
+			last = cp->ts.tv_sec;
+			n++;
+		}
+		CPPUNIT_ASSERT(n > 0 && n < 5000);
+		CPPUNIT_ASSERT_EQUAL(4999U, last);
+		CPPUNIT_ASSERT_EQUAL((uint64_t)5000, n + stream_get_stat(src)->dropped);
+		stream_close(src);
+	}
+
+	void test_shm_block(){
+		char address[64];
+		sprintf(address, "shm://test-block-%d?size=1M", (int)getpid());
+		stream_t dst = shm_create(address);
+		stream_t src = shm_open(address);
+
+		/* about 10 MiB through a 1 MiB ring, no packet may be lost */
+		pthread_t thread;
+		pthread_create(&thread, NULL, shm_producer, dst);
+		cap_head* cp;
+		unsigned int n = 0;
+		while ( stream_read(src, &cp, NULL, NULL) == 0 ){
+			CPPUNIT_ASSERT_EQUAL(n, cp->ts.tv_sec);
+			CPPUNIT_ASSERT_EQUAL((unsigned char)n, (unsigned char)cp->payload[999]);
+			n++;
+		}
+		pthread_join(thread, NULL);
+		CPPUNIT_ASSERT_EQUAL(10000U, n);
+		CPPUNIT_ASSERT_EQUAL((uint64_t)0, stream_get_stat(src)->dropped);
+		stream_close(src);
+	}
+
+	void test_fanout(){
+		static const unsigned int ts[] = {1, 2, 3, 4, 5};
+		write_trace("test-fanout.cap", ts, 5);
+
+		stream_t src;
+		stream_t child[3];
+		stream_addr_t addr = STREAM_ADDR_INITIALIZER;
+		stream_addr_str(&addr, "test-fanout.cap", 0);
+		CPPUNIT_ASSERT_EQUAL(0, stream_open(&src, &addr, NULL, 0));
+		CPPUNIT_ASSERT_EQUAL(0, stream_fanout_open(child, src, 3, 0));
+
+		/* interleaved reads, a packet must stay valid until the next read of the same child */
+		cap_head* a;
+		cap_head* b;
+		CPPUNIT_ASSERT_EQUAL(0, stream_read(child[0], &a, NULL, NULL));
+		CPPUNIT_ASSERT_EQUAL(0, stream_read(child[0], &a, NULL, NULL));
+		CPPUNIT_ASSERT_EQUAL(0, stream_read(child[1], &b, NULL, NULL));
+		CPPUNIT_ASSERT_EQUAL((uint32_t)2, a->ts.tv_sec);
+		CPPUNIT_ASSERT_EQUAL((uint32_t)1, b->ts.tv_sec);
+		CPPUNIT_ASSERT_EQUAL(0, stream_peek(child[1], &b, NULL));
+		CPPUNIT_ASSERT_EQUAL((uint32_t)2, b->ts.tv_sec);
+		CPPUNIT_ASSERT_EQUAL((uint64_t)0, stream_get_stat(child[0])->buffer_usage);
+		CPPUNIT_ASSERT_EQUAL((uint64_t)(sizeof(struct cap_header) + 14), stream_get_stat(child[1])->buffer_usage);
+
+		/* closing a child early must not affect the others */
+		stream_close(child[2]);
+
+		for ( int j = 0; j < 2; j++ ){
+			unsigned int n = j == 0 ? 2 : 1;
+			cap_head* cp;
+			while ( stream_read(child[j], &cp, NULL, NULL) == 0 ){
+				CPPUNIT_ASSERT_EQUAL(++n, cp->ts.tv_sec);
+			}
+			CPPUNIT_ASSERT_EQUAL(5U, n);
+			CPPUNIT_ASSERT_EQUAL((uint64_t)0, stream_get_stat(child[j])->dropped);
+		}
+
+		stream_close(child[0]);
+		stream_close(child[1]);
+		unlink("test-fanout.cap");
+	}
+
+	void test_fanout_drop(){
+		std::vector<unsigned int> ts(100);
+		for ( unsigned int i = 0; i < 100; i++ ) ts[i] = i;
+		write_trace("test-fanout.cap", &ts[0], ts.size());
+
+		stream_t src;
+		stream_t child[2];
+		stream_addr_t addr = STREAM_ADDR_INITIALIZER;
+		stream_addr_str(&addr, "test-fanout.cap", 0);
+		CPPUNIT_ASSERT_EQUAL(0, stream_open(&src, &addr, NULL, 0));
+
+		/* room for 10 packets */
+		const size_t packet_size = sizeof(struct cap_header) + 14;
+		CPPUNIT_ASSERT_EQUAL(0, stream_fanout_open(child, src, 2, packet_size * 10));
+
+		/* fast child reads everything, the slow child holds its packet meanwhile */
+		cap_head* held;
+		cap_head* cp;
+		CPPUNIT_ASSERT_EQUAL(0, stream_read(child[1], &held, NULL, NULL));
+		unsigned int n = 0;
+		while ( stream_read(child[0], &cp, NULL, NULL) == 0 ){
+			CPPUNIT_ASSERT_EQUAL(n++, cp->ts.tv_sec);
+		}
+		CPPUNIT_ASSERT_EQUAL(100U, n);
+		CPPUNIT_ASSERT_EQUAL((uint32_t)0, held->ts.tv_sec);
+
+		/* the slow child only gets the newest packets */
+		n = 0;
+		while ( stream_read(child[1], &cp, NULL, NULL) == 0 ){
+			CPPUNIT_ASSERT_EQUAL(90 + n++, cp->ts.tv_sec);
+		}
+		CPPUNIT_ASSERT_EQUAL(10U, n);
+		CPPUNIT_ASSERT_EQUAL((uint64_t)89, stream_get_stat(child[1])->dropped);
+		CPPUNIT_ASSERT_EQUAL((uint64_t)0, stream_get_stat(child[0])->dropped);
+
+		stream_close(child[1]);
+		stream_close(child[0]);
+		unlink("test-fanout.cap");
+	}
+
+	void test_fanout_shared(){
+		static const unsigned int ts[] = {1, 2, 3, 4, 5};
+		static const char* filename = "test-fanout.cap";
+
+		/* file streams supports retain, merge streams is copied once */
+		for ( int copy = 0; copy < 2; copy++ ){
+			write_trace(filename, ts, 5);
+
+			stream_t src;
+			stream_t child[2];
+			if ( copy ){
+				src = open_merge(&filename, 1);
+			} else {
+				stream_addr_t addr = STREAM_ADDR_INITIALIZER;
+				stream_addr_str(&addr, filename, 0);
+				CPPUNIT_ASSERT_EQUAL(0, stream_open(&src, &addr, NULL, 0));
+			}
+			CPPUNIT_ASSERT_EQUAL(0, stream_fanout_open(child, src, 2, 0));
+
+			/* both children gets the same packet */
+			cap_head* a;
+			cap_head* b;
+			for ( unsigned int n = 1; n <= 5; n++ ){
+				CPPUNIT_ASSERT_EQUAL(0, stream_read(child[0], &a, NULL, NULL));
+				CPPUNIT_ASSERT_EQUAL(0, stream_read(child[1], &b, NULL, NULL));
+				CPPUNIT_ASSERT(a == b);
+				CPPUNIT_ASSERT_EQUAL(n, a->ts.tv_sec);
+			}
+			CPPUNIT_ASSERT_EQUAL(-1, stream_read(child[0], &a, NULL, NULL));
+
+			stream_close(child[0]);
+			stream_close(child[1]);
+			unlink(filename);
+		}
+	}
+
+	void test_retain(){
+		/* many times the buffer size so the buffer is refilled repeatedly */
+		std::vector<unsigned int> ts(5000);
+		for ( unsigned int i = 0; i < ts.size(); i++ ) ts[i] = i;
+		write_trace("test-retain.cap", &ts[0], ts.size());
+
+		stream_t st;
+		stream_addr_t addr = STREAM_ADDR_INITIALIZER;
+		stream_addr_str(&addr, "test-retain.cap", 0);
+		CPPUNIT_ASSERT_EQUAL(0, stream_open(&st, &addr, NULL, 1024));
+
+		/* hold every 7th packet, releasing some of them along the way */
+		std::vector<cap_head*> held;
+		cap_head* cp;
+		while ( stream_read(st, &cp, NULL, NULL) == 0 ){
+			if ( cp->ts.tv_sec % 7 == 0 ){
+				CPPUNIT_ASSERT_EQUAL(0, stream_retain(st, cp));
+				held.push_back(cp);
+			}
+			if ( cp->ts.tv_sec % 100 == 50 ){
+				CPPUNIT_ASSERT_EQUAL(0, stream_release(st, held.front()));
+				held.erase(held.begin());
+			}
+		}
+
+		/* all held packets must still be intact */
+		unsigned int expected = 7 * (5000 / 100);
+		for ( std::vector<cap_head*>::iterator it = held.begin(); it != held.end(); ++it ){
+			CPPUNIT_ASSERT_EQUAL(expected, (*it)->ts.tv_sec);
+			CPPUNIT_ASSERT_EQUAL((uint32_t)14, (*it)->caplen);
+			CPPUNIT_ASSERT_EQUAL(0, stream_release(st, *it));
+			expected += 7;
+		}
+
+		stream_close(st);
+		unlink("test-retain.cap");
+	}
+
+	void test_retain_fanout(){
+		static const unsigned int ts[] = {1, 2, 3};
+		write_trace("test-retain.cap", ts, 3);
+
+		stream_t src;
+		stream_t child[2];
+		stream_addr_t addr = STREAM_ADDR_INITIALIZER;
+		stream_addr_str(&addr, "test-retain.cap", 0);
+		CPPUNIT_ASSERT_EQUAL(0, stream_open(&src, &addr, NULL, 0));
+		CPPUNIT_ASSERT_EQUAL(0, stream_fanout_open(child, src, 2, 0));
+
+		/* packet outlives both the next read and the other child passing it */
+		cap_head* held;
+		cap_head* cp;
+		CPPUNIT_ASSERT_EQUAL(0, stream_read(child[0], &held, NULL, NULL));
+		CPPUNIT_ASSERT_EQUAL(0, stream_retain(child[0], held));
+		while ( stream_read(child[0], &cp, NULL, NULL) == 0 );
+		while ( stream_read(child[1], &cp, NULL, NULL) == 0 );
+		CPPUNIT_ASSERT_EQUAL((uint32_t)1, held->ts.tv_sec);
+		CPPUNIT_ASSERT_EQUAL(0, stream_release(child[0], held));
+
+		stream_close(child[0]);
+		stream_close(child[1]);
+		unlink("test-retain.cap");
+	}
+
+	void test_tcp_receive(){
+		struct tcp_peer peer;
+		tcp_address(peer.address, 0);
+		peer.num_packets = 10000;
+		peer.received = 0;
+
+		pthread_t thread;
+		pthread_create(&thread, NULL, tcp_sender, &peer);
+		tcp_receiver(&peer);
+		pthread_join(thread, NULL);
+
+		CPPUNIT_ASSERT_EQUAL(std::string("tcp"), peer.comment);
+		CPPUNIT_ASSERT_EQUAL(10000U, peer.received);
+	}
+
+	void test_tcp_send(){
+		struct tcp_peer peer;
+		tcp_address(peer.address, 1);
+		peer.num_packets = 100000; /* larger than socket buffers, sender must wait for the receiver */
+		peer.received = 0;
+
+		pthread_t thread;
+		pthread_create(&thread, NULL, tcp_receiver, &peer);
+		tcp_sender(&peer);
+		pthread_join(thread, NULL);
+
+		CPPUNIT_ASSERT_EQUAL(100000U, peer.received);
+	}
+
+	/* largest comment the header can hold, and one byte more */
+	void test_tcp_large_comment(){
+		struct tcp_peer peer;
+		tcp_address(peer.address, 5);
+		peer.num_packets = 100;
+		peer.received = 0;
+		peer.send_comment = std::string(UINT16_MAX + 1, 'x');
+
+		stream_t st;
+		stream_addr_t addr = STREAM_ADDR_INITIALIZER;
+		stream_addr_aton(&addr, peer.address, STREAM_ADDR_GUESS, 0);
+		CPPUNIT_ASSERT_EQUAL(EMSGSIZE, stream_create(&st, &addr, NULL, "test", peer.send_comment.c_str()));
+		peer.send_comment.resize(UINT16_MAX);
+
+		pthread_t thread;
+		pthread_create(&thread, NULL, tcp_sender, &peer);
+		tcp_receiver(&peer);
+		pthread_join(thread, NULL);
+
+		CPPUNIT_ASSERT(peer.comment == peer.send_comment);
+		CPPUNIT_ASSERT_EQUAL(100U, peer.received);
+	}
+
+	void test_sender(){
+		stream_t rx, tx;
+		sender_t sender;
+		udp_pair(&rx, &tx, 2);
+
+		/* packets is packed into multiple frames */
+		CPPUNIT_ASSERT_EQUAL(0, sender_open(&sender, tx, 1400, NULL));
+		CPPUNIT_ASSERT_EQUAL(300U, sender_write_packets(sender, 300));
+		const struct sender_stat* stat = sender_get_stat(sender);
+		CPPUNIT_ASSERT_EQUAL((uint64_t)300, stat->packets);
+		CPPUNIT_ASSERT_EQUAL((uint64_t)0, stat->frames); /* less than a full batch */
+		CPPUNIT_ASSERT_EQUAL(0, sender_close(sender));
+
+		CPPUNIT_ASSERT_EQUAL(300U, sender_read_packets(rx));
+		stream_close(tx);
+		stream_close(rx);
+	}
+
+	void test_sender_no_offload(){
+		stream_t rx, tx;
+		sender_t sender;
+		udp_pair(&rx, &tx, 4, STREAM_ADDR_NO_OFFLOAD);
+
+		/* one datagram per frame (with offloading frames is sent and received coalesced) */
+		CPPUNIT_ASSERT_EQUAL(0, sender_open(&sender, tx, 1400, NULL));
+		CPPUNIT_ASSERT_EQUAL(300U, sender_write_packets(sender, 300));
+		CPPUNIT_ASSERT_EQUAL(0, sender_close(sender));
+
+		CPPUNIT_ASSERT_EQUAL(300U, sender_read_packets(rx));
+		stream_close(tx);
+		stream_close(rx);
+	}
+
+	void test_sender_latency(){
+		stream_t rx, tx;
+		sender_t sender;
+		udp_pair(&rx, &tx, 3);
+
+		/* zero latency sends a frame for each packet */
+		struct timeval latency = {0, 0};
+		CPPUNIT_ASSERT_EQUAL(0, sender_open(&sender, tx, 0, &latency));
+		CPPUNIT_ASSERT_EQUAL(50U, sender_write_packets(sender, 50));
+		const struct sender_stat* stat = sender_get_stat(sender);
+		CPPUNIT_ASSERT_EQUAL((uint64_t)50, stat->frames);
+		CPPUNIT_ASSERT_EQUAL((uint64_t)50, stat->batches);
+
+		/* nothing is pending so close sends an empty frame */
+		CPPUNIT_ASSERT_EQUAL(0, sender_close(sender));
+
+		CPPUNIT_ASSERT_EQUAL(50U, sender_read_packets(rx));
+		stream_close(tx);
+		stream_close(rx);
+	}
+
+	void test_sender_unsupported(){
+		stream_t st;
+		sender_t sender;
+		stream_addr_t addr = STREAM_ADDR_INITIALIZER;
+		stream_addr_str(&addr, "/dev/null", 0);
+		CPPUNIT_ASSERT_EQUAL(0, stream_create(&st, &addr, NULL, "test", "file"));
+		CPPUNIT_ASSERT(sender_open(&sender, st, 0, NULL) != 0);
+		stream_close(st);
+	}
+
+	void test_iface(){
+		stream_t st;
+		stream_addr_t addr = STREAM_ADDR_INITIALIZER;
+		CPPUNIT_ASSERT_EQUAL(0, stream_addr_aton(&addr, "iface://lo?caplen=60&mampid=test&nic=cap0", STREAM_ADDR_GUESS, 0));
+		int ret = stream_open(&st, &addr, NULL, 4*1024*1024);
+		if ( ret == EPERM || ret == EACCES ){
+			return; /* capturing requires CAP_NET_RAW */
+		}
+		CPPUNIT_ASSERT_EQUAL(0, ret);
+
+		/* send datagrams to a port nobody listens to */
+		const int port = 30000 + ((int)getpid() + 5) % 20000;
+		struct sockaddr_in dst;
+		memset(&dst, 0, sizeof(dst));
+		dst.sin_family = AF_INET;
+		dst.sin_port = htons(port);
+		dst.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		const int fd = socket(AF_INET, SOCK_DGRAM, 0);
+		char payload[200];
+		for ( int i = 0; i < 3; i++ ){
+			memset(payload, 'a' + i, sizeof(payload));
+			sendto(fd, payload, 50 + i * 50, 0, (struct sockaddr*)&dst, sizeof(dst));
+		}
+		close(fd);
+
+		const size_t header = sizeof(struct ethhdr) + sizeof(struct iphdr) + sizeof(struct udphdr);
+		int found = 0;
+		struct timeval timeout = {2, 0};
+		cap_head* cp;
+		while ( found < 3 && stream_read(st, &cp, NULL, &timeout) == 0 ){
+			const struct udphdr* udp = (const struct udphdr*)(cp->payload + sizeof(struct ethhdr) + sizeof(struct iphdr));
+			if ( cp->caplen < header || ntohs(cp->ethhdr->h_proto) != ETH_P_IP || ntohs(udp->dest) != port ){
+				continue;
+			}
+
+			CPPUNIT_ASSERT_EQUAL(std::string("cap0"), std::string(cp->nic));
+			CPPUNIT_ASSERT_EQUAL(std::string("test"), std::string(cp->mampid));
+			CPPUNIT_ASSERT_EQUAL((uint32_t)(header + 50 + found * 50), cp->len);
+			CPPUNIT_ASSERT_EQUAL((uint32_t)60, cp->caplen);
+			CPPUNIT_ASSERT_EQUAL('a' + found, (int)cp->payload[header]);
+			found++;
+		}
+		CPPUNIT_ASSERT_EQUAL(3, found);
+
+		stream_close(st);
+	}
+	void test_pcap(){
+		stream_t pcap;
+		stream_t cap;
+		stream_addr_t addr = STREAM_ADDR_INITIALIZER;
+		stream_addr_str(&addr, TOP_SRCDIR "/tests/traces/GRE.pcap", 0);
+		CPPUNIT_ASSERT_EQUAL(0, stream_open(&pcap, &addr, NULL, 0));
+		stream_addr_str(&addr, TOP_SRCDIR "/tests/traces/GRE.cap", 0);
+		CPPUNIT_ASSERT_EQUAL(0, stream_open(&cap, &addr, NULL, 0));
+
+		/* must match the trace converted by pcap2cap */
+		cap_head* a;
+		cap_head* b;
+		int packets = 0;
+		while ( stream_read(cap, &b, NULL, NULL) == 0 ){
+			CPPUNIT_ASSERT_EQUAL(0, stream_peek(pcap, &a, NULL));
+			CPPUNIT_ASSERT_EQUAL(0, stream_read(pcap, &a, NULL, NULL));
+			CPPUNIT_ASSERT_EQUAL(0, timecmp(&a->ts, &b->ts));
+			CPPUNIT_ASSERT_EQUAL(b->len, a->len);
+			CPPUNIT_ASSERT_EQUAL(b->caplen, a->caplen);
+			CPPUNIT_ASSERT_EQUAL(0, memcmp(a->payload, b->payload, a->caplen));
+			packets++;
+		}
+		CPPUNIT_ASSERT_EQUAL(10, packets);
+		CPPUNIT_ASSERT_EQUAL(-1, stream_read(pcap, &a, NULL, NULL));
+
+		stream_close(pcap);
+		stream_close(cap);
+	}
+
+	void test_pcapng(){
+		static const char* filename = "test-pcapng.pcapng";
+		std::vector<char> file;
+		std::vector<char> body;
+		char payload[64];
+		memset(payload, 0x55, sizeof(payload));
+
+		/* section header */
+		const uint32_t magic = 0x1a2b3c4d;
+		const uint16_t version[2] = {1, 0};
+		const int64_t section_length = -1;
+		append(body, &magic, 4);
+		append(body, version, 4);
+		append(body, &section_length, 8);
+		pcapng_block(file, 0x0a0d0d0a, body);
+
+		/* interface with name and nanosecond resolution */
+		const uint16_t linktype[2] = {1, 0};
+		const uint32_t snaplen = 0;
+		const uint16_t if_name[2] = {2, 4};
+		const uint16_t if_tsresol[2] = {9, 1};
+		const uint32_t tsresol = 9;
+		const uint32_t end = 0;
+		body.clear();
+		append(body, linktype, 4);
+		append(body, &snaplen, 4);
+		append(body, if_name, 4);
+		append(body, "eth9", 4);
+		append(body, if_tsresol, 4);
+		append(body, &tsresol, 4);
+		append(body, &end, 4);
+		pcapng_block(file, 1, body);
+
+		/* unknown blocks is ignored */
+		body.assign(8, 0);
+		pcapng_block(file, 0x12345678, body);
+
+		/* enhanced packet at 1.000000123 */
+		const uint64_t ts = UINT64_C(1000000123);
+		const uint32_t epb[5] = {0, (uint32_t)(ts >> 32), (uint32_t)ts, 60, 64};
+		body.clear();
+		append(body, epb, sizeof(epb));
+		append(body, payload, 60);
+		pcapng_block(file, 6, body);
+
+		/* simple packet */
+		const uint32_t spb = 64;
+		body.clear();
+		append(body, &spb, 4);
+		append(body, payload, 64);
+		pcapng_block(file, 3, body);
+
+		/* truncated enhanced packet */
+		pcapng_block(file, 6, std::vector<char>(epb, epb + 2));
+
+		FILE* fp = fopen(filename, "wb");
+		CPPUNIT_ASSERT(fp);
+		CPPUNIT_ASSERT_EQUAL(file.size(), fwrite(&file[0], 1, file.size(), fp));
+		fclose(fp);
+
+		stream_t st;
+		stream_addr_t addr = STREAM_ADDR_INITIALIZER;
+		stream_addr_str(&addr, filename, 0);
+		CPPUNIT_ASSERT_EQUAL(0, stream_open(&st, &addr, NULL, 0));
+
+		cap_head* cp;
+		CPPUNIT_ASSERT_EQUAL(0, stream_read(st, &cp, NULL, NULL));
+		CPPUNIT_ASSERT_EQUAL(std::string("eth9"), std::string(cp->nic));
+		CPPUNIT_ASSERT_EQUAL((uint32_t)1, cp->ts.tv_sec);
+		CPPUNIT_ASSERT_EQUAL((uint64_t)123000, cp->ts.tv_psec);
+		CPPUNIT_ASSERT_EQUAL((uint32_t)64, cp->len);
+		CPPUNIT_ASSERT_EQUAL((uint32_t)60, cp->caplen);
+		CPPUNIT_ASSERT_EQUAL(0, memcmp(cp->payload, payload, 60));
+
+		CPPUNIT_ASSERT_EQUAL(0, stream_read(st, &cp, NULL, NULL));
+		CPPUNIT_ASSERT_EQUAL((uint32_t)64, cp->len);
+		CPPUNIT_ASSERT_EQUAL((uint32_t)64, cp->caplen);
+
+		CPPUNIT_ASSERT(stream_read(st, &cp, NULL, NULL) > 0);
+
+		stream_close(st);
+		unlink(filename);
+	}
+	void test_pcap_writer(){
+		static const char* filename = "test-writer.pcapng";
+		static const char* nic[] = {"eth0", "eth1", "eth1"};
+		static const char* mampid[] = {"mp1", "mp1", "mp2"};
+		char buf[sizeof(struct cap_header) + 100];
+		struct cap_header* cp = (struct cap_header*)buf;
+
+		for ( int format = PCAP_FORMAT_USEC; format <= PCAP_FORMAT_PCAPNG; format++ ){
+			pcap_writer_t writer;
+			CPPUNIT_ASSERT_EQUAL(0, pcap_writer_open(&writer, filename, (enum pcap_format)format, 1, 80));
+
+			/* first half written directly, second half as a batch with interfaces in another order */
+			pcap_batch_t batch = pcap_batch_new(writer);
+			CPPUNIT_ASSERT(batch);
+			for ( int i = 0; i < 6; i++ ){
+				memset(buf, 0, sizeof(buf));
+				strcpy(cp->nic, nic[i % 3]);
+				strcpy(cp->mampid, mampid[(i < 3 ? i : 5 - i) % 3]);
+				cp->ts = timepico_new(i, 123456789123);
+				cp->len = 100;
+				cp->caplen = 100;
+				memset(cp->payload, i, 100);
+				CPPUNIT_ASSERT_EQUAL(0, i < 3 ? pcap_writer_write(writer, cp) : pcap_batch_add(batch, cp));
+			}
+			CPPUNIT_ASSERT_EQUAL(0, pcap_writer_write_batch(writer, batch));
+			CPPUNIT_ASSERT_EQUAL((uint64_t)6, pcap_writer_packets(writer));
+			pcap_batch_free(batch);
+			CPPUNIT_ASSERT_EQUAL(0, pcap_writer_close(writer));
+
+			stream_t st;
+			stream_addr_t addr = STREAM_ADDR_INITIALIZER;
+			stream_addr_str(&addr, filename, 0);
+			CPPUNIT_ASSERT_EQUAL(0, stream_open(&st, &addr, NULL, 0));
+
+			cap_head* cp2;
+			for ( int i = 0; i < 6; i++ ){
+				CPPUNIT_ASSERT_EQUAL(0, stream_read(st, &cp2, NULL, NULL));
+				CPPUNIT_ASSERT_EQUAL((uint32_t)i, cp2->ts.tv_sec);
+				CPPUNIT_ASSERT_EQUAL(format == PCAP_FORMAT_USEC ? (uint64_t)123456000000 : (uint64_t)123456789000, cp2->ts.tv_psec);
+				CPPUNIT_ASSERT_EQUAL((uint32_t)100, cp2->len);
+				CPPUNIT_ASSERT_EQUAL((uint32_t)80, cp2->caplen);
+				CPPUNIT_ASSERT_EQUAL((char)i, cp2->payload[79]);
+				if ( format == PCAP_FORMAT_PCAPNG ){
+					CPPUNIT_ASSERT_EQUAL(std::string(nic[i % 3]), std::string(cp2->nic));
+					CPPUNIT_ASSERT_EQUAL(std::string(mampid[(i < 3 ? i : 5 - i) % 3]), std::string(cp2->mampid, strnlen(cp2->mampid, 8)));
+				}
+			}
+			CPPUNIT_ASSERT_EQUAL(-1, stream_read(st, &cp2, NULL, NULL));
+			stream_close(st);
+		}
+
+		unlink(filename);
+	}
+
+	/* even packets is vlan + ipv4 + tcp, odd is ipv6 + udp */
+	static size_t column_packet(char* buf, int i){
+		struct cap_header* cp = (struct cap_header*)buf;
+		memset(buf, 0, sizeof(struct cap_header) + 100);
+		strcpy(cp->nic, "eth0");
+		strcpy(cp->mampid, i < 5 ? "mp1" : "mp2");
+		cp->ts = timepico_new(1000 + i, i * 1000);
+
+		unsigned char* ptr = (unsigned char*)cp->payload;
+		size_t size;
+		if ( i % 2 == 0 ){
+			static const unsigned char hdr[] = {
+				0x81, 0x00, 0x00, 0x64, 0x08, 0x00,                   /* vlan 100, ipv4 */
+				0x45, 0x00, 0x00, 0x28, 0x00, 0x00, 0x00, 0x00,       /* ipv4, 40 bytes */
+				0x40, 0x06, 0x00, 0x00, 10, 0, 0, 1, 10, 0, 0, 2,     /* tcp, 10.0.0.1 > 10.0.0.2 */
+				0x04, 0xd2, 0x00, 0x50, 0, 0, 0, 0, 0, 0, 0, 0,       /* 1234 > 80 */
+				0x50, 0x12, 0xff, 0xff, 0, 0, 0, 0,                   /* syn+ack */
+			};
+			memcpy(ptr + 12, hdr, sizeof(hdr));
+			size = 12 + sizeof(hdr);
+		} else {
+			static const unsigned char hdr[] = {
+				0x86, 0xdd, 0x60, 0, 0, 0, 0x00, 0x08, 0x11, 0x40,    /* ipv6, udp */
+				0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1,       /* ::1 */
+				0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, /* 2001:db8::2 */
+				0x00, 0x35, 0xc0, 0x00, 0x00, 0x08, 0, 0,             /* 53 > 49152 */
+			};
+			memcpy(ptr + 12, hdr, sizeof(hdr));
+			size = 12 + sizeof(hdr);
+		}
+
+		cp->len = size + i;
+		cp->caplen = size;
+		return size;
+	}
+
+	void test_column(){
+		static const char* filename = "test-column.col";
+		char buf[sizeof(struct cap_header) + 100];
+		const struct cap_header* cp = (const struct cap_header*)buf;
+
+		CPPUNIT_ASSERT_EQUAL((int)COLUMN_VLAN, column_from_name("vlan"));
+		CPPUNIT_ASSERT_EQUAL(-1, column_from_name("foo"));
+
+		for ( int flags = 0; flags <= COLUMN_COMPRESS; flags++ ){
+			column_writer_t writer;
+			CPPUNIT_ASSERT_EQUAL(0, column_writer_open(&writer, filename, 4, flags));
+			for ( int i = 0; i < 10; i++ ){
+				column_packet(buf, i);
+				CPPUNIT_ASSERT_EQUAL(0, column_writer_add(writer, cp));
+			}
+			CPPUNIT_ASSERT_EQUAL((uint64_t)10, column_writer_rows(writer));
+			CPPUNIT_ASSERT_EQUAL(0, column_writer_close(writer));
+
+			column_reader_t reader;
+			CPPUNIT_ASSERT_EQUAL(0, column_reader_open(&reader, filename));
+			CPPUNIT_ASSERT_EQUAL((size_t)3, column_reader_chunks(reader));
+			CPPUNIT_ASSERT_EQUAL((uint64_t)10, column_reader_rows(reader));
+			CPPUNIT_ASSERT_EQUAL((size_t)2, column_reader_chunk_rows(reader, 2));
+
+			/* every column of every chunk must decode to the summary of the packet */
+			for ( size_t chunk = 0; chunk < 3; chunk++ ){
+				const size_t rows = column_reader_chunk_rows(reader, chunk);
+				for ( int column = 0; column < COLUMN_MAX; column++ ){
+					const size_t width = column_width((enum column_id)column);
+					std::vector<char> data(rows * width);
+					CPPUNIT_ASSERT_EQUAL(0, column_reader_read(reader, chunk, (enum column_id)column, &data[0]));
+
+					for ( size_t row = 0; row < rows; row++ ){
+						column_packet(buf, chunk * 4 + row);
+						struct column_row expected;
+						column_row_from_packet(&expected, cp);
+
+						const char* value = &data[row * width];
+						switch ( column ){
+						case COLUMN_TS_SEC: CPPUNIT_ASSERT_EQUAL((uint64_t)expected.ts.tv_sec, column_uint(COLUMN_TS_SEC, value)); break;
+						case COLUMN_TS_PSEC: CPPUNIT_ASSERT_EQUAL((uint64_t)expected.ts.tv_psec, column_uint(COLUMN_TS_PSEC, value)); break;
+						case COLUMN_LEN: CPPUNIT_ASSERT_EQUAL((uint64_t)expected.len, column_uint(COLUMN_LEN, value)); break;
+						case COLUMN_MAMPID: CPPUNIT_ASSERT(memcmp(expected.mampid, value, 8) == 0); break;
+						case COLUMN_IP_DST: CPPUNIT_ASSERT(memcmp(&expected.dst, value, 16) == 0); break;
+						case COLUMN_DPORT: CPPUNIT_ASSERT_EQUAL((uint64_t)expected.dport, column_uint(COLUMN_DPORT, value)); break;
+						case COLUMN_VLAN: CPPUNIT_ASSERT_EQUAL((uint64_t)expected.vlan, column_uint(COLUMN_VLAN, value)); break;
+						}
+					}
+				}
+			}
+
+			/* statistics of the first chunk */
+			struct column_stats stats;
+			CPPUNIT_ASSERT_EQUAL(0, column_reader_stats(reader, 0, COLUMN_TS_SEC, &stats));
+			CPPUNIT_ASSERT_EQUAL((uint64_t)1000, column_uint(COLUMN_TS_SEC, stats.min));
+			CPPUNIT_ASSERT_EQUAL((uint64_t)1003, column_uint(COLUMN_TS_SEC, stats.max));
+			CPPUNIT_ASSERT_EQUAL((size_t)16, stats.raw_size);
+			CPPUNIT_ASSERT_EQUAL(flags ? COLUMN_CODEC_DELTA : COLUMN_CODEC_RAW, stats.codec);
+			CPPUNIT_ASSERT(flags ? stats.stored_size < stats.raw_size : stats.stored_size == stats.raw_size);
+			CPPUNIT_ASSERT_EQUAL(0, column_reader_stats(reader, 0, COLUMN_VLAN, &stats));
+			CPPUNIT_ASSERT_EQUAL((uint64_t)100, column_uint(COLUMN_VLAN, stats.min));
+			CPPUNIT_ASSERT_EQUAL((uint64_t)COLUMN_NO_VLAN, column_uint(COLUMN_VLAN, stats.max));
+			CPPUNIT_ASSERT_EQUAL(EINVAL, column_reader_stats(reader, 3, COLUMN_VLAN, &stats));
+
+			column_reader_close(reader);
+		}
+
+		/* summary fields */
+		struct column_row row;
+		column_packet(buf, 0);
+		column_row_from_packet(&row, cp);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)100, row.vlan);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)IPPROTO_TCP, row.proto);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)1234, row.sport);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)80, row.dport);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)0x12, row.tcp_flags);
+		CPPUNIT_ASSERT(IN6_IS_ADDR_V4MAPPED(&row.src));
+		CPPUNIT_ASSERT_EQUAL((uint8_t)2, row.dst.s6_addr[15]);
+
+		column_packet(buf, 1);
+		column_row_from_packet(&row, cp);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)COLUMN_NO_VLAN, row.vlan);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)IPPROTO_UDP, row.proto);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)53, row.sport);
+		CPPUNIT_ASSERT_EQUAL((uint16_t)49152, row.dport);
+		CPPUNIT_ASSERT_EQUAL((uint8_t)0, row.tcp_flags);
+		CPPUNIT_ASSERT(IN6_IS_ADDR_LOOPBACK(&row.src));
+
+		unlink(filename);
+	}
+
+	void test_column_invalid(){
+		static const char* filename = "test-column.col";
+		char buf[sizeof(struct cap_header) + 100];
+		column_reader_t reader;
+
+		column_writer_t writer;
+		CPPUNIT_ASSERT_EQUAL(0, column_writer_open(&writer, filename, 0, COLUMN_COMPRESS));
+		for ( int i = 0; i < 10; i++ ){
+			column_packet(buf, i);
+			CPPUNIT_ASSERT_EQUAL(0, column_writer_add(writer, (const struct cap_header*)buf));
+		}
+		CPPUNIT_ASSERT_EQUAL(0, column_writer_close(writer));
+
+		/* last chunk is incomplete */
+		CPPUNIT_ASSERT_EQUAL(0, truncate(filename, 1000));
+		CPPUNIT_ASSERT(column_reader_open(&reader, filename) > 0);
+
+		/* not a column file */
+		CPPUNIT_ASSERT(column_reader_open(&reader, TOP_SRCDIR "/tests/traces/GRE.cap") > 0);
+		CPPUNIT_ASSERT_EQUAL(ENOENT, column_reader_open(&reader, "missing.col"));
+
+		/* a failed chunk write is returned by all later calls */
+		struct rlimit old, limit;
+		CPPUNIT_ASSERT_EQUAL(0, getrlimit(RLIMIT_FSIZE, &old));
+		limit = old;
+		limit.rlim_cur = 4096;
+		signal(SIGXFSZ, SIG_IGN);
+		CPPUNIT_ASSERT_EQUAL(0, setrlimit(RLIMIT_FSIZE, &limit));
+		CPPUNIT_ASSERT_EQUAL(0, column_writer_open(&writer, filename, 4, 0));
+		int ret = 0;
+		for ( int i = 0; i < 1000 && ret == 0; i++ ){
+			column_packet(buf, i);
+			ret = column_writer_add(writer, (const struct cap_header*)buf);
+		}
+		CPPUNIT_ASSERT_EQUAL(EFBIG, ret);
+		CPPUNIT_ASSERT_EQUAL(EFBIG, column_writer_add(writer, (const struct cap_header*)buf));
+		CPPUNIT_ASSERT_EQUAL(EFBIG, column_writer_close(writer));
+		CPPUNIT_ASSERT_EQUAL(0, setrlimit(RLIMIT_FSIZE, &old));
+		signal(SIGXFSZ, SIG_DFL);
+
+		unlink(filename);
+	}
 };
 
 CPPUNIT_TEST_SUITE_REGISTRATION(Test);
@@ -0,0 +1,124 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <caputils/caputils.h>
+#include <caputils/stream.h>
+#include <caputils/packet.h>
+#include <caputils/log.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+
+#include <cppunit/CompilerOutputter.h>
+#include <cppunit/extensions/TestFactoryRegistry.h>
+#include <cppunit/ui/text/TestRunner.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+/* Processes the same traces in several threads at once and verifies the output
+ * is identical to a single thread. Most useful when built with
+ * -fsanitize=thread. */
+
+#define NUM_THREADS 8
+
+static const char* traces[] = {
+	TOP_SRCDIR "/tests/traces/t2.cap",
+	TOP_SRCDIR "/tests/traces/protocols/tcp.cap",
+	TOP_SRCDIR "/tests/traces/protocols/http.cap",
+	TOP_SRCDIR "/tests/traces/vrrp.cap",
+	NULL,
+};
+
+struct job {
+	const char* filename;
+	std::string output;
+	int ret;
+};
+
+static void* process(void* ptr){
+	struct job* job = (struct job*)ptr;
+	job->ret = 0;
+
+	stream_t st;
+	stream_addr_t addr = STREAM_ADDR_INITIALIZER;
+	stream_addr_str(&addr, job->filename, 0);
+	if ( (job->ret=stream_open(&st, &addr, NULL, 0)) != 0 ){
+		return NULL;
+	}
+
+	char* buf = NULL;
+	size_t size = 0;
+	FILE* fp = open_memstream(&buf, &size);
+
+	struct format format;
+	format_setup(&format, FORMAT_DATE_STR | FORMAT_HEADER | FORMAT_LAYER_APPLICATION);
+
+	cap_head* cp;
+	while ( stream_read(st, &cp, NULL, NULL) == 0 ){
+		char tmp[128];
+		format_pkg(fp, &format, cp);
+		fprintf(fp, "%s %s %s %s\n",
+		        hexdump_address((const struct ether_addr*)cp->ethhdr->h_source),
+		        timepico_to_string(&cp->ts, "%Y-%m-%d %H:%M:%S"),
+		        timepico_to_string_r(&cp->ts, tmp, sizeof(tmp), "%s"),
+		        stream_addr_ntoa(&addr));
+	}
+
+	fclose(fp);
+	job->output = std::string(buf, size);
+	free(buf);
+	stream_close(st);
+	return NULL;
+}
+
+class Test: public CppUnit::TestFixture {
+	CPPUNIT_TEST_SUITE(Test);
+	CPPUNIT_TEST( test_parallel_decode );
+	CPPUNIT_TEST_SUITE_END();
+
+public:
+	void test_parallel_decode(){
+		for ( const char** filename = traces; *filename; filename++ ){
+			/* reference output, run in a separate thread so it gets fresh thread-local state */
+			struct job reference = { *filename, "", 0 };
+			pthread_t ref;
+			CPPUNIT_ASSERT_EQUAL(0, pthread_create(&ref, NULL, process, &reference));
+			pthread_join(ref, NULL);
+			CPPUNIT_ASSERT_EQUAL(0, reference.ret);
+			CPPUNIT_ASSERT(reference.output.size() > 0);
+
+			struct job job[NUM_THREADS];
+			pthread_t thread[NUM_THREADS];
+			for ( int i = 0; i < NUM_THREADS; i++ ){
+				job[i].filename = *filename;
+				CPPUNIT_ASSERT_EQUAL(0, pthread_create(&thread[i], NULL, process, &job[i]));
+			}
+
+			for ( int i = 0; i < NUM_THREADS; i++ ){
+				pthread_join(thread[i], NULL);
+				CPPUNIT_ASSERT_EQUAL(0, job[i].ret);
+				CPPUNIT_ASSERT_EQUAL(reference.output, job[i].output);
+			}
+		}
+	}
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(Test);
+
+int main(int argc, const char* argv[]){
+	/* with TZ unset glibc reloads the zone on each strftime, guarded by a lock
+	 * which is invisible to ThreadSanitizer */
+	setenv("TZ", "UTC", 1);
+	tzset();
+
+	CppUnit::Test *suite = CppUnit::TestFactoryRegistry::getRegistry().makeTest();
+	CppUnit::TextUi::TestRunner runner;
+
+	runner.addTest(suite);
+	runner.setOutputter(new CppUnit::CompilerOutputter(&runner.result(), std::cerr));
+
+	return runner.run() ? 0 : 1;
+}
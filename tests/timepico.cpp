@@ -3,6 +3,8 @@
 #endif
 
 #include "caputils/picotime.h"
+#include <stdint.h>
+#include <math.h>
 
 #include <cppunit/CompilerOutputter.h>
 #include <cppunit/extensions/TestFactoryRegistry.h>
@@ -24,9 +26,29 @@ static timepico t(uint32_t a, uint64_t b){ timepico tmp = {a,b}; return tmp; }
 
 #define CPPUNIT_ASSERT_TIMEPICO(expected, actual) check_timepico(expected, actual, CPPUNIT_SOURCELINE())
 
+static const uint64_t P = PICOSECONDS_PER_SECOND;
+
+/* reference arithmetic using 128-bit picoseconds (seconds modulo 2^32) */
+typedef unsigned __int128 u128;
+static u128 to_ps(timepico t){ return (u128)t.tv_sec * P + t.tv_psec; }
+static timepico from_ps(u128 ps){
+	const u128 range = (u128)P << 32;
+	ps %= range;
+	return t((uint32_t)(ps / P), (uint64_t)(ps % P));
+}
+
 class TimepicoTest: public CppUnit::TestFixture {
 	CPPUNIT_TEST_SUITE(TimepicoTest);
 	CPPUNIT_TEST(test_sub);
+	CPPUNIT_TEST(test_sub_edge);
+	CPPUNIT_TEST(test_add_edge);
+	CPPUNIT_TEST(test_cmp);
+	CPPUNIT_TEST(test_reference);
+	CPPUNIT_TEST(test_normalize);
+	CPPUNIT_TEST(test_diff_ps);
+	CPPUNIT_TEST(test_min);
+	CPPUNIT_TEST(test_deltas);
+	CPPUNIT_TEST(test_to_double);
 	CPPUNIT_TEST(from_string_unix);
 	CPPUNIT_TEST_SUITE_END();
 
@@ -47,6 +69,120 @@ public:
 		CPPUNIT_ASSERT_TIMEPICO(t(4, 9), "4.000000000009");
 		CPPUNIT_ASSERT_TIMEPICO(t(1341272547, 795973301000), "1341272547.795973301000");
 	}
+
+	void test_sub_edge(){
+		CPPUNIT_ASSERT_TIMEPICO(t(0, 0),            timepico_sub(t(5, 7), t(5, 7)));
+		CPPUNIT_ASSERT_TIMEPICO(t(0, 1),            timepico_sub(t(5, 0), t(4, P-1)));
+		CPPUNIT_ASSERT_TIMEPICO(t(0, P-1),          timepico_sub(t(5, P-1), t(5, 0)));
+		CPPUNIT_ASSERT_TIMEPICO(t(1, 0),            timepico_sub(t(5, 3), t(4, 3)));
+		CPPUNIT_ASSERT_TIMEPICO(t(UINT32_MAX, P-5), timepico_sub(t(1, 0), t(1, 5)));    /* negative wraps */
+		CPPUNIT_ASSERT_TIMEPICO(t(UINT32_MAX, 0),   timepico_sub(t(1, 0), t(2, 0)));
+		CPPUNIT_ASSERT_TIMEPICO(t(0, 0),            timepico_sub(t(UINT32_MAX, P-1), t(UINT32_MAX, P-1)));
+
+		/* not normalized */
+		CPPUNIT_ASSERT_TIMEPICO(t(1, 0),            timepico_sub(t(0, 2*P), t(0, P)));
+		CPPUNIT_ASSERT_TIMEPICO(t(2, 5),            timepico_sub(t(1, 2*P+5), t(1, 0)));
+		CPPUNIT_ASSERT_TIMEPICO(t(0, P-1),          timepico_sub(t(4, 0), t(1, 2*P+1)));
+	}
+
+	void test_add_edge(){
+		CPPUNIT_ASSERT_TIMEPICO(t(0, 0),            timepico_add(t(0, 0), t(0, 0)));
+		CPPUNIT_ASSERT_TIMEPICO(t(1, 0),            timepico_add(t(0, P-1), t(0, 1)));    /* exactly one second carries */
+		CPPUNIT_ASSERT_TIMEPICO(t(1, P-2),          timepico_add(t(0, P-1), t(0, P-1)));
+		CPPUNIT_ASSERT_TIMEPICO(t(3, 5),            timepico_add(t(1, 2), t(2, 3)));
+		CPPUNIT_ASSERT_TIMEPICO(t(0, 0),            timepico_add(t(UINT32_MAX, P-1), t(0, 1))); /* wraps */
+
+		/* not normalized */
+		CPPUNIT_ASSERT_TIMEPICO(t(3, 1),            timepico_add(t(0, 3*P), t(0, 1)));
+		CPPUNIT_ASSERT_TIMEPICO(t(4, 0),            timepico_add(t(0, 2*P+P/2), t(1, P/2)));
+	}
+
+	void test_cmp(){
+		/* all combinations of seconds and fractions being less, equal or greater */
+		for ( int s = -1; s <= 1; s++ ){
+			for ( int p = -1; p <= 1; p++ ){
+				const timepico a = t(10, P/2);
+				const timepico b = t(10 + s, P/2 + p);
+				const int expected = s != 0 ? -s : -p;
+				CPPUNIT_ASSERT_EQUAL(expected, timecmp(&a, &b));
+				CPPUNIT_ASSERT_EQUAL(-expected, timecmp(&b, &a));
+			}
+		}
+
+		/* compares lexicographically even if not normalized (used as "largest" sentinel) */
+		const timepico max = t(UINT32_MAX, UINT64_MAX);
+		const timepico x = t(UINT32_MAX, P-1);
+		CPPUNIT_ASSERT_EQUAL( 1, timecmp(&max, &x));
+		CPPUNIT_ASSERT_EQUAL(-1, timecmp(&x, &max));
+		CPPUNIT_ASSERT_EQUAL( 0, timecmp(&max, &max));
+	}
+
+	/* compare against 128-bit arithmetic for all combinations of edge values */
+	void test_reference(){
+		static const uint32_t sec[] = {0, 1, 2, 1000, 0x7fffffff, 0x80000000, UINT32_MAX-1, UINT32_MAX};
+		static const uint64_t psec[] = {0, 1, 2, P/2-1, P/2, P/2+1, P-2, P-1};
+		const size_t ns = sizeof(sec) / sizeof(sec[0]);
+		const size_t np = sizeof(psec) / sizeof(psec[0]);
+
+		for ( size_t i = 0; i < ns*np; i++ ){
+			for ( size_t j = 0; j < ns*np; j++ ){
+				const timepico a = t(sec[i/np], psec[i%np]);
+				const timepico b = t(sec[j/np], psec[j%np]);
+				const u128 range = (u128)P << 32;
+
+				CPPUNIT_ASSERT_TIMEPICO(from_ps(to_ps(a) + range - to_ps(b)), timepico_sub(a, b));
+				CPPUNIT_ASSERT_TIMEPICO(from_ps(to_ps(a) + to_ps(b)), timepico_add(a, b));
+				CPPUNIT_ASSERT_EQUAL((to_ps(a) > to_ps(b)) - (to_ps(a) < to_ps(b)), timecmp(&a, &b));
+			}
+		}
+	}
+
+	void test_normalize(){
+		CPPUNIT_ASSERT_TIMEPICO(t(1, P-1),          timepico_normalize(t(1, P-1)));
+		CPPUNIT_ASSERT_TIMEPICO(t(2, 0),            timepico_normalize(t(1, P)));
+		CPPUNIT_ASSERT_TIMEPICO(t(18446745, 73709551615), timepico_normalize(t(1, UINT64_MAX)));
+	}
+
+	void test_diff_ps(){
+		CPPUNIT_ASSERT_EQUAL((int64_t)0,          timepico_diff_ps(t(7, 5), t(7, 5)));
+		CPPUNIT_ASSERT_EQUAL((int64_t)1,          timepico_diff_ps(t(8, 0), t(7, P-1)));
+		CPPUNIT_ASSERT_EQUAL((int64_t)-1,         timepico_diff_ps(t(7, P-1), t(8, 0)));
+		CPPUNIT_ASSERT_EQUAL((int64_t)(3*P + 2),  timepico_diff_ps(t(1341272550, 5), t(1341272547, 3)));
+		CPPUNIT_ASSERT_EQUAL(-(int64_t)(3*P + 2), timepico_diff_ps(t(1341272547, 3), t(1341272550, 5)));
+		CPPUNIT_ASSERT_EQUAL((int64_t)(9000000*P), timepico_diff_ps(t(9000000, 0), t(0, 0)));
+	}
+
+	void test_min(){
+		const timepico ts[] = {
+			t(5, 100), t(4, P-1), t(5, 0), t(4, 7), t(4, 7), t(6, 0),
+		};
+		CPPUNIT_ASSERT_EQUAL((size_t)0, timepico_min(ts, 0));
+		CPPUNIT_ASSERT_EQUAL((size_t)0, timepico_min(ts, 1));
+		CPPUNIT_ASSERT_EQUAL((size_t)1, timepico_min(ts, 3));
+		CPPUNIT_ASSERT_EQUAL((size_t)3, timepico_min(ts, 6));  /* first of equal */
+		CPPUNIT_ASSERT_EQUAL((size_t)4, timepico_min(ts + 4, 2) + 4);
+	}
+
+	void test_deltas(){
+		const timepico ts[] = { t(1, P-1), t(2, 0), t(2, 0), t(1, 0), t(3, 5) };
+		int64_t dt[5];
+		timepico_deltas(ts, 5, dt);
+		CPPUNIT_ASSERT_EQUAL((int64_t)1,     dt[0]);
+		CPPUNIT_ASSERT_EQUAL((int64_t)0,     dt[1]);
+		CPPUNIT_ASSERT_EQUAL(-(int64_t)P,    dt[2]);
+		CPPUNIT_ASSERT_EQUAL((int64_t)(2*P+5), dt[3]);
+
+		timepico_diff_batch(ts, 5, t(2, 0), dt);
+		CPPUNIT_ASSERT_EQUAL((int64_t)-1,    dt[0]);
+		CPPUNIT_ASSERT_EQUAL((int64_t)0,     dt[1]);
+		CPPUNIT_ASSERT_EQUAL(-(int64_t)P,    dt[3]);
+		CPPUNIT_ASSERT_EQUAL((int64_t)(P+5), dt[4]);
+	}
+
+	void test_to_double(){
+		CPPUNIT_ASSERT_EQUAL(2.5, timepico_to_double(t(2, P/2)));
+		CPPUNIT_ASSERT(fabs(timepico_to_double(t(1341272547, 795973301000)) - 1341272547.795973301) < 1e-6);
+	}
 };
 
 CPPUNIT_TEST_SUITE_REGISTRATION(TimepicoTest);
@@ -28,14 +28,14 @@
 #include "caputils/marker.h"
 #include "caputils/log.h"
 #include "caputils/packet.h"
+#include "caputils/parallel.h"
+#include "caputils/pcap_writer.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
-#include <net/if_arp.h>
 #include <unistd.h>
 #include <getopt.h>
-#include <pcap.h>
 #include <string.h>
 #include <errno.h>
 #include <signal.h>
@@ -44,13 +44,77 @@ static const char* program_name = NULL;
 static size_t caplen = 9964;
 static const char* outFilename = NULL;
 static const char* iface = NULL;
-static int linktype = DLT_EN10MB;
+static int linktype = 1; /* LINKTYPE_ETHERNET */
 static int quiet = 0;
 static int keep_running = 1;
 static unsigned int max_packets = 0;
 static struct timeval timeout = {1,0};
+static enum pcap_format format = PCAP_FORMAT_NSEC;
+static unsigned int threads = 1;
 
 
+static int parse_format(const char* str){
+	if ( strcmp(str, "pcap") == 0 || strcmp(str, "usec") == 0 ){
+		format = PCAP_FORMAT_USEC;
+	} else if ( strcmp(str, "nsec") == 0 ){
+		format = PCAP_FORMAT_NSEC;
+	} else if ( strcmp(str, "pcapng") == 0 ){
+		format = PCAP_FORMAT_PCAPNG;
+	} else {
+		return 0;
+	}
+	return 1;
+}
+
+static void batch_init(void* state, void* user){
+	*(pcap_batch_t*)state = pcap_batch_new((pcap_writer_t)user);
+}
+
+static int batch_map(void* state, const struct cap_header* cp, int match, void* user){
+	pcap_batch_t batch = *(pcap_batch_t*)state;
+	if ( !batch ){
+		return ENOMEM;
+	}
+	return match ? pcap_batch_add(batch, cp) : 0;
+}
+
+static void batch_reduce(void* state, size_t index, void* user){
+	int ret;
+	if ( (ret=pcap_writer_write_batch((pcap_writer_t)user, *(pcap_batch_t*)state)) != 0 ){
+		fprintf(stderr, "%s: failed to write packets: %s\n", program_name, strerror(ret));
+		exit(1);
+	}
+}
+
+static void batch_cleanup(void* state, void* user){
+	pcap_batch_free(*(pcap_batch_t*)state);
+}
+
+/**
+ * Convert a capfile using a pool of threads, each chunk of the file is
+ * encoded separately and written in order.
+ */
+static int convert_parallel(const char* filename, const struct filter* filter, pcap_writer_t writer){
+	const struct caputils_parallel job = {
+		.state_size = sizeof(pcap_batch_t),
+		.init = batch_init,
+		.map = batch_map,
+		.reduce = batch_reduce,
+		.cleanup = batch_cleanup,
+		.user = writer,
+		.filter = filter,
+		.chunk_size = 0,
+	};
+
+	int ret;
+	if ( (ret=caputils_parallel_foreach(&filename, 1, threads, &job)) != 0 ){
+		fprintf(stderr, "%s: failed to convert `%s': %s\n", program_name, filename, caputils_error_string(ret));
+		return 1;
+	}
+
+	return 0;
+}
+
 void handle_sigint(int signum){
 	if ( keep_running == 0 ){
 		fprintf(stderr, "\rGot SIGINT again, terminating.\n");
@@ -88,13 +152,15 @@ int main (int argc, char **argv){
 		{"iface", required_argument, 0, 'i'},
 		{"caplen", required_argument, 0, 'a'},
 		{"linktype",1,0,'l'},
+		{"format", required_argument, 0, 'f'},
+		{"jobs", required_argument, 0, 'j'},
 		{"packets",  required_argument, 0, 'p'},
 		{"quiet", no_argument, 0, 'q'},
 		{"help", 0, 0, 'h'},
 		{0, 0, 0, 0}
 	};
 
-	while ( (op = getopt_long(argc, argv, "i:l:o:p:qh", long_options, &option_index)) != -1 ){
+	while ( (op = getopt_long(argc, argv, "i:l:o:p:f:j:qh", long_options, &option_index)) != -1 ){
 		switch (op){
 		case 0:   /* long opt */
 		case '?': /* unknown opt */
@@ -114,11 +180,21 @@ int main (int argc, char **argv){
 
 		case 'l':
 			linktype = atoi(optarg);
-			fprintf(stderr, "Linktype = %d ==> %s(%s)\n", linktype, pcap_datalink_val_to_name(linktype),
-			        pcap_datalink_val_to_description(linktype));
+			fprintf(stderr, "Linktype = %d\n", linktype);
 			break;
 			
 			
+		case 'f': /* --format */
+			if ( !parse_format(optarg) ){
+				fprintf(stderr, "%s: unknown format `%s', expected pcap, nsec or pcapng.\n", program_name, optarg);
+				return 1;
+			}
+			break;
+
+		case 'j': /* --jobs */
+			threads = atoi(optarg);
+			break;
+
 		case 'p': /* --packets */
 		        max_packets = atoi(optarg);
 			break;
@@ -137,6 +213,10 @@ int main (int argc, char **argv){
 			       "  -i, --iface=INTERFACE      Capture interface (used when converting live ethernet stream.\n");  
 			printf("      --caplen=INT           Set caplen. Default %zd.\n", caplen);
 			printf("  -l, --linktype=INTEGER     pcap linktype (see PCAP-LINKTYPE(7))\n");
+			printf("  -f, --format=FORMAT        Output format: pcap (microsecond timestamps), nsec\n"
+			       "                             (nanosecond timestamps) or pcapng (one interface\n"
+			       "                             per nic and mampid) [default: nsec].\n");
+			printf("  -j, --jobs=N               Convert capfiles using N threads (0 for one per CPU).\n");
 			printf("  -p, --packets=N            Stop after N read packets.\n");
 			printf("  -q, --quiet                Silent output, only errors is printed.\n");
 			filter_from_argv_usage();
@@ -147,48 +227,42 @@ int main (int argc, char **argv){
 		}
 	}
 
-	stream_addr_t src = STREAM_ADDR_INITIALIZER;
-	if ( argc-optind > 0 ){
-		ret = stream_addr_aton(&src, argv[optind], STREAM_ADDR_GUESS, 0);
-	} else if ( !isatty(STDIN_FILENO) ){
-		ret = stream_addr_str(&src, "/dev/stdin", 0); /* stdin is pipe */
-	} else {
-		fprintf(stderr, "%s: must specify source address.\n", program_name);
+	if ( threads != 1 && (max_packets > 0 || argc - optind != 1) ){
+		fprintf(stderr, "%s: --jobs requires a single input file and cannot be combined with --packets.\n", program_name);
 		return 1;
 	}
 
-	if ( ret != 0 ){
-		fprintf(stderr, "%s: Failed to parse source address: %s\n", program_name, strerror(ret));
+	/* open output stream */
+	pcap_writer_t writer;
+	if ( !outFilename ){
+		if ( isatty(STDOUT_FILENO) ){
+			fprintf(stderr, "You need to specify a file reciving the converted data.\n");
+			fprintf(stderr, "Terminating.\n");
+			return 1;
+		}
+		outFilename = "/dev/stdout";
+	}
+	if ( (ret=pcap_writer_open(&writer, outFilename, format, linktype, caplen)) != 0 ){
+		fprintf(stderr, "%s: Error opening pcap file %s: %s\n", program_name, outFilename, strerror(ret));
 		return 1;
 	}
 
+	if ( threads != 1 ){
+		const int status = convert_parallel(argv[optind], &filter, writer);
+		if ( (ret=pcap_writer_close(writer)) != 0 ){
+			fprintf(stderr, "%s: failed to write %s: %s\n", program_name, outFilename, strerror(ret));
+			return 1;
+		}
+		filter_close(&filter);
+		return status;
+	}
+
 	/* Open stream(s) */
 	struct stream* stream;
 	if ( (ret=stream_from_getopt(&stream, argv, optind, argc, iface, "-", program_name, 0)) != 0 ) {
 		return ret; /* Error already shown */
 	}
 	const stream_stat_t* stat = stream_get_stat(stream);
-	stream_print_info(stream, stderr);
-
-
-	pcap_t* pcapHandle = pcap_open_dead(linktype, caplen);
-	pcap_dumper_t* pH = NULL;
-
-	/* open output stream */
-	if ( outFilename ){
-		pH = pcap_dump_open(pcapHandle, outFilename);
-	} else if ( !isatty(STDOUT_FILENO) ){
-		pH = pcap_dump_open(pcapHandle, "/dev/stdout");
-	} else {
-		fprintf(stderr, "You need to specify a file reciving the converted data.\n");
-		fprintf(stderr, "Terminating.\n");
-		return 1;
-	}
-
-	if ( !pH ) {
-		fprintf(stderr, "%s: Error opening pcap file %s.\n", program_name, outFilename);
-		return 1;
-	}
 
 	if ( !quiet ){
 		stream_print_info(stream, stderr);
@@ -198,52 +272,49 @@ int main (int argc, char **argv){
 	signal(SIGINT, handle_sigint);
 
 	cap_head* cp;
-	struct pcap_pkthdr pcapHeader;
 	long int packets = 0;
 
-	while ( keep_running)
-	  {
-	    struct timeval tv = timeout;
-	    
-	    ret=stream_read(stream, &cp, &filter, &tv);
-	    if ( ret == EAGAIN ) {
-	      continue;
-	    } else if ( ret != 0) {
-	      break;
-	    }
-	    packets++;
-
-	    pcapHeader.ts.tv_sec  = cp->ts.tv_sec;
-	    pcapHeader.ts.tv_usec = cp->ts.tv_psec/1000000;
-	    pcapHeader.len    = cp->len;
-	    pcapHeader.caplen = cp->caplen;
-	    
-	    // Let the user know that we are alive, good when processing large files.
-	    if ( !quiet && packets % 1000 == 0) {
-	      fprintf(stderr, ".");
-	      fflush(stderr);
-	    }
-	    
-	    // Save a copy of the frame to the new file.
-	    pcap_dump((u_char*)pH, &pcapHeader, (u_char*)cp->payload);
-	    pcap_dump_flush(pH);
-
-	    if ( max_packets > 0 && stat->matched >= max_packets) {
-	      /* Read enough pkts lets break. */
-	      break;
-	    }
-	    
-	  }
-	
+	while ( keep_running ){
+		struct timeval tv = timeout;
+		ret = stream_read(stream, &cp, &filter, &tv);
+		if ( ret == EAGAIN ){
+			if ( (ret=pcap_writer_flush(writer)) != 0 ){
+				break;
+			}
+			continue;
+		} else if ( ret != 0 ){
+			break;
+		}
+		packets++;
+
+		// Let the user know that we are alive, good when processing large files.
+		if ( !quiet && packets % 1000 == 0 ){
+			fprintf(stderr, ".");
+			fflush(stderr);
+		}
+
+		if ( (ret=pcap_writer_write(writer, cp)) != 0 ){
+			fprintf(stderr, "%s: failed to write packet: %s\n", program_name, strerror(ret));
+			break;
+		}
+
+		if ( max_packets > 0 && stat->matched >= max_packets ){
+			/* Read enough pkts lets break. */
+			break;
+		}
+	}
+
 	/* Close pcap file */
-	pcap_dump_close(pH);
-	
+	if ( (ret=pcap_writer_close(writer)) != 0 ){
+		fprintf(stderr, "%s: failed to write %s: %s\n", program_name, outFilename, strerror(ret));
+	}
+
 	/* close cap file */
 	stream_close(stream);
-	stream_addr_reset(&src);
-	
+	filter_close(&filter);
+
 	if ( !quiet ){
-	  fprintf(stderr, "\nThere was a total of %ld pkts that matched the filter.\n", packets);
+		fprintf(stderr, "\nThere was a total of %ld pkts that matched the filter.\n", packets);
 	}
 	return 0;
 }
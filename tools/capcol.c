@@ -0,0 +1,369 @@
+/**
+ * libcap_utils - DPMI capture utilities
+ * Copyright (C) 2003-2013 (see AUTHORS)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /*HAVE_CONFIG_H */
+
+#include "caputils/caputils.h"
+#include "caputils/stream.h"
+#include "caputils/filter.h"
+#include "caputils/column.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <arpa/inet.h>
+
+static const char* program_name = NULL;
+static const char* iface = NULL;
+static int quiet = 0;
+static int keep_running = 1;
+static unsigned int max_packets = 0;
+static size_t chunk_rows = 0;
+static int flags = COLUMN_COMPRESS;
+static struct timeval timeout = {1,0};
+
+static enum column_id selected[COLUMN_MAX];
+static size_t num_selected = 0;
+
+static const char* shortopts = "o:i:p:r:uc:s:Sqh";
+static struct option longopts[]= {
+	{"output",       required_argument, 0, 'o'},
+	{"iface",        required_argument, 0, 'i'},
+	{"packets",      required_argument, 0, 'p'},
+	{"rows",         required_argument, 0, 'r'},
+	{"uncompressed", no_argument,       0, 'u'},
+	{"columns",      required_argument, 0, 'c'},
+	{"show",         required_argument, 0, 's'},
+	{"stats",        no_argument,       0, 'S'},
+	{"quiet",        no_argument,       0, 'q'},
+	{"help",         no_argument,       0, 'h'},
+	{0, 0, 0, 0}
+};
+
+static void show_usage(void){
+	printf("%s-%s\n", program_name, caputils_version(NULL));
+	printf("(C) 2016 David Sveningsson <dsv@bth.se>\n");
+	printf("Usage: %s [OPTIONS] -o FILENAME [INPUT..]\n", program_name);
+	printf("       %s --show=FILENAME [--columns=LIST] [--stats]\n", program_name);
+	printf("Export packet summaries (timestamp, lengths, mampid, CI, addresses, ports,\n"
+	       "protocol, TCP flags and VLAN) to a column file.\n\n");
+	printf("  -o, --output=FILENAME      Destination filename.\n"
+	       "  -i, --iface=INTERFACE      Capture interface (used when reading from a live stream).\n"
+	       "  -p, --packets=N            Stop after N matched packets.\n"
+	       "  -r, --rows=N               Rows per chunk [default: %d].\n"
+	       "  -u, --uncompressed         Store all columns uncompressed.\n"
+	       "  -s, --show=FILENAME        Print rows of a column file.\n"
+	       "  -c, --columns=LIST         Comma-separated list of columns to print [default: all].\n"
+	       "  -S, --stats                Print chunk statistics instead of rows.\n"
+	       "  -q, --quiet                Silent output, only errors is printed.\n"
+	       "  -h, --help                 This text.\n", COLUMN_DEFAULT_ROWS);
+	printf("\nColumns:");
+	for ( unsigned int i = 0; i < COLUMN_MAX; i++ ){
+		printf(" %s", column_name(i));
+	}
+	printf("\n");
+	filter_from_argv_usage();
+}
+
+static int parse_columns(char* list){
+	char* saveptr = NULL;
+	for ( char* name = strtok_r(list, ",", &saveptr); name; name = strtok_r(NULL, ",", &saveptr) ){
+		const int column = column_from_name(name);
+		if ( column == -1 ){
+			fprintf(stderr, "%s: unknown column `%s'\n", program_name, name);
+			return 0;
+		}
+		if ( num_selected == COLUMN_MAX ){
+			fprintf(stderr, "%s: too many columns\n", program_name);
+			return 0;
+		}
+		selected[num_selected++] = column;
+	}
+	return 1;
+}
+
+static const char* format_value(enum column_id column, const char* value, char* buf, size_t size){
+	switch ( column_type(column) ){
+	case COLUMN_TYPE_UINT:
+		snprintf(buf, size, "%"PRIu64, column_uint(column, value));
+		break;
+
+	case COLUMN_TYPE_STRING:
+		snprintf(buf, size, "%.*s", (int)column_width(column), value);
+		break;
+
+	case COLUMN_TYPE_ADDRESS:
+		{
+			struct in6_addr addr;
+			memcpy(&addr, value, sizeof(struct in6_addr));
+			if ( IN6_IS_ADDR_UNSPECIFIED(&addr) ){
+				snprintf(buf, size, "-");
+			} else if ( IN6_IS_ADDR_V4MAPPED(&addr) ){
+				inet_ntop(AF_INET, &addr.s6_addr[12], buf, size);
+			} else {
+				inet_ntop(AF_INET6, &addr, buf, size);
+			}
+		}
+		break;
+	}
+	return buf;
+}
+
+static int show_stats(column_reader_t reader){
+	const size_t chunks = column_reader_chunks(reader);
+	static const char* codec[] = {"raw", "delta", "rle"};
+	char min[INET6_ADDRSTRLEN];
+	char max[INET6_ADDRSTRLEN];
+
+	printf("%zd chunks, %"PRIu64" rows\n", chunks, column_reader_rows(reader));
+	for ( size_t chunk = 0; chunk < chunks; chunk++ ){
+		printf("chunk %zd: %zd rows\n", chunk, column_reader_chunk_rows(reader, chunk));
+		for ( size_t i = 0; i < num_selected; i++ ){
+			struct column_stats stats;
+			column_reader_stats(reader, chunk, selected[i], &stats);
+			printf("  %-10s %-5s %8zd/%-8zd min %s max %s\n", column_name(selected[i]),
+			       codec[stats.codec], stats.stored_size, stats.raw_size,
+			       format_value(selected[i], (const char*)stats.min, min, sizeof(min)),
+			       format_value(selected[i], (const char*)stats.max, max, sizeof(max)));
+		}
+	}
+	return 0;
+}
+
+/**
+ * Print rows, only the selected columns is read from the file.
+ */
+static int show_rows(column_reader_t reader, const char* filename){
+	const size_t chunks = column_reader_chunks(reader);
+	char* data[COLUMN_MAX] = {NULL,};
+	char buf[INET6_ADDRSTRLEN];
+	int ret = 0;
+
+	for ( size_t i = 0; i < num_selected; i++ ){
+		printf("%s%s", i > 0 ? "\t" : "", column_name(selected[i]));
+	}
+	printf("\n");
+
+	for ( size_t chunk = 0; chunk < chunks && ret == 0; chunk++ ){
+		const size_t rows = column_reader_chunk_rows(reader, chunk);
+		for ( size_t i = 0; i < num_selected; i++ ){
+			free(data[i]);
+			data[i] = malloc(rows * column_width(selected[i]));
+			if ( (ret=column_reader_read(reader, chunk, selected[i], data[i])) != 0 ){
+				fprintf(stderr, "%s: failed to read `%s': %s\n", program_name, filename, caputils_error_string(ret));
+				break;
+			}
+		}
+
+		for ( size_t row = 0; row < rows && ret == 0; row++ ){
+			for ( size_t i = 0; i < num_selected; i++ ){
+				const char* value = data[i] + row * column_width(selected[i]);
+				printf("%s%s", i > 0 ? "\t" : "", format_value(selected[i], value, buf, sizeof(buf)));
+			}
+			printf("\n");
+		}
+	}
+
+	for ( size_t i = 0; i < num_selected; i++ ){
+		free(data[i]);
+	}
+	return ret;
+}
+
+static int show(const char* filename, int stats){
+	column_reader_t reader;
+	int ret;
+
+	if ( (ret=column_reader_open(&reader, filename)) != 0 ){
+		fprintf(stderr, "%s: failed to open `%s': %s\n", program_name, filename, caputils_error_string(ret));
+		return 1;
+	}
+
+	if ( num_selected == 0 ){
+		for ( unsigned int i = 0; i < COLUMN_MAX; i++ ){
+			selected[num_selected++] = i;
+		}
+	}
+
+	ret = stats ? show_stats(reader) : show_rows(reader, filename);
+	column_reader_close(reader);
+	return ret != 0;
+}
+
+static void handle_sigint(int signum){
+	if ( keep_running == 0 ){
+		fprintf(stderr, "\rGot SIGINT again, terminating.\n");
+		abort();
+	}
+	fprintf(stderr, "\rAborting export.\n");
+	keep_running = 0;
+}
+
+int main(int argc, char **argv){
+	/* extract program name from path. e.g. /path/to/MArCd -> MArCd */
+	const char* separator = strrchr(argv[0], '/');
+	if ( separator ){
+		program_name = separator + 1;
+	} else {
+		program_name = argv[0];
+	}
+
+	struct filter filter;
+	if ( filter_from_argv(&argc, argv, &filter) != 0 ){
+		return 0; /* error already shown */
+	}
+
+	const char* output = NULL;
+	const char* show_filename = NULL;
+	int stats = 0;
+	int op;
+	int option_index;
+	while ( (op = getopt_long(argc, argv, shortopts, longopts, &option_index)) != -1 ){
+		switch (op){
+		case 0:   /* long opt */
+			break;
+
+		case 'o': /* --output */
+			output = optarg;
+			break;
+
+		case 'i': /* --iface */
+			iface = optarg;
+			break;
+
+		case 'p': /* --packets */
+			max_packets = atoi(optarg);
+			break;
+
+		case 'r': /* --rows */
+			chunk_rows = atoi(optarg);
+			break;
+
+		case 'u': /* --uncompressed */
+			flags &= ~COLUMN_COMPRESS;
+			break;
+
+		case 'c': /* --columns */
+			if ( !parse_columns(optarg) ){
+				return 1;
+			}
+			break;
+
+		case 's': /* --show */
+			show_filename = optarg;
+			break;
+
+		case 'S': /* --stats */
+			stats = 1;
+			break;
+
+		case 'q': /* --quiet */
+			quiet = 1;
+			break;
+
+		case 'h': /* --help */
+			show_usage();
+			return 0;
+
+		default:
+			fprintf(stderr, "%s: see --help for usage\n", program_name);
+			return 1;
+		}
+	}
+
+	if ( show_filename ){
+		filter_close(&filter);
+		return show(show_filename, stats);
+	}
+
+	if ( !output ){
+		fprintf(stderr, "%s: no output filename given (see --help).\n", program_name);
+		return 1;
+	}
+
+	column_writer_t writer;
+	int ret;
+	if ( (ret=column_writer_open(&writer, output, chunk_rows, flags)) != 0 ){
+		fprintf(stderr, "%s: failed to create `%s': %s\n", program_name, output, strerror(ret));
+		return 1;
+	}
+
+	struct stream* stream;
+	if ( (ret=stream_from_getopt(&stream, argv, optind, argc, iface, "-", program_name, 0)) != 0 ) {
+		column_writer_close(writer);
+		return ret; /* Error already shown */
+	}
+	const stream_stat_t* stat = stream_get_stat(stream);
+
+	if ( !quiet ){
+		stream_print_info(stream, stderr);
+	}
+
+	/* handle C-c */
+	signal(SIGINT, handle_sigint);
+
+	int status = 0;
+	while ( keep_running ){
+		struct timeval tv = timeout;
+		cap_head* cp;
+		ret = stream_read(stream, &cp, &filter, &tv);
+		if ( ret == EAGAIN ){
+			continue;
+		} else if ( ret != 0 ){
+			break;
+		}
+
+		if ( (ret=column_writer_add(writer, cp)) != 0 ){
+			fprintf(stderr, "%s: failed to write `%s': %s\n", program_name, output, strerror(ret));
+			status = 1;
+			break;
+		}
+
+		if ( max_packets > 0 && stat->matched >= max_packets ){
+			break;
+		}
+	}
+
+	/* -1 is EOF and EINTR is implied by C-c */
+	if ( status == 0 && ret > 0 && ret != EINTR ){
+		fprintf(stderr, "%s: stream_read() returned 0x%08X: %s\n", program_name, ret, caputils_error_string(ret));
+		status = 1;
+	}
+
+	const uint64_t rows = column_writer_rows(writer);
+	if ( (ret=column_writer_close(writer)) != 0 ){
+		fprintf(stderr, "%s: failed to write `%s': %s\n", program_name, output, strerror(ret));
+		status = 1;
+	}
+
+	stream_close(stream);
+	filter_close(&filter);
+
+	if ( !quiet ){
+		fprintf(stderr, "%s: %"PRIu64" packets exported.\n", program_name, rows);
+	}
+	return status;
+}
@@ -26,6 +26,8 @@
 #include <caputils/capture.h>
 #include <caputils/utils.h>
 #include <caputils/version.h>
+#include <caputils/parallel.h>
+#include "demux.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -43,19 +45,25 @@ static const char* program_name = NULL;
 static const char* dst_filename = NULL;
 static const char* src_filename = NULL;
 static const char* rej_filename = NULL;
+static const char* demux_filename = NULL;
 static int keep_running = 1;
 static int invert = 0;
 static int quiet = 0;
+static int count_only = 0;
+static unsigned int threads = 1;
 static unsigned int max_read = 0;
 static unsigned int max_matched = 0;
 
-static const char* shortopts = "p:m:i:o:r:vqh";
+static const char* shortopts = "p:m:i:o:r:d:cj:vqh";
 static struct option longopts[] = {
 	{"packets", required_argument, 0, 'p'},
 	{"matched", required_argument, 0, 'm'},
 	{"input",   required_argument, 0, 'i'},
 	{"output",  required_argument, 0, 'o'},
 	{"rejects", required_argument, 0, 'r'},
+	{"demux",   required_argument, 0, 'd'},
+	{"count",   no_argument,       0, 'c'},
+	{"jobs",    required_argument, 0, 'j'},
 	{"invert",  no_argument,       0, 'v'},
 	{"quiet",   no_argument,       0, 'q'},
 	{"help",    no_argument,       0, 'h'},
@@ -69,8 +77,15 @@ static void show_usage(){
 	       "  -p, --packets=N             Stop after N read packets.\n"
 	       "  -m, --matched=N             Stop after N matched packets.\n"
 	       "  -i, --input=FILE            read from FILE [default stdin].\n"
-	       "  -o, --output=FILE           write to FILE [default stdout].\n"
+	       "  -o, --output=FILE           write to FILE [default stdout]. Stream addresses\n"
+	       "                              such as shm://NAME is also accepted for -i/-o/-r.\n"
 	       "  -r, --rejects=FILE          write packets not matching to FILE.\n"
+	       "  -d, --demux=FILE            write matching packets to multiple outputs\n"
+	       "                              using the rules in FILE (see capfilter(1)),\n"
+	       "                              packets matching no rule is written to --output\n"
+	       "                              (discarded by default).\n"
+	       "  -c, --count                 only count matching packets (printed on stdout).\n"
+	       "  -j, --jobs=N                count using N threads (0 for one per CPU, requires --count).\n"
 	       "  -v, --invert                invert filter.\n"
 	       "  -q, --quiet                 suppress output.\n"
 	       "  -h, --help                  help (this text).\n"
@@ -78,6 +93,76 @@ static void show_usage(){
 	filter_from_argv_usage();
 }
 
+/**
+ * Plain filenames is used as-is (even if they look like an ethernet address)
+ * but addresses with a scheme (e.g. shm://name) is parsed.
+ */
+static void set_address(stream_addr_t* addr, const char* str){
+	if ( strstr(str, "://") ){
+		stream_addr_aton(addr, str, STREAM_ADDR_GUESS, 0);
+	} else {
+		stream_addr_str(addr, str, 0);
+	}
+}
+
+struct counter {
+	uint64_t read;
+	uint64_t matched;
+};
+
+static int count_map(void* state, const struct cap_header* cp, int match, void* user){
+	struct counter* counter = (struct counter*)state;
+	counter->read++;
+	counter->matched += invert ? !match : !!match;
+	return 0;
+}
+
+static void count_reduce(void* state, size_t index, void* user){
+	const struct counter* counter = (const struct counter*)state;
+	struct counter* total = (struct counter*)user;
+	total->read += counter->read;
+	total->matched += counter->matched;
+}
+
+static void format_comment(char* dst, size_t size, const char* kind, uint64_t sample_rate){
+	if ( sample_rate > 1 ){
+		snprintf(dst, size, "capfilter%s %s stream (sample-rate=%"PRIu64")", VERSION, kind, sample_rate);
+	} else {
+		snprintf(dst, size, "capfilter%s %s stream", VERSION, kind);
+	}
+}
+
+/**
+ * Count matching packets using a pool of threads.
+ */
+static int count_parallel(const struct filter* filter){
+	struct counter total = {0, 0};
+	const struct caputils_parallel job = {
+		.state_size = sizeof(struct counter),
+		.init = NULL,
+		.map = count_map,
+		.reduce = count_reduce,
+		.cleanup = NULL,
+		.user = &total,
+		.filter = filter,
+		.chunk_size = 0,
+	};
+
+	int ret;
+	if ( (ret=caputils_parallel_foreach(&src_filename, 1, threads, &job)) != 0 ){
+		fprintf(stderr, "%s: failed to process `%s': %s\n", program_name, src_filename, caputils_error_string(ret));
+		return 1;
+	}
+
+	if ( !quiet ){
+		fprintf(stderr, "%s: There was a total of %'"PRIu64" packets read.\n", program_name, total.read);
+		fprintf(stderr, "%s: There was a total of %'"PRIu64" packets matched.\n", program_name, total.matched);
+	}
+	printf("%"PRIu64"\n", total.matched);
+
+	return 0;
+}
+
 static void handle_sigint(int signum){
 	if ( keep_running ){
 		fprintf(stderr, "\r%s: got SIGINT, terminating.\n", program_name);
@@ -127,6 +212,18 @@ int main(int argc, char* argv[]){
 			rej_filename = optarg;
 			break;
 
+		case 'd': /* --demux */
+			demux_filename = optarg;
+			break;
+
+		case 'c': /* --count */
+			count_only = 1;
+			break;
+
+		case 'j': /* --jobs */
+			threads = atoi(optarg);
+			break;
+
 		case 'v': /* --invert */
 			invert = 1;
 			break;
@@ -155,11 +252,29 @@ int main(int argc, char* argv[]){
 		}
 	}
 
+	if ( threads != 1 && !count_only ){
+		fprintf(stderr, "%s: --jobs can only be used together with --count.\n", program_name);
+		exit(1);
+	}
+	if ( threads != 1 && (max_read > 0 || max_matched > 0) ){
+		fprintf(stderr, "%s: --jobs cannot be combined with --packets or --matched.\n", program_name);
+		exit(1);
+	}
+	if ( threads != 1 && !caputils_parallel_filter_supported(&filter) ){
+		fprintf(stderr, "%s: --jobs cannot be used with sampling, frame numbers or max interarrival-time (depends on packet order), counting using a single thread.\n", program_name);
+		threads = 1;
+	}
+	if ( count_only && (dst_filename || rej_filename || demux_filename) ){
+		fprintf(stderr, "%s: --count cannot be combined with an output, rejects or demux file.\n", program_name);
+		exit(1);
+	}
+
 	int ret;
 	stream_addr_t addr = STREAM_ADDR_INITIALIZER;
 	stream_t src = NULL;
 	stream_t dst = NULL;
 	stream_t rej = NULL;
+	struct demux* demux = NULL;
 
 	/* ensure not reading/writing capfiles from terminal */
 	if ( src_filename == NULL && isatty(STDIN_FILENO) ){
@@ -167,34 +282,59 @@ int main(int argc, char* argv[]){
 		fprintf(stderr, "%s: Either specify another destination with --input, use redirection or pipe from another process.\n", program_name);
 		exit(1);
 	}
-	if ( dst_filename == NULL && isatty(STDOUT_FILENO) ){
+	if ( !count_only && !demux_filename && dst_filename == NULL && isatty(STDOUT_FILENO) ){
 		fprintf(stderr, "%s: Cannot output to stdout when it is connected to a terminal.\n", program_name);
 		fprintf(stderr, "%s: Either specify another destination with --output, use redirection or pipe to another process.\n", program_name);
 		exit(1);
 	}
 
-	/* defaults */
+	/* defaults (with --demux the output only holds packets matching no rule) */
 	src_filename = src_filename ? src_filename : "/dev/stdin";
-	dst_filename = dst_filename ? dst_filename : "/dev/stdout";
+	if ( !demux_filename ){
+		dst_filename = dst_filename ? dst_filename : "/dev/stdout";
+	}
+
+	if ( threads != 1 ){
+		const int status = count_parallel(&filter);
+		filter_close(&filter);
+		return status;
+	}
 
 	/* open source */
-	stream_addr_str(&addr, src_filename, 0);
+	set_address(&addr, src_filename);
 	if ( (ret=stream_open(&src, &addr, NULL, 0)) != 0 ){
 		fprintf(stderr, "%s: failed to open input `%s': %s\n", program_name, src_filename, caputils_error_string(ret));
 		return 1;
 	}
 
+	/* record the sampling rate so counts can be scaled back (rejects is not a
+	 * sample, only the rate of the input applies) */
+	const uint64_t src_rate = stream_get_sample_rate(src);
+	const uint64_t dst_rate = src_rate * filter_sample_rate(&filter);
+	char dst_comment[128];
+	char rej_comment[128];
+	format_comment(dst_comment, sizeof(dst_comment), "filtered", dst_rate);
+	format_comment(rej_comment, sizeof(rej_comment), "filtered", src_rate);
+
+	/* open demux outputs */
+	char demux_comment[128];
+	format_comment(demux_comment, sizeof(demux_comment), "demultiplexed", dst_rate);
+	if ( demux_filename && demux_open(&demux, demux_filename, demux_comment, program_name) != 0 ){
+		stream_close(src);
+		return 1; /* errors already displayed */
+	}
+
 	/* open destination */
-	stream_addr_str(&addr, dst_filename, 0);
-	if ( (ret=stream_create(&dst, &addr, NULL, "CONV", "capfilter" VERSION " filtered stream")) != 0 ){
+	if ( dst_filename ) set_address(&addr, dst_filename);
+	if ( !count_only && dst_filename && (ret=stream_create(&dst, &addr, NULL, "CONV", dst_comment)) != 0 ){
 		fprintf(stderr, "%s: failed to open output `%s': %s\n", program_name, dst_filename, caputils_error_string(ret));
 		return 1;
 	}
 
 	/* open rejects */
 	if ( rej_filename ){
-		stream_addr_str(&addr, rej_filename, 0);
-		if ( (ret=stream_create(&rej, &addr, NULL, "CONV", "capfilter" VERSION " filtered stream")) != 0 ){
+		set_address(&addr, rej_filename);
+		if ( (ret=stream_create(&rej, &addr, NULL, "CONV", rej_comment)) != 0 ){
 			fprintf(stderr, "%s: failed to open rejects `%s': %s\n", program_name, rej_filename, caputils_error_string(ret));
 			return 1;
 		}
@@ -236,6 +376,18 @@ int main(int argc, char* argv[]){
 			cp->caplen = min(filter.caplen, cp->caplen);
 		}
 
+		/* write to all outputs with a matching rule, the regular output gets the remaining */
+		if ( demux && post_match ){
+			int demuxed;
+			if ( (ret=demux_write(demux, cp, &demuxed)) != 0 ){
+				fprintf(stderr, "%s: demux_write() returned %d: %s\n", program_name, ret, caputils_error_string(ret));
+				keep_running = 0;
+			}
+			if ( demuxed ){
+				target = NULL;
+			}
+		}
+
 		/* copy packet */
 		if ( target && (ret=stream_copy(target, cp)) != 0 ){
 			fprintf(stderr, "%s: stream_copy() returned %d: %s\n", program_name, ret, caputils_error_string(ret));
@@ -251,12 +403,17 @@ int main(int argc, char* argv[]){
 	if ( !quiet ){
 		fprintf(stderr, "%s: There was a total of %'"PRIu64" packets read.\n", program_name, stats->read);
 		fprintf(stderr, "%s: There was a total of %'"PRIu64" packets matched.\n", program_name, matched);
+		if ( demux ) demux_print(demux, stderr);
+	}
+	if ( count_only ){
+		printf("%"PRIu64"\n", matched);
 	}
 
 	filter_close(&filter);
 	stream_close(src);
 	stream_close(dst);
 	stream_close(rej);
+	demux_close(demux);
 	stream_addr_reset(&addr);
 
 	if ( ret != 0 && ret != -1 ){
@@ -25,7 +25,9 @@
 
 #include "caputils/caputils.h"
 #include "caputils/marker.h"
+#include "caputils/parallel.h"
 #include "src/slist.h"
+#include <stdlib.h>
 #include <unistd.h>
 #include <getopt.h>
 #include <string.h>
@@ -50,15 +52,20 @@ struct stats {
 	struct count transport[UINT16_MAX];    /* packet summary for transport layer */
 };
 
-static struct stats global;
-static stream_t st = NULL;
-static struct count ipproto[UINT8_MAX]; /* protocol is defined as 1 octet */
-static struct simple_list mpid = {NULL, NULL, 0, 0};
-static struct simple_list CI = {NULL, NULL, 0, 0};
-static struct simple_list location = {NULL, NULL, 0, 0};
+/* all information gathered about a stream (or a part of it) */
+struct info {
+	struct stats global;
+	struct count ipproto[UINT8_MAX];       /* protocol is defined as 1 octet */
+	struct simple_list mpid;
+	struct simple_list CI;
+	struct simple_list location;
+};
+
+static unsigned int threads = 1;
 
-static const char* shortopts = "h";
+static const char* shortopts = "j:h";
 static struct option longopts[] = {
+	{"jobs",    required_argument, 0, 'j'},
 	{"help",    no_argument, 0, 'h'},
 	{0, 0, 0, 0}, /* sentinel */
 };
@@ -68,6 +75,7 @@ static void show_usage(void){
 	printf("(c) 2011 David Sveningsson\n\n");
 	printf("Open a capstream and show information about it.\n");
 	printf("Usage: capinfo [OPTIONS] FILENAME..\n\n");
+	printf("  -j, --jobs=N               Process files using N threads (0 for one per CPU).\n");
 	printf("  -h, --help                 Show this help.\n");
 	printf("\n");
 	printf("Hint: use `capfilter | capinfo` need to run capinfo on a filtered trace.\n");
@@ -97,7 +105,7 @@ static void reset_stats(struct stats* stat){
 	}
 }
 
-static void store_stats(struct stats* stat, struct cap_header* cp){
+static void store_stats(struct stats* stat, const struct cap_header* cp){
 	stat->packets++;
 
 	if ( stat->packets == 1 ){
@@ -109,18 +117,44 @@ static void store_stats(struct stats* stat, struct cap_header* cp){
 	stat->byte_max = max(stat->byte_max, cp->len);
 }
 
-static void reset(){
-	reset_stats(&global);
+static void merge_stats(struct stats* dst, const struct stats* src){
+	if ( src->packets == 0 ) return;
+
+	/* parts is merged in order so first is kept and last is overwritten */
+	if ( dst->packets == 0 ){
+		dst->first = src->first;
+	}
+	dst->last = src->last;
+	dst->packets += src->packets;
+	dst->bytes += src->bytes;
+	dst->byte_min = min(dst->byte_min, src->byte_min);
+	dst->byte_max = max(dst->byte_max, src->byte_max);
+	if ( !dst->marker_present ){
+		dst->marker_present = src->marker_present;
+	}
+
+	for ( unsigned int i = 0; i < UINT16_MAX; i++ ){
+		dst->transport[i].packets += src->transport[i].packets;
+		dst->transport[i].bytes += src->transport[i].bytes;
+	}
+}
+
+static void info_init(struct info* info, size_t initial_size){
+	reset_stats(&info->global);
 	for ( int i = 0; i < UINT8_MAX; i++ ){
-		ipproto[i].packets = 0;
-		ipproto[i].bytes = 0;
+		info->ipproto[i].packets = 0;
+		info->ipproto[i].bytes = 0;
 	}
 
-	/* reset storage (must be done for each iteration so the results is
-	 * only for the current file.) */
-	slist_clear(&mpid);
-	slist_clear(&CI);
-	slist_clear(&location);
+	slist_init(&info->mpid, sizeof(char*), sizeof(struct stats), initial_size);
+	slist_init(&info->CI, sizeof(char*), sizeof(struct stats), initial_size);
+	slist_init(&info->location, sizeof(char*), sizeof(struct stats), initial_size);
+}
+
+static void info_free(struct info* info){
+	slist_free(&info->mpid);
+	slist_free(&info->CI);
+	slist_free(&info->location);
 }
 
 static void format_bytes(char* dst, size_t size, uint64_t bytes){
@@ -159,7 +193,7 @@ static void format_rate(char* dst, size_t size, uint64_t bytes, uint64_t seconds
 
 static void format_seconds(char* dst, size_t size, timepico first, timepico last){
 	const timepico time_diff = timepico_sub(last, first);
-	uint64_t hseconds = time_diff.tv_sec * 10 + time_diff.tv_psec / (PICODIVIDER / 10);
+	uint64_t hseconds = time_diff.tv_sec * 10 + time_diff.tv_psec / (PICOSECONDS_PER_SECOND / 10);
 
 	int s = hseconds % 600;
 	hseconds /= 600;
@@ -177,14 +211,14 @@ static const char* array_join(char* dst, const char* src[], size_t n, const char
 	return dst;
 }
 
-static const char* get_mampid_list(const char* delimiter){
+static const char* get_mampid_list(const struct info* info, const char* delimiter){
 	static char buffer[2048];
-	return array_join(buffer, (const char**)mpid.key, mpid.size, delimiter);
+	return array_join(buffer, (const char**)info->mpid.key, info->mpid.size, delimiter);
 }
 
-static const char* get_CI_list(const char* delimiter){
+static const char* get_CI_list(const struct info* info, const char* delimiter){
 	static char buffer[2048];
-	return array_join(buffer, (const char**)CI.key, CI.size, delimiter);
+	return array_join(buffer, (const char**)info->CI.key, info->CI.size, delimiter);
 }
 
 static const char* get_comment(stream_t st){
@@ -192,72 +226,81 @@ static const char* get_comment(stream_t st){
 	return comment ? comment : "(unset)";
 }
 
-static void print_overview(){
+static void print_overview(const struct info* info, const char* comment, uint64_t sample_rate){
+	const struct stats* global = &info->global;
 	char byte_str[128];
 	char rate_str[128];
 	char first_str[128];
 	char last_str[128];
 	char sec_str[128];
 	char marker_str[128] = "no";
-	if ( global.marker_present ){
-		sprintf(marker_str, "present on port %d", global.marker_present);
-	}
-	const timepico time_diff = timepico_sub(global.last, global.first);
-	uint64_t hseconds = time_diff.tv_sec * 10 + time_diff.tv_psec / (PICODIVIDER / 10);
-	timepico_to_string_r(&global.first, first_str, 128, "%F %T");
-	timepico_to_string_r(&global.last,  last_str,  128, "%F %T");
-	format_bytes(byte_str, 128, global.bytes);
-	format_rate(rate_str, 128, global.bytes, hseconds/10);
-	format_seconds(sec_str, 128, global.first, global.last);
-	const int local_byte_min = global.packets > 0 ? global.byte_min : 0;
-	const int local_byte_max = global.packets > 0 ? global.byte_max : 0;
-	const int local_byte_avg = global.packets > 0 ? global.bytes / global.packets : 0;
+	if ( global->marker_present ){
+		sprintf(marker_str, "present on port %d", global->marker_present);
+	}
+	const timepico time_diff = timepico_sub(global->last, global->first);
+	uint64_t hseconds = time_diff.tv_sec * 10 + time_diff.tv_psec / (PICOSECONDS_PER_SECOND / 10);
+	timepico_to_string_r(&global->first, first_str, 128, "%F %T");
+	timepico_to_string_r(&global->last,  last_str,  128, "%F %T");
+	format_bytes(byte_str, 128, global->bytes);
+	format_rate(rate_str, 128, global->bytes, hseconds/10);
+	format_seconds(sec_str, 128, global->first, global->last);
+	const int local_byte_min = global->packets > 0 ? global->byte_min : 0;
+	const int local_byte_max = global->packets > 0 ? global->byte_max : 0;
+	const int local_byte_avg = global->packets > 0 ? global->bytes / global->packets : 0;
 
 	printf("Overview\n"
 	       "--------\n");
-	printf("       CI: %s\n", get_CI_list(", "));
-	printf("     mpid: %s\n", get_mampid_list(", "));
-	printf("  comment: %s\n", get_comment(st));
+	printf("       CI: %s\n", get_CI_list(info, ", "));
+	printf("     mpid: %s\n", get_mampid_list(info, ", "));
+	printf("  comment: %s\n", comment);
 	printf(" captured: %s to %s\n", first_str, last_str);
 	printf("  markers: %s\n", marker_str);
 	printf(" duration: %s (%.1f seconds)\n", sec_str, (float)hseconds/10);
-	printf("  packets: %ld\n", global.packets);
+	printf("  packets: %ld\n", global->packets);
 	printf("    bytes: %s\n", byte_str);
+	if ( sample_rate > 1 ){
+		char est_str[128];
+		format_bytes(est_str, 128, global->bytes * sample_rate);
+		printf("  sampled: 1 in %"PRIu64" (estimated %"PRIu64" packets, %s)\n", sample_rate, global->packets * sample_rate, est_str);
+	}
 	printf(" pkt size: min/avg/max = %d/%d/%d\n", local_byte_min, local_byte_avg, local_byte_max);
 	printf(" avg rate: %s\n", rate_str);
 	printf("\n");
 
 	printf("Locations\n"
 	       "---------\n");
-	for ( size_t i = 0; i < location.size; i++ ){
-		const struct stats* s = (const struct stats*)slist_get(&location, i);
+	for ( size_t i = 0; i < info->location.size; i++ ){
+		const struct stats* s = (const struct stats*)slist_get(&info->location, i);
 		const timepico time_diff = timepico_sub(s->last, s->first);
-		uint64_t hseconds = time_diff.tv_sec * 10 + time_diff.tv_psec / (PICODIVIDER / 10);
-		format_seconds(sec_str, 128, global.first, global.last);
-		printf("  location:%s %.1f seconds, %ld packets, %ld bytes\n", (const char *)location.key[i], (float)hseconds/10, s->packets, s->bytes);
+		uint64_t hseconds = time_diff.tv_sec * 10 + time_diff.tv_psec / (PICOSECONDS_PER_SECOND / 10);
+		format_seconds(sec_str, 128, global->first, global->last);
+		printf("  location:%s %.1f seconds, %ld packets, %ld bytes\n", (const char *)info->location.key[i], (float)hseconds/10, s->packets, s->bytes);
 	}
 	printf("\n");
 }
 
-static void print_distribution(){
+static void print_distribution(const struct info* info){
+	const struct stats* global = &info->global;
+	const struct count* ipproto = info->ipproto;
+
 	printf("Network protocols\n"
 	       "-----------------\n");
 
 	for ( unsigned int i = 0; i < UINT16_MAX; i++ ){
-		if ( global.transport[i].packets == 0 ) continue;
+		if ( global->transport[i].packets == 0 ) continue;
 		const struct ethertype* ethertype = ethertype_by_number(i);
 		if ( ethertype ){
 			printf("%9s: ", ethertype->name);
 		} else {
 			printf("   0x%04X: ", i);
 		}
-		printf("%"PRIu64" packets, %"PRIu64" bytes\n", global.transport[i].packets, global.transport[i].bytes);
+		printf("%"PRIu64" packets, %"PRIu64" bytes\n", global->transport[i].packets, global->transport[i].bytes);
 	}
 
 	printf("\nTransport protocols\n"
 	       "-------------------\n");
 
-	if ( global.transport[ETHERTYPE_IP].packets > 0 || global.transport[ETHERTYPE_IPV6].packets > 0 ){
+	if ( global->transport[ETHERTYPE_IP].packets > 0 || global->transport[ETHERTYPE_IPV6].packets > 0 ){
 		struct count ipother = {0, 0};
 		for ( int i = 0; i < UINT8_MAX; i++ ){
 			if ( ipproto[i].packets == 0 ){
@@ -282,11 +325,10 @@ static void print_distribution(){
 
 /**
  * Get location for this packet.
- * Returns pointer to internal buffer that will be overwritten by successive calls.
+ * Returns pointer to buffer (at least 17 bytes).
  */
-static const char* get_location(struct cap_header* cp){
-  static char buffer[17];
-  snprintf(buffer, sizeof(buffer), "%.8s:%.8s", cp->mampid, cp->nic);
+static const char* get_location(const struct cap_header* cp, char* buffer){
+  snprintf(buffer, 17, "%.8s:%.8s", cp->mampid, cp->nic);
   return buffer;
 }
 
@@ -310,26 +352,34 @@ static struct stats* store_unique(struct simple_list* slist, const char* key, si
 	return stats;
 }
 
-static void store_mampid(struct cap_header* cp){
-	struct stats* stats = store_unique(&mpid, cp->mampid, 8);
+static void store_mampid(struct info* info, const struct cap_header* cp){
+	struct stats* stats = store_unique(&info->mpid, cp->mampid, 8);
 	store_stats(stats, cp);
 }
 
-static void store_CI(struct cap_header* cp){
-	struct stats* stats = store_unique(&CI, cp->nic, CAPHEAD_NICLEN);
+static void store_CI(struct info* info, const struct cap_header* cp){
+	struct stats* stats = store_unique(&info->CI, cp->nic, CAPHEAD_NICLEN);
 	store_stats(stats, cp);
 }
 
-static void store_location(struct cap_header* cp){
-	struct stats* stats = store_unique(&location, get_location(cp), 17);
+static void store_location(struct info* info, const struct cap_header* cp){
+	char buffer[17];
+	struct stats* stats = store_unique(&info->location, get_location(cp, buffer), 17);
 	store_stats(stats, cp);
 }
 
-static void parse_ethernetII(const struct cap_header* cp){
+static void merge_slist(struct simple_list* dst, const struct simple_list* src, size_t maxlen){
+	for ( size_t i = 0; i < src->size; i++ ){
+		struct stats* stats = store_unique(dst, (const char*)src->key[i], maxlen);
+		merge_stats(stats, (const struct stats*)slist_get(src, i));
+	}
+}
+
+static void parse_ethernetII(struct info* info, const struct cap_header* cp){
 	const struct ethhdr* eth = cp->ethhdr;
 	const uint16_t h_proto = ntohs(eth->h_proto);
-	global.transport[h_proto].packets++;
-	global.transport[h_proto].bytes += cp->len;
+	info->global.transport[h_proto].packets++;
+	info->global.transport[h_proto].bytes += cp->len;
 
 	const struct iphdr* ip = NULL;
 	switch ( h_proto ){
@@ -343,8 +393,8 @@ static void parse_ethernetII(const struct cap_header* cp){
 			ip = (const struct iphdr*)(cp->payload + sizeof(struct ethhdr));
 		}
 
-		ipproto[ip->protocol].packets++;
-		ipproto[ip->protocol].bytes += cp->len;
+		info->ipproto[ip->protocol].packets++;
+		info->ipproto[ip->protocol].bytes += cp->len;
 		break;
 
 	case ETHERTYPE_IPV6:
@@ -357,9 +407,54 @@ static void parse_llc(const struct cap_header* cp){
 
 }
 
-static int show_info(const char* filename){
+static void store_packet(struct info* info, const struct cap_header* cp){
+	if ( !info->global.marker_present ){
+		info->global.marker_present = is_marker(cp, NULL, 0);
+	}
+
+	store_stats(&info->global, cp);
+	store_mampid(info, cp);
+	store_CI(info, cp);
+	store_location(info, cp);
+
+	/* this is not a fool-proof test since ethertypes can be < 0x05dc and
+	 * jumboframes exist. 0x05dc refers to the MTU. */
+	const int have_llc = ntohs(cp->ethhdr->h_proto) <= 0x05DC;
+	if ( have_llc ){
+		parse_llc(cp);
+		return;
+	}
+
+	parse_ethernetII(info, cp);
+}
+
+static void merge_info(struct info* dst, const struct info* src){
+	merge_stats(&dst->global, &src->global);
+	for ( int i = 0; i < UINT8_MAX; i++ ){
+		dst->ipproto[i].packets += src->ipproto[i].packets;
+		dst->ipproto[i].bytes += src->ipproto[i].bytes;
+	}
+
+	merge_slist(&dst->mpid, &src->mpid, 8);
+	merge_slist(&dst->CI, &src->CI, CAPHEAD_NICLEN);
+	merge_slist(&dst->location, &src->location, 17);
+}
+
+static void print_info(const char* filename, stream_t st, const struct info* info){
+	/* write header */
+	struct file_version version;
+	stream_get_version(st, &version);
+	int n = printf("%s: caputils %d.%d stream\n", filename, version.major, version.minor);
+	while ( n-- ){ putchar('='); } puts("\n");
+
+	print_overview(info, get_comment(st), stream_get_sample_rate(st));
+	print_distribution(info);
+}
+
+static int show_info(const char* filename, struct info* info){
 	stream_addr_t addr = STREAM_ADDR_INITIALIZER;
 	stream_addr_str(&addr, filename, 0);
+	stream_t st;
 	long ret = 0;
 
 	if ( (ret=stream_open(&st, &addr, NULL, 0)) != 0 ){
@@ -369,38 +464,14 @@ static int show_info(const char* filename){
 
 	struct cap_header* cp;
 	while ( (ret=stream_read(st, &cp, NULL, NULL)) == 0 ){
-		if ( !global.marker_present ){
-			global.marker_present = is_marker(cp, NULL, 0);
-		}
-
-		store_stats(&global, cp);
-		store_mampid(cp);
-		store_CI(cp);
-		store_location(cp);
-
-		/* this is not a fool-proof test since ethertypes can be < 0x05dc and
-		 * jumboframes exist. 0x05dc refers to the MTU. */
-		const int have_llc = ntohs(cp->ethhdr->h_proto) <= 0x05DC;
-		if ( have_llc ){
-			parse_llc(cp);
-			continue;
-		}
-
-		parse_ethernetII(cp);
+		store_packet(info, cp);
 	}
 
 	if ( ret > 0 ){
 		fprintf(stderr, "stream_read() returned 0x%08lx: %s\n", ret, caputils_error_string(ret));
 	}
 
-	/* write header */
-	struct file_version version;
-	stream_get_version(st, &version);
-	int n = printf("%s: caputils %d.%d stream\n", filename, version.major, version.minor);
-	while ( n-- ){ putchar('='); } puts("\n");
-
-	print_overview();
-	print_distribution();
+	print_info(filename, st, info);
 
 	stream_close(st);
 	stream_addr_reset(&addr);
@@ -408,8 +479,83 @@ static int show_info(const char* filename){
 }
 
 static int process(const char* filename){
-	reset();
-	return show_info(filename);
+	struct info* info = malloc(sizeof(struct info));
+	info_init(info, 80);
+	const int ret = show_info(filename, info);
+	info_free(info);
+	free(info);
+	return ret;
+}
+
+/* parallel processing: each task gathers info for a part of a file which is
+ * merged into the result for the file */
+
+static void task_init(void* state, void* user){
+	info_init((struct info*)state, 8);
+}
+
+static int task_map(void* state, const struct cap_header* cp, int match, void* user){
+	store_packet((struct info*)state, cp);
+	return 0;
+}
+
+static void task_reduce(void* state, size_t index, void* user){
+	struct info* result = (struct info*)user;
+	merge_info(&result[index], (const struct info*)state);
+}
+
+static void task_cleanup(void* state, void* user){
+	info_free((struct info*)state);
+}
+
+static int process_parallel(char** filename, size_t num_files){
+	int status = 0;
+	struct info* result = malloc(sizeof(struct info) * num_files);
+	for ( size_t i = 0; i < num_files; i++ ){
+		info_init(&result[i], 80);
+	}
+
+	const struct caputils_parallel job = {
+		.state_size = sizeof(struct info),
+		.init = task_init,
+		.map = task_map,
+		.reduce = task_reduce,
+		.cleanup = task_cleanup,
+		.user = result,
+		.filter = NULL,
+		.chunk_size = 0,
+	};
+
+	int ret;
+	if ( (ret=caputils_parallel_foreach((const char* const*)filename, num_files, threads, &job)) != 0 ){
+		fprintf(stderr, "capinfo: %s\n", caputils_error_string(ret));
+		status = ret;
+	}
+
+	/* the streams is only opened to present the header, partial results (e.g.
+	 * truncated files) is presented as well just like when reading serially */
+	for ( size_t i = 0; i < num_files; i++ ){
+		stream_addr_t addr = STREAM_ADDR_INITIALIZER;
+		stream_addr_str(&addr, filename[i], 0);
+		stream_t st;
+		if ( (ret=stream_open(&st, &addr, NULL, 0)) != 0 ){
+			fprintf(stderr, "%s: %s\n", filename[i], caputils_error_string(ret));
+			status = ret;
+			continue;
+		}
+
+		if ( i > 0 ){
+			putchar('\n');
+		}
+		print_info(filename[i], st, &result[i]);
+		stream_close(st);
+	}
+
+	for ( size_t i = 0; i < num_files; i++ ){
+		info_free(&result[i]);
+	}
+	free(result);
+	return status;
 }
 
 int main(int argc, char* argv[]){
@@ -420,18 +566,20 @@ int main(int argc, char* argv[]){
 	/* parse arguments */
 	while ( (op=getopt_long(argc, argv, shortopts, longopts, &option_index)) != -1 ){
 		switch ( op ){
+		case 'j':
+			threads = atoi(optarg);
+			break;
+
 		case 'h':
 			show_usage();
 			return 0;
+
+		default:
+			fprintf(stderr, "see --help for usage\n");
+			return 1;
 		}
 	}
 
-	/* initial storage */
-	const size_t initial_size = 80;
-	slist_init(&mpid, sizeof(char*), sizeof(struct stats), initial_size);
-	slist_init(&CI, sizeof(char*), sizeof(struct stats), initial_size);
-	slist_init(&location, sizeof(char*), sizeof(struct stats), initial_size);
-
 	/* no positional arguments, try to process stdin */
 	if ( optind == argc ){
 		if ( isatty(STDIN_FILENO) ){
@@ -442,6 +590,10 @@ int main(int argc, char* argv[]){
 	}
 
 	/* visit all targets */
+	if ( threads != 1 && optind < argc ){
+		return process_parallel(&argv[optind], argc - optind) == 0 ? 0 : 1;
+	}
+
 	while ( optind < argc ){
 		status |= process(argv[optind++]);
 		if ( optind < argc ){
@@ -449,10 +601,5 @@ int main(int argc, char* argv[]){
 		}
 	}
 
-	/* release resources */
-	slist_free(&mpid);
-	slist_free(&CI);
-	slist_free(&location);
-
 	return status == 0 ? 0 : 1;
 }
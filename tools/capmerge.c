@@ -32,10 +32,12 @@ static const char* program_name;
 static FILE* sort = NULL;
 static int quiet = 0;
 
-static const char* shortopts = "o:c:sqh";
+static const char* shortopts = "o:c:i:t:sqh";
 static struct option longopts[] = {
 	{"output",     required_argument, 0, 'o'},
 	{"comment",    required_argument, 0, 'c'},
+	{"iface",      required_argument, 0, 'i'},
+	{"idle",       required_argument, 0, 't'},
 	{"sort",       no_argument,       0, 's'},
 	{"quiet",      no_argument,       0, 'q'},
 	{"help",       no_argument,       0, 'h'},
@@ -44,10 +46,13 @@ static struct option longopts[] = {
 
 static void show_usage(){
 	printf("capmerge-%s\n", caputils_version(NULL));
-	printf("usage: %s [OPTIONS..] -o OUTPUT FILES..\n"
+	printf("usage: %s [OPTIONS..] -o OUTPUT STREAM..\n"
 	       "\n"
 	       "  -o, --output=FILE    Write merged file to FILE.\n"
 	       "  -c, --comment=STRING Set stream comment.\n"
+	       "  -i, --iface=IFACE    Interface to use for ethernet input streams.\n"
+	       "  -t, --idle=MS        Do not wait for input streams which has been idle\n"
+	       "                       for MS milliseconds (default: wait for all inputs).\n"
 	       "  -s, --sort           Sort out-of-order packets based on timestamp.\n"
 	       "  -q, --quiet          Quiet output (no progressbar)\n"
 	       "  -h, --help           This text.\n",
@@ -60,6 +65,9 @@ static size_t min(size_t a, size_t b){
 
 int main(int argc, char* argv[]){
 	const char* comment = "capmerge-" VERSION " stream";
+	const char* iface = NULL;
+	struct timeval idle;
+	int use_idle = 0;
 	char* sort_buffer = NULL;
 	size_t sort_size = 0;
 	stream_addr_t output = STREAM_ADDR_INITIALIZER;
@@ -88,6 +96,19 @@ int main(int argc, char* argv[]){
 			comment = optarg;
 			break;
 
+		case 'i': /* --iface */
+			iface = optarg;
+			break;
+
+		case 't': /* --idle */
+			{
+				const long ms = atol(optarg);
+				idle.tv_sec = ms / 1000;
+				idle.tv_usec = (ms % 1000) * 1000;
+				use_idle = 1;
+			}
+			break;
+
 		case 's': /* --sort */
 			sort = open_memstream(&sort_buffer, &sort_size);
 			break;
@@ -128,65 +149,44 @@ int main(int argc, char* argv[]){
 
 	/* open input streams */
 	const size_t files = argc - optind;
+	if ( files == 0 ){
+		fprintf(stderr, "%s: no input streams specified.\n", program_name);
+		return 1;
+	}
+
 	stream_t st[files];
 	for ( int i = optind, n = 0; i < argc; i++, n++ ){
 		stream_addr_t addr = STREAM_ADDR_INITIALIZER;
-		stream_addr_str(&addr, argv[i], 0);
+		if ( (ret=stream_addr_aton(&addr, argv[i], STREAM_ADDR_GUESS, 0)) != 0 ){
+			fprintf(stderr, "%s: failed to parse stream address `%s'\n", program_name, argv[i]);
+			exit(1);
+		}
 
-		int ret;
-		if ( (ret=stream_open(&st[n], &addr, NULL, 0)) != 0 ){
+		if ( (ret=stream_open(&st[n], &addr, iface, 0)) != 0 ){
 			fprintf(stderr, "%s: when opening `%s':\n", program_name, argv[i]);
 			fprintf(stderr, "%s:   stream_open(..) returned %d: %s\n", program_name, ret, caputils_error_string(ret));
 			exit(1);
 		}
 	}
 
+	/* merge inputs into a single time-ordered stream */
+	stream_t src;
+	if ( (ret=stream_merge_open(&src, st, files, use_idle ? &idle : NULL)) != 0 ){
+		fprintf(stderr, "%s: stream_merge_open(..) returned %d: %s\n", program_name, ret, caputils_error_string(ret));
+		exit(1);
+	}
+
 	/* read packets */
-	unsigned int streams = files;
 	unsigned long packets = 0;
-	while ( streams > 0 ){
-		struct cap_header* pkt[streams];
-
-		/* take a peek at all open streams */
-		for ( unsigned int i = 0; i < streams; i++ ){
-			int ret;
-			switch ( (ret=stream_peek(st[i], &pkt[i], NULL)) ){
-			case 0:
-				break;
-
-			case EAGAIN:
-				pkt[i] = NULL;
-				break;
-
-			default:
-				pkt[i] = NULL;
-				stream_close(st[i]);
-				st[i] = st[streams-1];
-				streams--;
-				if ( ret != -1 ){
-					fprintf(stderr, "%s: stream_peek(..) returned %d: %s\n", program_name, ret, caputils_error_string(ret));
-				}
-			}
-		}
-
-		/* find newest packet */
-		int oldest = -1;
-		timepico cur = {-1, -1};
-		for ( unsigned int i = 0; i < streams; i++ ){
-			if ( pkt[i] && timecmp(&pkt[i]->ts, &cur) < 0 ){
-				oldest = i;
-				cur = pkt[i]->ts;
+	while ( 1 ){
+		struct cap_header* cp;
+		if ( (ret=stream_read(src, &cp, NULL, NULL)) != 0 ){
+			if ( ret != -1 ){
+				fprintf(stderr, "%s: stream_read(..) returned %d: %s\n", program_name, ret, caputils_error_string(ret));
 			}
+			break;
 		}
 
-		/* no packet was found */
-		if ( oldest < 0 ){
-			continue;
-		}
-
-		struct cap_header* cp;
-		stream_read(st[oldest], &cp, NULL, NULL);
-
 		packets++;
 		cp->caplen = min(cp->caplen, cp->len); /* truncate when caplen > len */
 		if ( (ret=stream_write(dst, cp, sizeof(struct cap_header) + cp->caplen)) != 0 ){
@@ -196,11 +196,8 @@ int main(int argc, char* argv[]){
 		}
 	}
 
-	for ( unsigned int i = 0; i < streams; i++ ){
-		stream_close(st[i]);
-	}
+	stream_close(src);
 	stream_close(dst);
-
 	
 	if ( sort ){
 		if ( !quiet ){
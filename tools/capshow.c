@@ -37,6 +37,8 @@
 #include <getopt.h>
 #include <errno.h>
 #include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
 
 static int keep_running = 1;
 static unsigned int flags = FORMAT_REL_TIMESTAMP;
@@ -45,6 +47,7 @@ static unsigned int max_matched_packets = 0;
 static const char* iface = NULL;
 static struct timeval timeout = {1,0};
 static const char* program_name = NULL;
+static unsigned int jobs = 1;
 
 void handle_sigint(int signum){
 	if ( keep_running == 0 ){
@@ -59,12 +62,13 @@ enum {
 	ARGUMENT_VERSION = 256,
 };
 
-static const char* shortopts = "p:c:i:t:dDar1234xHh";
+static const char* shortopts = "p:c:i:t:j:dDar1234xHh";
 static struct option longopts[]= {
 	{"packets",  required_argument, 0, 'p'},
 	{"count",    required_argument, 0, 'c'},
 	{"iface",    required_argument, 0, 'i'},
 	{"timeout",  required_argument, 0, 't'},
+	{"jobs",     required_argument, 0, 'j'},
 	{"calender", no_argument,       0, 'd'},
 	{"localtime",no_argument,       0, 'D'},
 	{"absolute", no_argument,       0, 'a'},
@@ -87,6 +91,7 @@ static void show_usage(void){
 	       "  -c, --count=N        Stop after N matched packets.\n"
 	       "                       If both -p and -c is used, what ever happens first will stop.\n"
 	       "  -t, --timeout=N      Wait for N ms while buffer fills [default: 1000ms].\n"
+	       "  -j, --jobs=N         Format packets using N threads [default: 1].\n"
 	       "      --version        Show program version and exit.\n"
 	       "  -h, --help           This text.\n"
 	       "\n"
@@ -109,6 +114,213 @@ static void show_version(void){
 	printf("%s-%s\n", program_name, caputils_version(NULL));
 }
 
+/**
+ * Parallel formatting (--jobs).
+ *
+ * The main thread reads packets, determines connection ids and packet numbers
+ * (which depends on all previous packets) and collects matched packets into
+ * batches. The workers format batches into private buffers and the main
+ * thread writes the buffers in the original order.
+ */
+enum {
+	BATCH_PACKETS = 256,
+};
+
+struct batch {
+	/* copies of the packets (stream_read only holds the packet until the next read) */
+	char* data;
+	size_t data_size;
+	size_t data_used;
+
+	size_t num_packets;
+	size_t offset[BATCH_PACKETS];
+	uint64_t pktcount[BATCH_PACKETS];
+	connection_id_t id[BATCH_PACKETS];
+	timepico ref;
+
+	/* formatted output, owned by the batch until written */
+	char* output;
+	size_t output_size;
+	int done;
+};
+
+struct pipeline {
+	pthread_mutex_t mutex;
+	pthread_cond_t work;                   /* a batch was submitted (or shutdown) */
+	pthread_cond_t done;                   /* a batch was formatted */
+	unsigned int flags;
+	int shutdown;
+
+	struct batch* batch;                   /* ring of batches */
+	unsigned int num_batches;
+	uint64_t submitted;                    /* batches handed to workers (the next is being filled) */
+	uint64_t taken;                        /* batches taken by a worker */
+	uint64_t written;                      /* batches written to output */
+
+	pthread_t* thread;
+	unsigned int num_threads;
+};
+
+static void* pipeline_worker(void* arg){
+	struct pipeline* pipeline = (struct pipeline*)arg;
+
+	/* each worker has its own state so the date cache is not shared */
+	struct format format;
+	format_setup(&format, pipeline->flags);
+	format.first = 0;
+
+	for (;;){
+		pthread_mutex_lock(&pipeline->mutex);
+		while ( !pipeline->shutdown && pipeline->taken == pipeline->submitted ){
+			pthread_cond_wait(&pipeline->work, &pipeline->mutex);
+		}
+		if ( pipeline->taken == pipeline->submitted ){
+			pthread_mutex_unlock(&pipeline->mutex);
+			break;
+		}
+		struct batch* batch = &pipeline->batch[pipeline->taken++ % pipeline->num_batches];
+		pthread_mutex_unlock(&pipeline->mutex);
+
+		FILE* fp = open_memstream(&batch->output, &batch->output_size);
+		format.ref = batch->ref;
+		for ( size_t i = 0; i < batch->num_packets; i++ ){
+			const struct cap_header* cp = (const struct cap_header*)(batch->data + batch->offset[i]);
+			format.pktcount = batch->pktcount[i] - 1;
+			format_pkg_id(fp, &format, cp, batch->id[i]);
+		}
+		fclose(fp);
+
+		pthread_mutex_lock(&pipeline->mutex);
+		batch->done = 1;
+		pthread_cond_broadcast(&pipeline->done);
+		pthread_mutex_unlock(&pipeline->mutex);
+	}
+
+	return NULL;
+}
+
+static int pipeline_init(struct pipeline* pipeline, unsigned int threads, unsigned int flags){
+	pthread_mutex_init(&pipeline->mutex, NULL);
+	pthread_cond_init(&pipeline->work, NULL);
+	pthread_cond_init(&pipeline->done, NULL);
+	pipeline->flags = flags;
+	pipeline->shutdown = 0;
+	pipeline->num_batches = 2 * threads + 1; /* while one batch is written and one filled each worker has one */
+	pipeline->batch = calloc(pipeline->num_batches, sizeof(struct batch));
+	pipeline->submitted = 0;
+	pipeline->taken = 0;
+	pipeline->written = 0;
+	pipeline->thread = calloc(threads, sizeof(pthread_t));
+	pipeline->num_threads = 0;
+
+	if ( !pipeline->batch || !pipeline->thread ){
+		return ENOMEM;
+	}
+
+	for ( unsigned int i = 0; i < threads; i++ ){
+		int ret;
+		if ( (ret=pthread_create(&pipeline->thread[i], NULL, pipeline_worker, pipeline)) != 0 ){
+			return ret;
+		}
+		pipeline->num_threads++;
+	}
+
+	return 0;
+}
+
+/**
+ * Write formatted batches in order.
+ * @param min Wait until at least this many batches (in total) is written.
+ */
+static void pipeline_write(struct pipeline* pipeline, uint64_t min){
+	while ( pipeline->written < pipeline->submitted ){
+		struct batch* batch = &pipeline->batch[pipeline->written % pipeline->num_batches];
+
+		pthread_mutex_lock(&pipeline->mutex);
+		while ( !batch->done && pipeline->written < min ){
+			pthread_cond_wait(&pipeline->done, &pipeline->mutex);
+		}
+		const int done = batch->done;
+		pthread_mutex_unlock(&pipeline->mutex);
+		if ( !done ) break;
+
+		fwrite(batch->output, 1, batch->output_size, stdout);
+		free(batch->output);
+		batch->output = NULL;
+		batch->output_size = 0;
+		batch->num_packets = 0;
+		batch->data_used = 0;
+		batch->done = 0;
+		pipeline->written++;
+	}
+}
+
+static void pipeline_submit(struct pipeline* pipeline){
+	struct batch* batch = &pipeline->batch[pipeline->submitted % pipeline->num_batches];
+	if ( batch->num_packets == 0 ) return;
+
+	pthread_mutex_lock(&pipeline->mutex);
+	pipeline->submitted++;
+	pthread_cond_signal(&pipeline->work);
+	pthread_mutex_unlock(&pipeline->mutex);
+
+	/* write what is done and make sure the next batch is free to fill */
+	const uint64_t n = pipeline->num_batches;
+	pipeline_write(pipeline, pipeline->submitted >= n ? pipeline->submitted - n + 1 : 0);
+}
+
+static void pipeline_push(struct pipeline* pipeline, const struct cap_header* cp, const struct format* format, connection_id_t id){
+	struct batch* batch = &pipeline->batch[pipeline->submitted % pipeline->num_batches];
+	const size_t size = sizeof(struct cap_header) + cp->caplen;
+
+	if ( batch->data_used + size > batch->data_size ){
+		batch->data_size = (batch->data_used + size) * 2;
+		batch->data = realloc(batch->data, batch->data_size);
+	}
+
+	const size_t n = batch->num_packets++;
+	memcpy(batch->data + batch->data_used, cp, size);
+	batch->offset[n] = batch->data_used;
+	batch->pktcount[n] = format->pktcount;
+	batch->id[n] = id;
+	batch->ref = format->ref;
+	batch->data_used += size;
+
+	if ( batch->num_packets == BATCH_PACKETS ){
+		pipeline_submit(pipeline);
+	}
+}
+
+/**
+ * Write all packets pushed so far.
+ */
+static void pipeline_flush(struct pipeline* pipeline){
+	pipeline_submit(pipeline);
+	pipeline_write(pipeline, pipeline->submitted);
+}
+
+static void pipeline_free(struct pipeline* pipeline){
+	pipeline_flush(pipeline);
+
+	pthread_mutex_lock(&pipeline->mutex);
+	pipeline->shutdown = 1;
+	pthread_cond_broadcast(&pipeline->work);
+	pthread_mutex_unlock(&pipeline->mutex);
+
+	for ( unsigned int i = 0; i < pipeline->num_threads; i++ ){
+		pthread_join(pipeline->thread[i], NULL);
+	}
+
+	for ( unsigned int i = 0; i < pipeline->num_batches && pipeline->batch; i++ ){
+		free(pipeline->batch[i].data);
+	}
+	free(pipeline->batch);
+	free(pipeline->thread);
+	pthread_cond_destroy(&pipeline->done);
+	pthread_cond_destroy(&pipeline->work);
+	pthread_mutex_destroy(&pipeline->mutex);
+}
+
 int main(int argc, char **argv){
 	/* extract program name from path. e.g. /path/to/MArCd -> MArCd */
 	const char* separator = strrchr(argv[0], '/');
@@ -177,6 +389,14 @@ int main(int argc, char **argv){
 		}
 		break;
 
+		case 'j': /* --jobs */
+			jobs = atoi(optarg);
+			if ( jobs < 1 ){
+				fprintf(stderr, "%s: --jobs must be at least 1\n", program_name);
+				return 1;
+			}
+			break;
+
 		case 'x': /* --hexdump */
 			flags |= FORMAT_HEXDUMP;
 			break;
@@ -216,6 +436,20 @@ int main(int argc, char **argv){
 	struct format format;
 	format_setup(&format, flags);
 
+	/* when output is redirected it is written in large chunks (flushed when
+	 * the stream is idle so live captures is still shown) */
+	static char output_buffer[1024*1024];
+	const int buffered = !isatty(STDOUT_FILENO);
+	if ( buffered ){
+		setvbuf(stdout, output_buffer, _IOFBF, sizeof(output_buffer));
+	}
+
+	struct pipeline pipeline;
+	if ( jobs > 1 && (ret=pipeline_init(&pipeline, jobs, flags)) != 0 ){
+		fprintf(stderr, "%s: failed to start workers: %s\n", program_name, strerror(ret));
+		return 1;
+	}
+
 	uint64_t matched = 0;
 	while ( keep_running ) {
 		/* A short timeout is used to allow the application to "breathe", i.e
@@ -226,6 +460,8 @@ int main(int argc, char **argv){
 		cap_head* cp;
 		ret = stream_read(stream, &cp, NULL, &tv);
 		if ( ret == EAGAIN ){
+			if ( jobs > 1 ) pipeline_flush(&pipeline);
+			if ( buffered ) fflush(stdout);
 			continue; /* timeout */
 		} else if ( ret != 0 ){
 			break; /* shutdown or error */
@@ -233,10 +469,15 @@ int main(int argc, char **argv){
 
 		/* identify connection even if filter doesn't match so id will be
 		 * deterministic when changing the filter */
-		connection_id(cp);
+		const connection_id_t id = connection_id(cp);
 
 		if ( filter_match(&filter, cp->payload, cp) ){
-			format_pkg(stdout, &format, cp);
+			if ( jobs > 1 ){
+				format_ignore(stdout, &format, cp); /* only updates packet number and time reference */
+				pipeline_push(&pipeline, cp, &format, id);
+			} else {
+				format_pkg_id(stdout, &format, cp, id);
+			}
 			matched++;
 		} else {
 			format_ignore(stdout, &format, cp);
@@ -252,6 +493,10 @@ int main(int argc, char **argv){
 		}
 	}
 
+	if ( jobs > 1 ){
+		pipeline_free(&pipeline);
+	}
+
 	/* if ret == -1 the stream was closed properly (e.g EOF or TCP shutdown)
 	 * In addition EINTR should not give any errors because it is implied when the
 	 * user presses C-c */
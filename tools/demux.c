@@ -0,0 +1,503 @@
+/**
+ * libcap_utils - DPMI capture utilities
+ * Copyright (C) 2003-2013 (see AUTHORS)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "demux.h"
+#include <caputils/stream.h>
+#include <caputils/filter.h>
+#include <caputils/utils.h>
+#include <ctype.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+enum key_type {
+	KEY_MAMPID,
+	KEY_IFACE,
+	KEY_VLAN,
+	KEY_MAX,
+};
+
+static const char* key_name[KEY_MAX] = {"mampid", "iface", "vlan"};
+
+struct output {
+	char* name;
+	stream_t stream;
+	uint64_t packets;
+	uint64_t seq;                      /* last packet written (to write only once per packet) */
+};
+
+/* outputs for a single key value */
+struct key_entry {
+	uint64_t key;
+	int used;
+	int resolved;                      /* wildcard outputs has been added */
+	int* output;
+	int num_outputs;
+};
+
+/* open addressing hash table (power-of-two capacity) */
+struct key_table {
+	struct key_entry* entry;
+	size_t capacity;
+	size_t size;
+	char** wildcard;                   /* destination templates for "*" */
+	int num_wildcards;
+};
+
+struct expr_rule {
+	struct filter filter;
+	int output;
+};
+
+struct demux {
+	const char* program_name;
+	const char* comment;
+	struct output* output;
+	int num_outputs;
+	struct key_table table[KEY_MAX];
+	struct expr_rule* rule;
+	int num_rules;
+	uint64_t seq;
+};
+
+static uint64_t key_hash(uint64_t key){
+	return key * UINT64_C(0x9E3779B97F4A7C15);
+}
+
+/**
+ * Pack up to 8 chars (e.g. nic or mampid) into an integer, the remaining bytes
+ * is zeroed so the key is independent of trailing garbage.
+ */
+static uint64_t key_from_string(const char* str){
+	uint64_t key = 0;
+	memcpy(&key, str, strnlen(str, sizeof(key)));
+	return key;
+}
+
+static void key_to_string(enum key_type type, uint64_t key, char* buf, size_t size){
+	if ( type == KEY_VLAN ){
+		snprintf(buf, size, "%"PRIu64, key);
+		return;
+	}
+
+	char tmp[9] = {0,};
+	memcpy(tmp, &key, sizeof(key));
+	snprintf(buf, size, "%s", tmp);
+
+	/* keep it a valid filename */
+	for ( char* c = buf; *c; c++ ){
+		if ( *c == '/' || !isprint((unsigned char)*c) ) *c = '_';
+	}
+}
+
+static struct key_entry* table_find(struct key_table* table, uint64_t key){
+	if ( table->capacity == 0 ){
+		return NULL;
+	}
+	const size_t mask = table->capacity - 1;
+	for ( size_t i = key_hash(key) >> 32 & mask; ; i = (i + 1) & mask ){
+		struct key_entry* entry = &table->entry[i];
+		if ( !entry->used ) return NULL;
+		if ( entry->key == key ) return entry;
+	}
+}
+
+static struct key_entry* table_insert(struct key_table* table, uint64_t key){
+	/* grow when half full */
+	if ( 2 * (table->size + 1) > table->capacity ){
+		struct key_table tmp = *table;
+		tmp.capacity = table->capacity > 0 ? table->capacity * 2 : 16;
+		tmp.size = 0;
+		if ( !(tmp.entry = calloc(tmp.capacity, sizeof(struct key_entry))) ){
+			return NULL;
+		}
+		for ( size_t i = 0; i < table->capacity; i++ ){
+			if ( !table->entry[i].used ) continue;
+			*table_insert(&tmp, table->entry[i].key) = table->entry[i];
+		}
+		free(table->entry);
+		*table = tmp;
+	}
+
+	const size_t mask = table->capacity - 1;
+	size_t i = key_hash(key) >> 32 & mask;
+	while ( table->entry[i].used ){
+		i = (i + 1) & mask;
+	}
+
+	struct key_entry* entry = &table->entry[i];
+	entry->key = key;
+	entry->used = 1;
+	table->size++;
+	return entry;
+}
+
+static int entry_add_output(struct key_entry* entry, int output){
+	for ( int i = 0; i < entry->num_outputs; i++ ){
+		if ( entry->output[i] == output ) return 0;
+	}
+	int* tmp = realloc(entry->output, (entry->num_outputs + 1) * sizeof(int));
+	if ( !tmp ){
+		return ENOMEM;
+	}
+	entry->output = tmp;
+	entry->output[entry->num_outputs++] = output;
+	return 0;
+}
+
+/**
+ * Find output by name or open a new.
+ * @return Index of output or -1 on errors.
+ */
+static int output_open(struct demux* demux, const char* name){
+	for ( int i = 0; i < demux->num_outputs; i++ ){
+		if ( strcmp(demux->output[i].name, name) == 0 ) return i;
+	}
+
+	struct output* tmp = realloc(demux->output, (demux->num_outputs + 1) * sizeof(struct output));
+	if ( !tmp ){
+		return -1;
+	}
+	demux->output = tmp;
+
+	int ret;
+	stream_addr_t addr = STREAM_ADDR_INITIALIZER;
+	stream_t stream;
+	stream_addr_str(&addr, name, 0);
+	if ( (ret=stream_create(&stream, &addr, NULL, "CONV", demux->comment)) != 0 ){
+		fprintf(stderr, "%s: failed to open output `%s': %s\n", demux->program_name, name, caputils_error_string(ret));
+		stream_addr_reset(&addr);
+		return -1;
+	}
+	stream_addr_reset(&addr);
+
+	struct output* output = &demux->output[demux->num_outputs];
+	output->name = strdup(name);
+	output->stream = stream;
+	output->packets = 0;
+	output->seq = 0;
+	return demux->num_outputs++;
+}
+
+/**
+ * Expand %s in template with the key.
+ */
+static char* format_template(const char* template, enum key_type type, uint64_t key){
+	char value[32];
+	key_to_string(type, key, value, sizeof(value));
+
+	const char* pos = strstr(template, "%s");
+	const size_t size = strlen(template) + strlen(value) + 1;
+	char* name = malloc(size);
+	if ( !name ){
+		return NULL;
+	}
+	snprintf(name, size, "%.*s%s%s", (int)(pos - template), template, value, pos + 2);
+	return name;
+}
+
+/**
+ * Add wildcard outputs the first time a key is seen.
+ */
+static int entry_resolve(struct demux* demux, enum key_type type, struct key_entry* entry){
+	const struct key_table* table = &demux->table[type];
+	entry->resolved = 1;
+
+	for ( int i = 0; i < table->num_wildcards; i++ ){
+		char* name = format_template(table->wildcard[i], type, entry->key);
+		if ( !name ){
+			return ENOMEM;
+		}
+		const int output = output_open(demux, name);
+		free(name);
+		if ( output == -1 ){
+			return EIO;
+		}
+
+		int ret;
+		if ( (ret=entry_add_output(entry, output)) != 0 ){
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+static int parse_key(enum key_type type, const char* value, uint64_t* key){
+	switch ( type ){
+	case KEY_MAMPID:
+	case KEY_IFACE:
+		if ( strlen(value) > 8 ) return 0;
+		*key = key_from_string(value);
+		return 1;
+
+	case KEY_VLAN:
+		{
+			char* end;
+			const unsigned long vid = strtoul(value, &end, 0);
+			*key = vid;
+			return *value && *end == 0 && vid < 4096;
+		}
+
+	case KEY_MAX:
+		break;
+	}
+	return 0;
+}
+
+static int parse_rule(struct demux* demux, char* line, const char* filename, int lineno){
+	/* KIND VALUE.. DEST */
+	char* kind = line;
+	char* value = kind + strcspn(kind, " \t");
+	if ( *value ) *value++ = 0;
+	while ( isspace((unsigned char)*value) ) value++;
+
+	char* dest = value + strlen(value);
+	while ( dest > value && !isspace((unsigned char)dest[-1]) ) dest--;
+	char* end = dest;
+	while ( end > value && isspace((unsigned char)end[-1]) ) end--;
+	*end = 0;
+
+	if ( *value == 0 || *dest == 0 ){
+		fprintf(stderr, "%s: %s:%d: expected `KIND VALUE DESTINATION'\n", demux->program_name, filename, lineno);
+		return EINVAL;
+	}
+
+	/* filter expression */
+	if ( strcasecmp(kind, "expr") == 0 ){
+		struct filter filter;
+		filter_init(&filter);
+		if ( filter_expr_set(&filter, value) != 0 ){
+			fprintf(stderr, "%s: %s:%d: invalid expression\n", demux->program_name, filename, lineno);
+			filter_close(&filter);
+			return EINVAL;
+		}
+
+		const int output = output_open(demux, dest);
+		struct expr_rule* tmp = output >= 0 ? realloc(demux->rule, (demux->num_rules + 1) * sizeof(struct expr_rule)) : NULL;
+		if ( !tmp ){
+			filter_close(&filter);
+			return EIO;
+		}
+		demux->rule = tmp;
+		demux->rule[demux->num_rules].filter = filter;
+		demux->rule[demux->num_rules].output = output;
+		demux->num_rules++;
+		return 0;
+	}
+
+	/* key split */
+	enum key_type type;
+	if      ( strcasecmp(kind, "mampid") == 0 || strcasecmp(kind, "mpid") == 0 ){ type = KEY_MAMPID; }
+	else if ( strcasecmp(kind, "iface")  == 0 || strcasecmp(kind, "if") == 0 || strcasecmp(kind, "nic") == 0 ){ type = KEY_IFACE; }
+	else if ( strcasecmp(kind, "vlan")   == 0 ){ type = KEY_VLAN; }
+	else {
+		fprintf(stderr, "%s: %s:%d: unknown rule `%s' (expected mampid, iface, vlan or expr)\n", demux->program_name, filename, lineno, kind);
+		return EINVAL;
+	}
+
+	struct key_table* table = &demux->table[type];
+
+	if ( strcmp(value, "*") == 0 ){
+		const char* pos = strstr(dest, "%s");
+		if ( !pos || strstr(pos + 2, "%s") ){
+			fprintf(stderr, "%s: %s:%d: destination must contain %%s once when using *\n", demux->program_name, filename, lineno);
+			return EINVAL;
+		}
+		char** tmp = realloc(table->wildcard, (table->num_wildcards + 1) * sizeof(char*));
+		if ( !tmp ){
+			return ENOMEM;
+		}
+		table->wildcard = tmp;
+		table->wildcard[table->num_wildcards++] = strdup(dest);
+		return 0;
+	}
+
+	uint64_t key;
+	if ( !parse_key(type, value, &key) ){
+		fprintf(stderr, "%s: %s:%d: invalid %s `%s'\n", demux->program_name, filename, lineno, key_name[type], value);
+		return EINVAL;
+	}
+
+	const int output = output_open(demux, dest);
+	if ( output == -1 ){
+		return EIO;
+	}
+
+	struct key_entry* entry = table_find(table, key);
+	if ( !entry && !(entry = table_insert(table, key)) ){
+		return ENOMEM;
+	}
+	return entry_add_output(entry, output);
+}
+
+int demux_open(struct demux** demuxptr, const char* filename, const char* comment, const char* program_name){
+	FILE* fp = fopen(filename, "r");
+	if ( !fp ){
+		const int ret = errno;
+		fprintf(stderr, "%s: failed to open rules `%s': %s\n", program_name, filename, strerror(ret));
+		return ret;
+	}
+
+	struct demux* demux = calloc(1, sizeof(struct demux));
+	if ( !demux ){
+		fclose(fp);
+		return ENOMEM;
+	}
+	demux->program_name = program_name;
+	demux->comment = comment;
+
+	char* line = NULL;
+	size_t size = 0;
+	int lineno = 0;
+	int ret = 0;
+	while ( ret == 0 && getline(&line, &size, fp) != -1 ){
+		lineno++;
+
+		/* strip whitespace, skip empty lines and comments */
+		char* begin = line;
+		while ( isspace((unsigned char)*begin) ) begin++;
+		char* end = begin + strlen(begin);
+		while ( end > begin && isspace((unsigned char)end[-1]) ) *--end = 0;
+		if ( *begin == 0 || *begin == '#' ) continue;
+
+		ret = parse_rule(demux, begin, filename, lineno);
+	}
+
+	free(line);
+	fclose(fp);
+
+	if ( ret != 0 ){
+		demux_close(demux);
+		return ret;
+	}
+
+	*demuxptr = demux;
+	return 0;
+}
+
+static int packet_key(enum key_type type, const struct cap_header* cp, uint64_t* key){
+	switch ( type ){
+	case KEY_MAMPID:
+		*key = key_from_string(cp->mampid);
+		return 1;
+
+	case KEY_IFACE:
+		*key = key_from_string(cp->nic);
+		return 1;
+
+	case KEY_VLAN:
+		if ( cp->caplen < sizeof(struct ether_vlan_header) || ntohs(cp->ethhdr->h_proto) != ETHERTYPE_VLAN ){
+			return 0;
+		}
+		*key = ntohs(cp->ethvlanhdr->vlan_tci) & 0x0fff;
+		return 1;
+
+	case KEY_MAX:
+		break;
+	}
+	return 0;
+}
+
+static int output_write(struct demux* demux, int index, const struct cap_header* cp){
+	struct output* output = &demux->output[index];
+	if ( output->seq == demux->seq ){
+		return 0; /* already written by another rule */
+	}
+	output->seq = demux->seq;
+	output->packets++;
+	return stream_copy(output->stream, cp);
+}
+
+int demux_write(struct demux* demux, struct cap_header* cp, int* matched){
+	int ret;
+	demux->seq++;
+	*matched = 0;
+
+	for ( int type = 0; type < KEY_MAX; type++ ){
+		struct key_table* table = &demux->table[type];
+		if ( table->size == 0 && table->num_wildcards == 0 ) continue;
+
+		uint64_t key;
+		if ( !packet_key(type, cp, &key) ) continue;
+
+		struct key_entry* entry = table_find(table, key);
+		if ( !entry ){
+			if ( table->num_wildcards == 0 ) continue;
+			if ( !(entry = table_insert(table, key)) ) return ENOMEM;
+		}
+		if ( !entry->resolved && (ret=entry_resolve(demux, type, entry)) != 0 ){
+			return ret;
+		}
+
+		for ( int i = 0; i < entry->num_outputs; i++ ){
+			if ( (ret=output_write(demux, entry->output[i], cp)) != 0 ) return ret;
+		}
+		*matched |= entry->num_outputs > 0;
+	}
+
+	for ( int i = 0; i < demux->num_rules; i++ ){
+		struct expr_rule* rule = &demux->rule[i];
+		if ( !filter_match(&rule->filter, cp->payload, cp) ) continue;
+		if ( (ret=output_write(demux, rule->output, cp)) != 0 ) return ret;
+		*matched = 1;
+	}
+
+	return 0;
+}
+
+void demux_print(const struct demux* demux, FILE* fp){
+	for ( int i = 0; i < demux->num_outputs; i++ ){
+		fprintf(fp, "%s: %'"PRIu64" packets written to %s\n", demux->program_name, demux->output[i].packets, demux->output[i].name);
+	}
+}
+
+void demux_close(struct demux* demux){
+	if ( !demux ) return;
+
+	for ( int i = 0; i < demux->num_outputs; i++ ){
+		stream_close(demux->output[i].stream);
+		free(demux->output[i].name);
+	}
+	free(demux->output);
+
+	for ( int type = 0; type < KEY_MAX; type++ ){
+		struct key_table* table = &demux->table[type];
+		for ( size_t i = 0; i < table->capacity; i++ ){
+			free(table->entry[i].output);
+		}
+		for ( int i = 0; i < table->num_wildcards; i++ ){
+			free(table->wildcard[i]);
+		}
+		free(table->entry);
+		free(table->wildcard);
+	}
+
+	for ( int i = 0; i < demux->num_rules; i++ ){
+		filter_close(&demux->rule[i].filter);
+	}
+	free(demux->rule);
+	free(demux);
+}
@@ -0,0 +1,43 @@
+#ifndef CAPUTILS_TOOLS_DEMUX_H
+#define CAPUTILS_TOOLS_DEMUX_H
+
+#include <caputils/capture.h>
+#include <stdio.h>
+
+/**
+ * Writes packets to multiple outputs based on a rules file, one rule per line:
+ *
+ *   mampid MAMPID DEST
+ *   iface  IFACE  DEST
+ *   vlan   VID    DEST
+ *   expr   EXPRESSION DEST
+ *
+ * Key rules (mampid, iface and vlan) use a hash lookup per packet. Using * as
+ * key creates one output per distinct value where %s in DEST is replaced by the
+ * value. Expression rules is matched using a filter each. A packet is written to
+ * all outputs with a matching rule (but only once per output).
+ */
+struct demux;
+
+/**
+ * @param comment Comment of the output files, must be valid until closed.
+ * @param program_name Used as prefix for error messages.
+ * @return Zero if successful or an errno value.
+ */
+int demux_open(struct demux** demux, const char* filename, const char* comment, const char* program_name);
+
+/**
+ * Write packet to all outputs with a matching rule.
+ * @param matched Set to non-zero if any rule matched.
+ * @return Zero if successful or an errno value.
+ */
+int demux_write(struct demux* demux, struct cap_header* cp, int* matched);
+
+/**
+ * Show the number of packets written to each output.
+ */
+void demux_print(const struct demux* demux, FILE* fp);
+
+void demux_close(struct demux* demux);
+
+#endif /* CAPUTILS_TOOLS_DEMUX_H */
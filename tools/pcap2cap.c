@@ -30,7 +30,9 @@
 #include <signal.h>
 #include <unistd.h>
 #include <getopt.h>
+#include <errno.h>
 #include <pcap.h>
+#include <sys/stat.h>
 
 /* pcap stores error descriptions in this buffer */
 static char errorBuffer[PCAP_ERRBUF_SIZE] = {0,};
@@ -39,8 +41,9 @@ static const char* program_name = NULL;
 static int run = 1;
 static int quiet = 0;
 static size_t caplen = UINT16_MAX - sizeof(cap_head);
+static int keep_ids = 0;
 
-static const char* shortopts = "c:o:m:i:l:qh";
+static const char* shortopts = "c:o:m:i:l:kqh";
 static struct option longopts[] = {
 	{"comments",  required_argument, 0, 'c'},
 	{"output",    required_argument, 0, 'o'},
@@ -48,6 +51,7 @@ static struct option longopts[] = {
 	{"interface", required_argument, 0, 'i'},
 	{"CI",        required_argument, 0, 'i'},
 	{"caplen",    required_argument, 0, 'l'},
+	{"keep-ids",  no_argument,       0, 'k'},
 	{"quiet",     no_argument,       0, 'q'},
 	{"help",      no_argument,       0, 'h'},
 	{0, 0, 0, 0} /* sentinel */
@@ -70,6 +74,8 @@ static void show_usage(){
 	       "                             interfaces).\n"
 	       "      --CI=INTERFACE         Alias for --iface\n");
 	printf("      --caplen=INT           Set caplen. Default %zd bytes.\n", caplen);
+	printf("  -k, --keep-ids             Use interface names and descriptions from pcapng files\n"
+	       "                             as nic and mampid instead of --interface and --mpid.\n");
 	printf("  -q, --quiet                Silent output, only errors is printed.\n");
 	printf("  -h, --help                 Show this help.\n");
 }
@@ -125,6 +131,74 @@ static struct pcap* open_src(int argc, char* argv[], struct cap_header* cp){
   return pcap;
 }
 
+/**
+ * Regular files is read directly (see stream_open), libpcap is only used for
+ * live captures and pipes.
+ * @return Filename or NULL if libpcap must be used.
+ */
+static const char* regular_file(int argc, char* argv[]){
+	struct stat st;
+	switch ( argc - optind ){
+	case 0:
+		return !isatty(STDIN_FILENO) && fstat(STDIN_FILENO, &st) == 0 && S_ISREG(st.st_mode) ? "/dev/stdin" : NULL;
+	case 1:
+		return stat(argv[optind], &st) == 0 && S_ISREG(st.st_mode) ? argv[optind] : NULL;
+	default:
+		return NULL;
+	}
+}
+
+static stream_t open_src_stream(const char* filename){
+	stream_addr_t addr = STREAM_ADDR_INITIALIZER;
+	stream_addr_str(&addr, filename, 0);
+
+	int ret;
+	stream_t st;
+	if ( (ret=stream_open(&st, &addr, NULL, 0)) != 0 ){
+		fprintf(stderr, "%s: failed to open %s: %s.\n", program_name, filename, caputils_error_string(ret));
+		return NULL;
+	}
+
+	return st;
+}
+
+static void progress(unsigned long long pktCount){
+	// Let the user know that we are alive, good when processing large files.
+	if ( !quiet && pktCount % 1000 == 0 ) {
+		fprintf(stderr, ".");
+		fflush(stderr);
+	}
+}
+
+/**
+ * Convert packets from a pcap file opened as a stream. The packet is
+ * modified in place and written as-is.
+ */
+static unsigned long long convert_stream(stream_t src, stream_t dst, const struct cap_header* defaults){
+	unsigned long long pktCount = 0;
+	cap_head* cp;
+	int ret;
+
+	while ( run && (ret=stream_read(src, &cp, NULL, NULL)) == 0 ){
+		if ( !keep_ids ){
+			memcpy(cp->nic, defaults->nic, CAPHEAD_NICLEN);
+			memcpy(cp->mampid, defaults->mampid, sizeof(cp->mampid));
+		}
+		cp->caplen = min(cp->caplen, caplen);
+
+		progress(pktCount++);
+		if ( (ret=stream_write(dst, cp, sizeof(struct cap_header) + cp->caplen)) != 0 ) {
+			fprintf(stderr, "stream_write(..) returned %d: %s\n", ret, caputils_error_string(ret));
+		}
+	}
+
+	if ( run && ret != -1 ){
+		fprintf(stderr, "\n%s: failed to read packet: %s\n", program_name, caputils_error_string(ret));
+	}
+
+	return pktCount;
+}
+
 static stream_t open_dst(stream_addr_t* addr, const caphead_t cp, const char* comment){
 	/* default to stdout */
 	if( !stream_addr_is_set(addr) ){
@@ -198,6 +272,10 @@ int main (int argc, char **argv){
       stream_addr_str(&dst, optarg, 0);
       break;
 
+    case 'k': /* --keep-ids */
+	    keep_ids = 1;
+	    break;
+
     case 'q': /* --quiet */
 	    quiet = 1;
 	    break;
@@ -212,9 +290,16 @@ int main (int argc, char **argv){
   }
 
   /* open input/output */
-  pcap_t* pcap = open_src(argc, argv, &cp);
+  const char* filename = regular_file(argc, argv);
+  stream_t src = NULL;
+  pcap_t* pcap = NULL;
+  if ( filename ){
+	  src = open_src_stream(filename);
+  } else {
+	  pcap = open_src(argc, argv, &cp);
+  }
   stream_t st = open_dst(&dst, &cp, comments);
-  if ( !(pcap && st) ){
+  if ( !((pcap || src) && st) ){
 	  return 1; /* error already shown */
   }
 
@@ -225,32 +310,36 @@ int main (int argc, char **argv){
   /* setup signal handler so it can handle ctrl-c etc with proper closing of streams */
   signal(SIGINT, sighandler);
 
-  const u_char* packet;
-  struct pcap_pkthdr pcapHeader;
   unsigned long long pktCount = 0;
-  while ( (packet=pcap_next(pcap, &pcapHeader)) && run ){
-    cp.ts.tv_sec  = pcapHeader.ts.tv_sec;  /* Copy and convert the timestamp provided by PCAP, assumes _usec. If nsec will be present adjust! */
-    cp.ts.tv_psec = pcapHeader.ts.tv_usec * 1e6;
-    cp.len = pcapHeader.len; /* The Wire-lenght of the frame */
-    cp.caplen = min(pcapHeader.caplen, caplen);
-
-    // Let the user know that we are alive, good when processing large files.
-    if ( !quiet && pktCount++ % 1000 == 0 ) {
-      fprintf(stderr, ".");
-      fflush(stderr);
-    }
-
-    // Save a copy of the frame to the new file.
-    int ret;
-    if ( (ret=stream_write_separate(st, &cp, packet, cp.caplen)) != 0 ) {
-	    fprintf(stderr, "stream_write(..) returned %d: %s\n", ret, caputils_error_string(ret));
-    }
+  if ( src ){
+	  pktCount = convert_stream(src, st, &cp);
+  } else {
+	  const u_char* packet;
+	  struct pcap_pkthdr pcapHeader;
+	  while ( (packet=pcap_next(pcap, &pcapHeader)) && run ){
+		  cp.ts.tv_sec  = pcapHeader.ts.tv_sec;  /* Copy and convert the timestamp provided by PCAP, assumes _usec. */
+		  cp.ts.tv_psec = (uint64_t)pcapHeader.ts.tv_usec * 1000000;
+		  cp.len = pcapHeader.len; /* The Wire-lenght of the frame */
+		  cp.caplen = min(pcapHeader.caplen, caplen);
+
+		  progress(pktCount++);
+
+		  // Save a copy of the frame to the new file.
+		  int ret;
+		  if ( (ret=stream_write_separate(st, &cp, packet, cp.caplen)) != 0 ) {
+			  fprintf(stderr, "stream_write(..) returned %d: %s\n", ret, caputils_error_string(ret));
+		  }
+	  }
   }
 
   /* Release resources */
   stream_close(st);
   stream_addr_reset(&dst);
-  pcap_close(pcap);
+  if ( src ){
+	  stream_close(src);
+  } else {
+	  pcap_close(pcap);
+  }
 
   if ( !quiet ){
 	  fprintf(stderr, "\n%s: There was a total of %lld packets converted.\n", program_name, pktCount);